@@ -7,6 +7,8 @@
 
 #include "BackgroundPublishRK.h"
 
+#include <vector>
+
 BackgroundPublishRK *BackgroundPublishRK::_instance;
 
 BackgroundPublishRK::BackgroundPublishRK() {
@@ -24,12 +26,26 @@ BackgroundPublishRK &BackgroundPublishRK::instance() {
     return *_instance;
 }
 
+BackgroundPublishRK &BackgroundPublishRK::withMaxInFlight(size_t maxCount)
+{
+    if(!thread)
+    {
+        maxInFlight = (maxCount > 0) ? maxCount : 1;
+    }
+    return *this;
+}
+
 void BackgroundPublishRK::start()
 {
     if(!thread)
     {
         os_mutex_create(&mutex);
 
+        requests = new PublishRequest[maxInFlight];
+        head = 0;
+        count = 0;
+        state = BACKGROUND_PUBLISH_IDLE;
+
         // use OS_THREAD_PRIORITY_DEFAULT so that application, system, and
         // background publish thread will all run at the same priority and
         // be able to preempt each other
@@ -47,11 +63,20 @@ void BackgroundPublishRK::stop()
         thread->dispose();
         delete thread;
         thread = NULL;
+
+        delete[] requests;
+        requests = NULL;
+        count = 0;
     }
 }
 
 void BackgroundPublishRK::thread_f()
 {
+    // Publishes that have been started, oldest first. The request for futures[ii] is
+    // requests[(head + ii) % maxInFlight].
+    std::vector<particle::Future<bool>> futures;
+    futures.reserve(maxInFlight);
+
     while(true)
     {
         while(state == BACKGROUND_PUBLISH_IDLE)
@@ -72,30 +97,42 @@ void BackgroundPublishRK::thread_f()
         // additional synchronization around a publish request and acts as a
         // memory barrier around publish arguments to ensure all updates
         // are complete
-        lock();
-        unlock();
+        size_t requested;
+        WITH_LOCK(*this)
+        {
+            requested = count;
+        }
 
-        // kick off the publish
+        // kick off the publishes requested since the last pass without waiting
+        // for the earlier ones to complete
         // WITH_ACK does not work as expected from a background thread
         // use the Future<bool> object directly as its default wait
         // (used by WITH_ACK) short-circuits when not called from the
         // main application thread
-        auto ok = Particle.publish(event_name, event_data, event_flags);
+        while(futures.size() < requested)
+        {
+            PublishRequest &req = requests[(head + futures.size()) % maxInFlight];
+            futures.push_back(Particle.publish(req.event_name, req.event_data, req.event_flags));
+        }
 
-        // then wait for publish to complete
-        while(!ok.isDone() && state != BACKGROUND_PUBLISH_STOP)
+        // then wait for the oldest publish to complete, so the callbacks are
+        // called in the same order as publish() even if a later one completes first
+        if(!futures.front().isDone() && state != BACKGROUND_PUBLISH_STOP)
         {
             // yield to rest of system while we wait
             delay(1);
+            continue;
         }
 
-        if(completed_cb)
+        PublishRequest &req = requests[head];
+        if(req.completed_cb)
         {
-            completed_cb(ok.isSucceeded(),
-                event_name,
-                event_data,
-                event_context);
+            req.completed_cb(futures.front().isSucceeded(),
+                req.event_name,
+                req.event_data,
+                req.event_context);
         }
+        futures.erase(futures.begin());
 
         WITH_LOCK(*this)
         {
@@ -103,9 +140,14 @@ void BackgroundPublishRK::thread_f()
             {
                 return;
             }
-            event_context = NULL;
-            completed_cb = NULL;
-            state = BACKGROUND_PUBLISH_IDLE;
+            req.event_context = NULL;
+            req.completed_cb = NULL;
+            head = (head + 1) % maxInFlight;
+            count--;
+            if(count == 0)
+            {
+                state = BACKGROUND_PUBLISH_IDLE;
+            }
         }
     }
 }
@@ -115,8 +157,8 @@ bool BackgroundPublishRK::publish(const char *name, const char *data, PublishFla
     // protect against separate threads trying to publish at the same time
     WITH_LOCK(*this)
 
-    // check currently in idle state and ready to accept publish request
-    if(!thread || state != BACKGROUND_PUBLISH_IDLE)
+    // check the thread is running and ready to accept another publish request
+    if(!thread || state == BACKGROUND_PUBLISH_STOP || count >= maxInFlight)
     {
         return false;
     }
@@ -128,24 +170,27 @@ bool BackgroundPublishRK::publish(const char *name, const char *data, PublishFla
         return false;
     }
 
-    // have the lock and thread is currently idle
+    // have the lock and there is a free request
     // safe to prepare publish request
-    strncpy(event_name, name, sizeof(event_name));
-    event_name[sizeof(event_name)-1] = '\0'; // ensure null termination
+    PublishRequest &req = requests[(head + count) % maxInFlight];
+
+    strncpy(req.event_name, name, sizeof(req.event_name));
+    req.event_name[sizeof(req.event_name)-1] = '\0'; // ensure null termination
 
     if(data)
     {
-        strncpy(event_data, data, sizeof(event_data));
-        event_data[sizeof(event_data)-1] = '\0'; // ensure null termination
+        strncpy(req.event_data, data, sizeof(req.event_data));
+        req.event_data[sizeof(req.event_data)-1] = '\0'; // ensure null termination
     }
     else
     {
-        event_data[0] = '\0'; // null terminate at start for no event data
+        req.event_data[0] = '\0'; // null terminate at start for no event data
     }
 
-    completed_cb = cb;
-    event_context = context;
-    event_flags = flags;
+    req.completed_cb = cb;
+    req.event_context = context;
+    req.event_flags = flags;
+    count++;
     state = BACKGROUND_PUBLISH_REQUESTED;
 
     return true;
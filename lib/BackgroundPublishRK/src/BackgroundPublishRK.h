@@ -12,7 +12,7 @@
  */
 typedef enum {
     BACKGROUND_PUBLISH_IDLE = 0,	//!< Not currently publishing
-    BACKGROUND_PUBLISH_REQUESTED,	//!< Publish started
+    BACKGROUND_PUBLISH_REQUESTED,	//!< One or more publishes started
     BACKGROUND_PUBLISH_STOP,		//!< Thread stopped (need to start again to publish)
 } publish_thread_state_t;
 
@@ -51,6 +51,28 @@ public:
      */
     static BackgroundPublishRK &instance();
 
+    /**
+     * @brief Sets how many publishes can be in flight at once (default is 1)
+     *
+     * @param maxCount The number of publishes that can be started before the first one completes.
+     *
+     * With more than one, a new publish starts without waiting for the round trip of the earlier
+     * ones. Completion callbacks are still called in the order of publish(), even if a later publish
+     * completes first. Each publish in flight uses about 700 bytes of RAM, allocated by start(), so
+     * call this before start().
+     */
+    BackgroundPublishRK &withMaxInFlight(size_t maxCount);
+
+    /**
+     * @brief Gets the number of publishes that can be in flight at once
+     */
+    size_t getMaxInFlight() const { return maxInFlight; };
+
+    /**
+     * @brief Returns true if publish() can accept another publish now
+     */
+    bool canPublish() const { return thread && count < maxInFlight; };
+
     /**
      * @brief Start the background publish thread. Required!
      *
@@ -72,6 +94,9 @@ public:
     /**
      * @brief Publish method. Use this instead of Particle.publish().
      *
+     * Returns false without publishing if the thread is not started, or withMaxInFlight()
+     * publishes are already in flight.
+     *
      * @param name Event name to publish (required)
      *
      * @param data Event data (optional). Must be a c-string (null-terminated) if non-NULL.
@@ -130,18 +155,28 @@ private:
     BackgroundPublishRK& operator=(const BackgroundPublishRK&) = delete;
 
 
+    /**
+     * @brief Arguments of one publish, from publish() until its completion callback returns
+     */
+    struct PublishRequest {
+        // arguments for Particle.publish
+        char event_name[particle::protocol::MAX_EVENT_NAME_LENGTH+1];	//!< name passed to publish
+        char event_data[particle::protocol::MAX_EVENT_DATA_LENGTH+1];	//!< event data passed to publish (may be empty string)
+        PublishFlags event_flags; 	//!< event flags, typically PRIVATE, PRIVATE | WITH_ACK, or PRIVATE | NO_ACK.
+        // callback when publish completes
+        PublishCompletedCallback completed_cb = NULL; 	//!< Completion callback (optional)
+        const void *event_context = NULL; 		//!< Context passed to completion (optional)
+    };
+
     Thread *thread = NULL;		//!< Thread object pointer. Allocated during start()
     void thread_f();			//!< Thread function, passed to the Thread object
     os_mutex_t mutex;	//!< Mutex to protect access to class members from multiple threads
     volatile publish_thread_state_t state = BACKGROUND_PUBLISH_IDLE; //!< Current state
 
-    // arguments for Particle.publish
-    char event_name[particle::protocol::MAX_EVENT_NAME_LENGTH+1];	//!< name passed to publish
-    char event_data[particle::protocol::MAX_EVENT_DATA_LENGTH+1];	//!< event data passed to publish (may be empty string)
-    PublishFlags event_flags; 	//!< event flags, typically PRIVATE, PRIVATE | WITH_ACK, or PRIVATE | NO_ACK.
-    // callback when publish completes
-    PublishCompletedCallback completed_cb = NULL; 	//!< Completion callback (optional)
-    const void *event_context = NULL; 		//!< Context passed to completion (optional)
+    PublishRequest *requests = NULL;	//!< Circular buffer of maxInFlight requests. Allocated during start()
+    size_t maxInFlight = 1;		//!< Size of requests, set using withMaxInFlight()
+    size_t head = 0;			//!< Index in requests of the oldest publish
+    volatile size_t count = 0;	//!< Number of requests from head, started or waiting to be started
 
     static BackgroundPublishRK *_instance; //!< Singleton instance of this class
 };
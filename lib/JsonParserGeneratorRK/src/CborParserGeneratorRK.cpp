@@ -0,0 +1,647 @@
+#include "Particle.h"
+#include "CborParserGeneratorRK.h"
+#include "JsonParserGeneratorRK.h"
+#include "Base64RK.h"
+#include <math.h>
+
+// Writes the initial byte and argument of a data item in the shortest form. buf must be 9 bytes.
+static size_t encodeHead(uint8_t *buf, uint8_t majorType, uint64_t value) {
+	size_t argLen;
+
+	if (value < 24) {
+		buf[0] = (uint8_t)((majorType << 5) | value);
+		return 1;
+	}
+	else if (value <= 0xff) {
+		buf[0] = (uint8_t)((majorType << 5) | 24);
+		argLen = 1;
+	}
+	else if (value <= 0xffff) {
+		buf[0] = (uint8_t)((majorType << 5) | 25);
+		argLen = 2;
+	}
+	else if (value <= 0xffffffff) {
+		buf[0] = (uint8_t)((majorType << 5) | 26);
+		argLen = 4;
+	}
+	else {
+		buf[0] = (uint8_t)((majorType << 5) | 27);
+		argLen = 8;
+	}
+
+	// Big endian
+	for(size_t ii = 0; ii < argLen; ii++) {
+		buf[argLen - ii] = (uint8_t)(value >> (8 * ii));
+	}
+	return 1 + argLen;
+}
+
+//
+//
+//
+CborWriter::CborWriter(uint8_t *buffer, size_t bufferLen) : CborBuffer(buffer, bufferLen) {
+	init();
+}
+
+CborWriter::~CborWriter() {
+
+}
+
+void CborWriter::init() {
+	offset = 0;
+
+	contextIndex = 0;
+	context[contextIndex].headOffset = 0;
+	context[contextIndex].count = 0;
+	keyPending = false;
+
+	truncated = false;
+}
+
+bool CborWriter::startObjectOrArray(uint8_t majorType) {
+	if ((contextIndex + 1) >= MAX_NESTED_CONTEXT) {
+		return false;
+	}
+	insertItem();
+
+	contextIndex++;
+
+	context[contextIndex].headOffset = offset;
+	context[contextIndex].count = 0;
+
+	// The length is filled in by finishObjectOrArray()
+	uint8_t head = (uint8_t)(majorType << 5);
+	insertRaw(&head, 1);
+	return true;
+}
+
+void CborWriter::finishObjectOrArray() {
+	if (contextIndex == 0) {
+		return;
+	}
+	Context &ctx = context[contextIndex--];
+	if (truncated) {
+		return;
+	}
+
+	uint8_t head[9];
+	size_t headLen = encodeHead(head, buffer[ctx.headOffset] >> 5, ctx.count);
+	if (headLen > 1) {
+		// More than 23 items, so the argument doesn't fit in the initial byte. Move the items up to make room.
+		if (offset + headLen - 1 > bufferLen) {
+			truncated = true;
+			return;
+		}
+		size_t itemsOffset = ctx.headOffset + 1;
+		memmove(&buffer[itemsOffset + headLen - 1], &buffer[itemsOffset], offset - itemsOffset);
+		offset += headLen - 1;
+	}
+	memcpy(&buffer[ctx.headOffset], head, headLen);
+}
+
+void CborWriter::insertItem() {
+	if (keyPending) {
+		// The object or array is the value of a key/value pair that was already counted
+		keyPending = false;
+	}
+	else {
+		context[contextIndex].count++;
+	}
+}
+
+void CborWriter::insertHead(uint8_t majorType, uint64_t value) {
+	uint8_t head[9];
+	insertRaw(head, encodeHead(head, majorType, value));
+}
+
+void CborWriter::insertRaw(const void *data, size_t dataLen) {
+	// A partial item can't be parsed, so nothing is written if it doesn't fit
+	if (offset + dataLen <= bufferLen) {
+		memcpy(&buffer[offset], data, dataLen);
+		offset += dataLen;
+	}
+	else {
+		truncated = true;
+	}
+}
+
+void CborWriter::insertText(const char *s, size_t len) {
+	insertHead(MAJOR_TEXT, len);
+	insertRaw(s, len);
+}
+
+void CborWriter::insertValue(long long value) {
+	if (value >= 0) {
+		insertHead(MAJOR_UNSIGNED, (uint64_t)value);
+	}
+	else {
+		insertHead(MAJOR_NEGATIVE, (uint64_t)(-1 - value));
+	}
+}
+
+void CborWriter::insertValue(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	uint8_t buf[5];
+	buf[0] = (MAJOR_SIMPLE << 5) | 26;
+	for(size_t ii = 0; ii < 4; ii++) {
+		buf[4 - ii] = (uint8_t)(bits >> (8 * ii));
+	}
+	insertRaw(buf, sizeof(buf));
+}
+
+void CborWriter::insertValue(double value) {
+	float f = (float)value;
+	if ((double)f == value || value != value) {
+		// Exact as a float (or NaN), so save 4 bytes
+		insertValue(f);
+		return;
+	}
+
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	uint8_t buf[9];
+	buf[0] = (MAJOR_SIMPLE << 5) | 27;
+	for(size_t ii = 0; ii < 8; ii++) {
+		buf[8 - ii] = (uint8_t)(bits >> (8 * ii));
+	}
+	insertRaw(buf, sizeof(buf));
+}
+
+void CborWriter::insertBytes(const uint8_t *data, size_t dataLen) {
+	insertHead(MAJOR_BYTES, dataLen);
+	insertRaw(data, dataLen);
+}
+
+void CborWriter::insertKeyObject(const char *key) {
+	insertItem();
+	insertValue(key);
+	keyPending = true;
+	startObject();
+}
+
+void CborWriter::insertKeyArray(const char *key) {
+	insertItem();
+	insertValue(key);
+	keyPending = true;
+	startArray();
+}
+
+bool CborWriter::encodeBase64(char *dst, size_t &dstLen) const {
+	if (truncated) {
+		return false;
+	}
+	return Base64::encode(buffer, offset, dst, dstLen, true);
+}
+
+//
+//
+//
+CborParser::CborParser(uint8_t *buffer, size_t bufferLen) : CborBuffer(buffer, bufferLen), parsed(false) {
+
+}
+
+CborParser::~CborParser() {
+
+}
+
+bool CborParser::addData(const uint8_t *data, size_t dataLen) {
+	parsed = false;
+	if (offset + dataLen > bufferLen) {
+		return false;
+	}
+	memcpy(&buffer[offset], data, dataLen);
+	offset += dataLen;
+	return true;
+}
+
+bool CborParser::addBase64(const char *src) {
+	parsed = false;
+
+	size_t dstLen = bufferLen - offset;
+	if (!Base64::decode(src, &buffer[offset], dstLen)) {
+		return false;
+	}
+	offset += dstLen;
+	return true;
+}
+
+bool CborParser::parse() {
+	size_t itemOffset = 0;
+
+	parsed = offset > 0 && validate(itemOffset, 0) && itemOffset == offset;
+	return parsed;
+}
+
+size_t CborParser::readHead(size_t itemOffset, size_t end, uint8_t &majorType, uint8_t &info, uint64_t &value) const {
+	if (itemOffset >= end) {
+		return 0;
+	}
+	majorType = buffer[itemOffset] >> 5;
+	info = buffer[itemOffset] & 0x1f;
+	if (info < 24) {
+		value = info;
+		return 1;
+	}
+	if (info > 27) {
+		// Reserved, or an indefinite length item which isn't supported
+		return 0;
+	}
+
+	size_t argLen = (size_t)1 << (info - 24);
+	if (itemOffset + 1 + argLen > end) {
+		return 0;
+	}
+	value = 0;
+	for(size_t ii = 1; ii <= argLen; ii++) {
+		value = (value << 8) | buffer[itemOffset + ii];
+	}
+	return 1 + argLen;
+}
+
+bool CborParser::validate(size_t &itemOffset, size_t depth) const {
+	uint8_t majorType, info;
+	uint64_t value;
+
+	size_t headLen = readHead(itemOffset, offset, majorType, info, value);
+	if (headLen == 0) {
+		return false;
+	}
+	itemOffset += headLen;
+
+	switch(majorType) {
+	case CborWriter::MAJOR_BYTES:
+	case CborWriter::MAJOR_TEXT:
+		if (value > offset - itemOffset) {
+			return false;
+		}
+		itemOffset += (size_t)value;
+		break;
+
+	case CborWriter::MAJOR_ARRAY:
+	case CborWriter::MAJOR_MAP:
+		if (depth >= MAX_NESTING) {
+			return false;
+		}
+		// Every item is at least one byte, which also bounds the loop for bad data
+		if (majorType == CborWriter::MAJOR_MAP) {
+			if (value > (offset - itemOffset) / 2) {
+				return false;
+			}
+			value *= 2;
+		}
+		if (value > offset - itemOffset) {
+			return false;
+		}
+		for(uint64_t ii = 0; ii < value; ii++) {
+			if (!validate(itemOffset, depth + 1)) {
+				return false;
+			}
+		}
+		break;
+
+	case CborWriter::MAJOR_TAG:
+		return depth < MAX_NESTING && validate(itemOffset, depth + 1);
+
+	default:
+		// Integers, simple values and floats are entirely in the head
+		break;
+	}
+	return true;
+}
+
+void CborParser::skip(size_t &itemOffset) const {
+	uint8_t majorType = 0, info;
+	uint64_t value = 0;
+
+	// parse() already checked the data, so there's no bounds checking here
+	uint64_t itemsLeft = 1;
+	while(itemsLeft > 0) {
+		itemOffset += readHead(itemOffset, offset, majorType, info, value);
+		itemsLeft--;
+
+		switch(majorType) {
+		case CborWriter::MAJOR_BYTES:
+		case CborWriter::MAJOR_TEXT:
+			itemOffset += (size_t)value;
+			break;
+
+		case CborWriter::MAJOR_ARRAY:
+			itemsLeft += value;
+			break;
+
+		case CborWriter::MAJOR_MAP:
+			itemsLeft += value * 2;
+			break;
+
+		case CborWriter::MAJOR_TAG:
+			itemsLeft++;
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+size_t CborParser::itemHead(size_t &itemOffset, uint8_t &majorType, uint8_t &info, uint64_t &value) const {
+	size_t headLen;
+
+	// Tags (dates, bignums, and so on) are ignored and the tagged item is used
+	while(true) {
+		headLen = readHead(itemOffset, offset, majorType, info, value);
+		if (headLen == 0 || majorType != CborWriter::MAJOR_TAG) {
+			return headLen;
+		}
+		itemOffset += headLen;
+	}
+}
+
+bool CborParser::isObject(CborItem item) const {
+	uint8_t majorType, info;
+	uint64_t value;
+
+	if (!item) {
+		return false;
+	}
+	size_t itemOffset = item - buffer;
+	return itemHead(itemOffset, majorType, info, value) && majorType == CborWriter::MAJOR_MAP;
+}
+
+bool CborParser::isArray(CborItem item) const {
+	uint8_t majorType, info;
+	uint64_t value;
+
+	if (!item) {
+		return false;
+	}
+	size_t itemOffset = item - buffer;
+	return itemHead(itemOffset, majorType, info, value) && majorType == CborWriter::MAJOR_ARRAY;
+}
+
+size_t CborParser::getArraySize(CborItem container) const {
+	uint8_t majorType, info;
+	uint64_t value;
+
+	if (!container) {
+		return 0;
+	}
+	size_t itemOffset = container - buffer;
+	if (!itemHead(itemOffset, majorType, info, value) ||
+		(majorType != CborWriter::MAJOR_ARRAY && majorType != CborWriter::MAJOR_MAP)) {
+		return 0;
+	}
+	return (size_t)value;
+}
+
+bool CborParser::getValueItemByKey(CborItem container, const char *key, CborItem &value) const {
+	uint8_t majorType, info;
+	uint64_t count, keyValue;
+
+	if (!container) {
+		return false;
+	}
+	size_t itemOffset = container - buffer;
+	size_t headLen = itemHead(itemOffset, majorType, info, count);
+	if (headLen == 0 || majorType != CborWriter::MAJOR_MAP) {
+		return false;
+	}
+	itemOffset += headLen;
+
+	size_t keyLen = strlen(key);
+	for(uint64_t ii = 0; ii < count; ii++) {
+		size_t keyOffset = itemOffset;
+		headLen = itemHead(keyOffset, majorType, info, keyValue);
+		if (majorType == CborWriter::MAJOR_TEXT && keyValue == keyLen && memcmp(&buffer[keyOffset + headLen], key, keyLen) == 0) {
+			itemOffset = keyOffset + headLen + keyLen;
+			value = &buffer[itemOffset];
+			return true;
+		}
+		skip(itemOffset);
+		skip(itemOffset);
+	}
+	return false;
+}
+
+bool CborParser::getValueItemByIndex(CborItem container, size_t index, CborItem &item) const {
+	uint8_t majorType, info;
+	uint64_t count;
+
+	if (!container) {
+		return false;
+	}
+	size_t itemOffset = container - buffer;
+	size_t headLen = itemHead(itemOffset, majorType, info, count);
+	if (headLen == 0 || (majorType != CborWriter::MAJOR_ARRAY && majorType != CborWriter::MAJOR_MAP) || index >= count) {
+		return false;
+	}
+	itemOffset += headLen;
+
+	if (majorType == CborWriter::MAJOR_MAP) {
+		index *= 2;
+	}
+	for(size_t ii = 0; ii < index; ii++) {
+		skip(itemOffset);
+	}
+	item = &buffer[itemOffset];
+	return true;
+}
+
+bool CborParser::getNumber(CborItem item, double &number, long long &integer, bool &isInteger) const {
+	uint8_t majorType, info;
+	uint64_t value;
+
+	if (!item) {
+		return false;
+	}
+	size_t itemOffset = item - buffer;
+	if (!itemHead(itemOffset, majorType, info, value)) {
+		return false;
+	}
+
+	isInteger = true;
+	if (majorType == CborWriter::MAJOR_UNSIGNED) {
+		integer = (long long)value;
+		number = (double)value;
+		return true;
+	}
+	if (majorType == CborWriter::MAJOR_NEGATIVE) {
+		integer = -1 - (long long)value;
+		number = (double)integer;
+		return true;
+	}
+	if (majorType != CborWriter::MAJOR_SIMPLE) {
+		return false;
+	}
+
+	isInteger = false;
+	if (info == 25) {
+		// Half precision
+		int exponent = (value >> 10) & 0x1f;
+		int mantissa = value & 0x3ff;
+		if (exponent == 0) {
+			number = ldexp(mantissa, -24);
+		}
+		else if (exponent != 31) {
+			number = ldexp(mantissa + 1024, exponent - 25);
+		}
+		else {
+			number = (mantissa == 0) ? INFINITY : NAN;
+		}
+		if (value & 0x8000) {
+			number = -number;
+		}
+	}
+	else if (info == 26) {
+		uint32_t bits = (uint32_t)value;
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		number = f;
+	}
+	else if (info == 27) {
+		memcpy(&number, &value, sizeof(number));
+	}
+	else {
+		return false;
+	}
+	integer = (long long)number;
+	return true;
+}
+
+bool CborParser::getItemValue(CborItem item, bool &result) const {
+	uint8_t majorType, info;
+	uint64_t value;
+
+	if (!item) {
+		return false;
+	}
+	size_t itemOffset = item - buffer;
+	if (!itemHead(itemOffset, majorType, info, value) || majorType != CborWriter::MAJOR_SIMPLE ||
+		(value != CborWriter::SIMPLE_FALSE && value != CborWriter::SIMPLE_TRUE)) {
+		return false;
+	}
+	result = (value == CborWriter::SIMPLE_TRUE);
+	return true;
+}
+
+bool CborParser::getItemValue(CborItem item, int &result) const {
+	double number;
+	long long integer;
+	bool isInteger;
+
+	if (!getNumber(item, number, integer, isInteger)) {
+		return false;
+	}
+	result = (int)integer;
+	return true;
+}
+
+bool CborParser::getItemValue(CborItem item, unsigned int &result) const {
+	double number;
+	long long integer;
+	bool isInteger;
+
+	if (!getNumber(item, number, integer, isInteger) || integer < 0) {
+		return false;
+	}
+	result = (unsigned int)integer;
+	return true;
+}
+
+bool CborParser::getItemValue(CborItem item, long &result) const {
+	double number;
+	long long integer;
+	bool isInteger;
+
+	if (!getNumber(item, number, integer, isInteger)) {
+		return false;
+	}
+	result = (long)integer;
+	return true;
+}
+
+bool CborParser::getItemValue(CborItem item, unsigned long &result) const {
+	double number;
+	long long integer;
+	bool isInteger;
+
+	if (!getNumber(item, number, integer, isInteger) || integer < 0) {
+		return false;
+	}
+	result = (unsigned long)integer;
+	return true;
+}
+
+bool CborParser::getItemValue(CborItem item, float &result) const {
+	double number;
+	long long integer;
+	bool isInteger;
+
+	if (!getNumber(item, number, integer, isInteger)) {
+		return false;
+	}
+	result = (float)number;
+	return true;
+}
+
+bool CborParser::getItemValue(CborItem item, double &result) const {
+	long long integer;
+	bool isInteger;
+
+	return getNumber(item, result, integer, isInteger);
+}
+
+bool CborParser::getItemData(CborItem item, const uint8_t *&data, size_t &dataLen) const {
+	uint8_t majorType;
+
+	return getStringItem(item, majorType, data, dataLen);
+}
+
+bool CborParser::getItemValue(CborItem item, String &result) const {
+	uint8_t majorType;
+	const uint8_t *data;
+	size_t dataLen;
+
+	if (!getStringItem(item, majorType, data, dataLen) || majorType != CborWriter::MAJOR_TEXT) {
+		return false;
+	}
+	result = "";
+	result.reserve(dataLen + 1);
+
+	JsonParserString strWrapper(&result);
+	strWrapper.append((const char *)data, dataLen);
+	return true;
+}
+
+bool CborParser::getItemValue(CborItem item, char *str, size_t &bufLen) const {
+	uint8_t majorType;
+	const uint8_t *data;
+	size_t dataLen;
+
+	if (!getStringItem(item, majorType, data, dataLen) || majorType != CborWriter::MAJOR_TEXT || dataLen + 1 > bufLen) {
+		return false;
+	}
+	memcpy(str, data, dataLen);
+	str[dataLen] = 0;
+	bufLen = dataLen + 1;
+	return true;
+}
+
+bool CborParser::getStringItem(CborItem item, uint8_t &majorType, const uint8_t *&data, size_t &dataLen) const {
+	uint8_t info;
+	uint64_t value;
+
+	if (!item) {
+		return false;
+	}
+	size_t itemOffset = item - buffer;
+	size_t headLen = itemHead(itemOffset, majorType, info, value);
+	if (headLen == 0 || (majorType != CborWriter::MAJOR_TEXT && majorType != CborWriter::MAJOR_BYTES)) {
+		return false;
+	}
+	data = &buffer[itemOffset + headLen];
+	dataLen = (size_t)value;
+	return true;
+}
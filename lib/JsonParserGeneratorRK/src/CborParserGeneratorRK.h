@@ -0,0 +1,579 @@
+#ifndef __CBORPARSERGENERATORRK_H
+#define __CBORPARSERGENERATORRK_H
+
+#include "Particle.h"
+
+/**
+ * @brief CBOR (RFC 8949) writer and parser with an API like JsonWriter and JsonParser
+ *
+ * CBOR holds the same data as JSON (objects, arrays, strings, numbers, booleans and null) in binary, so
+ * numbers and object structure take fewer bytes and there's nothing to escape or convert with sprintf.
+ * Neither class allocates memory; they work in a buffer you pass in, or use CborWriterStatic and
+ * CborParserStatic.
+ *
+ * Event data must be text, so use CborWriter::encodeBase64() and CborParser::addBase64() to send it
+ * with Particle.publish() or receive it in a function or subscription handler. This requires Base64RK.
+ */
+
+/**
+ * @brief A reference to an item (value, array or object) in the CborParser buffer
+ *
+ * This is the CBOR equivalent of a jsmntok_t pointer with JsonParser. It's only valid until the
+ * parser buffer is changed.
+ */
+typedef const uint8_t *CborItem;
+
+/**
+ * @brief Buffer to write or parse CBOR data in. The buffer is passed in and never allocated.
+ */
+class CborBuffer {
+public:
+	/**
+	 * @brief Use the buffer of bufferLen bytes
+	 */
+	CborBuffer(uint8_t *buffer, size_t bufferLen) : buffer(buffer), bufferLen(bufferLen), offset(0) {};
+
+	/**
+	 * @brief Destroy the object. The buffer is not freed.
+	 */
+	virtual ~CborBuffer() {};
+
+	/**
+	 * @brief Returns the buffer
+	 */
+	uint8_t *getBuffer() const { return buffer; };
+
+	/**
+	 * @brief Returns the number of bytes of data in the buffer
+	 */
+	size_t getOffset() const { return offset; };
+
+	/**
+	 * @brief Returns the size of the buffer
+	 */
+	size_t getBufferLen() const { return bufferLen; };
+
+	/**
+	 * @brief Removes the data from the buffer
+	 */
+	void clear() { offset = 0; };
+
+protected:
+	uint8_t *buffer;			//!< Buffer passed to the constructor
+	size_t bufferLen;			//!< Size of buffer in bytes
+	size_t offset;				//!< Bytes of data in buffer
+};
+
+/**
+ * @brief Class for building CBOR data
+ *
+ * You use it like JsonWriter:
+ *
+ * ```
+ * CborWriterStatic<256> cw;
+ * cw.startObject();
+ * cw.insertKeyValue("space", 3);
+ * cw.insertKeyValue("spaceNet", 12);
+ * cw.finishObjectOrArray();
+ * ```
+ *
+ * Objects and arrays are written with a definite length. One byte is reserved for the length when the object
+ * or array is started, and the length is filled in by finishObjectOrArray(); up to 23 items fit in that byte.
+ */
+class CborWriter : public CborBuffer {
+public:
+	/**
+	 * @brief Construct a CborWriter to write to a buffer
+	 *
+	 * @param buffer Pointer to the buffer
+	 *
+	 * @param bufferLen Length of the buffer in bytes
+	 */
+	CborWriter(uint8_t *buffer, size_t bufferLen);
+
+	/**
+	 * @brief Destroy the object. The buffer is not freed.
+	 */
+	virtual ~CborWriter();
+
+	/**
+	 * @brief Reset the writer, clearing all data
+	 */
+	void init();
+
+	/**
+	 * @brief Start a new object. Make sure you finish it with finishObjectOrArray()
+	 */
+	bool startObject() { return startObjectOrArray(MAJOR_MAP); };
+
+	/**
+	 * @brief Start a new array. Make sure you finish it with finishObjectOrArray()
+	 */
+	bool startArray() { return startObjectOrArray(MAJOR_ARRAY); };
+
+	/**
+	 * @brief Finish an object or array started with startObject() or startArray(), writing its length
+	 */
+	void finishObjectOrArray();
+
+	/**
+	 * @brief Inserts a boolean value
+	 *
+	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
+	 * as those functions count the items in the object or array.
+	 */
+	void insertValue(bool value) { insertHead(MAJOR_SIMPLE, value ? SIMPLE_TRUE : SIMPLE_FALSE); }
+
+	/**
+	 * @brief Inserts an integer value, in 1 to 5 bytes depending on its magnitude
+	 */
+	void insertValue(int value) { insertValue((long long)value); }
+
+	/**
+	 * @brief Inserts an unsigned integer value
+	 */
+	void insertValue(unsigned int value) { insertHead(MAJOR_UNSIGNED, value); }
+
+	/**
+	 * @brief Inserts a long integer value
+	 */
+	void insertValue(long value) { insertValue((long long)value); }
+
+	/**
+	 * @brief Inserts an unsigned long integer value
+	 */
+	void insertValue(unsigned long value) { insertHead(MAJOR_UNSIGNED, value); }
+
+	/**
+	 * @brief Inserts a 64-bit integer value
+	 */
+	void insertValue(long long value);
+
+	/**
+	 * @brief Inserts a float value, in 5 bytes
+	 */
+	void insertValue(float value);
+
+	/**
+	 * @brief Inserts a double value, in 5 bytes if it's exactly representable as a float, otherwise 9
+	 */
+	void insertValue(double value);
+
+	/**
+	 * @brief Inserts a UTF-8 string value. Nothing is escaped.
+	 */
+	void insertValue(const char *value) { insertText(value, strlen(value)); }
+
+	/**
+	 * @brief Inserts a String value
+	 */
+	void insertValue(const String &value) { insertText(value.c_str(), value.length()); }
+
+	/**
+	 * @brief Inserts null
+	 */
+	void insertNull() { insertHead(MAJOR_SIMPLE, SIMPLE_NULL); }
+
+	/**
+	 * @brief Inserts binary data as a CBOR byte string. JSON has no equivalent of this.
+	 */
+	void insertBytes(const uint8_t *data, size_t dataLen);
+
+	/**
+	 * @brief Inserts a new key and empty object. You must close the object using finishObjectOrArray()!
+	 */
+	void insertKeyObject(const char *key);
+
+	/**
+	 * @brief Inserts a new key and empty array. You must close the array using finishObjectOrArray()!
+	 */
+	void insertKeyArray(const char *key);
+
+	/**
+	 * @brief Inserts a key/value pair into an object
+	 *
+	 * @param key the key name to insert
+	 *
+	 * @param value the value to insert: bool, int, unsigned int, long, unsigned long, long long, float, double,
+	 * const char * or String.
+	 */
+	template<class T>
+	void insertKeyValue(const char *key, T value) {
+		insertItem();
+		insertValue(key);
+		insertValue(value);
+	}
+
+	/**
+	 * @brief Inserts a value into an array
+	 */
+	template<class T>
+	void insertArrayValue(T value) {
+		insertItem();
+		insertValue(value);
+	}
+
+	/**
+	 * @brief Inserts an array of values into an array
+	 */
+	template<class T>
+	void insertArray(T *pArray, size_t numElem) {
+		startArray();
+		for(size_t ii = 0; ii < numElem; ii++) {
+			insertArrayValue(pArray[ii]);
+		}
+		finishObjectOrArray();
+	}
+
+	/**
+	 * @brief Inserts a key and an array of values into an object
+	 */
+	template<class T>
+	void insertKeyArray(const char *key, T *pArray, size_t numElem) {
+		insertKeyArray(key);
+		for(size_t ii = 0; ii < numElem; ii++) {
+			insertArrayValue(pArray[ii]);
+		}
+		finishObjectOrArray();
+	}
+
+	/**
+	 * @brief Returns true if data was added that didn't fit in the buffer
+	 */
+	bool isTruncated() const { return truncated; };
+
+	/**
+	 * @brief Encodes the data as Base64 for use as event data
+	 *
+	 * @param dst Buffer for the Base64 text, which is null terminated
+	 *
+	 * @param dstLen On input, the size of dst. On output, the length of the text not including the null.
+	 *
+	 * @return false if the data was truncated or dst is too small
+	 *
+	 * The encoded data is 4/3 the size of the CBOR data, plus one byte for the null.
+	 */
+	bool encodeBase64(char *dst, size_t &dstLen) const;
+
+	/**
+	 * @brief Used internally to start an object or array
+	 */
+	bool startObjectOrArray(uint8_t majorType);
+
+	/**
+	 * @brief Used internally to count an item (or key/value pair) in the current object or array
+	 */
+	void insertItem();
+
+	/**
+	 * @brief Used internally to write the initial byte and argument of a data item, in the shortest form
+	 */
+	void insertHead(uint8_t majorType, uint64_t value);
+
+	/**
+	 * @brief Used internally to insert a text string
+	 */
+	void insertText(const char *s, size_t len);
+
+	/**
+	 * @brief Used internally to insert bytes
+	 */
+	void insertRaw(const void *data, size_t dataLen);
+
+	/**
+	 * This constant is the maximum number of nested objects that are supported, like JsonWriter.
+	 */
+	static const size_t MAX_NESTED_CONTEXT = 9;
+
+	static const uint8_t MAJOR_UNSIGNED = 0;	//!< Major type 0: unsigned integer
+	static const uint8_t MAJOR_NEGATIVE = 1;	//!< Major type 1: negative integer -1 - n
+	static const uint8_t MAJOR_BYTES = 2;		//!< Major type 2: byte string
+	static const uint8_t MAJOR_TEXT = 3;		//!< Major type 3: UTF-8 text string
+	static const uint8_t MAJOR_ARRAY = 4;		//!< Major type 4: array
+	static const uint8_t MAJOR_MAP = 5;			//!< Major type 5: map (object)
+	static const uint8_t MAJOR_TAG = 6;			//!< Major type 6: tag
+	static const uint8_t MAJOR_SIMPLE = 7;		//!< Major type 7: simple values and floats
+	static const uint8_t SIMPLE_FALSE = 20;		//!< false
+	static const uint8_t SIMPLE_TRUE = 21;		//!< true
+	static const uint8_t SIMPLE_NULL = 22;		//!< null
+
+protected:
+	/**
+	 * @brief An object or array being written
+	 */
+	typedef struct {
+		size_t headOffset;		//!< Offset of the initial byte, which gets the length at finishObjectOrArray()
+		size_t count;			//!< Items, or key/value pairs, inserted
+	} Context;
+
+	size_t contextIndex;							//!< Index into the context for the current level of nesting
+	Context context[MAX_NESTED_CONTEXT];			//!< Objects and arrays being written
+	bool keyPending;								//!< The next object or array is the value of a key already counted
+	bool truncated;									//!< true if data was added that didn't fit and was truncated
+};
+
+/**
+ * @brief Creates a CborWriter with a statically allocated buffer.
+ *
+ * ```
+ * CborWriterStatic<256> cborWriter;
+ * ```
+ */
+template <size_t BUFFER_SIZE>
+class CborWriterStatic : public CborWriter {
+public:
+	explicit CborWriterStatic() : CborWriter(staticBuffer, BUFFER_SIZE) {};
+
+private:
+	uint8_t staticBuffer[BUFFER_SIZE]; //!< static buffer to write to
+};
+
+/**
+ * @brief Class for reading CBOR data
+ *
+ * You use it like JsonParser, with a CborItem in place of a token pointer:
+ *
+ * ```
+ * CborParserStatic<256> cp;
+ * cp.addBase64(data);
+ * if (cp.parse()) {
+ *     int space;
+ *     cp.getValueByKey(cp.getOuterObject(), "space", space);
+ * }
+ * ```
+ *
+ * parse() checks the whole buffer once, so the accessors can walk it without bounds checks. Nothing is
+ * copied or indexed, so finding a key or index is a linear scan of the container. Definite length items,
+ * floats (half, single and double) and tags (which are skipped) are supported. Indefinite length items
+ * are not.
+ */
+class CborParser : public CborBuffer {
+public:
+	/**
+	 * @brief Parse data in a buffer of bufferLen bytes
+	 */
+	CborParser(uint8_t *buffer, size_t bufferLen);
+
+	/**
+	 * @brief Destroy the object. The buffer is not freed.
+	 */
+	virtual ~CborParser();
+
+	/**
+	 * @brief Adds CBOR data to the buffer
+	 *
+	 * @return false if it doesn't fit
+	 */
+	bool addData(const uint8_t *data, size_t dataLen);
+
+	/**
+	 * @brief Decodes Base64 text, such as event or function data, and adds it to the buffer
+	 *
+	 * @return false if the text isn't valid Base64 or doesn't fit
+	 */
+	bool addBase64(const char *src);
+
+	/**
+	 * @brief Checks that the data in the buffer is a single, well formed CBOR item
+	 *
+	 * Call this before the accessors, which rely on it.
+	 */
+	bool parse();
+
+	/**
+	 * @brief Gets the outer item, normally an object
+	 */
+	CborItem getOuterObject() const { return parsed ? buffer : NULL; };
+
+	/**
+	 * @brief Gets the outer item, normally an object
+	 */
+	CborItem getOuterArray() const { return getOuterObject(); };
+
+	/**
+	 * @brief Returns true if the item is an object
+	 */
+	bool isObject(CborItem item) const;
+
+	/**
+	 * @brief Returns true if the item is an array
+	 */
+	bool isArray(CborItem item) const;
+
+	/**
+	 * @brief Returns the number of items in an array, or key/value pairs in an object
+	 */
+	size_t getArraySize(CborItem container) const;
+
+	/**
+	 * @brief Given an object, gets the value with the specified key name
+	 *
+	 * @param container The object to obtain the data from
+	 *
+	 * @param key The name of the key to retrieve
+	 *
+	 * @param result The returned data. The value can be of type: bool, int, unsigned int, long, unsigned long,
+	 * float, double, String, or (char *, size_t&).
+	 *
+	 * @result true if the data was retrieved successfully, false if not (key not present or incompatible data type).
+	 */
+	template<class T>
+	bool getValueByKey(CborItem container, const char *key, T &result) const {
+		CborItem value;
+		return getValueItemByKey(container, key, value) && getItemValue(value, result);
+	}
+
+	/**
+	 * @brief Gets a value from the outer object by key name
+	 */
+	template<class T>
+	bool getOuterValueByKey(const char *key, T &result) const {
+		return getValueByKey(getOuterObject(), key, result);
+	}
+
+	/**
+	 * @brief Given an object, gets a string value with the specified key name into a buffer
+	 *
+	 * @param bufLen On input, the size of str. On output, the length of the string including the null.
+	 */
+	bool getValueByKey(CborItem container, const char *key, char *str, size_t &bufLen) const {
+		CborItem value;
+		return getValueItemByKey(container, key, value) && getItemValue(value, str, bufLen);
+	}
+
+	/**
+	 * @brief Given an array, gets the value at index (0-based)
+	 */
+	template<class T>
+	bool getValueByIndex(CborItem container, size_t index, T &result) const {
+		CborItem value;
+		return getValueItemByIndex(container, index, value) && getItemValue(value, result);
+	}
+
+	/**
+	 * @brief Given an object, gets the item (value, object or array) with the specified key name
+	 */
+	bool getValueItemByKey(CborItem container, const char *key, CborItem &value) const;
+
+	/**
+	 * @brief Given an array, gets the item at index (0-based). For an object this is the key of pair index.
+	 */
+	bool getValueItemByIndex(CborItem container, size_t index, CborItem &item) const;
+
+	/**
+	 * @brief Gets the value of a boolean item
+	 */
+	bool getItemValue(CborItem item, bool &result) const;
+
+	/**
+	 * @brief Gets the value of an integer item. Floats are truncated.
+	 */
+	bool getItemValue(CborItem item, int &result) const;
+
+	/**
+	 * @brief Gets the value of an integer item. Negative values are not converted.
+	 */
+	bool getItemValue(CborItem item, unsigned int &result) const;
+
+	/**
+	 * @brief Gets the value of an integer item
+	 */
+	bool getItemValue(CborItem item, long &result) const;
+
+	/**
+	 * @brief Gets the value of an integer item. Negative values are not converted.
+	 */
+	bool getItemValue(CborItem item, unsigned long &result) const;
+
+	/**
+	 * @brief Gets the value of a float or integer item
+	 */
+	bool getItemValue(CborItem item, float &result) const;
+
+	/**
+	 * @brief Gets the value of a float or integer item
+	 */
+	bool getItemValue(CborItem item, double &result) const;
+
+	/**
+	 * @brief Gets the value of a text string item
+	 */
+	bool getItemValue(CborItem item, String &result) const;
+
+	/**
+	 * @brief Gets the value of a text string item into a buffer, which is null terminated
+	 *
+	 * @param bufLen On input, the size of str. On output, the length of the string including the null, as
+	 * with JsonParser.
+	 *
+	 * @return false if it's not a text string or it doesn't fit
+	 */
+	bool getItemValue(CborItem item, char *str, size_t &bufLen) const;
+
+	/**
+	 * @brief Gets a text or byte string item without copying it
+	 *
+	 * @param data Set to the start of the string in the parser buffer. It's not null terminated.
+	 *
+	 * @param dataLen Set to the length of the string in bytes
+	 */
+	bool getItemData(CborItem item, const uint8_t *&data, size_t &dataLen) const;
+
+	/**
+	 * @brief Maximum depth of nested objects and arrays accepted by parse()
+	 */
+	static const size_t MAX_NESTING = 16;
+
+protected:
+	/**
+	 * @brief Decodes the initial byte and argument of the item at itemOffset
+	 *
+	 * @return the length of the head, or 0 if it's not valid or runs past end
+	 */
+	size_t readHead(size_t itemOffset, size_t end, uint8_t &majorType, uint8_t &info, uint64_t &value) const;
+
+	/**
+	 * @brief Checks the item at itemOffset and everything in it, and moves itemOffset to the next item
+	 */
+	bool validate(size_t &itemOffset, size_t depth) const;
+
+	/**
+	 * @brief Moves itemOffset past the item at itemOffset. The data must have been checked by parse().
+	 */
+	void skip(size_t &itemOffset) const;
+
+	/**
+	 * @brief Skips tags, moving itemOffset to the tagged item, then decodes the head of the item
+	 */
+	size_t itemHead(size_t &itemOffset, uint8_t &majorType, uint8_t &info, uint64_t &value) const;
+
+	/**
+	 * @brief Gets a text or byte string item and which of the two it is
+	 */
+	bool getStringItem(CborItem item, uint8_t &majorType, const uint8_t *&data, size_t &dataLen) const;
+
+	/**
+	 * @brief Gets an integer or float item as a double, and as a 64-bit integer if it's an integer
+	 */
+	bool getNumber(CborItem item, double &number, long long &integer, bool &isInteger) const;
+
+	bool parsed;		//!< parse() succeeded on the current data
+};
+
+/**
+ * @brief Creates a CborParser with a statically allocated buffer.
+ *
+ * ```
+ * CborParserStatic<512> cborParser;
+ * ```
+ */
+template <size_t BUFFER_SIZE>
+class CborParserStatic : public CborParser {
+public:
+	explicit CborParserStatic() : CborParser(staticBuffer, BUFFER_SIZE) {};
+
+private:
+	uint8_t staticBuffer[BUFFER_SIZE]; //!< static buffer to parse
+};
+
+#endif /* __CBORPARSERGENERATORRK_H */
@@ -668,6 +668,21 @@ public:
 	 */
 	bool getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, unsigned long &result) const;
 
+	/**
+	 * @brief Gets an unsigned int value.
+	 *
+	 * uint32_t is an unsigned long on the devices but an unsigned int on most hosts, so this lets code that
+	 * reads into a uint32_t build on both.
+	 */
+	bool getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, unsigned int &result) const {
+		unsigned long value;
+		if (!getTokenValue(token, value)) {
+			return false;
+		}
+		result = (unsigned int)value;
+		return true;
+	}
+
 	/**
 	 * @brief Gets a float (single precision floating point) value.
 	 *
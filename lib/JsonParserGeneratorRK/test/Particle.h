@@ -0,0 +1,24 @@
+// Just enough of Device OS to build JsonParserGeneratorRK, CborParserGeneratorRK and Base64RK on a host
+#ifndef __PARTICLE_H
+#define __PARTICLE_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+class String : public std::string {
+public:
+	String() {}
+	String(const char *s) : std::string(s ? s : "") {}
+	String(const std::string &s) : std::string(s) {}
+	const char *c_str() const { return std::string::c_str(); }
+	operator const char *() const { return c_str(); }
+	unsigned length() const { return (unsigned)size(); }
+	void reserve(size_t n) { std::string::reserve(n); }
+	bool concat(char c) { push_back(c); return true; }
+};
+
+#endif /* __PARTICLE_H */
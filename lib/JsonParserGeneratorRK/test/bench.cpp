@@ -0,0 +1,221 @@
+// JSON vs CBOR size and speed, using the payloads the gateway publishes and the commands it parses
+#include "Particle.h"
+#include "JsonParserGeneratorRK.h"
+#include "CborParserGeneratorRK.h"
+#include <chrono>
+
+static const int ITERATIONS = 200000;
+static volatile size_t sink;
+
+// Values for one node report
+static const unsigned long uniqueID = 2613062658UL;
+static const int battery = 87, space = 3, spaceNet = 12, spaceGross = 140, placement = 1, multi = 0, zoneMode = 2;
+static const int sensorType = 10, temp = 24, resets = 2, alerts = 0, node = 5, rssi = -92, snr = 7, hops = 1;
+static const unsigned long timestamp = 1760745600UL;
+
+template<class F>
+static double usPerOp(F fn) {
+	auto start = std::chrono::steady_clock::now();
+	for(int ii = 0; ii < ITERATIONS; ii++) {
+		fn();
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::micro>(end - start).count() / ITERATIONS;
+}
+
+static size_t base64Len(const CborWriter &cw) {
+	char b64[1024];
+	size_t b64Len = sizeof(b64);
+	cw.encodeBase64(b64, b64Len);
+	return b64Len;
+}
+
+static void report(const char *name, size_t jsonLen, size_t cborLen, size_t b64Len, double jsonUs, double cborUs, double b64Us) {
+	printf("%-26s %5u %5u %5u   %7.3f %7.3f %7.3f\n", name, (unsigned)jsonLen, (unsigned)cborLen, (unsigned)b64Len, jsonUs, cborUs, b64Us);
+}
+
+// The occupancy webhook the gateway sends for each space (LoRA_Particle_Gateway.cpp publishWebhook)
+static size_t spaceJson(char *data, size_t dataLen) {
+	return snprintf(data, dataLen, "{\"nodeUniqueID\":\"%lu\",\"battery\":%d,\"space\":%d,\"spaceNet\":%d,\"spaceGross\":%d}",
+		uniqueID, battery, space, spaceNet, spaceGross);
+}
+
+static void spaceCbor(CborWriter &cw) {
+	cw.init();
+	cw.startObject();
+	cw.insertKeyValue("nodeUniqueID", uniqueID);
+	cw.insertKeyValue("battery", battery);
+	cw.insertKeyValue("space", space);
+	cw.insertKeyValue("spaceNet", spaceNet);
+	cw.insertKeyValue("spaceGross", spaceGross);
+	cw.finishObjectOrArray();
+}
+
+// The full occupancy node report
+static size_t nodeJson(char *data, size_t dataLen) {
+	return snprintf(data, dataLen, "{\"uniqueid\":\"%lu\", \"gross\":%u, \"net\":%i, \"space\":%d, \"placement\":%d, \"multi\":%d, \"zoneMode\":%d, \"sensortype\":%d, \"battery\":%d,\"key1\":\"%s\",\"temp\":%d, \"resets\":%d,\"alerts\":%d, \"node\":%d, \"rssi\":%d, \"snr\":%d,\"hops\":%d,\"timestamp\":%lu000}",
+		uniqueID, spaceGross, spaceNet, space, placement, multi, zoneMode, sensorType, battery, "Charging",
+		temp, resets, alerts, node, rssi, snr, hops, timestamp);
+}
+
+static void nodeCbor(CborWriter &cw) {
+	cw.init();
+	cw.startObject();
+	cw.insertKeyValue("uniqueid", uniqueID);
+	cw.insertKeyValue("gross", spaceGross);
+	cw.insertKeyValue("net", spaceNet);
+	cw.insertKeyValue("space", space);
+	cw.insertKeyValue("placement", placement);
+	cw.insertKeyValue("multi", multi);
+	cw.insertKeyValue("zoneMode", zoneMode);
+	cw.insertKeyValue("sensortype", sensorType);
+	cw.insertKeyValue("battery", battery);
+	cw.insertKeyValue("key1", "Charging");
+	cw.insertKeyValue("temp", temp);
+	cw.insertKeyValue("resets", resets);
+	cw.insertKeyValue("alerts", alerts);
+	cw.insertKeyValue("node", node);
+	cw.insertKeyValue("rssi", rssi);
+	cw.insertKeyValue("snr", snr);
+	cw.insertKeyValue("hops", hops);
+	cw.insertKeyValue("timestamp", (long long)timestamp * 1000);
+	cw.finishObjectOrArray();
+}
+
+// The command format Particle_Functions::jsonFunctionParser accepts
+static const char *commandJson = "{\"cmd\":[{\"node\":2613062658,\"var\":\"hourly\",\"fn\":\"reset\"},{\"node\":0,\"var\":1,\"fn\":\"lowpowermode\"},{\"node\":3861745302,\"var\":\"daily\",\"fn\":\"report\"}]}";
+
+static void commandCbor(CborWriter &cw) {
+	static const unsigned long nodes[] = { 2613062658UL, 0, 3861745302UL };
+	static const char *fns[] = { "reset", "lowpowermode", "report" };
+
+	cw.init();
+	cw.startObject();
+	cw.insertKeyArray("cmd");
+	for(int ii = 0; ii < 3; ii++) {
+		cw.startObject();
+		cw.insertKeyValue("node", nodes[ii]);
+		if (ii == 1) {
+			cw.insertKeyValue("var", 1);
+		}
+		else {
+			cw.insertKeyValue("var", ii == 0 ? "hourly" : "daily");
+		}
+		cw.insertKeyValue("fn", fns[ii]);
+		cw.finishObjectOrArray();
+	}
+	cw.finishObjectOrArray();
+	cw.finishObjectOrArray();
+}
+
+static size_t parseCommandsJson(JsonParser &jp, const char *command) {
+	unsigned long nodeUniqueID;
+	String variable, function;
+	size_t result = 0;
+
+	jp.clear();
+	jp.addString(command);
+	if (!jp.parse()) {
+		return 0;
+	}
+	const JsonParserGeneratorRK::jsmntok_t *cmdArrayContainer;
+	jp.getValueTokenByKey(jp.getOuterObject(), "cmd", cmdArrayContainer);
+	for(int ii = 0; ii < 10; ii++) {
+		const JsonParserGeneratorRK::jsmntok_t *cmdObjectContainer = jp.getTokenByIndex(cmdArrayContainer, ii);
+		if (cmdObjectContainer == NULL) {
+			break;
+		}
+		jp.getValueByKey(cmdObjectContainer, "node", nodeUniqueID);
+		jp.getValueByKey(cmdObjectContainer, "var", variable);
+		jp.getValueByKey(cmdObjectContainer, "fn", function);
+		result += nodeUniqueID + variable.length() + function.length();
+	}
+	return result;
+}
+
+static size_t parseCommandsCbor(CborParser &cp) {
+	unsigned long nodeUniqueID;
+	String variable, function;
+	size_t result = 0;
+
+	if (!cp.parse()) {
+		return 0;
+	}
+	CborItem cmdArrayContainer, cmdObjectContainer;
+	cp.getValueItemByKey(cp.getOuterObject(), "cmd", cmdArrayContainer);
+	for(size_t ii = 0; ii < 10; ii++) {
+		if (!cp.getValueItemByIndex(cmdArrayContainer, ii, cmdObjectContainer)) {
+			break;
+		}
+		cp.getValueByKey(cmdObjectContainer, "node", nodeUniqueID);
+		if (!cp.getValueByKey(cmdObjectContainer, "var", variable)) {
+			// A number, which JsonParser returns as text
+			int value = 0;
+			cp.getValueByKey(cmdObjectContainer, "var", value);
+			variable = String(std::to_string(value));
+		}
+		cp.getValueByKey(cmdObjectContainer, "fn", function);
+		result += nodeUniqueID + variable.length() + function.length();
+	}
+	return result;
+}
+
+int main() {
+	char data[622];
+	char b64[1024];
+	size_t b64Len;
+	CborWriterStatic<622> cw;
+	JsonWriterStatic<622> jw;
+
+	printf("Sizes in bytes; times in microseconds per operation (%d iterations)\n\n", ITERATIONS);
+	printf("%-26s %5s %5s %5s   %7s %7s %7s\n", "encode", "json", "cbor", "b64", "json", "cbor", "cbor+b64");
+
+	report("space webhook (snprintf)", spaceJson(data, sizeof(data)), (spaceCbor(cw), cw.getOffset()), base64Len(cw),
+		usPerOp([&]() { sink = spaceJson(data, sizeof(data)); }),
+		usPerOp([&]() { spaceCbor(cw); sink = cw.getOffset(); }),
+		usPerOp([&]() { spaceCbor(cw); b64Len = sizeof(b64); cw.encodeBase64(b64, b64Len); sink = b64Len; }));
+
+	auto spaceJsonWriter = [&]() {
+		jw.init();
+		jw.startObject();
+		jw.insertKeyValue("nodeUniqueID", String(std::to_string(uniqueID)));
+		jw.insertKeyValue("battery", battery);
+		jw.insertKeyValue("space", space);
+		jw.insertKeyValue("spaceNet", spaceNet);
+		jw.insertKeyValue("spaceGross", spaceGross);
+		jw.finishObjectOrArray();
+		sink = jw.getOffset();
+	};
+	spaceJsonWriter();
+	report("space webhook (JsonWriter)", jw.getOffset(), cw.getOffset(), base64Len(cw),
+		usPerOp(spaceJsonWriter),
+		usPerOp([&]() { spaceCbor(cw); sink = cw.getOffset(); }),
+		usPerOp([&]() { spaceCbor(cw); b64Len = sizeof(b64); cw.encodeBase64(b64, b64Len); sink = b64Len; }));
+
+	report("node webhook (snprintf)", nodeJson(data, sizeof(data)), (nodeCbor(cw), cw.getOffset()), base64Len(cw),
+		usPerOp([&]() { sink = nodeJson(data, sizeof(data)); }),
+		usPerOp([&]() { nodeCbor(cw); sink = cw.getOffset(); }),
+		usPerOp([&]() { nodeCbor(cw); b64Len = sizeof(b64); cw.encodeBase64(b64, b64Len); sink = b64Len; }));
+
+	// Parse the commands from JSON, from CBOR and from CBOR received as Base64 event or function data
+	JsonParserStatic<1024, 80> jp;
+	CborParserStatic<256> cp;
+	commandCbor(cw);
+	b64Len = sizeof(b64);
+	cw.encodeBase64(b64, b64Len);
+
+	size_t expected = parseCommandsJson(jp, commandJson);
+	cp.clear();
+	cp.addBase64(b64);
+	if (parseCommandsCbor(cp) != expected) {
+		printf("CBOR commands don't match JSON\n");
+		return 1;
+	}
+
+	printf("\n%-26s %5s %5s %5s   %7s %7s %7s\n", "decode", "json", "cbor", "b64", "json", "cbor", "b64+cbor");
+	report("commands", strlen(commandJson), cw.getOffset(), b64Len,
+		usPerOp([&]() { sink = parseCommandsJson(jp, commandJson); }),
+		usPerOp([&]() { sink = parseCommandsCbor(cp); }),
+		usPerOp([&]() { cp.clear(); cp.addBase64(b64); sink = parseCommandsCbor(cp); }));
+	return 0;
+}
@@ -0,0 +1,325 @@
+// Self-checking tests for CborWriter and CborParser, including examples from RFC 8949 Appendix A
+#include "Particle.h"
+#include "CborParserGeneratorRK.h"
+#include <math.h>
+
+static bool failed = false;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); failed = true; } } while (0)
+
+// Compare the writer output to hex
+static bool matches(const CborWriter &cw, const char *hex) {
+	size_t len = strlen(hex) / 2;
+	if (cw.isTruncated() || cw.getOffset() != len) {
+		return false;
+	}
+	for(size_t ii = 0; ii < len; ii++) {
+		unsigned int byte;
+		sscanf(&hex[ii * 2], "%2x", &byte);
+		if (cw.getBuffer()[ii] != byte) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Load hex into the parser and parse it
+static bool load(CborParser &cp, const char *hex) {
+	uint8_t buf[256];
+	size_t len = strlen(hex) / 2;
+	for(size_t ii = 0; ii < len; ii++) {
+		unsigned int byte;
+		sscanf(&hex[ii * 2], "%2x", &byte);
+		buf[ii] = (uint8_t)byte;
+	}
+	cp.clear();
+	return cp.addData(buf, len) && cp.parse();
+}
+
+template<class T>
+static bool writes(T value, const char *hex) {
+	CborWriterStatic<64> cw;
+	cw.insertValue(value);
+	return matches(cw, hex);
+}
+
+static void testWriterScalars() {
+	CHECK(writes(0, "00"));
+	CHECK(writes(23, "17"));
+	CHECK(writes(24, "1818"));
+	CHECK(writes(100, "1864"));
+	CHECK(writes(1000, "1903e8"));
+	CHECK(writes(1000000, "1a000f4240"));
+	CHECK(writes(1000000000000LL, "1b000000e8d4a51000"));
+	CHECK(writes(-1, "20"));
+	CHECK(writes(-10, "29"));
+	CHECK(writes(-100, "3863"));
+	CHECK(writes(-1000, "3903e7"));
+	CHECK(writes(4294967295UL, "1affffffff"));
+	CHECK(writes(100000.0f, "fa47c35000"));
+	CHECK(writes(1.1, "fb3ff199999999999a"));
+	CHECK(writes(1.5, "fa3fc00000"));
+	CHECK(writes(false, "f4"));
+	CHECK(writes(true, "f5"));
+	CHECK(writes("", "60"));
+	CHECK(writes("a", "6161"));
+	CHECK(writes("IETF", "6449455446"));
+	CHECK(writes("\xc3\xbc", "62c3bc"));
+	CHECK(writes(String("\"\\"), "62225c"));
+
+	CborWriterStatic<16> cw;
+	cw.insertNull();
+	CHECK(matches(cw, "f6"));
+
+	const uint8_t bytes[] = { 1, 2, 3, 4 };
+	cw.init();
+	cw.insertBytes(bytes, sizeof(bytes));
+	CHECK(matches(cw, "4401020304"));
+}
+
+static void testWriterContainers() {
+	CborWriterStatic<256> cw;
+
+	// []
+	cw.startArray();
+	cw.finishObjectOrArray();
+	CHECK(matches(cw, "80"));
+
+	// [1, [2, 3], [4, 5]]
+	cw.init();
+	cw.startArray();
+	cw.insertArrayValue(1);
+	int a[] = { 2, 3 }, b[] = { 4, 5 };
+	cw.insertArray(a, 2);
+	cw.insertArray(b, 2);
+	cw.finishObjectOrArray();
+	CHECK(matches(cw, "8301820203820405"));
+
+	// [1, 2, ... 25] - more than 23 items, so the length moves the items up a byte
+	cw.init();
+	cw.startArray();
+	for(int ii = 1; ii <= 25; ii++) {
+		cw.insertArrayValue(ii);
+	}
+	cw.finishObjectOrArray();
+	CHECK(matches(cw, "98190102030405060708090a0b0c0d0e0f101112131415161718181819"));
+
+	// {"a": 1, "b": [2, 3]}
+	cw.init();
+	cw.startObject();
+	cw.insertKeyValue("a", 1);
+	cw.insertKeyArray("b");
+	cw.insertArrayValue(2);
+	cw.insertArrayValue(3);
+	cw.finishObjectOrArray();
+	cw.finishObjectOrArray();
+	CHECK(matches(cw, "a26161016162820203"));
+
+	// ["a", {"b": "c"}]
+	cw.init();
+	cw.startArray();
+	cw.insertArrayValue("a");
+	cw.startObject();
+	cw.insertKeyValue("b", "c");
+	cw.finishObjectOrArray();
+	cw.finishObjectOrArray();
+	CHECK(matches(cw, "826161a161626163"));
+
+	// {"a": {}, "b": 1} - an object value is one pair
+	cw.init();
+	cw.startObject();
+	cw.insertKeyObject("a");
+	cw.finishObjectOrArray();
+	cw.insertKeyValue("b", 1);
+	cw.finishObjectOrArray();
+	CHECK(matches(cw, "a26161a0616201"));
+}
+
+static void testWriterTruncated() {
+	CborWriterStatic<8> cw;
+	cw.startObject();
+	cw.insertKeyValue("space", 3);
+	cw.insertKeyValue("spaceNet", 12);
+	cw.finishObjectOrArray();
+	CHECK(cw.isTruncated());
+
+	char b64[32];
+	size_t b64Len = sizeof(b64);
+	CHECK(!cw.encodeBase64(b64, b64Len));
+
+	// Growing an array's length at finish needs room too
+	CborWriterStatic<25> cw2;
+	cw2.startArray();
+	for(int ii = 0; ii < 23; ii++) {
+		cw2.insertArrayValue(ii);
+	}
+	cw2.insertArrayValue(0);
+	CHECK(!cw2.isTruncated());
+	cw2.finishObjectOrArray();
+	CHECK(cw2.isTruncated());
+}
+
+static void testParserScalars() {
+	CborParserStatic<256> cp;
+	int i;
+	unsigned int u;
+	long l;
+	unsigned long ul;
+	float f;
+	double d;
+	bool b;
+	String s;
+
+	CHECK(load(cp, "1903e8") && cp.getItemValue(cp.getOuterObject(), i) && i == 1000);
+	CHECK(load(cp, "3903e7") && cp.getItemValue(cp.getOuterObject(), l) && l == -1000);
+	CHECK(load(cp, "3903e7") && !cp.getItemValue(cp.getOuterObject(), u));
+	CHECK(load(cp, "1affffffff") && cp.getItemValue(cp.getOuterObject(), ul) && ul == 4294967295UL);
+	CHECK(load(cp, "1b000000e8d4a51000") && cp.getItemValue(cp.getOuterObject(), d) && d == 1000000000000.0);
+	CHECK(load(cp, "f93c00") && cp.getItemValue(cp.getOuterObject(), d) && d == 1.0);
+	CHECK(load(cp, "f93e00") && cp.getItemValue(cp.getOuterObject(), d) && d == 1.5);
+	CHECK(load(cp, "f97bff") && cp.getItemValue(cp.getOuterObject(), d) && d == 65504.0);
+	CHECK(load(cp, "f90001") && cp.getItemValue(cp.getOuterObject(), d) && d == 5.960464477539063e-8);
+	CHECK(load(cp, "f9c400") && cp.getItemValue(cp.getOuterObject(), d) && d == -4.0);
+	CHECK(load(cp, "f97c00") && cp.getItemValue(cp.getOuterObject(), d) && isinf(d));
+	CHECK(load(cp, "f97e00") && cp.getItemValue(cp.getOuterObject(), d) && isnan(d));
+	CHECK(load(cp, "fa47c35000") && cp.getItemValue(cp.getOuterObject(), f) && f == 100000.0f);
+	CHECK(load(cp, "fb3ff199999999999a") && cp.getItemValue(cp.getOuterObject(), d) && d == 1.1);
+	CHECK(load(cp, "fb3ff199999999999a") && cp.getItemValue(cp.getOuterObject(), i) && i == 1);
+	CHECK(load(cp, "f5") && cp.getItemValue(cp.getOuterObject(), b) && b);
+	CHECK(load(cp, "f4") && cp.getItemValue(cp.getOuterObject(), b) && !b);
+	CHECK(load(cp, "f6") && !cp.getItemValue(cp.getOuterObject(), b));
+	CHECK(load(cp, "6449455446") && cp.getItemValue(cp.getOuterObject(), s) && s == "IETF");
+	CHECK(load(cp, "4401020304") && !cp.getItemValue(cp.getOuterObject(), s));
+
+	// Tags are skipped: 1(1363896240) is an epoch date
+	CHECK(load(cp, "c11a514b67b0") && cp.getItemValue(cp.getOuterObject(), ul) && ul == 1363896240UL);
+
+	// A string into a buffer that's too small
+	char buf[4];
+	size_t bufLen = sizeof(buf);
+	CHECK(load(cp, "6449455446") && !cp.getItemValue(cp.getOuterObject(), buf, bufLen));
+	bufLen = sizeof(buf);
+	CHECK(load(cp, "63616263") && cp.getItemValue(cp.getOuterObject(), buf, bufLen) && strcmp(buf, "abc") == 0 && bufLen == 4);
+}
+
+static void testParserContainers() {
+	CborParserStatic<256> cp;
+	CborItem item;
+	int i;
+	String s;
+
+	// {"a": 1, "b": [2, 3]}
+	CHECK(load(cp, "a26161016162820203"));
+	CHECK(cp.isObject(cp.getOuterObject()));
+	CHECK(cp.getArraySize(cp.getOuterObject()) == 2);
+	CHECK(cp.getOuterValueByKey("a", i) && i == 1);
+	CHECK(cp.getValueItemByKey(cp.getOuterObject(), "b", item) && cp.isArray(item) && cp.getArraySize(item) == 2);
+	CHECK(cp.getValueByIndex(item, 1, i) && i == 3);
+	CHECK(!cp.getValueByIndex(item, 2, i));
+	CHECK(!cp.getOuterValueByKey("c", i));
+	CHECK(!cp.getOuterValueByKey("", i));
+
+	// {"a": "A", "b": "B", "c": "C", "d": "D", "e": "E"} - keys after nested values
+	CHECK(load(cp, "a56161614161626142616361436164614461656145"));
+	CHECK(cp.getOuterValueByKey("e", s) && s == "E");
+
+	// [1, [2, 3], [4, 5]]
+	CHECK(load(cp, "8301820203820405"));
+	CHECK(cp.getValueItemByIndex(cp.getOuterArray(), 2, item) && cp.getValueByIndex(item, 0, i) && i == 4);
+
+	// [1, 2, ... 25]
+	CHECK(load(cp, "98190102030405060708090a0b0c0d0e0f101112131415161718181819"));
+	CHECK(cp.getArraySize(cp.getOuterArray()) == 25);
+	CHECK(cp.getValueByIndex(cp.getOuterArray(), 24, i) && i == 25);
+}
+
+static void testParserRejects() {
+	CborParserStatic<256> cp;
+
+	CHECK(!load(cp, ""));
+	CHECK(!load(cp, "18"));				// Argument missing
+	CHECK(!load(cp, "62c3"));			// String runs past the end
+	CHECK(!load(cp, "8301"));			// Array runs past the end
+	CHECK(!load(cp, "a161610"));		// Map with a key and no value
+	CHECK(!load(cp, "0000"));			// Two items
+	CHECK(!load(cp, "9f0102ff"));		// Indefinite length
+	CHECK(!load(cp, "1c"));				// Reserved
+	CHECK(!load(cp, "9bffffffffffffffff00"));	// Huge count
+	CHECK(!load(cp, "bbffffffffffffffff00"));	// Huge map count
+
+	// Nesting deeper than MAX_NESTING
+	char deep[80] = "";
+	for(size_t ii = 0; ii <= CborParser::MAX_NESTING; ii++) {
+		strcat(deep, "81");
+	}
+	strcat(deep, "00");
+	CHECK(!load(cp, deep));
+	CHECK(cp.getOuterObject() == NULL);
+}
+
+static void testRoundTrip() {
+	CborWriterStatic<256> cw;
+
+	cw.startObject();
+	cw.insertKeyValue("nodeUniqueID", String("2613062658"));
+	cw.insertKeyValue("battery", 87);
+	cw.insertKeyValue("spaceNet", -3);
+	cw.insertKeyValue("ratio", 0.25f);
+	cw.insertKeyValue("pi", 3.14159265358979);
+	cw.insertKeyValue("ok", true);
+	cw.insertKeyArray("cmd");
+	for(int ii = 0; ii < 3; ii++) {
+		cw.startObject();
+		cw.insertKeyValue("node", 100 + ii);
+		cw.insertKeyValue("fn", "reset");
+		cw.finishObjectOrArray();
+	}
+	cw.finishObjectOrArray();
+	cw.finishObjectOrArray();
+	CHECK(!cw.isTruncated());
+
+	// Through Base64, as with event data
+	char b64[400];
+	size_t b64Len = sizeof(b64);
+	CHECK(cw.encodeBase64(b64, b64Len));
+	CHECK(b64Len == strlen(b64));
+
+	CborParserStatic<256> cp;
+	CHECK(cp.addBase64(b64));
+	CHECK(cp.getOffset() == cw.getOffset() && memcmp(cp.getBuffer(), cw.getBuffer(), cw.getOffset()) == 0);
+	CHECK(cp.parse());
+
+	String s;
+	int i;
+	float f;
+	double d;
+	bool b;
+	CborItem cmd, obj;
+	CHECK(cp.getOuterValueByKey("nodeUniqueID", s) && s == "2613062658");
+	CHECK(cp.getOuterValueByKey("battery", i) && i == 87);
+	CHECK(cp.getOuterValueByKey("spaceNet", i) && i == -3);
+	CHECK(cp.getOuterValueByKey("ratio", f) && f == 0.25f);
+	CHECK(cp.getOuterValueByKey("pi", d) && d == 3.14159265358979);
+	CHECK(cp.getOuterValueByKey("ok", b) && b);
+	CHECK(cp.getValueItemByKey(cp.getOuterObject(), "cmd", cmd) && cp.getArraySize(cmd) == 3);
+	CHECK(cp.getValueItemByIndex(cmd, 2, obj) && cp.getValueByKey(obj, "node", i) && i == 102);
+	CHECK(cp.getValueByKey(obj, "fn", s) && s == "reset");
+
+	// A Base64 string that doesn't fit
+	CborParserStatic<8> small;
+	CHECK(!small.addBase64(b64));
+	CHECK(!small.addBase64("not base64!"));
+}
+
+int main() {
+	testWriterScalars();
+	testWriterContainers();
+	testWriterTruncated();
+	testParserScalars();
+	testParserContainers();
+	testParserRejects();
+	testRoundTrip();
+
+	printf("cbor_test %s\n", failed ? "FAILED" : "passed");
+	return failed ? 1 : 0;
+}
@@ -8,39 +8,85 @@ MB85RC::MB85RC(TwoWire &wire, size_t memorySize, int addr) :
 }
 
 MB85RC::~MB85RC() {
+	for(size_t ii = 0; ii < numReadCaches; ii++) {
+		free(readCaches[ii].data);
+	}
 }
 
 void MB85RC::begin() {
 	wire.begin();
 }
 
+MB85RC &MB85RC::withWireBufferSize(size_t size) {
+	if (size >= 4) {
+		wireBufferSize = size;
+	}
+	return *this;
+}
+
 bool MB85RC::erase() {
+	bool result = fillData(0, 0, memorySize);
+	if (!result) {
+		Log.info("fillData failed during erase");
+	}
+	return result;
+}
+
+bool MB85RC::fillData(size_t framAddr, uint8_t value, size_t dataLen) {
+	bool result = true;
 
 	WITH_LOCK(wire) {
-		size_t framAddr = 0;
-		size_t totalLen = memorySize;
+		size_t cacheAddr = framAddr;
+		size_t cacheLen = dataLen;
 
-		uint8_t zero[30];
-		memset(zero, 0, sizeof(zero));
+		while(dataLen > 0) {
+			size_t count = transferLimit(framAddr, dataLen, wireBufferSize - 2);
 
-		while(totalLen > 0) {
-			size_t count = totalLen;
-			if (count > sizeof(zero)) {
-				count = sizeof(zero);
-			}
+			wire.beginTransmission(getI2CAddr(framAddr));
+			wire.write(framAddr >> 8);
+			wire.write(framAddr);
 
-			bool result = writeData(framAddr, zero, count);
-			if (!result) {
-				Log.info("writeData failed during erase framAddr=%u", framAddr);
-				return false;
+			for(size_t ii = 0; ii < count; ii++) {
+				wire.write(value);
 			}
 
-			totalLen -= count;
+			int stat = wire.endTransmission(true);
+			if (stat != 0) {
+				Log.info("fill failed %d", stat);
+				result = false;
+				break;
+			}
 			framAddr += count;
+			dataLen -= count;
+		}
+		if (result) {
+			updateCache(cacheAddr, NULL, value, cacheLen);
 		}
 	}
+	return result;
+}
 
-	return true;
+bool MB85RC::addReadCache(size_t framAddr, size_t length) {
+	bool result = false;
+
+	WITH_LOCK(wire) {
+		if (numReadCaches < MAX_READ_CACHES && length > 0 && (framAddr + length) <= memorySize) {
+			uint8_t *data = (uint8_t *) malloc(length);
+			if (data) {
+				if (readData(framAddr, data, length)) {
+					ReadCache &cache = readCaches[numReadCaches++];
+					cache.framAddr = framAddr;
+					cache.length = length;
+					cache.data = data;
+					result = true;
+				}
+				else {
+					free(data);
+				}
+			}
+		}
+	}
+	return result;
 }
 
 
@@ -48,9 +94,14 @@ bool MB85RC::readData(size_t framAddr, uint8_t *data, size_t dataLen) {
 	bool result = true;
 
 	WITH_LOCK(wire) {
+		if (readFromCache(framAddr, data, dataLen)) {
+			dataLen = 0;		// All of it came from RAM
+		}
 
 		while(dataLen > 0) {
-			wire.beginTransmission(addr | DEVICE_ADDR);
+			size_t bytesToRead = transferLimit(framAddr, dataLen, wireBufferSize);
+
+			wire.beginTransmission(getI2CAddr(framAddr));
 			wire.write(framAddr >> 8);
 			wire.write(framAddr);
 			int stat = wire.endTransmission(false);
@@ -60,20 +111,15 @@ bool MB85RC::readData(size_t framAddr, uint8_t *data, size_t dataLen) {
 				break;
 			}
 
-			size_t bytesToRead = dataLen;
-			if (bytesToRead > 32) {
-				bytesToRead = 32;
-			}
-
-			wire.requestFrom((uint8_t)(addr | DEVICE_ADDR), bytesToRead, (uint8_t) true);
+			wire.requestFrom(getI2CAddr(framAddr), bytesToRead, (uint8_t) true);
 
-			if (Wire.available() < (int) bytesToRead) {
+			if (wire.available() < (int) bytesToRead) {
 				result = false;
 				break;
 			}
 
 			for(size_t ii = 0; ii < bytesToRead; ii++) {
-				*data++ = Wire.read();    // receive a byte as character
+				*data++ = wire.read();    // receive a byte as character
 				framAddr++;
 				dataLen--;
 			}
@@ -87,17 +133,21 @@ bool MB85RC::writeData(size_t framAddr, const uint8_t *data, size_t dataLen) {
 	bool result = true;
 
 	WITH_LOCK(wire) {
+		size_t cacheAddr = framAddr;
+		size_t cacheLen = dataLen;
+		const uint8_t *cacheData = data;
+
 		while(dataLen > 0) {
-			wire.beginTransmission(addr | DEVICE_ADDR);
+			size_t count = transferLimit(framAddr, dataLen, wireBufferSize - 2);
+
+			wire.beginTransmission(getI2CAddr(framAddr));
 			wire.write(framAddr >> 8);
 			wire.write(framAddr);
 
-			for(size_t ii = 0; ii < 30 && dataLen > 0; ii++) {
-				wire.write(*data);
-				framAddr++;
-				data++;
-				dataLen--;
-			}
+			wire.write(data, count);
+			framAddr += count;
+			data += count;
+			dataLen -= count;
 
 			int stat = wire.endTransmission(true);
 			if (stat != 0) {
@@ -106,16 +156,56 @@ bool MB85RC::writeData(size_t framAddr, const uint8_t *data, size_t dataLen) {
 				break;
 			}
 		}
+		if (result) {
+			updateCache(cacheAddr, cacheData, 0, cacheLen);		// Write-through - keep the cached copy in step
+		}
 	}
 	return result;
 }
 
+uint8_t MB85RC::getI2CAddr(size_t framAddr) const {
+	return (uint8_t) (addr | DEVICE_ADDR);
+}
+
+size_t MB85RC::transferLimit(size_t framAddr, size_t count, size_t maxCount) const {
+	return (count > maxCount) ? maxCount : count;
+}
+
+bool MB85RC::readFromCache(size_t framAddr, uint8_t *data, size_t dataLen) const {
+	for(size_t ii = 0; ii < numReadCaches; ii++) {
+		const ReadCache &cache = readCaches[ii];
+		if (framAddr >= cache.framAddr && (framAddr + dataLen) <= (cache.framAddr + cache.length)) {
+			memcpy(data, &cache.data[framAddr - cache.framAddr], dataLen);
+			return true;
+		}
+	}
+	return false;
+}
+
+void MB85RC::updateCache(size_t framAddr, const uint8_t *data, uint8_t value, size_t dataLen) {
+	for(size_t ii = 0; ii < numReadCaches; ii++) {
+		const ReadCache &cache = readCaches[ii];
+
+		// Overlap between the written range and the cached range
+		size_t start = (framAddr > cache.framAddr) ? framAddr : cache.framAddr;
+		size_t end = ((framAddr + dataLen) < (cache.framAddr + cache.length)) ? (framAddr + dataLen) : (cache.framAddr + cache.length);
+		if (start < end) {
+			if (data) {
+				memcpy(&cache.data[start - cache.framAddr], &data[start - framAddr], end - start);
+			}
+			else {
+				memset(&cache.data[start - cache.framAddr], value, end - start);
+			}
+		}
+	}
+}
+
 
 bool MB85RC::moveData(size_t framAddrFrom, size_t framAddrTo, size_t numBytes) {
 	bool result = true;
 
-	// Maximum number of bytes we can write is 30
-	uint8_t buf[30];
+	// Each step is a read and a write - readData and writeData split it further if the Wire buffer is smaller
+	uint8_t buf[64];
 
 	WITH_LOCK(wire) {
 		if (framAddrFrom < framAddrTo) {
@@ -171,96 +261,18 @@ bool MB85RC::moveData(size_t framAddrFrom, size_t framAddrTo, size_t numBytes) {
 
 
 //
-// Special versions of readData and writeData are required for the MB85RC1M
+// The MB85RC1M uses the next I2C address for the upper 64K and transfers cannot cross that boundary
 //
 
-bool MB85RC1M::readData(size_t framAddr, uint8_t *data, size_t dataLen) {
-	bool result = true;
-
-	WITH_LOCK(wire) {
-
-		while(dataLen > 0) {
-			size_t count = dataLen;
-			if (count > 32) {
-				// Don't read more than 32 bytes (limit of Wire implementation)
-				count = 32;
-			}
-			if ((framAddr < 65536) && ((framAddr + count) >= 65536)) {
-				// Crosses boundary at 65536, only write up to the boundary
-				count = 65536 - framAddr;
-			}
-
-			wire.beginTransmission(getI2CAddr(framAddr));
-			wire.write(framAddr >> 8);
-			wire.write(framAddr);
-			int stat = wire.endTransmission(false);
-			if (stat != 0) {
-				Log.info("read set address failed %d", stat);
-				result = false;
-				break;
-			}
-
-			wire.requestFrom(getI2CAddr(framAddr), count, (uint8_t) true);
-
-			if (Wire.available() < (int) count) {
-				Log.info("didn't receive enough bytes count=%u", count);
-				result = false;
-				break;
-			}
-
-			for(size_t ii = 0; ii < count; ii++) {
-				*data++ = Wire.read();    // receive a byte as character
-				framAddr++;
-				dataLen--;
-			}
-		}
+size_t MB85RC1M::transferLimit(size_t framAddr, size_t count, size_t maxCount) const {
+	count = MB85RC::transferLimit(framAddr, count, maxCount);
+	if ((framAddr < 65536) && ((framAddr + count) > 65536)) {
+		// Crosses boundary at 65536, only transfer up to the boundary
+		count = 65536 - framAddr;
 	}
-	return result;
-}
-
-bool MB85RC1M::writeData(size_t framAddr, const uint8_t *data, size_t dataLen) {
-	bool result = true;
-
-	WITH_LOCK(wire) {
-		while(dataLen > 0) {
-			size_t count = dataLen;
-			if (count > 30) {
-				// Don't write more than 30 bytes (limit of Wire implementation)
-				count = 30;
-			}
-			if ((framAddr < 65536) && ((framAddr + count) >= 65536)) {
-				// Crosses boundary at 65536, only write up to the boundary
-				count = 65536 - framAddr;
-			}
-
-			wire.beginTransmission(getI2CAddr(framAddr));
-			wire.write(framAddr >> 8);
-			wire.write(framAddr);
-
-			for(size_t ii = 0; ii < count; ii++) {
-				wire.write(*data);
-				framAddr++;
-				data++;
-				dataLen--;
-				count--;
-			}
-
-			int stat = wire.endTransmission(true);
-			if (stat != 0) {
-				Log.info("write failed %d", stat);
-				result = false;
-				break;
-			}
-		}
-	}
-	return result;
+	return count;
 }
 
 uint8_t MB85RC1M::getI2CAddr(size_t framAddr) const {
 	return (uint8_t) (addr | DEVICE_ADDR | (framAddr >= 65536 ? 1 : 0));
 }
-
-
-
-
-
@@ -20,6 +20,17 @@ public:
 	 */
 	void begin();
 
+	/**
+	 * @brief Sets the size of the Wire (I2C) buffers so larger transfers can be done in one transaction
+	 *
+	 * @param size The buffer size in bytes. The default is 32, the standard Wire buffer. Reads are done
+	 * in transactions of up to size bytes, writes up to size - 2 bytes (the address takes two bytes).
+	 *
+	 * Only set this larger than 32 if the application has configured larger buffers by defining
+	 * acquireWireBuffer() (Device OS 1.5.0 and later). Returns the object so you can chain it with begin().
+	 */
+	MB85RC &withWireBufferSize(size_t size);
+
 	/**
 	 * @brief Returns the length of the device in bytes
 	 *
@@ -35,6 +46,34 @@ public:
 	 */
 	bool erase();
 
+	/**
+	 * @brief Sets a range of the FRAM to a single value
+	 *
+	 * @param framAddr The address in the FRAM to start at
+	 *
+	 * @param value The byte value to write, for example 0 or 0xff
+	 *
+	 * @param dataLen The number of bytes to set
+	 *
+	 * No source buffer is needed and each transaction is as large as the Wire buffer allows.
+	 */
+	bool fillData(size_t framAddr, uint8_t value, size_t dataLen);
+
+	/**
+	 * @brief Keep a copy of a frequently read region of the FRAM in RAM
+	 *
+	 * @param framAddr The address in the FRAM of the start of the region
+	 *
+	 * @param length The number of bytes to cache
+	 *
+	 * Reads that fall entirely within the region are served from RAM without any I2C traffic. The cache is
+	 * write-through: writeData(), fillData() and moveData() update the FRAM and the cached copy. Call this
+	 * after begin(); the region is read from the FRAM when it is added. Up to MAX_READ_CACHES regions are supported.
+	 *
+	 * Returns false if there are no free cache slots or the memory could not be allocated.
+	 */
+	bool addReadCache(size_t framAddr, size_t length);
+
 	/**
 	 * @brief Read from FRAM using EEPROM-style API
 	 *
@@ -94,12 +133,56 @@ public:
 	 */
 	virtual bool moveData(size_t framAddrFrom, size_t framAddrTo, size_t numBytes);
 
+	/**
+	 * @brief Returns the 7-bit I2C address to use for an access to framAddr
+	 */
+	virtual uint8_t getI2CAddr(size_t framAddr) const;
+
 	static const uint8_t DEVICE_ADDR = 0b1010000;
 
+	static const size_t MAX_READ_CACHES = 2; //!< Number of regions that can be cached with addReadCache()
+
 protected:
+	/**
+	 * @brief Limits a transfer so it can be done in a single I2C transaction
+	 *
+	 * @param framAddr The address in the FRAM the transfer starts at
+	 *
+	 * @param count The number of bytes left to transfer
+	 *
+	 * @param maxCount The most the Wire buffer can hold for this type of transfer
+	 */
+	virtual size_t transferLimit(size_t framAddr, size_t count, size_t maxCount) const;
+
+	/**
+	 * @brief Copies the data from a read cache if the whole range is cached
+	 *
+	 * @return true if the data was read from the cache
+	 */
+	bool readFromCache(size_t framAddr, uint8_t *data, size_t dataLen) const;
+
+	/**
+	 * @brief Updates any cached bytes in a range that was written
+	 *
+	 * @param data The data written, or NULL if the range was filled with value
+	 */
+	void updateCache(size_t framAddr, const uint8_t *data, uint8_t value, size_t dataLen);
+
+	/**
+	 * @brief A region of the FRAM mirrored in RAM
+	 */
+	struct ReadCache {
+		size_t framAddr;	//!< Address of the first cached byte
+		size_t length;		//!< Number of bytes cached
+		uint8_t *data;		//!< Copy of the FRAM contents
+	};
+
 	TwoWire &wire;
 	size_t memorySize;
 	int addr; // This is just 0-7, the (0b1010000 of the 7-bit address is ORed in later)
+	size_t wireBufferSize = 32; // Size of the Wire rx and tx buffers
+	ReadCache readCaches[MAX_READ_CACHES];
+	size_t numReadCaches = 0;
 
 };
 
@@ -158,39 +241,21 @@ public:
 	 */
 	MB85RC1M(TwoWire &wire, int addr = 0) : MB85RC(wire, 131072, addr & 6) {};
 
-    /**
-     * @brief Low-level read call
-     *
-	 * @param framAddr The address in the FRAM to read from
-	 *
-	 * @param data The buffer to read into
-	 *
-	 * @param dataLen The number of bytes to read
-	 *
-	 * The dataLen can be larger than the maximum I2C read. Multiple reads will be done if necessary.
+	/**
+	 * @brief Returns the 7-bit I2C address to use for an access to framAddr
 	 *
-	 * On the MB85RC1M reads across the framAddr 65536 page boundary are special but this call will break the
-	 * read into multiple reads if necessary so you don't have to worry about it.
-     */
-	virtual bool readData(size_t framAddr, uint8_t *data, size_t dataLen);
+	 * On the MB85RC1M the upper 64K is accessed through the next I2C address.
+	 */
+	virtual uint8_t getI2CAddr(size_t framAddr) const;
 
+protected:
 	/**
-     * @brief Low-level write call
-     *
-	 * @param framAddr The address in the FRAM to write to
-	 *
-	 * @param data The buffer containing the data to write
+	 * @brief Limits a transfer so it can be done in a single I2C transaction
 	 *
-	 * @param dataLen The number of bytes to write
-	 *
-	 * The dataLen can be larger than the maximum I2C write. Multiple writes will be done if necessary.
-	 *
-	 * On the MB85RC1M writes across the framAddr 65536 page boundary are special but this call will break the
-	 * read into multiple reads if necessary so you don't have to worry about it.
-     */
-	virtual bool writeData(size_t framAddr, const uint8_t *data, size_t dataLen);
-
-	uint8_t getI2CAddr(size_t framAddr) const;
+	 * On the MB85RC1M reads and writes across the framAddr 65536 page boundary are special, so transfers
+	 * are split there and you don't have to worry about it.
+	 */
+	virtual size_t transferLimit(size_t framAddr, size_t count, size_t maxCount) const;
 };
 
 
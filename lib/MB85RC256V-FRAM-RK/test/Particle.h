@@ -0,0 +1,104 @@
+// Just enough of Device OS to build the MB85RC driver on a host, with TwoWire emulating FRAM chips on an I2C bus
+#ifndef __PARTICLE_H
+#define __PARTICLE_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+class Logger {
+public:
+	void info(const char *fmt, ...) const {}
+};
+extern Logger Log;
+
+#define WITH_LOCK(lockable) for (bool __todo = true; __todo; ) for (std::lock_guard<typename std::remove_reference<decltype(lockable)>::type> __lock((lockable)); __todo; __todo = false)
+
+/**
+ * @brief I2C bus with FRAM chips on it. Each 7-bit address is 64K of memory with a two byte address pointer, as the
+ * MB85RC parts are. Transfers larger than the Wire buffer are cut short, as they are on a device.
+ */
+class TwoWire {
+public:
+	void begin() {}
+	void lock() { mutex.lock(); }
+	void unlock() { mutex.unlock(); }
+
+	void beginTransmission(uint8_t address) {
+		txAddress = address;
+		txBuf.clear();
+	}
+	size_t write(uint8_t value) {
+		if (txBuf.size() >= bufferSize) {
+			return 0;
+		}
+		txBuf.push_back(value);
+		return 1;
+	}
+	size_t write(const uint8_t *data, size_t len) {
+		size_t count = 0;
+		while(count < len && write(data[count])) {
+			count++;
+		}
+		return count;
+	}
+	uint8_t endTransmission(bool stop = true) {
+		transactions++;
+		busBytes += 1 + txBuf.size();
+		if (txBuf.size() < 2) {
+			return 2;			// NACK - the driver always sends the memory address
+		}
+		std::vector<uint8_t> &mem = chip(txAddress);
+		pointer[txAddress] = (txBuf[0] << 8 | txBuf[1]);
+		for(size_t ii = 2; ii < txBuf.size(); ii++) {
+			mem[pointer[txAddress]++ & 0xffff] = txBuf[ii];
+		}
+		return 0;
+	}
+	size_t requestFrom(uint8_t address, size_t len, uint8_t stop) {
+		transactions++;
+		if (len > bufferSize) {
+			len = bufferSize;
+		}
+		busBytes += 1 + len;
+		std::vector<uint8_t> &mem = chip(address);
+		rxBuf.clear();
+		rxPos = 0;
+		for(size_t ii = 0; ii < len; ii++) {
+			rxBuf.push_back(mem[pointer[address]++ & 0xffff]);
+		}
+		return len;
+	}
+	int available() { return (int)(rxBuf.size() - rxPos); }
+	int read() { return (rxPos < rxBuf.size()) ? rxBuf[rxPos++] : -1; }
+
+	std::vector<uint8_t> &chip(uint8_t address) {
+		std::vector<uint8_t> &mem = chips[address];
+		if (mem.empty()) {
+			mem.resize(65536, 0);
+		}
+		return mem;
+	}
+
+	size_t bufferSize = 32;			//!< Wire rx and tx buffer size - 32 unless acquireWireBuffer() enlarges it
+	unsigned long transactions = 0;	//!< Address phases and reads on the bus
+	unsigned long busBytes = 0;		//!< Bytes clocked on the bus, including the device address of each transaction
+
+private:
+	std::recursive_mutex mutex;
+	std::map<uint8_t, std::vector<uint8_t>> chips;
+	std::map<uint8_t, uint16_t> pointer;
+	uint8_t txAddress = 0;
+	std::vector<uint8_t> txBuf;
+	std::vector<uint8_t> rxBuf;
+	size_t rxPos = 0;
+};
+extern TwoWire Wire;
+
+#endif /* __PARTICLE_H */
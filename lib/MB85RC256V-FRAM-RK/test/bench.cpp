@@ -0,0 +1,103 @@
+// I2C traffic to load, save and erase the gateway's node database, against the emulated bus in Particle.h
+#include "Particle.h"
+#include "MB85RC256V-FRAM-RK.h"
+
+Logger Log;
+TwoWire Wire;
+
+static const size_t NODE_DATA_ADDR = 200;		// Where the gateway keeps its node database
+static const size_t NODE_DATA_LEN = 3100;		// sizeof(nodeIDData::NodeData)
+static const double BUS_HZ = 400000;			// Fast mode I2C
+
+static uint8_t written[NODE_DATA_LEN];
+static uint8_t readBack[NODE_DATA_LEN];
+static bool failed = false;
+
+struct Traffic {
+	unsigned long transactions;
+	unsigned long busBytes;
+};
+
+// Runs fn and returns the bus traffic it made
+template<class F>
+static Traffic measure(F fn) {
+	Traffic before = { Wire.transactions, Wire.busBytes };
+	fn();
+	return { Wire.transactions - before.transactions, Wire.busBytes - before.busBytes };
+}
+
+static void report(const char *name, size_t wireBufferSize, const Traffic &traffic) {
+	// 9 clocks a byte with its ack, plus a start and a stop per transaction
+	double busMs = (traffic.busBytes * 9.0 + traffic.transactions * 2.0) * 1000.0 / BUS_HZ;
+	printf("%-24s %6u %12lu %10lu %10.2f\n", name, (unsigned)wireBufferSize, traffic.transactions, traffic.busBytes, busMs);
+}
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		printf("FAILED: %s\n", what);
+		failed = true;
+	}
+}
+
+static bool filledWith(size_t framAddr, uint8_t value, size_t len) {
+	const std::vector<uint8_t> &mem = Wire.chip(0x50);
+	for(size_t ii = 0; ii < len; ii++) {
+		if (mem[framAddr + ii] != value) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int main() {
+	for(size_t ii = 0; ii < sizeof(written); ii++) {
+		written[ii] = (uint8_t)(ii * 7 + 3);
+	}
+
+	printf("Node database of %u bytes on an MB85RC64\n\n", (unsigned)NODE_DATA_LEN);
+	printf("%-24s %6s %12s %10s %10s\n", "", "buffer", "transactions", "bus bytes", "bus ms");
+
+	static const size_t bufferSizes[] = { 32, 128 };
+	for(size_t wireBufferSize : bufferSizes) {
+		MB85RC64 fram(Wire, 0);
+		Wire.bufferSize = wireBufferSize;
+		fram.withWireBufferSize(wireBufferSize).begin();
+
+		report("writeData", wireBufferSize, measure([&]() { check(fram.writeData(NODE_DATA_ADDR, written, sizeof(written)), "writeData"); }));
+		memset(readBack, 0, sizeof(readBack));
+		report("readData", wireBufferSize, measure([&]() { check(fram.readData(NODE_DATA_ADDR, readBack, sizeof(readBack)), "readData"); }));
+		check(memcmp(written, readBack, sizeof(written)) == 0, "read back what was written");
+		report("fillData", wireBufferSize, measure([&]() { check(fram.fillData(NODE_DATA_ADDR, 0xff, NODE_DATA_LEN), "fillData"); }));
+		check(filledWith(NODE_DATA_ADDR, 0xff, NODE_DATA_LEN), "filled with 0xff");
+	}
+
+	// The erase loop nodeIDData::initialize() used before fillData(): two bytes per transaction, one address at a time
+	{
+		MB85RC64 fram(Wire, 0);
+		Wire.bufferSize = 32;
+		fram.begin();
+		static const uint8_t ff[2] = { 0xff, 0xff };
+		report("erase byte by byte", 32, measure([&]() {
+			for(size_t ii = 0; ii < NODE_DATA_LEN; ii++) {
+				fram.writeData(NODE_DATA_ADDR + ii, ff, 2);
+			}
+		}));
+	}
+
+	// A read cache over the database makes loads free and keeps itself in step with writes and fills
+	{
+		MB85RC64 fram(Wire, 0);
+		Wire.bufferSize = 128;
+		fram.withWireBufferSize(128).begin();
+		check(fram.addReadCache(NODE_DATA_ADDR, NODE_DATA_LEN), "addReadCache");
+		fram.writeData(NODE_DATA_ADDR, written, sizeof(written));
+		memset(readBack, 0, sizeof(readBack));
+		report("readData, cached", 128, measure([&]() { check(fram.readData(NODE_DATA_ADDR, readBack, sizeof(readBack)), "cached readData"); }));
+		check(memcmp(written, readBack, sizeof(written)) == 0, "cache follows writes");
+		fram.fillData(NODE_DATA_ADDR + 100, 0, 50);
+		fram.readData(NODE_DATA_ADDR + 100, readBack, 50);
+		check(readBack[0] == 0 && readBack[49] == 0, "cache follows fills");
+	}
+
+	return failed ? 1 : 0;
+}
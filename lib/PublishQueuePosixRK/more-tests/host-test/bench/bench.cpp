@@ -0,0 +1,115 @@
+// Publish path benchmarks: an outage and recovery scripted against the fake cloud, one forked process per case
+#include "harness.h"
+#include <sys/wait.h>
+
+struct BenchCase {
+    const char *name;
+    const char *queue;              //!< "legacy" one file per event, "seg" segment files, "spill" FRAM spill then segments
+    size_t window;                  //!< withMaxInFlight()
+    int events;                     //!< events published during the outage
+    unsigned long latencyMs;        //!< fake cloud round trip
+    int failEvery;                  //!< fake cloud fails every Nth publish
+    double ratePerSec;              //!< fake cloud rate limit (0 = none)
+};
+
+static const BenchCase cases[] = {
+    { "short outage",       "legacy", 1,  20,  300, 0,  0 },
+    { "short outage",       "seg",    1,  20,  300, 0,  0 },
+    { "short outage",       "spill",  1,  20,  300, 0,  0 },
+    { "long outage",        "legacy", 1, 200,  300, 0,  0 },
+    { "long outage",        "seg",    1, 200,  300, 0,  0 },
+    { "long outage",        "spill",  1, 200,  300, 0,  0 },
+    { "long outage",        "seg",    4, 200,  300, 0,  0 },
+    { "slow cloud",         "seg",    1, 200, 2000, 0,  0 },
+    { "slow cloud",         "seg",    4, 200, 2000, 0,  0 },
+    { "flaky cloud",        "seg",    4, 200,  300, 5,  0 },
+    { "rate limited",       "seg",    4, 200,  300, 0,  1 },
+};
+
+static uint8_t fram[768];
+
+static bool framRead(size_t offset, uint8_t *buf, size_t len) {
+    if (offset + len > sizeof(fram)) {
+        return false;
+    }
+    memcpy(buf, &fram[offset], len);
+    return true;
+}
+
+static bool framWrite(size_t offset, const uint8_t *buf, size_t len) {
+    if (offset + len > sizeof(fram)) {
+        return false;
+    }
+    memcpy(&fram[offset], buf, len);
+    return true;
+}
+
+static void runCase(const BenchCase &bc) {
+    std::string dir = hostFsReset("bench");
+    fakeCloud.latencyMs = bc.latencyMs;
+    fakeCloud.failEvery = bc.failEvery;
+    fakeCloud.ratePerSec = bc.ratePerSec;
+
+    PublishQueuePosix &pq = PublishQueuePosix::instance();
+    pq.withDirPath((dir + "/pubqueue").c_str()).withRamQueueSize(0).withFileQueueSize(1000).withMaxInFlight(bc.window);
+    if (strcmp(bc.queue, "legacy") != 0) {
+        pq.withSegmentSize(4096);
+    }
+    if (strcmp(bc.queue, "spill") == 0) {
+        memset(fram, 0xff, sizeof(fram));
+        pq.withSpillStorage(sizeof(fram), framRead, framWrite);
+    }
+    pq.setup();
+    loopFor(100);
+
+    // The outage starts now and ends after the last event, one event every 100 ms while it lasts
+    unsigned long outageMs = bc.events * 100;
+    hostSetConnected(false);
+    hostAt(millis() + outageMs, []() { hostSetConnected(true); });
+
+    FsCounters before = fsCounters;
+    unsigned long long cpuUs = 0;
+    for (int ii = 0; ii < bc.events; ii++) {
+        char data[128];
+        snprintf(data, sizeof(data), "{\"space\":%d,\"spaceNet\":%d,\"spaceGross\":%d,\"battery\":87,\"temp\":21}", ii % 8, ii, ii * 2);
+        unsigned long long start = hostMicros();
+        pq.publish("Ubidots-LoRA-Occupancy-v2", data, PRIVATE | WITH_ACK);
+        cpuUs += hostMicros() - start;
+        loopFor(100);
+    }
+    FsCounters afterWrite = fsCounters;
+
+    unsigned long drainMs = drain(3600000);
+    FsCounters afterDrain = fsCounters;
+    bool ok = pq.getNumEvents() == 0 && fakeCloud.received.size() >= (size_t)bc.events;
+
+    printf("%-13s %-6s %6u %6d %7lu %8.1f %8.2f %8.2f %9lu %9lu %8lu %6lu %s\n", bc.name, bc.queue, (unsigned)bc.window, bc.events, bc.latencyMs,
+        (double)cpuUs / bc.events,
+        (double)(afterWrite.total() - before.total()) / bc.events,
+        (double)(afterDrain.total() - afterWrite.total()) / bc.events,
+        afterDrain.bytesWritten - before.bytesWritten,
+        drainMs, fakeCloud.attempts, fakeCloud.failed, ok ? "" : "INCOMPLETE");
+    fflush(stdout);
+    _exit(ok ? 0 : 1);
+}
+
+int main(int argc, char **argv) {
+    printf("%-13s %-6s %6s %6s %7s %8s %8s %8s %9s %9s %8s %6s\n", "case", "queue", "window", "events", "latency",
+        "us/pub", "ops/ev w", "ops/ev d", "bytes wr", "drain ms", "publish", "failed");
+    fflush(stdout);
+
+    // Each case runs in its own process so it gets a fresh queue singleton and virtual clock
+    int failed = 0;
+    for (const BenchCase &bc : cases) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            runCase(bc);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed++;
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Runs each host test scenario and reports the number that failed
+BUILD=${1:-build}
+
+pass=0
+fail=0
+run() {
+    if "$BUILD/$@"; then
+        pass=$((pass + 1))
+    else
+        echo "FAILED: $*"
+        fail=$((fail + 1))
+    fi
+}
+
+run queue_test legacy
+run queue_test seg
+run queue_test legacybatch
+run queue_test segbatch
+run queue_test seg 400
+run queue_test segfull
+run online_test 0
+run online_test 1
+run lanes_test strict
+run lanes_test weighted
+run keyed_test ram
+run keyed_test seg
+run keyed_test segsmall
+run keyed_test reboot
+run keyed_test collision
+run keyed_test ramcollision
+run pipeline_test seg 1
+run pipeline_test seg 4
+run pipeline_test ram 4
+run pipeline_test batch 4
+run pipeline_test fail 4
+run pipeline_test ramfail 4
+run pipeline_test flap 4
+run spill_test
+run seqindex_test
+
+echo "$pass passed, $fail failed"
+[ "$fail" -eq 0 ]
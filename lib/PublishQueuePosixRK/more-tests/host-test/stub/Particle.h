@@ -0,0 +1,137 @@
+// Host stand-in for the parts of Device OS used by PublishQueuePosixRK, SequentialFileRK and BackgroundPublishRK.
+// Only what the libraries use is here, and millis() is a virtual clock advanced by the test with hostTick().
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <type_traits>
+
+class String : public std::string {
+public:
+    String() {}
+    String(const char *s) : std::string(s ? s : "") {}
+    String(const std::string &s) : std::string(s) {}
+    String(int v) : std::string(std::to_string(v)) {}
+    const char *c_str() const { return std::string::c_str(); }
+    operator const char *() const { return c_str(); }
+    bool endsWith(const char *s) const { size_t n = strlen(s); return size() >= n && compare(size() - n, n, s) == 0; }
+    String substring(size_t from, size_t to) const { return String(std::string::substr(from, to - from)); }
+    String substring(size_t from) const { return String(std::string::substr(from)); }
+    unsigned length() const { return (unsigned)size(); }
+    void reserve(size_t n) { std::string::reserve(n); }
+    static String format(const char *fmt, ...) { char buf[512]; va_list ap; va_start(ap, fmt); vsnprintf(buf, sizeof(buf), fmt, ap); va_end(ap); return String(buf); }
+};
+inline String operator+(const String &a, const String &b) { return String(static_cast<const std::string &>(a) + static_cast<const std::string &>(b)); }
+inline String operator+(const String &a, const char *b) { return String(static_cast<const std::string &>(a) + b); }
+
+extern int hostLogLevel;                                    // 0 = errors, 1 = info, 2 = trace
+class Logger {
+public:
+    Logger(const char *name = "app") : name(name) {}
+    void trace(const char *fmt, ...) const { va_list ap; va_start(ap, fmt); out(2, fmt, ap); va_end(ap); }
+    void info(const char *fmt, ...) const { va_list ap; va_start(ap, fmt); out(1, fmt, ap); va_end(ap); }
+    void warn(const char *fmt, ...) const { va_list ap; va_start(ap, fmt); out(1, fmt, ap); va_end(ap); }
+    void error(const char *fmt, ...) const { va_list ap; va_start(ap, fmt); out(0, fmt, ap); va_end(ap); }
+    void dump(const void *, size_t) const {}
+    void print(const char *) const {}
+private:
+    void out(int level, const char *fmt, va_list ap) const {
+        if (level > hostLogLevel) return;
+        printf("[%s] ", name); vprintf(fmt, ap); printf("\n");
+    }
+    const char *name;
+};
+extern Logger Log;
+
+// Virtual clock - advanced by the harness
+unsigned long millis();
+void delay(unsigned long ms);
+unsigned long micros();     // Real time, for measuring work
+class TimeClass {
+public:
+    bool isValid() const { return valid; }
+    time_t now() const { return 1700000000 + millis() / 1000; }
+    bool valid = true;
+};
+extern TimeClass Time;
+
+typedef std::mutex *os_mutex_t;
+typedef std::recursive_mutex *os_mutex_recursive_t;
+inline int os_mutex_create(os_mutex_t *m) { *m = new std::mutex(); return 0; }
+inline int os_mutex_lock(os_mutex_t m) { m->lock(); return 0; }
+inline int os_mutex_unlock(os_mutex_t m) { m->unlock(); return 0; }
+inline int os_mutex_recursive_create(os_mutex_recursive_t *m) { *m = new std::recursive_mutex(); return 0; }
+inline int os_mutex_recursive_lock(os_mutex_recursive_t m) { m->lock(); return 0; }
+inline bool os_mutex_recursive_trylock(os_mutex_recursive_t m) { return m->try_lock(); }
+inline int os_mutex_recursive_unlock(os_mutex_recursive_t m) { m->unlock(); return 0; }
+
+#define WITH_LOCK(lockable) for (bool __todo = true; __todo; ) for (std::lock_guard<typename std::remove_reference<decltype(lockable)>::type> __lock((lockable)); __todo; __todo = false)
+
+namespace spark { namespace feature { enum State { DISABLED, ENABLED }; } }
+inline spark::feature::State system_thread_get_state(void *) { return spark::feature::ENABLED; }
+
+typedef uint64_t system_event_t;
+const system_event_t reset = 1 << 0;
+const system_event_t cloud_status = 1 << 1;
+enum { cloud_status_disconnected = 0, cloud_status_connecting = 1, cloud_status_connected = 8, cloud_status_disconnecting = 9 };
+typedef void (*system_event_handler_t)(system_event_t event, int param);
+class SystemClass {
+public:
+    bool on(system_event_t events, system_event_handler_t handler) { this->handler = handler; return true; }
+    void fire(system_event_t event, int param) { if (handler) handler(event, param); }
+    system_event_handler_t handler = nullptr;
+};
+extern SystemClass System;
+
+class PublishFlags {
+public:
+    PublishFlags() : v(0) {}
+    explicit constexpr PublishFlags(uint8_t v) : v(v) {}
+    PublishFlags operator|(PublishFlags o) const { return PublishFlags((uint8_t)(v | o.v)); }
+    uint8_t value() const { return v; }
+    static PublishFlags fromUnderlying(uint8_t v) { return PublishFlags(v); }
+private:
+    uint8_t v;
+};
+const PublishFlags PUBLIC(0), PRIVATE(1), NO_ACK(2), WITH_ACK(8);
+
+namespace particle { namespace protocol {
+    const size_t MAX_EVENT_NAME_LENGTH = 64;
+    const size_t MAX_EVENT_DATA_LENGTH = 622;
+} }
+
+// Completion of a simulated cloud publish
+class PublishFuture {
+public:
+    PublishFuture(int id = -1) : id(id) {}
+    bool isDone() const;
+    bool isSucceeded() const;
+    int id;
+};
+
+namespace particle { template<typename T> using Future = PublishFuture; }
+
+class CloudClass {
+public:
+    bool connected();
+    PublishFuture publish(const char *name, const char *data, PublishFlags flags);
+};
+extern CloudClass Particle;
+
+#define OS_THREAD_PRIORITY_DEFAULT 2
+class Thread {
+public:
+    Thread(const char *name, std::function<void()> fn, int priority = OS_THREAD_PRIORITY_DEFAULT);
+    void dispose() {}
+};
@@ -0,0 +1,226 @@
+// Host runtime: virtual clock, lockstep worker thread and a scriptable fake cloud
+#include "Particle.h"
+#include "host.h"
+#include <condition_variable>
+#include <vector>
+#include <deque>
+#include <map>
+
+#ifndef HOST_FS_DIR
+#define HOST_FS_DIR "/tmp/pqhost-fs"
+#endif
+
+int hostLogLevel = getenv("LOGLEVEL") ? atoi(getenv("LOGLEVEL")) : 0;
+Logger Log("app");
+SystemClass System;
+CloudClass Particle;
+
+static std::mutex clockMutex;
+static std::condition_variable clockCv;
+static unsigned long nowMs = 0;
+static bool workerStarted = false;
+static bool workerParked = false;
+static unsigned long workerTarget = 0;
+static std::thread::id mainThread = std::this_thread::get_id();
+
+static std::multimap<unsigned long, std::function<void()>> timeline;
+
+TimeClass Time;
+
+unsigned long long hostMicros() {
+    return (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+unsigned long micros() {
+    return (unsigned long)hostMicros();
+}
+
+unsigned long millis() {
+    std::lock_guard<std::mutex> lock(clockMutex);
+    return nowMs;
+}
+
+void hostTick(unsigned long ms) {
+    for (unsigned long ii = 0; ii < ms; ii++) {
+        unsigned long now;
+        {
+            std::unique_lock<std::mutex> lock(clockMutex);
+            now = ++nowMs;
+            clockCv.notify_all();
+            if (workerStarted) {
+                // Wait for the worker to run up to its next delay()
+                clockCv.wait(lock, [] { return workerParked && workerTarget > nowMs; });
+            }
+        }
+        while (!timeline.empty() && timeline.begin()->first <= now) {
+            std::function<void()> fn = timeline.begin()->second;
+            timeline.erase(timeline.begin());
+            fn();
+        }
+    }
+}
+
+void hostAt(unsigned long atMs, std::function<void()> fn) {
+    timeline.insert(std::make_pair(atMs, fn));
+}
+
+void hostSetConnected(bool connected) {
+    if (connected == fakeCloud.connected) {
+        return;
+    }
+    if (connected) {
+        fakeCloud.connected = true;
+        System.fire(cloud_status, cloud_status_connected);
+    }
+    else {
+        System.fire(cloud_status, cloud_status_disconnecting);
+        fakeCloud.connected = false;
+        System.fire(cloud_status, cloud_status_disconnected);
+    }
+}
+
+std::string hostFsReset(const char *name) {
+    std::string path = std::string(HOST_FS_DIR) + "/" + name;
+    std::string cmd = "rm -rf '" + path + "' && mkdir -p '" + path + "'";
+    if (system(cmd.c_str()) != 0) {
+        fprintf(stderr, "could not create %s\n", path.c_str());
+        exit(1);
+    }
+    return path;
+}
+
+void delay(unsigned long ms) {
+    if (std::this_thread::get_id() == mainThread) {
+        hostTick(ms);
+        return;
+    }
+    std::unique_lock<std::mutex> lock(clockMutex);
+    workerTarget = nowMs + (ms ? ms : 1);
+    workerParked = true;
+    clockCv.notify_all();
+    clockCv.wait(lock, [] { return nowMs >= workerTarget; });
+    workerParked = false;
+}
+
+Thread::Thread(const char *name, std::function<void()> fn, int priority) {
+    {
+        std::lock_guard<std::mutex> lock(clockMutex);
+        workerStarted = true;
+    }
+    std::thread t(fn);
+    t.detach();
+    // Let it reach its first delay()
+    std::unique_lock<std::mutex> lock(clockMutex);
+    clockCv.wait(lock, [] { return workerParked; });
+}
+
+// ---------------------------------------------------------------- fake cloud
+FakeCloud fakeCloud;
+
+struct PendingPublish {
+    unsigned long doneAt;
+    bool succeeded;
+};
+static std::mutex cloudMutex;
+static std::vector<PendingPublish> pending;
+
+bool CloudClass::connected() {
+    return fakeCloud.connected;
+}
+
+PublishFuture CloudClass::publish(const char *name, const char *data, PublishFlags flags) {
+    std::lock_guard<std::mutex> lock(cloudMutex);
+    unsigned long now = millis();
+    bool ok = fakeCloud.connected;
+
+    // Particle rate limit - a token bucket of fakeCloud.burst events refilled at fakeCloud.ratePerSec
+    if (fakeCloud.ratePerSec > 0) {
+        fakeCloud.tokens += (now - fakeCloud.lastRefill) * fakeCloud.ratePerSec / 1000.0;
+        if (fakeCloud.tokens > fakeCloud.burst) fakeCloud.tokens = fakeCloud.burst;
+        fakeCloud.lastRefill = now;
+        if (fakeCloud.tokens < 1.0) {
+            ok = false;
+            fakeCloud.rateLimited++;
+        }
+        else fakeCloud.tokens -= 1.0;
+    }
+    if (ok && fakeCloud.failNext > 0) {
+        fakeCloud.failNext--;
+        ok = false;
+    }
+    if (ok && fakeCloud.failEvery > 0 && ((fakeCloud.attempts + 1) % fakeCloud.failEvery) == 0) {
+        ok = false;
+    }
+    fakeCloud.attempts++;
+    fakeCloud.inFlight = 1;
+    for (const PendingPublish &p : pending) if (p.doneAt > now) fakeCloud.inFlight++;
+    if (fakeCloud.inFlight > fakeCloud.maxInFlight) fakeCloud.maxInFlight = fakeCloud.inFlight;
+    if (ok) {
+        fakeCloud.received.push_back(std::string(name) + "=" + (data ? data : ""));
+        fakeCloud.bytes += strlen(name) + (data ? strlen(data) : 0);
+    }
+    else fakeCloud.failed++;
+
+    pending.push_back({now + fakeCloud.latencyMs, ok});
+    return PublishFuture((int)pending.size() - 1);
+}
+
+bool PublishFuture::isDone() const {
+    std::lock_guard<std::mutex> lock(cloudMutex);
+    bool done = millis() >= pending[id].doneAt;
+    return done;
+}
+
+bool PublishFuture::isSucceeded() const {
+    std::lock_guard<std::mutex> lock(cloudMutex);
+    if (millis() >= pending[id].doneAt && pending[id].succeeded) {
+        return true;
+    }
+    return false;
+}
+
+
+// ---------------------------------------------------------------- file system operation counters
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+FsCounters fsCounters;
+long hostFsSpace = -1;
+
+extern "C" {
+int __real_open(const char *path, int flags, ...);
+int __wrap_open(const char *path, int flags, ...) { fsCounters.open++; return __real_open(path, flags, 0644); }
+int __real_close(int fd);
+int __wrap_close(int fd) { fsCounters.close++; return __real_close(fd); }
+ssize_t __real_read(int fd, void *buf, size_t n);
+ssize_t __wrap_read(int fd, void *buf, size_t n) { fsCounters.read++; return __real_read(fd, buf, n); }
+ssize_t __real_write(int fd, const void *buf, size_t n);
+ssize_t __wrap_write(int fd, const void *buf, size_t n) {
+    fsCounters.write++;
+    if (hostFsSpace >= 0) {
+        // A full file system writes what fits, then fails
+        if ((long)n > hostFsSpace) n = (size_t)hostFsSpace;
+        if (n == 0) { errno = ENOSPC; return -1; }
+        hostFsSpace -= (long)n;
+    }
+    fsCounters.bytesWritten += n;
+    return __real_write(fd, buf, n);
+}
+off_t __real_lseek(int fd, off_t off, int whence);
+off_t __wrap_lseek(int fd, off_t off, int whence) { fsCounters.lseek++; return __real_lseek(fd, off, whence); }
+int __real_unlink(const char *path);
+int __wrap_unlink(const char *path) { fsCounters.unlink++; return __real_unlink(path); }
+DIR *__real_opendir(const char *path);
+DIR *__wrap_opendir(const char *path) { fsCounters.opendir++; return __real_opendir(path); }
+struct dirent *__real_readdir(DIR *dir);
+struct dirent *__wrap_readdir(DIR *dir) { fsCounters.readdir++; return __real_readdir(dir); }
+int __real_fstat(int fd, struct stat *sb);
+int __wrap_fstat(int fd, struct stat *sb) { fsCounters.stat++; return __real_fstat(fd, sb); }
+int __real_stat(const char *path, struct stat *sb);
+int __wrap_stat(const char *path, struct stat *sb) { fsCounters.stat++; return __real_stat(path, sb); }
+}
+
+unsigned long FsCounters::total() const {
+    return open + close + read + write + lseek + unlink + opendir + readdir + stat;
+}
@@ -0,0 +1,76 @@
+// Host runtime: virtual clock, scripted timeline, fake cloud and file system counters
+#pragma once
+#include <vector>
+#include <string>
+#include <functional>
+#include <stdint.h>
+
+/**
+ * @brief Advance the virtual clock by ms, letting the background publish thread run in lockstep
+ * 
+ * Actions scheduled with hostAt() run on the calling thread as their time is reached.
+ */
+void hostTick(unsigned long ms);
+
+/**
+ * @brief Run fn when the virtual clock reaches atMs, for scripting outages and recoveries
+ */
+void hostAt(unsigned long atMs, std::function<void()> fn);
+
+/**
+ * @brief Connect or disconnect the fake cloud, firing the cloud_status system events as Device OS does
+ */
+void hostSetConnected(bool connected);
+
+/**
+ * @brief Remove and create the directory HOST_FS_DIR/name, returning its path
+ */
+std::string hostFsReset(const char *name);
+
+/**
+ * @brief Real time in microseconds, for measuring CPU time of the code under test
+ */
+unsigned long long hostMicros();
+
+/**
+ * @brief Log level for the library Loggers: 0 errors, 1 info, 2 trace. Set from the LOGLEVEL environment variable.
+ */
+extern int hostLogLevel;
+
+/**
+ * @brief Fake cloud endpoint. Set the fields from the test to script latency, failures and rate limits.
+ */
+struct FakeCloud {
+    bool connected = true;
+    unsigned long latencyMs = 300;      //!< publish round trip
+    int failNext = 0;                   //!< fail this many publishes
+    int failEvery = 0;                  //!< fail every Nth publish (0 = never)
+    double ratePerSec = 0;              //!< cloud rate limit, a token bucket (0 = none)
+    double burst = 4;                   //!< bucket size of the rate limit
+    double tokens = 4;
+    unsigned long lastRefill = 0;
+
+    unsigned long attempts = 0;         //!< publishes started
+    unsigned long failed = 0;           //!< publishes that failed, including rate limited
+    unsigned long rateLimited = 0;      //!< publishes refused by the rate limit
+    unsigned long bytes = 0;            //!< name and data bytes of the publishes that succeeded
+    int inFlight = 0;
+    int maxInFlight = 0;                //!< most publishes in flight at once
+    std::vector<std::string> received;  //!< "name=data" of each publish that succeeded, in order
+};
+extern FakeCloud fakeCloud;
+
+/**
+ * @brief Calls the libraries made to the file system, counted with the linker --wrap option
+ */
+struct FsCounters {
+    unsigned long open = 0, close = 0, read = 0, write = 0, lseek = 0, unlink = 0, opendir = 0, readdir = 0, stat = 0;
+    unsigned long bytesWritten = 0;
+    unsigned long total() const;
+};
+extern FsCounters fsCounters;
+
+/**
+ * @brief Bytes the file system can still take, -1 for no limit. A write that doesn't fit is short, then fails with ENOSPC.
+ */
+extern long hostFsSpace;
@@ -0,0 +1 @@
+// Included by BackgroundPublishRK.h; the limits it needs are in Particle.h
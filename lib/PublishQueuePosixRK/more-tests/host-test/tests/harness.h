@@ -0,0 +1,48 @@
+// Helpers shared by the host tests and benchmarks
+#pragma once
+#include "Particle.h"
+#include "host.h"
+#include "PublishQueuePosixRK.h"
+
+/**
+ * @brief Run PublishQueuePosix::loop() once per virtual millisecond for ms
+ */
+inline void loopFor(unsigned long ms) {
+    for (unsigned long ii = 0; ii < ms; ii++) {
+        PublishQueuePosix::instance().loop();
+        hostTick(1);
+    }
+}
+
+/**
+ * @brief Run the queue until it's empty and can sleep, or limitMs passes. Returns the time it took.
+ */
+inline unsigned long drain(unsigned long limitMs) {
+    PublishQueuePosix &pq = PublishQueuePosix::instance();
+    unsigned long start = millis();
+    while (millis() - start < limitMs) {
+        pq.loop();
+        hostTick(1);
+        if (pq.getNumEvents() == 0 && pq.getCanSleep()) {
+            break;
+        }
+    }
+    return millis() - start;
+}
+
+static bool harnessFailed = false;
+
+/**
+ * @brief Check a condition, printing what failed and continuing
+ */
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); harnessFailed = true; } } while (0)
+
+/**
+ * @brief Print the result and exit, without running destructors as the publish thread is still running
+ */
+inline void finish(const char *name, bool ok) {
+    ok = ok && !harnessFailed;
+    printf("%s: %s\n", name, ok ? "PASS" : "FAIL");
+    fflush(stdout);
+    _exit(ok ? 0 : 1);
+}
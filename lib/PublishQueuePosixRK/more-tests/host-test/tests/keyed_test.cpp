@@ -0,0 +1,119 @@
+// Keyed events: only the latest event per space is sent, in the RAM queue, segments, and after a restart, and
+// events whose different keys have the same hash are all sent
+#include "Particle.h"
+#include "host.h"
+#define protected public
+#include "PublishQueuePosixRK.h"
+#undef protected
+#include "harness.h"
+#include <map>
+
+int main(int argc, char **argv) {
+    const char *mode = argc > 1 ? argv[1] : "seg";
+    int events = argc > 2 ? atoi(argv[2]) : 200;
+    std::string dir = hostFsReset("keyed_test");
+
+    bool ram = strcmp(mode, "ram") == 0 || strcmp(mode, "ramcollision") == 0;
+    PublishQueuePosix &pq = PublishQueuePosix::instance();
+    pq.withDirPath((dir + "/pubqueue").c_str()).withRamQueueSize(ram ? 50 : 0).withFileQueueSize(500).withKeyedEvents(16);
+    if (!ram) {
+        pq.withSegmentSize(strcmp(mode, "segsmall") == 0 ? 512 : 4096);
+    }
+    pq.setup();
+    loopFor(10);
+
+    fakeCloud.connected = ram;
+    if (ram) {
+        pq.setPausePublishing(true);
+    }
+    if (strstr(mode, "collision")) {
+        // Found by search: the keyHash() of each pair is the same, in one lane and across two lanes
+        struct { PublishQueuePriority priority; const char *key; } keys[] = {
+            { PublishQueuePriority::TELEMETRY, "k539848" }, { PublishQueuePriority::TELEMETRY, "k1885106" },
+            { PublishQueuePriority::CRITICAL, "k452380" }, { PublishQueuePriority::TELEMETRY, "k14457" }
+        };
+        CHECK(PublishQueuePosix::keyHash(keys[0].priority, "Ubidots-LoRA-Occupancy-v2", keys[0].key) ==
+            PublishQueuePosix::keyHash(keys[1].priority, "Ubidots-LoRA-Occupancy-v2", keys[1].key));
+        CHECK(PublishQueuePosix::keyHash(keys[2].priority, "Ubidots-LoRA-Occupancy-v2", keys[2].key) ==
+            PublishQueuePosix::keyHash(keys[3].priority, "Ubidots-LoRA-Occupancy-v2", keys[3].key));
+        std::map<std::string, int> expected;
+        for (auto &k : keys) {
+            pq.publishKeyed(k.priority, k.key, "Ubidots-LoRA-Occupancy-v2", k.key, PRIVATE | WITH_ACK);
+            expected[std::string("Ubidots-LoRA-Occupancy-v2=") + k.key] = 1;
+            loopFor(5);
+        }
+        if (ram) {
+            pq.setPausePublishing(false);
+        }
+        hostSetConnected(true);
+        drain(600000);
+        std::map<std::string, int> got;
+        for (auto &r : fakeCloud.received) {
+            got[r]++;
+        }
+        for (auto &r : got) {
+            printf("%s: received %s x%d\n", mode, r.first.c_str(), r.second);
+        }
+        finish(mode, got == expected && pq.getNumEvents() == 0);
+    }
+
+    std::map<int, std::string> latest;
+    size_t statuses = 0;
+    for (int ii = 0; ii < events; ii++) {
+        char data[128], key[8];
+        int space = ii % 8;
+        snprintf(data, sizeof(data), "{\"space\":%d,\"spaceNet\":%d,\"spaceGross\":%d,\"battery\":87}", space, ii, ii * 2);
+        snprintf(key, sizeof(key), "%d", space);
+        pq.publishKeyed(key, "Ubidots-LoRA-Occupancy-v2", data, PRIVATE | WITH_ACK);
+        latest[space] = std::string("Ubidots-LoRA-Occupancy-v2=") + data;
+        if (ii % 50 == 25) {
+            pq.publish("status", "unkeyed", PRIVATE);
+            statuses++;
+        }
+        loopFor(5);
+    }
+    printf("%s: published %d, numEvents=%u, keys %u\n", mode, events, (unsigned)pq.getNumEvents(), (unsigned)pq.keyIndex.size());
+
+    if (strcmp(mode, "reboot") == 0) {
+        // Like a restart: forget the index and the head segment, then count the files again
+        PublishQueuePosix::Lane &lane = pq.getLane(PublishQueuePriority::TELEMETRY);
+        pq.keyIndex.clear();
+        pq.closeSegment(lane.headSegment);
+        lane.headSegment = PublishQueuePosix::SegmentState();
+        lane.tailSegment = PublishQueuePosix::SegmentState();
+        pq.countFileQueueEvents(lane);
+        for (int ii = 0; ii < 8; ii++) {
+            char data[128], key[8];
+            snprintf(data, sizeof(data), "{\"space\":%d,\"after\":1}", ii);
+            snprintf(key, sizeof(key), "%d", ii);
+            pq.publishKeyed(key, "Ubidots-LoRA-Occupancy-v2", data, PRIVATE | WITH_ACK);
+            latest[ii] = std::string("Ubidots-LoRA-Occupancy-v2=") + data;
+        }
+        printf("%s: after restart and republish numEvents=%u\n", mode, (unsigned)pq.getNumEvents());
+    }
+
+    if (ram) {
+        pq.setPausePublishing(false);
+    }
+    hostSetConnected(true);
+    unsigned long drainMs = drain(600000);
+    printf("%s: drained in %lu ms, cloud got %zu, numEvents=%u\n", mode, drainMs, fakeCloud.received.size(), (unsigned)pq.getNumEvents());
+
+    // Every unkeyed event and exactly the latest event of each space
+    bool ok = true;
+    std::map<int, int> seen;
+    size_t statusCount = 0;
+    for (auto &r : fakeCloud.received) {
+        if (r == "status=unkeyed") {
+            statusCount++;
+            continue;
+        }
+        int space = -1;
+        sscanf(r.c_str(), "Ubidots-LoRA-Occupancy-v2={\"space\":%d", &space);
+        if (space < 0 || seen[space]++ || latest[space] != r) {
+            printf("unexpected %s\n", r.c_str());
+            ok = false;
+        }
+    }
+    finish(mode, ok && seen.size() == 8 && statusCount == statuses && pq.getNumEvents() == 0);
+}
@@ -0,0 +1,59 @@
+// Priority lanes: critical jumps the backlog, strict or weighted drain, drop newest in a full lane
+#include "harness.h"
+
+int main(int argc, char **argv) {
+    const char *mode = argc > 1 ? argv[1] : "strict";
+    std::string dir = hostFsReset("lanes_test");
+
+    PublishQueuePosix &pq = PublishQueuePosix::instance();
+    pq.withDirPath((dir + "/pubqueue").c_str()).withRamQueueSize(0).withSegmentSize(4096)
+      .withLaneDropPolicy(PublishQueuePriority::DIAGNOSTICS, PublishQueuePosix::DropPolicy::DROP_NEWEST)
+      .withLaneLimits(PublishQueuePriority::DIAGNOSTICS, 0, 5);
+    bool weighted = strcmp(mode, "weighted") == 0;
+    if (weighted) {
+        pq.withDrainPolicy(PublishQueuePosix::DrainPolicy::WEIGHTED);
+    }
+    pq.setup();
+    loopFor(10);
+
+    fakeCloud.connected = false;
+    int refused = 0;
+    for (int ii = 0; ii < 20; ii++) {
+        char data[32];
+        snprintf(data, sizeof(data), "t%d", ii);
+        pq.publish("telemetry", data, PRIVATE);
+        snprintf(data, sizeof(data), "d%d", ii);
+        if (!pq.publish(PublishQueuePriority::DIAGNOSTICS, "diag", data, PRIVATE)) {
+            refused++;
+        }
+        loopFor(5);
+    }
+    pq.publish(PublishQueuePriority::CRITICAL, "Alert", "database corrupted", PRIVATE);
+    printf("queued: total %u critical %u telemetry %u diagnostics %u, refused %d\n", (unsigned)pq.getNumEvents(),
+        (unsigned)pq.getNumEvents(PublishQueuePriority::CRITICAL), (unsigned)pq.getNumEvents(PublishQueuePriority::TELEMETRY),
+        (unsigned)pq.getNumEvents(PublishQueuePriority::DIAGNOSTICS), refused);
+
+    hostSetConnected(true);
+    drain(120000);
+
+    std::vector<std::string> order;
+    std::string line;
+    for (auto &r : fakeCloud.received) {
+        order.push_back(r.substr(r.find('=') + 1));
+        line += order.back() + " ";
+    }
+    printf("%s\n", line.c_str());
+
+    // The alert first, then the lanes by policy: strict sends all telemetry first, weighted 4 to 1
+    auto position = [&order](const char *value) {
+        for (size_t ii = 0; ii < order.size(); ii++) {
+            if (order[ii] == value) {
+                return (int)ii;
+            }
+        }
+        return -1;
+    };
+    bool ok = order.size() == 26 && order[0] == "database corrupted" && refused == 15 && position("d4") >= 0;
+    ok = ok && (weighted ? (position("d0") == 5 && position("t19") > position("d3")) : position("d0") == 21);
+    finish(mode, ok && pq.getNumEvents() == 0);
+}
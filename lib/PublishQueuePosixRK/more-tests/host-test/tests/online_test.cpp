@@ -0,0 +1,56 @@
+// Online batching: RAM queue batch window, a mixed group of events, and a failed publish put back. Then how long
+// loop() can wait once offline
+#include "harness.h"
+
+int main(int argc, char **argv) {
+    int failNext = argc > 1 ? atoi(argv[1]) : 0;
+    std::string dir = hostFsReset("online_test");
+
+    PublishQueuePosix &pq = PublishQueuePosix::instance();
+    pq.withDirPath((dir + "/pubqueue").c_str()).withRamQueueSize(20).withSegmentSize(4096)
+      .withBatchEvent("Ubidots-LoRA-Occupancy-v2").withBatchEvent("status", "Ubidots-LoRA-Occupancy-v2");
+    pq.setup();
+    hostSetConnected(true);
+    loopFor(3000);
+
+    fakeCloud.failNext = failNext;
+    for (int ii = 0; ii < 6; ii++) {
+        char data[64];
+        snprintf(data, sizeof(data), "{\"space\":%d}", ii);
+        pq.publish("Ubidots-LoRA-Occupancy-v2", data, PRIVATE | WITH_ACK);
+        pq.publish("status", "ok \"q\"", PRIVATE | WITH_ACK);
+        if (ii == 2) {
+            pq.publish("Alert", "hello", PRIVATE);
+        }
+        loopFor(100);
+    }
+    drain(120000);
+
+    // Every space once, each status, and the alert, with fewer publishes than events
+    int spaces = 0, statuses = 0, alerts = 0;
+    for (auto &r : fakeCloud.received) {
+        if (getenv("SHOW")) {
+            printf("  %s\n", r.c_str());
+        }
+        for (size_t pos = r.find("\"space\":"); pos != std::string::npos; pos = r.find("\"space\":", pos + 1)) {
+            spaces++;
+        }
+        for (size_t pos = r.find("ok \\\"q\\\""); pos != std::string::npos; pos = r.find("ok \\\"q\\\"", pos + 1)) {
+            statuses++;
+        }
+        if (r == "Alert=hello") {
+            alerts++;
+        }
+    }
+    printf("online failNext=%d: %zu publishes, %d spaces, %d statuses, %d alerts, numEvents=%u\n", failNext, fakeCloud.received.size(), spaces, statuses, alerts, (unsigned)pq.getNumEvents());
+    // Connected, loop() moves the queue along. Offline with nothing in flight it's only needed for the stats publish
+    CHECK(pq.getMsUntilLoop() == 0);
+    hostSetConnected(false);
+    loopFor(10);
+    CHECK(pq.getMsUntilLoop() == 0xffffffff);
+    pq.withStatsPublish("Queue-Stats", 60000);
+    loopFor(1000);
+    CHECK(pq.getMsUntilLoop() == 59000);
+
+    finish("online", spaces == 6 && statuses == 6 && alerts == 1 && fakeCloud.received.size() < 13 && pq.getNumEvents() == 0);
+}
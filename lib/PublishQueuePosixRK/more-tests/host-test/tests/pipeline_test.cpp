@@ -0,0 +1,91 @@
+// Pipelined publishing: every event arrives exactly once with failures and a dropped connection, and in order when none failed
+#include "harness.h"
+#include <map>
+
+int main(int argc, char **argv) {
+    const char *mode = argc > 1 ? argv[1] : "seg";
+    size_t window = argc > 2 ? atoi(argv[2]) : 4;
+    int events = 60;
+    std::string dir = hostFsReset("pipeline_test");
+
+    fakeCloud.latencyMs = 2000;
+    fakeCloud.failEvery = (strcmp(mode, "fail") == 0 || strcmp(mode, "ramfail") == 0) ? 7 : 0;
+    bool ram = strcmp(mode, "ram") == 0 || strcmp(mode, "ramfail") == 0;
+    PublishQueuePosix &pq = PublishQueuePosix::instance();
+    pq.withDirPath((dir + "/pubqueue").c_str()).withRamQueueSize(ram ? 200 : 0).withFileQueueSize(500).withMaxInFlight(window);
+    if (ram) {
+        pq.withLaneRamBytes(PublishQueuePriority::TELEMETRY, 16384);
+    }
+    else {
+        pq.withSegmentSize(4096);
+    }
+    if (strcmp(mode, "batch") == 0) {
+        pq.withBatchEvent("ev").withBatchWindow(0);
+    }
+    pq.setup();
+    loopFor(10);
+
+    fakeCloud.connected = ram;
+    if (ram) {
+        pq.setPausePublishing(true);
+    }
+    for (int ii = 0; ii < events; ii++) {
+        pq.publish("ev", String(ii).c_str(), PRIVATE | WITH_ACK);
+        loopFor(2);
+    }
+    if (ram) {
+        pq.setPausePublishing(false);
+    }
+    hostSetConnected(true);
+    if (strcmp(mode, "flap") == 0) {
+        // Drop the connection partway through the drain, with publishes in flight
+        loopFor(5000);
+        hostSetConnected(false);
+        loopFor(5000);
+        for (int ii = 0; ii < 5; ii++) {
+            pq.publish("ev", String(events + ii).c_str(), PRIVATE | WITH_ACK);
+            loopFor(2);
+        }
+        events += 5;
+        hostSetConnected(true);
+    }
+    unsigned long drainMs = drain(3600000);
+
+    std::vector<int> seq;
+    for (auto &r : fakeCloud.received) {
+        const char *d = strchr(r.c_str(), '=') + 1;
+        if (*d == '[') {
+            for (const char *p = d + 1; p; p = strchr(p, ',')) {
+                p += (*p == ',');
+                seq.push_back(atoi(p + (*p == '"')));
+            }
+        }
+        else {
+            seq.push_back(atoi(d));
+        }
+    }
+    std::map<int, int> copies;
+    for (int value : seq) {
+        copies[value]++;
+    }
+    bool ok = seq.size() == (size_t)events && copies.size() == (size_t)events && pq.getNumEvents() == 0;
+    for (int ii = 0; ii < events; ii++) {
+        if (copies[ii] != 1) {
+            printf("event %d received %d times\n", ii, copies[ii]);
+            ok = false;
+        }
+    }
+    // Only a publish that failed is sent again, after the ones that were in flight with it
+    for (size_t ii = 1; ok && fakeCloud.failed == 0 && ii < seq.size(); ii++) {
+        if (seq[ii] < seq[ii - 1]) {
+            printf("out of order at %d\n", seq[ii]);
+            ok = false;
+        }
+    }
+    if (window > 1 && fakeCloud.attempts > window && fakeCloud.maxInFlight < 2) {
+        ok = false;
+    }
+    printf("%s window %u: drained %d events in %lu ms, %lu publishes, %lu failed, %zu received, max in flight %d\n",
+        mode, (unsigned)window, events, drainMs, fakeCloud.attempts, fakeCloud.failed, seq.size(), fakeCloud.maxInFlight);
+    finish(mode, ok);
+}
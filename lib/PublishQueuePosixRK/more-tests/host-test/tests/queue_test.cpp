@@ -0,0 +1,89 @@
+// Offline burst written to files, then drained in order: one event per file, segments, batches, and segments on a
+// file system that fills up partway through the burst
+#include "harness.h"
+
+int main(int argc, char **argv) {
+    const char *mode = argc > 1 ? argv[1] : "legacy";
+    int events = argc > 2 ? atoi(argv[2]) : 50;
+    std::string dir = hostFsReset("queue_test");
+
+    PublishQueuePosix &pq = PublishQueuePosix::instance();
+    pq.withDirPath((dir + "/pubqueue").c_str()).withRamQueueSize(0).withFileQueueSize(500);
+    if (strncmp(mode, "seg", 3) == 0) {
+        pq.withSegmentSize(4096);
+    }
+    if (strstr(mode, "batch")) {
+        pq.withBatchEvent("Ubidots-LoRA-Occupancy-v2").withBatchEvent("status", "Ubidots-LoRA-Occupancy-v2");
+    }
+    pq.setup();
+    loopFor(10);
+
+    // Offline burst
+    fakeCloud.connected = false;
+    FsCounters before = fsCounters;
+    for (int ii = 0; ii < events; ii++) {
+        if (strcmp(mode, "segfull") == 0) {
+            // Room for a couple of events at 20, so the next one is torn, and space again from 30
+            hostFsSpace = (ii == 20) ? 250 : (ii == 30) ? -1 : hostFsSpace;
+        }
+        char data[128];
+        snprintf(data, sizeof(data), "{\"space\":%d,\"net\":%d,\"gross\":%d,\"battery\":87}", ii % 8, ii, ii * 2);
+        pq.publish("Ubidots-LoRA-Occupancy-v2", data, PRIVATE | WITH_ACK);
+        loopFor(5);
+    }
+    FsCounters afterWrite = fsCounters;
+    printf("%s: queued %d events offline, fs ops %lu (per event %.2f)\n", mode, events,
+        afterWrite.total() - before.total(), (double)(afterWrite.total() - before.total()) / events);
+
+    hostSetConnected(true);
+    unsigned long drainMs = drain(600000);
+    FsCounters afterDrain = fsCounters;
+    printf("%s: drained in %lu ms, cloud got %zu, fs ops %lu (per event %.2f), numEvents=%u\n", mode, drainMs, fakeCloud.received.size(),
+        afterDrain.total() - afterWrite.total(), (double)(afterDrain.total() - afterWrite.total()) / events, (unsigned)pq.getNumEvents());
+
+    if (strstr(mode, "batch")) {
+        // Un-batch: "name=[{...},{...}]"
+        size_t publishes = fakeCloud.received.size();
+        std::vector<std::string> flat;
+        for (auto &r : fakeCloud.received) {
+            size_t eq = r.find('=');
+            std::string name = r.substr(0, eq), d = r.substr(eq + 2, r.size() - eq - 3);
+            size_t pos = 0;
+            while (pos < d.size()) {
+                size_t end = d.find("},{", pos);
+                end = (end == std::string::npos) ? d.size() : end + 1;
+                flat.push_back(name + "=" + d.substr(pos, end - pos));
+                pos = end + 1;
+            }
+        }
+        fakeCloud.received = flat;
+        printf("%s: %zu publishes carried %zu events\n", mode, publishes, flat.size());
+    }
+
+    // Events that could not be written are counted and skipped; the ones that were arrive whole and in order
+    PublishQueueStats stats;
+    pq.getStats(stats);
+    int writeFailed = stats.drops[(int)PublishQueueDropReason::WRITE_FAILED];
+    int corrupted = stats.drops[(int)PublishQueueDropReason::CORRUPTED];
+    int bad = 0;
+    int ii = 0;
+    for (auto &r : fakeCloud.received) {
+        char data[160];
+        for (; ii < events; ii++) {
+            snprintf(data, sizeof(data), "Ubidots-LoRA-Occupancy-v2={\"space\":%d,\"net\":%d,\"gross\":%d,\"battery\":87}", ii % 8, ii, ii * 2);
+            if (r == data || writeFailed == 0) {
+                break;
+            }
+        }
+        if ((ii == events || r != data) && bad++ < 3) {
+            printf("mismatch %d: %s\n", ii, r.c_str());
+        }
+        ii++;
+    }
+    if (writeFailed || corrupted) {
+        printf("%s: %d events could not be written, %d corrupted\n", mode, writeFailed, corrupted);
+    }
+    bool full = strcmp(mode, "segfull") == 0;
+    finish(mode, bad == 0 && (int)fakeCloud.received.size() + writeFailed == events && corrupted == 0 && (writeFailed > 0) == full &&
+        pq.getNumEvents() == 0);
+}
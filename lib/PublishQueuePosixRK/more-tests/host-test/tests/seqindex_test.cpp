@@ -0,0 +1,93 @@
+// SequentialFile index: boot cost with and without the index, and the fallbacks to a scan
+#include "harness.h"
+#include "SequentialFileRK.h"
+#include <fcntl.h>
+#include <algorithm>
+
+static std::string dirPath;
+
+static void makeFile(SequentialFile &queue, int fileNum) {
+    int fd = open(queue.getPathForFileNum(fileNum), O_RDWR | O_CREAT, 0666);
+    write(fd, "x", 1);
+    close(fd);
+}
+
+static std::vector<int> boot(bool index, unsigned long &ops) {
+    SequentialFile queue;
+    queue.withDirPath(dirPath.c_str());
+    if (index) {
+        queue.withIndexFile(".index");
+    }
+    FsCounters before = fsCounters;
+    queue.scanDir();
+    ops = fsCounters.total() - before.total();
+    std::vector<int> result;
+    queue.forEachFileInQueue([&result](int fileNum) { result.push_back(fileNum); });
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+int main(int argc, char **argv) {
+    unsigned long ops;
+    for (int n : {10, 100, 1000}) {
+        dirPath = hostFsReset("seqindex_test") + "/seq";
+        {
+            SequentialFile queue;
+            queue.withDirPath(dirPath.c_str()).withIndexFile(".index");
+            queue.scanDir();
+            for (int ii = 0; ii < n + 5; ii++) {
+                int fileNum = queue.reserveFile();
+                makeFile(queue, fileNum);
+                queue.addFileToQueue(fileNum);
+            }
+            for (int ii = 0; ii < 5; ii++) {
+                queue.removeFileNum(queue.getFileFromQueue(true), false);
+            }
+        }
+        unsigned long scanOps, indexOps;
+        std::vector<int> scanned = boot(false, scanOps);
+        std::vector<int> indexed = boot(true, indexOps);
+        printf("%d files: scan %lu fs ops, index %lu fs ops\n", n, scanOps, indexOps);
+        CHECK(scanned == indexed && indexed.size() == (size_t)n);
+        CHECK(indexOps < 20);
+    }
+
+    // A file written after the index, as if reset before addFileToQueue()
+    {
+        SequentialFile queue;
+        queue.withDirPath(dirPath.c_str());
+        queue.scanDir();
+        makeFile(queue, 1006);
+    }
+    std::vector<int> files = boot(true, ops);
+    printf("extra tail file: %u files %lu fs ops\n", (unsigned)files.size(), ops);
+    CHECK(files.size() == 1001);
+
+    // The index was rewritten by the scan, so the next boot uses it
+    files = boot(true, ops);
+    printf("after rescan: %u files %lu fs ops\n", (unsigned)files.size(), ops);
+    CHECK(files.size() == 1001 && ops < 20);
+
+    // Removed from the index but the file is still there
+    {
+        SequentialFile queue;
+        queue.withDirPath(dirPath.c_str()).withIndexFile(".index");
+        queue.scanDir();
+        queue.getFileFromQueue(true);
+    }
+    files = boot(true, ops);
+    printf("orphan head file: %u files %lu fs ops\n", (unsigned)files.size(), ops);
+    CHECK(files.size() == 1001);
+
+    // Corrupted index
+    {
+        int fd = open((dirPath + "/.index").c_str(), O_RDWR);
+        lseek(fd, 8, SEEK_SET);
+        write(fd, "zz", 2);
+        close(fd);
+    }
+    files = boot(true, ops);
+    printf("corrupt index: %u files %lu fs ops\n", (unsigned)files.size(), ops);
+    CHECK(files.size() == 1001);
+    finish("seqindex", true);
+}
@@ -0,0 +1,166 @@
+// FRAM spill ring: checks against an in-memory FRAM, then offline and online through the queue
+#include "harness.h"
+
+static uint8_t fram[768];
+
+static bool framRead(size_t offset, uint8_t *buf, size_t len) {
+    if (offset + len > sizeof(fram)) {
+        return false;
+    }
+    memcpy(buf, &fram[offset], len);
+    return true;
+}
+
+static bool framWrite(size_t offset, const uint8_t *buf, size_t len) {
+    if (offset + len > sizeof(fram)) {
+        return false;
+    }
+    memcpy(&fram[offset], buf, len);
+    return true;
+}
+
+static void ringChecks() {
+    // Reload the ring each round, pushing events of varying size and sending a few
+    memset(fram, 0xff, sizeof(fram));
+    unsigned next = 0, expect = 0;
+    for (int round = 0; round < 200; round++) {
+        PublishQueueSpill spill;
+        spill.withStorage(sizeof(fram), framRead, framWrite);
+        spill.load();
+        CHECK(spill.size(1) == next - expect);
+        for (int ii = 0; ii < 1 + round % 5; ii++) {
+            char data[80];
+            snprintf(data, sizeof(data), "%u%.*s", next, (int)(next * 7 % 50), "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx");
+            if (!spill.push_back(1, "ev", data, PRIVATE, 1000 + next)) {
+                break;
+            }
+            next++;
+        }
+        for (int ii = 0; ii < round % 3 + 1 && spill.size(1); ii++) {
+            uint32_t queuedAt = 0;
+            PublishQueueEvent *event = spill.read(1, 0, queuedAt);
+            CHECK(event && (unsigned)atoi(event->eventData) == expect && queuedAt == 1000 + expect);
+            PublishQueuePosix::freeEvent(event);
+            spill.markSent(1, 1);
+            expect++;
+        }
+    }
+    printf("ring: pushed %u sent %u\n", next, expect);
+    CHECK(expect > 200);
+
+    // Torn record: push 3, corrupt the data of the third, the reload finds 2
+    memset(fram, 0xff, sizeof(fram));
+    {
+        PublishQueueSpill spill;
+        spill.withStorage(sizeof(fram), framRead, framWrite);
+        spill.load();
+        spill.push_back(0, "a", "111", PRIVATE, 1);
+        spill.push_back(0, "b", "222", PRIVATE, 2);
+        spill.push_back(0, "c", "333", PRIVATE, 3);
+    }
+    for (size_t ii = 0; ii + 4 <= sizeof(fram); ii++) {
+        if (!memcmp(&fram[ii], "c333", 4)) {
+            fram[ii + 2] = '9';
+            break;
+        }
+    }
+    {
+        PublishQueueSpill spill;
+        spill.withStorage(sizeof(fram), framRead, framWrite);
+        spill.load();
+        CHECK(spill.size(0) == 2);
+        CHECK(spill.push_back(0, "d", "444", PRIVATE, 4));
+        uint32_t queuedAt;
+        PublishQueueEvent *event = spill.read(0, 2, queuedAt);
+        CHECK(event && !strcmp(event->eventData, "444"));
+        PublishQueuePosix::freeEvent(event);
+        spill.markSent(0, 1);
+    }
+
+    // Corrupt the newer header copy, the older one still loads
+    fram[16 + 5] ^= 0xff;
+    {
+        PublishQueueSpill spill;
+        spill.withStorage(sizeof(fram), framRead, framWrite);
+        spill.load();
+        CHECK(spill.size(0) >= 2);
+    }
+}
+
+int main(int argc, char **argv) {
+    ringChecks();
+
+    memset(fram, 0xff, sizeof(fram));
+    std::string dir = hostFsReset("spill_test");
+    PublishQueuePosix &pq = PublishQueuePosix::instance();
+    pq.withDirPath((dir + "/pubqueue").c_str()).withRamQueueSize(2).withSegmentSize(4096).withSpillStorage(sizeof(fram), framRead, framWrite)
+      .withMaxInFlight(1).withPublishRate(100, 4).withKeyedEvents(8);
+    pq.setup();
+    fakeCloud.connected = false;
+    loopFor(100);
+
+    // Keyed events in the ring are replaced: 3 keys with 4 updates each leaves 3
+    for (int ii = 0; ii < 12; ii++) {
+        char key[8], data[32];
+        snprintf(key, sizeof(key), "k%d", ii % 3);
+        snprintf(data, sizeof(data), "{\"k\":%d,\"v\":%d}", ii % 3, ii / 3);
+        pq.publishKeyed(key, "occ", data, PRIVATE | WITH_ACK);
+        loopFor(10);
+    }
+    PublishQueueStats stats;
+    pq.getStats(stats);
+    printf("keyed offline: events %u spill %u replaced %u\n", (unsigned)pq.getNumEvents(), stats.spillEvents, stats.drops[(int)PublishQueueDropReason::REPLACED]);
+    CHECK(pq.getNumEvents() == 3);
+    hostSetConnected(true);
+    drain(600000);
+    CHECK(fakeCloud.received.size() == 3);
+    for (auto &r : fakeCloud.received) {
+        CHECK(r.find("\"v\":3") != std::string::npos);
+    }
+    fakeCloud.received.clear();
+    hostSetConnected(false);
+    loopFor(100);
+
+    // A short outage fits in the ring without touching the flash, a longer one spills over into files
+    int total = 0;
+    for (int phase = 0; phase < 2; phase++) {
+        int count = phase ? 40 : 12;
+        unsigned long writesBefore = fsCounters.write;
+        for (int ii = 0; ii < count; ii++) {
+            char data[64];
+            snprintf(data, sizeof(data), "{\"n\":%d}", total++);
+            pq.publish("ev", data, PRIVATE | WITH_ACK);
+            loopFor(10);
+        }
+        pq.getStats(stats);
+        printf("phase %d offline: events %u spill %u files %u spill bytes %u fs writes %lu\n", phase, (unsigned)pq.getNumEvents(), stats.spillEvents,
+            stats.fileEvents, (unsigned)pq.getSpillBytesUsed(), fsCounters.write - writesBefore);
+        if (phase == 0) {
+            CHECK(stats.fileEvents == 0);
+        }
+        else {
+            CHECK(stats.fileEvents > 0 && stats.spillEvents > 0);
+        }
+        fakeCloud.failNext = phase;
+        hostSetConnected(true);
+        drain(600000);
+        CHECK(pq.getNumEvents() == 0 && pq.getSpillBytesUsed() == 0);
+        hostSetConnected(false);
+        loopFor(100);
+    }
+
+    int expect = 0;
+    for (auto &r : fakeCloud.received) {
+        const char *p = strstr(r.c_str(), "\"n\":");
+        int n = p ? atoi(p + 4) : -1;
+        if (n == expect) {
+            expect++;
+        }
+        else if (n > expect) {
+            printf("out of order %d expected %d\n", n, expect);
+            CHECK(n <= expect);
+        }
+    }
+    printf("received %u unique %d\n", (unsigned)fakeCloud.received.size(), expect);
+    finish("spill", expect == total);
+}
@@ -10,6 +10,9 @@ PublishQueuePosix *PublishQueuePosix::_instance;
 
 static Logger _log("app.pubq");
 
+const uint32_t PublishQueueStats::queueLatencyLimits[NUM_BUCKETS - 1] = { 10, 60, 600, 3600, 21600 };
+const uint32_t PublishQueueStats::publishLatencyLimits[NUM_BUCKETS - 1] = { 500, 1000, 2000, 5000, 10000 };
+
 
 PublishQueuePosix &PublishQueuePosix::instance() {
     if (!_instance) {
@@ -19,26 +22,107 @@ PublishQueuePosix &PublishQueuePosix::instance() {
 }
 
 PublishQueuePosix &PublishQueuePosix::withRamQueueSize(size_t size) { 
-    ramQueueSize = size;
+    Lane &lane = getLane(PublishQueuePriority::TELEMETRY);
+    lane.ramQueueSize = size;
 
     if (stateHandler) {
-        _log.trace("withRamQueueSize(%u)", ramQueueSize);
+        _log.trace("withRamQueueSize(%u)", lane.ramQueueSize);
         checkQueueLimits();
     }
     return *this; 
 }
 
 
+PublishQueuePosix &PublishQueuePosix::withSegmentSize(size_t size) {
+    segmentSize = size;
+    return *this;
+}
+
 PublishQueuePosix &PublishQueuePosix::withFileQueueSize(size_t size) {
-    fileQueueSize = size; 
+    Lane &lane = getLane(PublishQueuePriority::TELEMETRY);
+    lane.fileQueueSize = size; 
 
     if (stateHandler) {
-        _log.trace("withFileQueueSize(%u)", fileQueueSize);
+        _log.trace("withFileQueueSize(%u)", lane.fileQueueSize);
         checkQueueLimits();
     }
     return *this; 
 }
 
+PublishQueuePosix &PublishQueuePosix::withLaneLimits(PublishQueuePriority priority, size_t ramQueueSize, size_t fileQueueSize) {
+    Lane &lane = getLane(priority);
+    lane.ramQueueSize = ramQueueSize;
+    lane.fileQueueSize = fileQueueSize;
+
+    if (stateHandler) {
+        _log.trace("withLaneLimits(%d, %u, %u)", (int)priority, ramQueueSize, fileQueueSize);
+        checkQueueLimits();
+    }
+    return *this;
+}
+
+PublishQueuePosix &PublishQueuePosix::withLaneRamBytes(PublishQueuePriority priority, size_t bytes) {
+    Lane &lane = getLane(priority);
+    lane.ramQueueBytes = bytes;
+
+    if (lane.ramQueue.empty()) {
+        lane.ramQueue.allocate(bytes);
+    }
+    else {
+        _log.info("lane %d RAM queue not empty, buffer size unchanged", (int)priority);
+    }
+    return *this;
+}
+
+size_t PublishQueuePosix::getRamQueueBytesUsed(PublishQueuePriority priority) {
+    size_t result = 0;
+
+    WITH_LOCK(*this) {
+        result = getLane(priority).ramQueue.getBytesUsed();
+    }
+    return result;
+}
+
+PublishQueuePosix &PublishQueuePosix::withMaxInFlight(size_t count) {
+    if (!stateHandler) {
+        maxInFlight = (count < 1) ? 1 : (count > MAX_IN_FLIGHT) ? MAX_IN_FLIGHT : count;
+        inFlightLimit = maxInFlight;
+    }
+    return *this;
+}
+
+PublishQueuePosix &PublishQueuePosix::withKeyedEvents(size_t maxKeys) {
+    keyIndex.allocate(maxKeys);
+    return *this;
+}
+
+PublishQueuePosix &PublishQueuePosix::withLaneDropPolicy(PublishQueuePriority priority, DropPolicy dropPolicy) {
+    getLane(priority).dropPolicy = dropPolicy;
+    return *this;
+}
+
+PublishQueuePosix &PublishQueuePosix::withLaneWeight(PublishQueuePriority priority, unsigned int weight) {
+    getLane(priority).weight = (weight > 0) ? weight : 1;
+    return *this;
+}
+
+PublishQueuePosix &PublishQueuePosix::withBatchEvent(const char *eventName, const char *batchName) {
+    BatchEvent batchEvent;
+    batchEvent.eventName = eventName;
+    batchEvent.batchName = batchName ? batchName : eventName;
+    batchEvents.push_back(batchEvent);
+    return *this;
+}
+
+const char *PublishQueuePosix::getBatchName(const char *eventName) const {
+    for(auto it = batchEvents.begin(); it != batchEvents.end(); ++it) {
+        if (strcmp(it->eventName.c_str(), eventName) == 0) {
+            return it->batchName.c_str();
+        }
+    }
+    return NULL;
+}
+
 void PublishQueuePosix::setup() {
     if (system_thread_get_state(nullptr) != spark::feature::ENABLED) {
         _log.error("SYSTEM_THREAD(ENABLED) is required");
@@ -51,9 +135,24 @@ void PublishQueuePosix::setup() {
     System.on(reset | cloud_status, systemEventHandler);
 
     // Start the background publish thread
-    BackgroundPublishRK::instance().start();
+    BackgroundPublishRK::instance().withMaxInFlight(maxInFlight).start();
+
+    // The TELEMETRY lane is in the queue directory, so it must be created before the subdirectories of the other lanes
+    Lane &telemetry = getLane(PublishQueuePriority::TELEMETRY);
+    String dirPath(telemetry.fileQueue.getDirPath());
+    getLane(PublishQueuePriority::CRITICAL).fileQueue.withDirPath((dirPath + "/critical").c_str());
+    getLane(PublishQueuePriority::DIAGNOSTICS).fileQueue.withDirPath((dirPath + "/diagnostics").c_str());
+
+    telemetry.fileQueue.scanDir();
+    for(size_t ii = 0; ii < NUM_LANES; ii++) {
+        if (&lanes[ii] != &telemetry) {
+            lanes[ii].fileQueue.scanDir();
+        }
+        countFileQueueEvents(lanes[ii]);
+    }
 
-    fileQueue.scanDir();
+    // Events left in the FRAM ring are sent before the files
+    spill.load();
 
     checkQueueLimits();
 
@@ -62,345 +161,2502 @@ void PublishQueuePosix::setup() {
 
 void PublishQueuePosix::loop() {
     if (stateHandler) {
+        completeInFlight();
         stateHandler(*this);
+
+        if (statsPeriodMs && millis() - statsTime >= statsPeriodMs) {
+            publishStats();
+        }
+    }
+}
+
+unsigned long PublishQueuePosix::getMsUntilLoop() const {
+    if (Particle.connected() || inFlightCount > 0) {
+        return 0;
     }
+    if (!statsPeriodMs) {
+        return 0xffffffff;
+    }
+    unsigned long elapsed = millis() - statsTime;
+    return (elapsed >= statsPeriodMs) ? 0 : (statsPeriodMs - elapsed);
 }
 
-bool PublishQueuePosix::publishCommon(const char *eventName, const char *eventData, int ttl, PublishFlags flags1, PublishFlags flags2) {
+bool PublishQueuePosix::publishCommon(const char *eventName, const char *eventData, int ttl, PublishFlags flags1, PublishFlags flags2, PublishQueuePriority priority, const char *key) {
 
-    PublishQueueEvent *event = newRamEvent(eventName, eventData, flags1 | flags2);
-    if (!event) {
+    if (!eventData) {
+        eventData = "";
+    }
+    if (strlen(eventName) > particle::protocol::MAX_EVENT_NAME_LENGTH || strlen(eventData) > particle::protocol::MAX_EVENT_DATA_LENGTH) {
+        WITH_LOCK(*this) {
+            countDrop(PublishQueueDropReason::TOO_LARGE);
+        }
         return false;
     }
-    _log.trace("publishCommon eventName=%s eventData=%s", eventName, eventData ? eventData : "");
+    _log.trace("publishCommon eventName=%s eventData=%s priority=%d key=%s", eventName, eventData, (int)priority, key ? key : "");
 
-    WITH_LOCK(*this) {
-        ramQueue.push_back(event);
+    uint32_t keyValue = (key && keyIndex.getMaxKeys()) ? keyHash(priority, eventName, key) : 0;
+    uint32_t check = keyValue ? keyCheck(priority, eventName, key) : 0;
 
-        _log.trace("fileQueueLen=%u ramQueueLen=%u connected=%d", fileQueue.getQueueLen(), ramQueue.size(), Particle.connected());
+    WITH_LOCK(*this) {
+        Lane &lane = getLane(priority);
+
+        if (keyValue) {
+            // The older event with this key is not sent yet. In the RAM queue it's replaced in place if
+            // the data fits, otherwise it's skipped and this one is queued at the end instead.
+            PublishQueueKeyIndex::Entry *entry = findKey(keyValue);
+            if (entry && !isSameKey(*entry, lane, eventName, check)) {
+                // Another key with the same hash. Its event is sent as well, and no longer replaced.
+                _log.info("key of %s collides with a queued event, not replaced", eventName);
+                keyIndex.erase(entry);
+                entry = NULL;
+            }
+            if (entry && !entry->fileNum && lane.ramQueue.replace(entry->event, eventData, flags1 | flags2)) {
+                _log.trace("replaced %s key=%s", eventName, key);
+                countDrop(PublishQueueDropReason::REPLACED);
+                stats.eventsQueued++;
+                stats.bytesQueued += strlen(eventName) + strlen(eventData);
+                return true;
+            }
+            if (entry) {
+                bool superseded = true;
+                if (entry->fileNum == SPILL_FILE_NUM) {
+                    superseded = spill.supersede(entry->offset, eventName);
+                }
+                else if (entry->fileNum) {
+                    superseded = supersedeSegmentEvent(lane, entry->fileNum, entry->offset, eventName);
+                }
+                else {
+                    lane.ramQueue.remove(entry->event);
+                }
+                keyIndex.erase(entry);
+                if (superseded) {
+                    _log.trace("superseded %s key=%s", eventName, key);
+                    countDrop(PublishQueueDropReason::REPLACED);
+                }
+            }
+        }
 
-        if (fileQueue.getQueueLen() == 0 && (ramQueue.size() <= ramQueueSize) && Particle.connected()) {
-            // No files in the disk-based queue, RAM-based queue is not full, and we are cloud connected
-            // Leave the event in the RAM queue and return true
-            _log.trace("queued to ramQueue");
+        if (lane.dropPolicy == DropPolicy::DROP_NEWEST && countLaneEvents(lane) >= (lane.ramQueueSize + lane.fileQueueSize)) {
+            _log.info("lane %d full, discarded %s", (int)priority, eventName);
+            countDrop(PublishQueueDropReason::LANE_FULL);
+            return false;
+        }
+        stats.eventsQueued++;
+        stats.bytesQueued += strlen(eventName) + strlen(eventData);
+
+        // The events being sent are still in the RAM queue buffer, but don't count against the RAM queue size
+        size_t ramQueueLen = lane.ramQueue.size() - lane.ramQueue.getSending();
+        PublishQueueEvent *event = (ramQueueLen < lane.ramQueueSize) ? lane.ramQueue.push_back(eventName, eventData, flags1 | flags2, keyValue, queuedAtNow()) : NULL;
+        if (!event) {
+            // Over the RAM queue size, or does not fit in the buffer; the event goes to the file system with the queue
+            _log.trace("fileQueueLen=%u ramQueueLen=%u ramQueueBytes=%u, writing to files", lane.fileQueue.getQueueLen(), ramQueueLen, lane.ramQueue.getBytesUsed());
+            writeQueueToFiles(lane, eventName, eventData, flags1 | flags2, keyValue);
         }
         else {
-            // We need to move the queue to the file system
-            writeQueueToFiles();
+            if (keyValue) {
+                indexKey(keyValue, lane, 0, 0, event);
+            }
+
+            _log.trace("fileQueueLen=%u ramQueueLen=%u ramQueueBytes=%u connected=%d", lane.fileQueue.getQueueLen(), ramQueueLen + 1, lane.ramQueue.getBytesUsed(), Particle.connected());
+
+            if (lane.fileQueue.getQueueLen() == 0 && Particle.connected()) {
+                // No files in the disk-based queue, RAM-based queue is not full, and we are cloud connected
+                // Leave the event in the RAM queue and return true
+                _log.trace("queued to ramQueue");
+            }
+            else {
+                // We need to move the queue to the file system
+                writeQueueToFiles(lane);
+            }
         }
-        checkQueueLimits();
+        if (keyValue) {
+            // Set here, as the index entries of events written to files are made without the key
+            PublishQueueKeyIndex::Entry *entry = keyIndex.find(keyValue);
+            if (entry) {
+                entry->check = check;
+            }
+        }
+        checkQueueLimits(lane);
+        updateMaxDepths();
     }
 
 
     return true;
 }
 
-PublishQueueEvent *PublishQueuePosix::newRamEvent(const char *eventName, const char *eventData, PublishFlags flags) {
-
-    if (!eventData) {
-        eventData = "";
-    }
-    if (strlen(eventName) > particle::protocol::MAX_EVENT_NAME_LENGTH) {
-        return NULL;
+void PublishQueuePosix::writeQueueToFiles() {
+    WITH_LOCK(*this) {
+        for(size_t ii = 0; ii < NUM_LANES; ii++) {
+            writeQueueToFiles(lanes[ii]);
+        }
     }
-    if (strlen(eventData) > particle::protocol::MAX_EVENT_DATA_LENGTH) {
-        return NULL;
+}
+
+void PublishQueuePosix::writeQueueToFiles(Lane &lane, const char *eventName, const char *eventData, PublishFlags flags, uint32_t key) {
+
+    WITH_LOCK(*this) {
+        // Events go to the FRAM ring until it's full, then to files until the file queue is empty again
+        if (spill.isEnabled() && lane.fileQueue.getQueueLen() == 0 && writeQueueToSpill(lane, eventName, eventData, flags, key)) {
+            return;
+        }
     }
 
-    PublishQueueEvent *event;
+    FileSystemTimer timer(*this);
+    WITH_LOCK(*this) {
+        // Save how far the head segment has been sent so those events are not sent again after a reset
+        checkpointSegment(lane);
 
-    event = (PublishQueueEvent *) new char[sizeof(PublishQueueEvent) + strlen(eventData)];
-    if (event) {
-        event->flags = flags;
-        strcpy(event->eventName, eventName);
-        strcpy(event->eventData, eventData);
+        if (segmentSize) {
+            writeQueueToSegments(lane, eventName, eventData, flags, key);
+            return;
+        }
+
+        // Events in files one per file can't be replaced, so their keys are dropped
+        size_t written = 0;
+        for(PublishQueueEvent *event = lane.ramQueue.frontUnsent(); event; event = lane.ramQueue.next(event)) {
+            unindexRamEvent(lane, event);
+            if (!writeEventToFile(lane, event->eventName, event->eventData, event->flags)) {
+                _log.error("discarded %s, could not be written", event->eventName);
+                countDrop(PublishQueueDropReason::WRITE_FAILED);
+            }
+            written++;
+        }
+        lane.ramQueue.removeUnsent(written);
+
+        if (eventName && !writeEventToFile(lane, eventName, eventData, flags)) {
+            _log.error("discarded %s, could not be written", eventName);
+            countDrop(PublishQueueDropReason::WRITE_FAILED);
+        }
     }
-    return event;
 }
 
-void PublishQueuePosix::writeQueueToFiles() {
+bool PublishQueuePosix::writeQueueToSpill(Lane &lane, const char *eventName, const char *eventData, PublishFlags flags, uint32_t key) {
+    uint8_t index = laneIndex(lane);
 
     WITH_LOCK(*this) {
-        while(!ramQueue.empty()) {
-            PublishQueueEvent *event = ramQueue.front();
-            ramQueue.pop_front();
-
-            int fileNum = fileQueue.reserveFile();
-
-            int fd = open(fileQueue.getPathForFileNum(fileNum), O_RDWR | O_CREAT);
-            if (fd) {
-                PublishQueueFileHeader hdr;
-                hdr.magic = FILE_MAGIC;
-                hdr.version = FILE_VERSION;
-                hdr.headerSize = sizeof(PublishQueueFileHeader);
-                hdr.nameLen = sizeof(PublishQueueEvent::eventName);
-                write(fd, &hdr, sizeof(hdr));
-
-                write(fd, event, sizeof(PublishQueueEvent) + strlen(event->eventData));
-                close(fd);
+        PublishQueueEvent *event = lane.ramQueue.frontUnsent();
+        while(event) {
+            uint32_t eventKey = lane.ramQueue.getKey(event);
+            bool indexed = eventKey && isRamEventIndexed(lane, event);
 
-                // This message is monitored by the automated test tool. If you edit this, change that too.
-                _log.trace("writeQueueToFiles fileNum=%d", fileNum);
+            if (!spill.push_back(index, event->eventName, event->eventData, event->flags, lane.ramQueue.getQueuedAt(event))) {
+                return false;
             }
-            fileQueue.addFileToQueue(fileNum);
+            if (indexed) {
+                // The key now refers to the event in the FRAM ring
+                indexKey(eventKey, lane, SPILL_FILE_NUM, spill.getLastSeq(), NULL);
+            }
+
+            // Removed one at a time, as the events being sent before it stay in the RAM queue
+            PublishQueueEvent *nextEvent = lane.ramQueue.next(event);
+            lane.ramQueue.remove(event);
+            event = nextEvent;
+        }
 
-            delete event;
+        if (eventName) {
+            if (!spill.push_back(index, eventName, eventData, flags, queuedAtNow())) {
+                return false;
+            }
+            if (key) {
+                indexKey(key, lane, SPILL_FILE_NUM, spill.getLastSeq(), NULL);
+            }
         }
     }
+    _log.trace("spill bytesUsed=%u", spill.getBytesUsed());
+    return true;
 }
 
+bool PublishQueuePosix::writeEventToFile(Lane &lane, const char *eventName, const char *eventData, PublishFlags flags) {
+    int fileNum = lane.fileQueue.reserveFile();
 
-PublishQueueEvent *PublishQueuePosix::readQueueFile(int fileNum) {
-    PublishQueueEvent *result = NULL;
+    int fd = open(lane.fileQueue.getPathForFileNum(fileNum), O_RDWR | O_CREAT);
+    if (fd < 0) {
+        return false;
+    }
 
-    int fd = open(fileQueue.getPathForFileNum(fileNum), O_RDONLY);
-    if (fd) {
-        struct stat sb;
-        fstat(fd, &sb);
+    // File header and the PublishQueueEvent up to the data in one write, then the data with its null terminator
+    uint8_t buf[sizeof(PublishQueueFileHeader) + offsetof(PublishQueueEvent, eventData)];
+
+    PublishQueueFileHeader hdr;
+    hdr.magic = FILE_MAGIC;
+    hdr.version = FILE_VERSION;
+    hdr.headerSize = sizeof(PublishQueueFileHeader);
+    hdr.nameLen = sizeof(PublishQueueEvent::eventName);
+    memcpy(buf, &hdr, sizeof(hdr));
+
+    PublishQueueEvent *event = (PublishQueueEvent *) &buf[sizeof(hdr)];
+    event->flags = flags;
+    strncpy(event->eventName, eventName, sizeof(PublishQueueEvent::eventName));
+
+    size_t dataLen = strlen(eventData) + 1;
+    bool ok = write(fd, buf, sizeof(buf)) == (ssize_t)sizeof(buf) && write(fd, eventData, dataLen) == (ssize_t)dataLen;
+    close(fd);
+    if (!ok) {
+        unlink(lane.fileQueue.getPathForFileNum(fileNum));
+        return false;
+    }
 
-        _log.trace("fileNum=%d size=%ld", fileNum, sb.st_size);
+    // This message is monitored by the automated test tool. If you edit this, change that too.
+    _log.trace("writeQueueToFiles fileNum=%d", fileNum);
 
-        PublishQueueFileHeader hdr;
-        
-        lseek(fd, 0, SEEK_SET);
-        read(fd, &hdr, sizeof(PublishQueueFileHeader));
-        if (sb.st_size >= (off_t)(sizeof(PublishQueueFileHeader) + sizeof(PublishQueueEvent)) &&
-            hdr.magic == FILE_MAGIC && 
-            hdr.version == FILE_VERSION &&
-            hdr.headerSize == sizeof(PublishQueueFileHeader) &&
-            hdr.nameLen == sizeof(PublishQueueEvent::eventName)) {
+    lane.fileQueue.addFileToQueue(fileNum);
+    lane.fileQueueEvents++;
+    return true;
+}
 
-            size_t eventSize = sb.st_size - sizeof(PublishQueueFileHeader);
 
-            result = (PublishQueueEvent *)new char[eventSize];
-            if (result) {
-                read(fd, result, eventSize);
+void PublishQueuePosix::writeQueueToSegments(Lane &lane, const char *eventName, const char *eventData, PublishFlags flags, uint32_t key) {
+    int fd = -1;
 
-                if (((char *)result)[eventSize - 1] == 0 && strlen(result->eventName) < (sizeof(PublishQueueEvent::eventName) - 1)) {
-                    _log.trace("readQueueFile %d event=%s data=%s", fileNum, result->eventName, result->eventData);
-                }
-                else {
-                    _log.trace("readQueueFile %d corrupted event name or data", fileNum);
-                    delete result;
-                    result = NULL;
-                }
+    WITH_LOCK(*this) {
+        size_t written = 0;
+        bool ok = true;
+        PublishQueueEvent *event;
+        for(event = lane.ramQueue.frontUnsent(); event; event = lane.ramQueue.next(event)) {
+            uint32_t eventKey = lane.ramQueue.getKey(event);
+            bool indexed = eventKey && isRamEventIndexed(lane, event);
+
+            ok = writeEventToSegment(lane, event->eventName, event->eventData, event->flags, eventKey, lane.ramQueue.getQueuedAt(event), fd);
+            if (!ok) {
+                break;
+            }
+            if (indexed) {
+                // The key now refers to the event in the segment
+                indexKey(eventKey, lane, lane.tailSegment.fileNum, lane.tailSegment.lastOffset, NULL);
+            }
+            written++;
+        }
+        if (lane.ramQueue.getSending()) {
+            // The events that were not written are removed with the ones that were
+            for(; event; event = lane.ramQueue.next(event)) {
+                unindexRamEvent(lane, event);
+            }
+        }
+        size_t lost = lane.ramQueue.removeUnsent(written);
+        if (lost) {
+            _log.error("discarded %u events that could not be written", lost);
+            countDrop(PublishQueueDropReason::WRITE_FAILED, lost);
+        }
 
+        if (eventName) {
+            if (ok && writeEventToSegment(lane, eventName, eventData, flags, key, queuedAtNow(), fd)) {
+                if (key) {
+                    indexKey(key, lane, lane.tailSegment.fileNum, lane.tailSegment.lastOffset, NULL);
+                }
+            }
+            else {
+                _log.error("discarded %s, could not be written", eventName);
+                countDrop(PublishQueueDropReason::WRITE_FAILED);
             }
-        } else {
-            _log.trace("readQueueFile %d bad magic=%08lx version=%u headerSize=%u nameLen=%u", fileNum, hdr.magic, hdr.version, hdr.headerSize, hdr.nameLen);
         }
 
-        close(fd);
+        if (fd >= 0) {
+            close(fd);
+        }
     }
-    return result;
 }
 
-void PublishQueuePosix::clearQueues() {
-    WITH_LOCK(*this) {
-        while(!ramQueue.empty()) {
-            PublishQueueEvent *event = ramQueue.front();
-            ramQueue.pop_front();
-
-            delete event;
+bool PublishQueuePosix::writeEventToSegment(Lane &lane, const char *eventName, const char *eventData, PublishFlags flags, uint32_t key, uint32_t queuedAt, int &fd) {
+    PublishQueueSegmentRecord rec;
+    rec.flags = flags;
+    rec.nameLen = (uint8_t) strlen(eventName);
+    rec.dataLen = (uint16_t) strlen(eventData);
+    rec.key = key;
+    rec.queuedAt = queuedAt;
+    size_t recordSize = sizeof(PublishQueueSegmentRecord) + rec.nameLen + rec.dataLen;
+
+    if (lane.tailSegment.fileNum && lane.tailSegment.endOffset > sizeof(PublishQueueSegmentHeader) && (lane.tailSegment.endOffset + recordSize) > segmentSize) {
+        // Tail segment is full; it stays in the queue and a new one is started
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
         }
+        lane.tailSegment = SegmentState();
+    }
 
-        fileQueue.removeAll(true);
+    if (lane.tailSegment.fileNum && fd < 0) {
+        // Appending to the segment from an earlier batch
+        if (lane.headSegment.fileNum == lane.tailSegment.fileNum) {
+            // Also being read from; it's reopened so the read sees the new events
+            closeSegment(lane.headSegment);
+        }
+        fd = open(lane.fileQueue.getPathForFileNum(lane.tailSegment.fileNum), O_WRONLY | O_APPEND);
+        if (fd < 0) {
+            lane.tailSegment = SegmentState();
+        }
     }
 
-    _log.trace("clearQueues");
-}
+    if (!lane.tailSegment.fileNum) {
+        int fileNum = lane.fileQueue.reserveFile();
 
-void PublishQueuePosix::setPausePublishing(bool value) { 
-    pausePublishing = value; 
+        fd = open(lane.fileQueue.getPathForFileNum(fileNum), O_RDWR | O_CREAT | O_TRUNC);
+        if (fd < 0) {
+            _log.error("could not create segment %d", fileNum);
+            return false;
+        }
+        PublishQueueSegmentHeader &hdr = lane.tailSegment.hdr;
+        memset(&hdr, 0, sizeof(PublishQueueSegmentHeader));
+        hdr.magic = SEGMENT_MAGIC;
+        hdr.version = SEGMENT_VERSION;
+        hdr.headerSize = sizeof(PublishQueueSegmentHeader);
+        hdr.sentOffset = sizeof(PublishQueueSegmentHeader);
+        if (write(fd, &hdr, sizeof(PublishQueueSegmentHeader)) != sizeof(PublishQueueSegmentHeader)) {
+            _log.error("could not write segment %d header", fileNum);
+            close(fd);
+            fd = -1;
+            unlink(lane.fileQueue.getPathForFileNum(fileNum));
+            lane.tailSegment = SegmentState();
+            return false;
+        }
 
-    if (!value) {
-        // When resuming publishing, update the canSleep flag
-        if (getNumEvents() != 0) {
-            canSleep = false;
+        lane.tailSegment.fileNum = fileNum;
+        lane.tailSegment.endOffset = sizeof(PublishQueueSegmentHeader);
+        lane.fileQueue.addFileToQueue(fileNum);
+        _log.trace("new segment fileNum=%d", fileNum);
+    }
+
+    // Record header and name in one write, then the data
+    uint8_t buf[sizeof(PublishQueueSegmentRecord) + particle::protocol::MAX_EVENT_NAME_LENGTH];
+    memcpy(buf, &rec, sizeof(PublishQueueSegmentRecord));
+    memcpy(&buf[sizeof(PublishQueueSegmentRecord)], eventName, rec.nameLen);
+    size_t headLen = sizeof(PublishQueueSegmentRecord) + rec.nameLen;
+    if (write(fd, buf, headLen) != (ssize_t)headLen || write(fd, eventData, rec.dataLen) != (ssize_t)rec.dataLen) {
+        // A torn record would make the reader discard it and everything after it, so it's cut off. If
+        // that fails too, nothing more is appended to this segment.
+        _log.error("could not write to segment %d", lane.tailSegment.fileNum);
+        if (ftruncate(fd, lane.tailSegment.endOffset) != 0) {
+            close(fd);
+            fd = -1;
+            lane.tailSegment = SegmentState();
         }
+        return false;
     }
+
+    lane.tailSegment.lastOffset = lane.tailSegment.endOffset;
+    lane.tailSegment.endOffset += recordSize;
+    lane.fileQueueEvents++;
+
+    // This message is monitored by the automated test tool. If you edit this, change that too.
+    _log.trace("writeQueueToFiles fileNum=%d", lane.tailSegment.fileNum);
+    return true;
 }
 
+PublishQueueEvent *PublishQueuePosix::readSegmentEvent(Lane &lane, int fileNum, bool &isSegment, uint32_t &queuedAt) {
+    PublishQueueEvent *result = NULL;
 
+    isSegment = true;
+    queuedAt = 0;
 
-void PublishQueuePosix::checkQueueLimits() {
+    FileSystemTimer timer(*this);
     WITH_LOCK(*this) {
-        if (ramQueue.size() > ramQueueSize) {
-            // RAM queue is too large, move all to files
-            writeQueueToFiles();
+        if (lane.headSegment.fileNum != fileNum) {
+            closeSegment(lane.headSegment);
+            lane.headSegment = SegmentState();
+            if (!openSegment(lane, fileNum, lane.headSegment)) {
+                // Written one event per file (or corrupted, which readQueueFile reports)
+                lane.headSegment = SegmentState();
+                isSegment = false;
+                return readQueueFile(lane, fileNum);
+            }
         }
 
-        while(fileQueue.getQueueLen() > (int)fileQueueSize) {
-            int fileNum = fileQueue.getFileFromQueue(true);
-            if (fileNum) {
-                fileQueue.removeFileNum(fileNum, false);
-                _log.info("discarded event %d", fileNum);
+        if (lane.headSegment.exhausted) {
+            // Nothing more to read until the events in flight complete, then it's removed
+            if (lane.headSegment.readCount == lane.headSegment.hdr.sentCount) {
+                removeQueueFile(lane, fileNum, 0);
+                _log.trace("removed segment %d", fileNum);
             }
+            return NULL;
         }
-    }
-}
 
-size_t PublishQueuePosix::getNumEvents() {
-    size_t result = 0;
+        if (lane.headSegment.fd < 0) {
+            lane.headSegment.fd = open(lane.fileQueue.getPathForFileNum(fileNum), O_RDWR);
+            if (lane.headSegment.fd < 0) {
+                return NULL;
+            }
+            lane.headSegment.filePos = 0;
+        }
+        if (lane.headSegment.filePos != lane.headSegment.readOffset) {
+            lseek(lane.headSegment.fd, lane.headSegment.readOffset, SEEK_SET);
+            lane.headSegment.filePos = lane.headSegment.readOffset;
+        }
 
-    WITH_LOCK(*this) {
-        result = ramQueue.size();
-        if (result == 0) {
-            result = fileQueue.getQueueLen();
+        PublishQueueSegmentRecord rec;
+        int count;
+        while((count = read(lane.headSegment.fd, &rec, sizeof(PublishQueueSegmentRecord))) == sizeof(PublishQueueSegmentRecord) &&
+            (rec.nameLen & SEGMENT_RECORD_SUPERSEDED) != 0) {
+            // Replaced by a newer event with the same key, skip it. When nothing is being sent it counts as sent.
+            SegmentState &seg = lane.headSegment;
+            bool sending = (seg.readOffset != seg.hdr.sentOffset);
+
+            seg.readOffset += sizeof(PublishQueueSegmentRecord) + (rec.nameLen & ~SEGMENT_RECORD_SUPERSEDED) + rec.dataLen;
+            seg.readCount++;
+            if (!sending) {
+                seg.hdr.sentOffset = seg.readOffset;
+                seg.hdr.sentCount = seg.readCount;
+            }
+            lseek(seg.fd, seg.readOffset, SEEK_SET);
+            seg.filePos = seg.readOffset;
+        }
+        if (count == 0) {
+            if (lane.headSegment.readCount == lane.headSegment.hdr.sentCount) {
+                // End of the segment and every event in it has been sent
+                removeQueueFile(lane, fileNum, 0);
+                _log.trace("removed segment %d", fileNum);
+            }
+            else {
+                lane.headSegment.exhausted = true;
+            }
+            return NULL;
+        }
 
-            if (curEvent && curFileNum == 0) {
-                // This happens when we are sending an event from the RAM queue
-                // It's not in the RAM queue, but we want to count it, because
-                // otherwise getNumEvents would return 1 for the event sent from
-                // a file (because the file is not deleted until sent) and
-                // this makes the behavior consistent.
-                result++;
+        if (count == sizeof(PublishQueueSegmentRecord) &&
+            rec.nameLen > 0 && rec.nameLen <= particle::protocol::MAX_EVENT_NAME_LENGTH &&
+            rec.dataLen <= particle::protocol::MAX_EVENT_DATA_LENGTH) {
+
+            // Read the name and data in one read, then move the data into place
+            size_t len = rec.nameLen + rec.dataLen;
+            result = (PublishQueueEvent *)new char[sizeof(PublishQueueEvent) + len];
+            if (result) {
+                if (read(lane.headSegment.fd, result->eventData, len) == (int)len) {
+                    result->flags = rec.flags;
+                    memcpy(result->eventName, result->eventData, rec.nameLen);
+                    result->eventName[rec.nameLen] = 0;
+                    memmove(result->eventData, &result->eventData[rec.nameLen], rec.dataLen);
+                    result->eventData[rec.dataLen] = 0;
+                    queuedAt = rec.queuedAt;
+
+                    lane.headSegment.readOffset += sizeof(PublishQueueSegmentRecord) + len;
+                    lane.headSegment.readCount++;
+                    lane.headSegment.filePos = lane.headSegment.readOffset;
+                    _log.trace("readSegmentEvent %d event=%s data=%s", fileNum, result->eventName, result->eventData);
+                }
+                else {
+                    freeEvent(result);
+                    result = NULL;
+                }
             }
         }
+
+        if (!result) {
+            // A segment cannot be resynchronized after a bad record, so discard the rest of it
+            _log.info("discarding corrupted segment %d", fileNum);
+            size_t unsentEvents = countUnsentEvents(lane, fileNum);
+            removeQueueFile(lane, fileNum, unsentEvents);
+            countDrop(PublishQueueDropReason::CORRUPTED, unsentEvents);
+        }
     }
     return result;
 }
 
-void PublishQueuePosix::publishCompleteCallback(bool succeeded, const char *eventName, const char *eventData) {
-    publishComplete = true;
-    publishSuccess = succeeded;
+bool PublishQueuePosix::openSegment(Lane &lane, int fileNum, SegmentState &seg) {
+    int fd = open(lane.fileQueue.getPathForFileNum(fileNum), O_RDWR);
+    if (fd < 0) {
+        return false;
+    }
+
+    PublishQueueSegmentHeader hdr;
+    if (read(fd, &hdr, sizeof(PublishQueueSegmentHeader)) != sizeof(PublishQueueSegmentHeader) ||
+        hdr.magic != SEGMENT_MAGIC ||
+        hdr.version != SEGMENT_VERSION ||
+        hdr.headerSize != sizeof(PublishQueueSegmentHeader) ||
+        hdr.sentOffset < hdr.headerSize) {
+        close(fd);
+        return false;
+    }
+
+    seg.fileNum = fileNum;
+    seg.fd = fd;
+    seg.hdr = hdr;
+    seg.readOffset = hdr.sentOffset;
+    seg.readCount = hdr.sentCount;
+    seg.filePos = sizeof(PublishQueueSegmentHeader);
+    seg.checkpointCount = hdr.sentCount;
+    return true;
 }
 
+size_t PublishQueuePosix::countUnsentEvents(Lane &lane, int fileNum, bool indexKeys) {
+    size_t result = 0;
 
-void PublishQueuePosix::stateConnectWait() {
-    if (Particle.connected()) {
-        stateTime = millis();
-        durationMs = waitAfterConnect;
-        stateHandler = &PublishQueuePosix::stateWait;
+    SegmentState seg;
+    if (!openSegment(lane, fileNum, seg)) {
+        // One event per file
+        return 1;
     }
-    else {
-        if (pausePublishing || getNumEvents() == 0) {
-            canSleep = true;
+
+    // Walk the records after the checkpoint
+    off_t offset = lseek(seg.fd, seg.hdr.sentOffset, SEEK_SET);
+    PublishQueueSegmentRecord rec;
+    while(offset >= 0 && read(seg.fd, &rec, sizeof(PublishQueueSegmentRecord)) == sizeof(PublishQueueSegmentRecord)) {
+        if ((rec.nameLen & SEGMENT_RECORD_SUPERSEDED) == 0) {
+            result++;
+            if (indexKeys && rec.key) {
+                // A later event with the same key replaces this entry
+                indexKey(rec.key, lane, fileNum, (uint32_t) offset, NULL);
+            }
         }
+        offset = lseek(seg.fd, offset + sizeof(PublishQueueSegmentRecord) + (rec.nameLen & ~SEGMENT_RECORD_SUPERSEDED) + rec.dataLen, SEEK_SET);
     }
-}
+    closeSegment(seg);
 
+    return result;
+}
 
-void PublishQueuePosix::stateWait() {
-    if (!Particle.connected()) {
-        stateHandler = &PublishQueuePosix::stateConnectWait;
-        return;
-    }
+uint32_t PublishQueuePosix::segmentQueuedAt(Lane &lane, int fileNum) {
+    uint32_t result = 0;
 
-    if (pausePublishing) {
-        canSleep = true;
-        return;
+    FileSystemTimer timer(*this);
+    SegmentState seg;
+    if (!openSegment(lane, fileNum, seg)) {
+        // One event per file, which has no time
+        return 0;
     }
 
-    if (millis() - stateTime < durationMs) {
-        return;
-    }
-    
-    curFileNum = fileQueue.getFileFromQueue(false);
-    if (curFileNum) {
-        curEvent = readQueueFile(curFileNum);
-        if (!curEvent) {
-            // Probably a corrupted file, discard
-            _log.info("discarding corrupted file %d", curFileNum);
-            fileQueue.getFileFromQueue(true);
-            fileQueue.removeFileNum(curFileNum, false);
-        }
-    }
-    else {
-        if (!ramQueue.empty()) {
-            curEvent = ramQueue.front();
-            ramQueue.pop_front();
-        }
-        else {
-            curEvent = NULL;
+    // The first record after the checkpoint that is not superseded
+    off_t offset = lseek(seg.fd, seg.hdr.sentOffset, SEEK_SET);
+    PublishQueueSegmentRecord rec;
+    while(offset >= 0 && read(seg.fd, &rec, sizeof(PublishQueueSegmentRecord)) == sizeof(PublishQueueSegmentRecord)) {
+        if ((rec.nameLen & SEGMENT_RECORD_SUPERSEDED) == 0) {
+            result = rec.queuedAt;
+            break;
         }
+        offset = lseek(seg.fd, offset + sizeof(PublishQueueSegmentRecord) + (rec.nameLen & ~SEGMENT_RECORD_SUPERSEDED) + rec.dataLen, SEEK_SET);
     }
+    closeSegment(seg);
 
-    if (curEvent) {
-        stateTime = millis();
-        stateHandler = &PublishQueuePosix::statePublishWait;
-        publishComplete = false;
-        publishSuccess = false;
-        canSleep = false;
-
-        // This message is monitored by the automated test tool. If you edit this, change that too.
-        _log.trace("publishing %s event=%s data=%s", (curFileNum ? "file" : "ram"), curEvent->eventName, curEvent->eventData);
+    return result;
+}
 
-        if (BackgroundPublishRK::instance().publish(curEvent->eventName, curEvent->eventData, curEvent->flags, 
-            [this](bool succeeded, const char *eventName, const char *eventData, const void *context) {
-                publishCompleteCallback(succeeded, eventName, eventData);
-            })) {
-            // Successfully started publish
-        }
-    }
-    else {
-        // No events, can sleep
-        canSleep = true;
+void PublishQueuePosix::closeSegment(SegmentState &seg) {
+    if (seg.fd >= 0) {
+        close(seg.fd);
+        seg.fd = -1;
     }
+    // Events may have been appended or superseded, so it's read again
+    seg.exhausted = false;
 }
-void PublishQueuePosix::statePublishWait() {
-    if (!publishComplete) {
-        return;
-    }
-
-    if (publishSuccess) {
-        // Remove from the queue
-        _log.trace("publish success %d", curFileNum);
 
-        if (curFileNum) {
-            // Was from the file-based queue
-            int fileNum = fileQueue.getFileFromQueue(false);
-            if (fileNum == curFileNum) {
-                fileQueue.getFileFromQueue(true);
-                fileQueue.removeFileNum(fileNum, false);
-                _log.trace("removed file %d", fileNum);
-            }
-            curFileNum = 0;
+void PublishQueuePosix::checkpointSegment(Lane &lane) {
+    FileSystemTimer timer(*this);
+    WITH_LOCK(*this) {
+        if (!lane.headSegment.fileNum || lane.headSegment.hdr.sentCount == lane.headSegment.checkpointCount) {
+            return;
         }
 
-        delete curEvent;
-        curEvent = NULL;
-        durationMs = waitBetweenPublish;
-    }
-    else {
-        // Wait and retry
-        // This message is monitored by the automated test tool. If you edit this, change that too.
-        _log.trace("publish failed %d", curFileNum);
-        durationMs = waitAfterFailure;
-
-        if (curFileNum) {
-            // Was from the file-based queue
-            delete curEvent;
-            curEvent = NULL;
+        int fd = lane.headSegment.fd;
+        if (fd < 0) {
+            fd = open(lane.fileQueue.getPathForFileNum(lane.headSegment.fileNum), O_RDWR);
         }
-        else {
-            // Was in the RAM-based queue, put back
-            WITH_LOCK(*this) {
-                ramQueue.push_front(curEvent);
+        if (fd >= 0) {
+            lseek(fd, 0, SEEK_SET);
+            bool ok = write(fd, &lane.headSegment.hdr, sizeof(PublishQueueSegmentHeader)) == sizeof(PublishQueueSegmentHeader);
+            if (fd != lane.headSegment.fd) {
+                close(fd);
             }
-            // Then write the entire queue to files
-            _log.trace("writing to files after publish failure");
-            writeQueueToFiles();
+            // Unknown after a short write, so the next read seeks
+            lane.headSegment.filePos = ok ? sizeof(PublishQueueSegmentHeader) : (uint32_t)-1;
+            if (!ok) {
+                // Tried again at the next checkpoint; until then a reset only resends events
+                _log.error("could not checkpoint segment %d", lane.headSegment.fileNum);
+                return;
+            }
+            lane.headSegment.checkpointCount = lane.headSegment.hdr.sentCount;
+            _log.trace("checkpoint segment %d sent %u", lane.headSegment.fileNum, lane.headSegment.hdr.sentCount);
         }
     }
-
-    stateHandler = &PublishQueuePosix::stateWait;
-    stateTime = millis();
 }
 
+void PublishQueuePosix::removeQueueFile(Lane &lane, int fileNum, size_t unsentEvents) {
+    FileSystemTimer timer(*this);
+    WITH_LOCK(*this) {
+        if (lane.fileQueue.getFileFromQueue(false) == fileNum) {
+            lane.fileQueue.getFileFromQueue(true);
+        }
+        if (lane.headSegment.fileNum == fileNum) {
+            closeSegment(lane.headSegment);
+            lane.headSegment = SegmentState();
+        }
+        if (lane.tailSegment.fileNum == fileNum) {
+            lane.tailSegment = SegmentState();
+        }
+        lane.fileQueue.removeFileNum(fileNum, false);
+
+        lane.fileQueueEvents -= (unsentEvents < lane.fileQueueEvents) ? unsentEvents : lane.fileQueueEvents;
+    }
+}
+
+void PublishQueuePosix::countFileQueueEvents(Lane &lane) {
+    FileSystemTimer timer(*this);
+    WITH_LOCK(*this) {
+        if (!segmentSize) {
+            // One event per file
+            lane.fileQueueEvents = lane.fileQueue.getQueueLen();
+            return;
+        }
+
+        lane.fileQueueEvents = 0;
+        lane.fileQueue.forEachFileInQueue([this, &lane](int fileNum) {
+            lane.fileQueueEvents += countUnsentEvents(lane, fileNum, true);
+        });
+        _log.trace("fileQueueEvents=%u in %d files", lane.fileQueueEvents, lane.fileQueue.getQueueLen());
+    }
+}
+
+// [static]
+uint32_t PublishQueuePosix::keyHash(PublishQueuePriority priority, const char *eventName, const char *key) {
+    // FNV-1a over the priority, event name, and key
+    uint32_t hash = 2166136261;
+    auto add = [&hash](uint8_t c) {
+        hash = (hash ^ c) * 16777619;
+    };
+
+    add((uint8_t) priority);
+    for(const char *cp = eventName; *cp; cp++) {
+        add((uint8_t) *cp);
+    }
+    add(0);
+    for(const char *cp = key; *cp; cp++) {
+        add((uint8_t) *cp);
+    }
+    return hash ? hash : 1;
+}
+
+// [static]
+uint32_t PublishQueuePosix::keyCheck(PublishQueuePriority priority, const char *eventName, const char *key) {
+    // djb2 over the same bytes, so two keys with the same keyHash() are still told apart
+    uint32_t hash = 5381;
+    auto add = [&hash](uint8_t c) {
+        hash = (hash * 33) ^ c;
+    };
+
+    add((uint8_t) priority);
+    for(const char *cp = eventName; *cp; cp++) {
+        add((uint8_t) *cp);
+    }
+    add(0);
+    for(const char *cp = key; *cp; cp++) {
+        add((uint8_t) *cp);
+    }
+    return hash ? hash : 1;
+}
+
+bool PublishQueuePosix::isSameKey(const PublishQueueKeyIndex::Entry &entry, Lane &lane, const char *eventName, uint32_t check) {
+    if (entry.lane != laneIndex(lane) || (entry.check && entry.check != check)) {
+        return false;
+    }
+    if (!entry.fileNum) {
+        return strcmp(entry.event->eventName, eventName) == 0;
+    }
+    // The name of an event in a file or the FRAM ring is compared when it's superseded
+    return true;
+}
+
+PublishQueueKeyIndex::Entry *PublishQueuePosix::findKey(uint32_t key) {
+    PublishQueueKeyIndex::Entry *entry = keyIndex.find(key);
+    if (entry && !isKeyEntryValid(*entry)) {
+        keyIndex.erase(entry);
+        entry = NULL;
+    }
+    return entry;
+}
+
+bool PublishQueuePosix::isKeyEntryValid(const PublishQueueKeyIndex::Entry &entry) {
+    Lane &lane = lanes[entry.lane];
+
+    if (!entry.fileNum) {
+        // Events are removed from the index when they leave the RAM queue
+        return !lane.ramQueue.isSending(entry.event);
+    }
+    if (entry.fileNum == SPILL_FILE_NUM) {
+        // The events of the lane at the front of the FRAM ring are being sent
+        return spill.unsentIndex(entry.lane, entry.offset) >= (int) lane.spillSending;
+    }
+
+    // Files are only removed from the head of the queue, and the head segment is read in order
+    int headFileNum = lane.fileQueue.getFileFromQueue(false);
+    if (!headFileNum || entry.fileNum < headFileNum) {
+        return false;
+    }
+    if (lane.headSegment.fileNum == entry.fileNum && entry.offset < lane.headSegment.readOffset) {
+        return false;
+    }
+    return true;
+}
+
+void PublishQueuePosix::indexKey(uint32_t key, Lane &lane, int fileNum, uint32_t offset, PublishQueueEvent *event) {
+    PublishQueueKeyIndex::Entry *entry = keyIndex.insert(key);
+    if (!entry && keyIndex.getMaxKeys()) {
+        // Make room by removing the entries for events that have been sent or discarded
+        keyIndex.eraseIf([this](const PublishQueueKeyIndex::Entry &entry) {
+            return !isKeyEntryValid(entry);
+        });
+        entry = keyIndex.insert(key);
+        if (!entry) {
+            _log.info("too many keys, event will not be replaced");
+        }
+    }
+    if (entry) {
+        entry->lane = (uint8_t)(&lane - lanes);
+        entry->fileNum = fileNum;
+        entry->offset = offset;
+        entry->event = event;
+    }
+}
+
+void PublishQueuePosix::unindexRamEvent(Lane &lane, const PublishQueueEvent *event) {
+    uint32_t key = lane.ramQueue.getKey(event);
+    if (key) {
+        PublishQueueKeyIndex::Entry *entry = keyIndex.find(key);
+        if (entry && !entry->fileNum && entry->event == event) {
+            keyIndex.erase(entry);
+        }
+    }
+}
+
+bool PublishQueuePosix::isRamEventIndexed(Lane &lane, const PublishQueueEvent *event) {
+    PublishQueueKeyIndex::Entry *entry = keyIndex.find(lane.ramQueue.getKey(event));
+    return entry && !entry->fileNum && entry->event == event;
+}
+
+bool PublishQueuePosix::supersedeSegmentEvent(Lane &lane, int fileNum, uint32_t offset, const char *eventName) {
+    bool result = false;
+
+    FileSystemTimer timer(*this);
+    WITH_LOCK(*this) {
+        if (lane.headSegment.fileNum == fileNum) {
+            // Reopened by the next read so it sees the change
+            closeSegment(lane.headSegment);
+        }
+
+        int fd = open(lane.fileQueue.getPathForFileNum(fileNum), O_RDWR);
+        if (fd < 0) {
+            return false;
+        }
+
+        // Only the nameLen byte of the record is rewritten, and only if it's the same event name
+        PublishQueueSegmentRecord rec;
+        char name[particle::protocol::MAX_EVENT_NAME_LENGTH];
+        size_t nameLen = strlen(eventName);
+        if (lseek(fd, offset, SEEK_SET) == (off_t) offset &&
+            read(fd, &rec, sizeof(PublishQueueSegmentRecord)) == sizeof(PublishQueueSegmentRecord) &&
+            rec.nameLen == nameLen && nameLen <= sizeof(name) &&
+            read(fd, name, nameLen) == (ssize_t)nameLen && memcmp(name, eventName, nameLen) == 0) {
+            rec.nameLen |= SEGMENT_RECORD_SUPERSEDED;
+            lseek(fd, offset + offsetof(PublishQueueSegmentRecord, nameLen), SEEK_SET);
+            if (write(fd, &rec.nameLen, sizeof(rec.nameLen)) == sizeof(rec.nameLen)) {
+                if (lane.fileQueueEvents) {
+                    lane.fileQueueEvents--;
+                }
+                _log.trace("superseded event at %u in segment %d", offset, fileNum);
+                result = true;
+            }
+            else {
+                // The older event stays in the queue and is sent as well
+                _log.error("could not supersede event at %u in segment %d", offset, fileNum);
+            }
+        }
+        close(fd);
+    }
+    return result;
+}
+
+PublishQueueEvent *PublishQueuePosix::readQueueFile(Lane &lane, int fileNum) {
+    PublishQueueEvent *result = NULL;
+
+    FileSystemTimer timer(*this);
+
+    int fd = open(lane.fileQueue.getPathForFileNum(fileNum), O_RDONLY);
+    if (fd >= 0) {
+        struct stat sb;
+        fstat(fd, &sb);
+
+        _log.trace("fileNum=%d size=%ld", fileNum, sb.st_size);
+
+        PublishQueueFileHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        
+        lseek(fd, 0, SEEK_SET);
+        if (read(fd, &hdr, sizeof(PublishQueueFileHeader)) == sizeof(PublishQueueFileHeader) &&
+            sb.st_size >= (off_t)(sizeof(PublishQueueFileHeader) + sizeof(PublishQueueEvent)) &&
+            hdr.magic == FILE_MAGIC && 
+            hdr.version == FILE_VERSION &&
+            hdr.headerSize == sizeof(PublishQueueFileHeader) &&
+            hdr.nameLen == sizeof(PublishQueueEvent::eventName)) {
+
+            size_t eventSize = sb.st_size - sizeof(PublishQueueFileHeader);
+
+            result = (PublishQueueEvent *)new char[eventSize];
+            if (result) {
+                if (read(fd, result, eventSize) == (ssize_t)eventSize && ((char *)result)[eventSize - 1] == 0 && strlen(result->eventName) < (sizeof(PublishQueueEvent::eventName) - 1)) {
+                    _log.trace("readQueueFile %d event=%s data=%s", fileNum, result->eventName, result->eventData);
+                }
+                else {
+                    _log.trace("readQueueFile %d corrupted event name or data", fileNum);
+                    freeEvent(result);
+                    result = NULL;
+                }
+
+            }
+        } else {
+            _log.trace("readQueueFile %d bad magic=%08lx version=%u headerSize=%u nameLen=%u", fileNum, hdr.magic, hdr.version, hdr.headerSize, hdr.nameLen);
+        }
+
+        close(fd);
+    }
+    return result;
+}
+
+PublishQueueEvent *PublishQueuePosix::newBatchEvent(const char *batchName, PublishFlags flags) {
+    PublishQueueEvent *event;
+
+    // eventData[1] in the structure leaves room for the null terminator
+    event = (PublishQueueEvent *) new char[sizeof(PublishQueueEvent) + particle::protocol::MAX_EVENT_DATA_LENGTH];
+    if (event) {
+        event->flags = flags;
+        strcpy(event->eventName, batchName);
+        strcpy(event->eventData, "[");
+    }
+    return event;
+}
+
+bool PublishQueuePosix::addToBatch(PublishQueueEvent *batch, size_t &len, const PublishQueueEvent *event) const {
+    size_t sep = (len > 1) ? 1 : 0;
+    if ((len + sep + 1) > particle::protocol::MAX_EVENT_DATA_LENGTH) {
+        return false;
+    }
+
+    // Leave room for the closing bracket
+    size_t avail = particle::protocol::MAX_EVENT_DATA_LENGTH - len - sep - 1;
+    size_t elementLen = formatBatchElement(&batch->eventData[len + sep], avail, event, batch->eventName);
+    if (elementLen > avail) {
+        // Restore the closing bracket, which may have been overwritten
+        batch->eventData[len] = ']';
+        batch->eventData[len + 1] = 0;
+        return false;
+    }
+    if (sep) {
+        batch->eventData[len] = ',';
+    }
+    len += sep + elementLen;
+
+    batch->eventData[len] = ']';
+    batch->eventData[len + 1] = 0;
+    return true;
+}
+
+// [static]
+size_t PublishQueuePosix::formatBatchElement(char *buf, size_t bufSize, const PublishQueueEvent *event, const char *batchName) {
+    size_t len = 0;
+
+    auto put = [&](char c) {
+        if (len < bufSize) {
+            buf[len] = c;
+        }
+        len++;
+    };
+    auto putString = [&](const char *str) {
+        while(*str) {
+            put(*str++);
+        }
+    };
+    auto putJsonString = [&](const char *str) {
+        put('"');
+        for(; *str; str++) {
+            uint8_t c = (uint8_t) *str;
+            if (c == '"' || c == '\\') {
+                put('\\');
+                put(c);
+            }
+            else if (c < 0x20) {
+                char hex[7];
+                snprintf(hex, sizeof(hex), "\\u%04x", c);
+                putString(hex);
+            }
+            else {
+                put(c);
+            }
+        }
+        put('"');
+    };
+    auto putData = [&]() {
+        if (event->eventData[0] == '{' || event->eventData[0] == '[') {
+            putString(event->eventData);
+        }
+        else {
+            putJsonString(event->eventData);
+        }
+    };
+
+    if (strcmp(event->eventName, batchName) == 0) {
+        putData();
+    }
+    else {
+        putString("{\"name\":");
+        putJsonString(event->eventName);
+        putString(",\"data\":");
+        putData();
+        put('}');
+    }
+    return len;
+}
+
+PublishQueueEvent *PublishQueuePosix::batchFromRamQueue(Lane &lane, const char *batchName) {
+    PublishQueueEvent *batch = NULL;
+
+    WITH_LOCK(*this) {
+        size_t sending = lane.ramQueue.getSending();
+        PublishQueueEvent *first = lane.ramQueue.frontUnsent();
+        lane.ramQueue.setSending(sending + 1);
+
+        batch = newBatchEvent(batchName, first->flags);
+        size_t len = 1;
+        if (!batch || !addToBatch(batch, len, first)) {
+            // Too large to batch, send it unchanged
+            if (batch) {
+                freeEvent(batch);
+            }
+            return first;
+        }
+
+        // Only the events that follow in the RAM queue are added, to keep the order
+        size_t count = 1;
+        for(PublishQueueEvent *event = lane.ramQueue.next(first); event; event = lane.ramQueue.next(event)) {
+            const char *name = getBatchName(event->eventName);
+            if (!name || strcmp(name, batchName) != 0 || event->flags.value() != first->flags.value() || !addToBatch(batch, len, event)) {
+                break;
+            }
+            count++;
+        }
+        lane.ramQueue.setSending(sending + count);
+        _log.trace("batch %s of %u events from ramQueue, %u bytes", batchName, count, strlen(batch->eventData));
+    }
+    return batch;
+}
+
+PublishQueueEvent *PublishQueuePosix::batchFromFile(Lane &lane, PublishQueueEvent *first, const char *batchName) {
+    PublishQueueEvent *batch = newBatchEvent(batchName, first->flags);
+    size_t len = 1;
+    if (!batch || !addToBatch(batch, len, first)) {
+        // Too large to batch, send it unchanged
+        if (batch) {
+            freeEvent(batch);
+        }
+        return first;
+    }
+    curBatchCount = 1;
+
+    // Only the events that follow in the same segment are added, to keep the order
+    while(curFromSegment) {
+        uint32_t readOffset = lane.headSegment.readOffset;
+        uint16_t readCount = lane.headSegment.readCount;
+
+        bool isSegment;
+        uint32_t queuedAt;
+        PublishQueueEvent *event = readSegmentEvent(lane, curFileNum, isSegment, queuedAt);
+        if (!event) {
+            break;
+        }
+
+        const char *name = getBatchName(event->eventName);
+        bool added = name && strcmp(name, batchName) == 0 && event->flags.value() == first->flags.value() && addToBatch(batch, len, event);
+        freeEvent(event);
+
+        if (!added) {
+            // Read it again next time
+            lane.headSegment.readOffset = readOffset;
+            lane.headSegment.readCount = readCount;
+            break;
+        }
+        curBatchCount++;
+    }
+    freeEvent(first);
+
+    _log.trace("batch %s of %u events from file %d, %u bytes", batchName, curBatchCount, curFileNum, len + 1);
+    return batch;
+}
+
+void PublishQueuePosix::clearQueues() {
+    WITH_LOCK(*this) {
+        countDrop(PublishQueueDropReason::CLEARED, getNumEvents());
+
+        for(size_t ii = 0; ii < NUM_LANES; ii++) {
+            Lane &lane = lanes[ii];
+
+            lane.ramQueue.clear();
+            lane.spillSending = 0;
+
+            closeSegment(lane.headSegment);
+            lane.headSegment = SegmentState();
+            lane.tailSegment = SegmentState();
+            lane.fileQueueEvents = 0;
+
+            // The directories are kept, as the lane subdirectories are inside the TELEMETRY lane directory
+            lane.fileQueue.removeAll(false);
+        }
+        keyIndex.clear();
+        spill.clear();
+
+        // The publishes in flight complete, but their events are already gone and aren't sent again
+        for(size_t ii = 0; ii < inFlightCount; ii++) {
+            InFlight &publish = inFlight[(inFlightHead + ii) % maxInFlight];
+            publish.lane = NULL;
+            if (!publish.ownsEvent) {
+                publish.event = NULL;                           // Was in the RAM queue
+            }
+        }
+    }
+
+    _log.trace("clearQueues");
+}
+
+void PublishQueuePosix::setPausePublishing(bool value) { 
+    pausePublishing = value; 
+
+    if (!value) {
+        // When resuming publishing, update the canSleep flag
+        if (getNumEvents() != 0) {
+            canSleep = false;
+        }
+    }
+}
+
+
+
+void PublishQueuePosix::checkQueueLimits() {
+    WITH_LOCK(*this) {
+        for(size_t ii = 0; ii < NUM_LANES; ii++) {
+            checkQueueLimits(lanes[ii]);
+        }
+    }
+}
+
+void PublishQueuePosix::checkQueueLimits(Lane &lane) {
+    WITH_LOCK(*this) {
+        if (lane.ramQueue.size() - lane.ramQueue.getSending() > lane.ramQueueSize) {
+            // RAM queue is too large, move all to files
+            writeQueueToFiles(lane);
+        }
+
+        while(lane.fileQueueEvents > lane.fileQueueSize) {
+            int fileNum = lane.fileQueue.getFileFromQueue(false);
+            if (!fileNum) {
+                lane.fileQueueEvents = 0;
+                break;
+            }
+
+            if (segmentSize) {
+                // Checkpoint first so the events already sent are not counted
+                checkpointSegment(lane);
+                size_t unsentEvents = countUnsentEvents(lane, fileNum);
+                removeQueueFile(lane, fileNum, unsentEvents);
+                _log.info("discarded %u events in %d", unsentEvents, fileNum);
+                countDrop(PublishQueueDropReason::LANE_FULL, unsentEvents);
+            }
+            else {
+                removeQueueFile(lane, fileNum, 1);
+                _log.info("discarded event %d", fileNum);
+                countDrop(PublishQueueDropReason::LANE_FULL);
+            }
+        }
+    }
+}
+
+size_t PublishQueuePosix::getNumEvents() {
+    size_t result = 0;
+
+    WITH_LOCK(*this) {
+        for(size_t ii = 0; ii < NUM_LANES; ii++) {
+            result += countLaneEvents(lanes[ii]);
+        }
+    }
+    return result;
+}
+
+size_t PublishQueuePosix::getNumEvents(PublishQueuePriority priority) {
+    size_t result = 0;
+
+    WITH_LOCK(*this) {
+        result = countLaneEvents(getLane(priority));
+    }
+    return result;
+}
+
+void PublishQueuePosix::getStats(PublishQueueStats &result) {
+    WITH_LOCK(*this) {
+        result = stats;
+        result.periodMs = millis() - statsTime;
+        result.fileSystemMs = (uint32_t)(fileSystemUs / 1000);
+
+        result.ramEvents = result.fileEvents = result.spillEvents = 0;
+        result.ramBytes = 0;
+        uint32_t oldest = 0;
+        for(size_t ii = 0; ii < NUM_LANES; ii++) {
+            Lane &lane = lanes[ii];
+            result.ramEvents += lane.ramQueue.size();
+            result.fileEvents += lane.fileQueueEvents;
+            result.ramBytes += lane.ramQueue.getBytesUsed();
+            result.spillEvents += spill.size(laneIndex(lane));
+
+            // The FRAM ring is older than the file queue, which is older than the RAM queue of the same lane
+            uint32_t queuedAt = 0;
+            int fileNum = lane.fileQueue.getFileFromQueue(false);
+            if (spill.size(laneIndex(lane))) {
+                queuedAt = spill.frontQueuedAt(laneIndex(lane));
+            }
+            else if (fileNum && segmentSize) {
+                queuedAt = segmentQueuedAt(lane, fileNum);
+            }
+            else if (!fileNum && !lane.ramQueue.empty()) {
+                queuedAt = lane.ramQueue.getQueuedAt(lane.ramQueue.front());
+            }
+            if (queuedAt && (!oldest || queuedAt < oldest)) {
+                oldest = queuedAt;
+            }
+        }
+        uint32_t now = queuedAtNow();
+        result.oldestAge = (oldest && now >= oldest) ? now - oldest : 0;
+    }
+}
+
+void PublishQueuePosix::resetStats() {
+    WITH_LOCK(*this) {
+        stats = {};
+        statsTime = millis();
+        fileSystemUs = 0;
+    }
+}
+
+PublishQueuePosix &PublishQueuePosix::withStatsPublish(const char *eventName, unsigned long periodMs) {
+    statsEventName = eventName ? eventName : "";
+    statsPeriodMs = eventName ? periodMs : 0;
+    statsTime = millis();
+    return *this;
+}
+
+void PublishQueuePosix::publishStats() {
+    PublishQueueStats current;
+    getStats(current);
+    resetStats();
+
+    if (statsEventName.length() == 0) {
+        return;
+    }
+
+    char buf[particle::protocol::MAX_EVENT_DATA_LENGTH + 1];
+    size_t len = 0;
+    auto append = [&buf, &len](const char *fmt, ...) {
+        if (len < sizeof(buf)) {
+            va_list ap;
+            va_start(ap, fmt);
+            int count = vsnprintf(&buf[len], sizeof(buf) - len, fmt, ap);
+            va_end(ap);
+            len += (count > 0) ? count : 0;
+        }
+    };
+    auto appendArray = [&append](const char *name, const uint32_t *values, size_t count) {
+        append(",\"%s\":[", name);
+        for(size_t ii = 0; ii < count; ii++) {
+            append((ii == 0) ? "%lu" : ",%lu", (unsigned long)values[ii]);
+        }
+        append("]");
+    };
+
+    append("{\"t\":%lu,\"q\":%lu,\"qb\":%lu,\"s\":%lu,\"p\":%lu,\"f\":%lu,\"r\":%lu", 
+        (unsigned long)(current.periodMs / 1000), (unsigned long)current.eventsQueued, (unsigned long)current.bytesQueued, 
+        (unsigned long)current.eventsSent, (unsigned long)current.publishes, (unsigned long)current.publishFailures, (unsigned long)current.eventsResent);
+    appendArray("d", current.drops, PublishQueueStats::NUM_DROP_REASONS);
+    appendArray("ql", current.queueLatency, PublishQueueStats::NUM_BUCKETS);
+    appendArray("pl", current.publishLatency, PublishQueueStats::NUM_BUCKETS);
+    append(",\"fs\":%lu,\"mr\":%u,\"mf\":%u,\"mb\":%lu,\"r0\":%u,\"f0\":%u,\"s0\":%u,\"b0\":%lu,\"age\":%lu}", 
+        (unsigned long)current.fileSystemMs, current.maxRamEvents, current.maxFileEvents, (unsigned long)current.maxRamBytes,
+        current.ramEvents, current.fileEvents, current.spillEvents, (unsigned long)current.ramBytes, (unsigned long)current.oldestAge);
+
+    if (len < sizeof(buf)) {
+        publish(PublishQueuePriority::DIAGNOSTICS, statsEventName.c_str(), buf, PRIVATE);
+    }
+}
+
+void PublishQueuePosix::updateMaxDepths() {
+    size_t ramEvents = 0, fileEvents = 0, ramBytes = 0;
+    for(size_t ii = 0; ii < NUM_LANES; ii++) {
+        ramEvents += lanes[ii].ramQueue.size();
+        fileEvents += lanes[ii].fileQueueEvents;
+        ramBytes += lanes[ii].ramQueue.getBytesUsed();
+    }
+    if (ramEvents > stats.maxRamEvents) {
+        stats.maxRamEvents = (uint16_t) ramEvents;
+    }
+    if (fileEvents > stats.maxFileEvents) {
+        stats.maxFileEvents = (uint16_t) fileEvents;
+    }
+    if (ramBytes > stats.maxRamBytes) {
+        stats.maxRamBytes = ramBytes;
+    }
+}
+
+// [static]
+void PublishQueuePosix::addToHistogram(uint32_t *buckets, const uint32_t *limits, uint32_t value) {
+    size_t ii;
+    for(ii = 0; ii < PublishQueueStats::NUM_BUCKETS - 1 && value >= limits[ii]; ii++) {
+    }
+    buckets[ii]++;
+}
+
+unsigned long PublishQueuePosix::getTimeToDrainMs() {
+    size_t waiting = getNumEvents();
+    if (waiting == 0) {
+        return 0;
+    }
+
+    // The events in flight are still counted in the queue, but only need their acknowledgement. The ones that
+    // failed have to be published again.
+    for(size_t ii = 0; ii < inFlightCount; ii++) {
+        const InFlight &publish = inFlight[(inFlightHead + ii) % maxInFlight];
+        if (!publish.failed) {
+            waiting -= (publish.eventCount < waiting) ? publish.eventCount : waiting;
+        }
+    }
+
+    unsigned long now = millis();
+    unsigned long result = 0;
+    if (!Particle.connected()) {
+        result += waitAfterConnect;
+    }
+    else if (now - stateTime < durationMs) {
+        result += durationMs - (now - stateTime);
+    }
+
+    // With only maxInFlight outstanding, the latency can limit the rate more than the token bucket does
+    unsigned long intervalMs = governor.getIntervalMs();
+    if (governor.getLatencyMs() / maxInFlight > intervalMs) {
+        intervalMs = governor.getLatencyMs() / maxInFlight;
+    }
+
+    size_t tokens = governor.available(now);
+    if (waiting > tokens) {
+        result += (waiting - tokens) * intervalMs;
+    }
+    return result + governor.getLatencyMs();
+}
+
+size_t PublishQueuePosix::countLaneEvents(const Lane &lane) const {
+    // An event being sent from the RAM queue stays in it until the publish completes, the same as
+    // an event sent from a file, so it's counted either way
+    size_t result = lane.ramQueue.size();
+    if (result == 0) {
+        result = lane.fileQueueEvents;
+    }
+    return result + spill.size(laneIndex(lane));
+}
+
+PublishQueuePosix::Lane *PublishQueuePosix::selectLane() {
+    if (drainPolicy == DrainPolicy::STRICT) {
+        for(size_t ii = 0; ii < NUM_LANES; ii++) {
+            if (laneHasEvents(lanes[ii])) {
+                return &lanes[ii];
+            }
+        }
+        return NULL;
+    }
+
+    // Weighted: the highest priority lane with events and credit left. When no lane
+    // with events has credit, a new round starts.
+    for(int round = 0; round < 2; round++) {
+        for(size_t ii = 0; ii < NUM_LANES; ii++) {
+            if (lanes[ii].credit > 0 && laneHasEvents(lanes[ii])) {
+                return &lanes[ii];
+            }
+        }
+        for(size_t ii = 0; ii < NUM_LANES; ii++) {
+            lanes[ii].credit = lanes[ii].weight;
+        }
+    }
+    return NULL;
+}
+
+void PublishQueuePosix::publishCompleteCallback(bool succeeded, const char *eventName, const char *eventData, const void *context) {
+    InFlight *publish = (InFlight *)context;
+    publish->latencyMs = millis() - publish->startMs;
+    publish->success = succeeded;
+    publish->complete = true;
+}
+
+void PublishQueuePosix::completeInFlight() {
+    // Acknowledged in order, so the queue only moves past an event once the cloud has it. A publish
+    // that failed holds back the ones after it until it's sent again.
+    while(inFlightCount > 0 && inFlight[inFlightHead].complete) {
+        InFlight &publish = inFlight[inFlightHead];
+
+        if (publish.success) {
+            _log.trace("publish success %d", publish.fileNum);
+            finishPublish(publish);
+            governor.succeeded(publish.latencyMs);
+
+            stats.eventsSent += publish.eventCount;
+            addToHistogram(stats.publishLatency, PublishQueueStats::publishLatencyLimits, publish.latencyMs);
+            uint32_t now = queuedAtNow();
+            if (publish.queuedAt && now >= publish.queuedAt) {
+                addToHistogram(stats.queueLatency, PublishQueueStats::queueLatencyLimits, now - publish.queuedAt);
+            }
+            if (inFlightLimit < maxInFlight) {
+                inFlightLimit++;
+            }
+        }
+        else if (publish.lane) {
+            // Kept, with its event, to be sent again
+            break;
+        }
+
+        // Succeeded, or failed after the queue was cleared
+        releaseInFlight(publish);
+        inFlightHead = (inFlightHead + 1) % maxInFlight;
+        inFlightCount--;
+    }
+
+    bool waiting = false;
+    for(size_t ii = 0; ii < inFlightCount; ii++) {
+        InFlight &publish = inFlight[(inFlightHead + ii) % maxInFlight];
+        if (!publish.complete) {
+            waiting = true;
+        }
+        else if (!publish.success && !publish.failed) {
+            // This message is monitored by the automated test tool. If you edit this, change that too.
+            _log.trace("publish failed %d", publish.fileNum);
+            publish.failed = true;
+            inFlightFailures++;
+            stats.publishFailures++;
+            stats.eventsResent += publish.eventCount;
+        }
+    }
+
+    if (inFlightFailures > 0 && !waiting) {
+        // Everything in flight has completed. Only the publishes that failed are sent again, oldest first
+        // and by itself, so a failure that depends on the number in flight can't repeat forever.
+        inFlightLimit = 1;
+        stateTime = millis();
+        durationMs = governor.failed(stateTime, inFlightFailures);
+        inFlightFailures = 0;
+        _log.trace("waiting %lu ms after failure %u, interval now %lu ms", durationMs, governor.getFailureCount(), governor.getIntervalMs());
+    }
+}
+
+void PublishQueuePosix::finishPublish(const InFlight &publish) {
+    Lane *lane = publish.lane;
+    if (!lane) {
+        // The queue was cleared
+        return;
+    }
+
+    if (publish.fromSpill) {
+        // Was from the FRAM ring; marked as sent so it's not sent again after a reset
+        WITH_LOCK(*this) {
+            spill.markSent(laneIndex(*lane), publish.eventCount);
+            lane->spillSending -= (publish.eventCount < lane->spillSending) ? publish.eventCount : lane->spillSending;
+        }
+    }
+    else if (publish.fileNum && publish.fromSegment) {
+        // Was from a segment; the segment is removed when the next read finds nothing left in it
+        WITH_LOCK(*this) {
+            SegmentState &headSegment = lane->headSegment;
+            if (headSegment.fileNum == publish.fileNum) {
+                headSegment.hdr.sentOffset = publish.readOffset;
+                headSegment.hdr.sentCount = publish.readCount;
+                lane->fileQueueEvents -= (publish.eventCount < lane->fileQueueEvents) ? publish.eventCount : lane->fileQueueEvents;
+            }
+        }
+    }
+    else if (publish.fileNum) {
+        // Was from the file-based queue
+        int fileNum = lane->fileQueue.getFileFromQueue(false);
+        if (fileNum == publish.fileNum) {
+            removeQueueFile(*lane, fileNum, 1);
+            _log.trace("removed file %d", fileNum);
+        }
+    }
+    else {
+        // Was from the RAM-based queue. Publishes complete in order, so its events are the oldest.
+        WITH_LOCK(*this) {
+            for(size_t ii = 0; ii < publish.eventCount && !lane->ramQueue.empty(); ii++) {
+                unindexRamEvent(*lane, lane->ramQueue.front());
+                lane->ramQueue.pop_front();
+            }
+        }
+    }
+}
+
+bool PublishQueuePosix::resendFailed() {
+    if (inFlightCount == 0 || !inFlight[inFlightHead].failed || !inFlight[inFlightHead].event) {
+        // Nothing failed, or the queue was cleared and it's discarded by completeInFlight()
+        return false;
+    }
+    InFlight &publish = inFlight[inFlightHead];
+    if (millis() - stateTime < durationMs || governor.available(millis()) == 0) {
+        return true;
+    }
+
+    publish.failed = false;
+    publish.complete = false;
+    publish.success = false;
+    publish.startMs = millis();
+    publish.latencyMs = 0;
+    stats.publishes++;
+    governor.take(publish.startMs);
+
+    // This message is monitored by the automated test tool. If you edit this, change that too.
+    _log.trace("publishing again event=%s data=%s", publish.event->eventName, publish.event->eventData);
+
+    if (!BackgroundPublishRK::instance().publish(publish.event->eventName, publish.event->eventData, publish.event->flags, 
+        [this](bool succeeded, const char *eventName, const char *eventData, const void *context) {
+            publishCompleteCallback(succeeded, eventName, eventData, context);
+        }, &publish)) {
+        // Not started, handled the same as a failed publish
+        publish.complete = true;
+    }
+    return true;
+}
+
+void PublishQueuePosix::releaseInFlight(InFlight &publish) {
+    if (publish.ownsEvent) {
+        freeEvent(publish.event);
+    }
+    publish.event = NULL;
+    publish.ownsEvent = false;
+    publish.failed = false;
+}
+
+bool PublishQueuePosix::isFileInFlight(const Lane &lane, int fileNum) const {
+    for(size_t ii = 0; ii < inFlightCount; ii++) {
+        const InFlight &publish = inFlight[(inFlightHead + ii) % maxInFlight];
+        if (publish.lane == &lane && publish.fileNum == fileNum && !publish.fromSegment) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void PublishQueuePosix::stateConnectWait() {
+    if (Particle.connected()) {
+        stateTime = millis();
+        durationMs = waitAfterConnect;
+        governor.reset(stateTime);
+        stateHandler = &PublishQueuePosix::stateWait;
+    }
+    else {
+        if (pausePublishing || getNumEvents() == 0) {
+            canSleep = true;
+        }
+    }
+}
+
+
+void PublishQueuePosix::stateWait() {
+    if (!Particle.connected()) {
+        stateHandler = &PublishQueuePosix::stateConnectWait;
+        return;
+    }
+
+    if (pausePublishing) {
+        canSleep = (inFlightCount == 0);
+        return;
+    }
+
+    if (inFlightFailures > 0 || !BackgroundPublishRK::instance().canPublish()) {
+        // Wait for the publishes in flight to complete
+        canSleep = false;
+        return;
+    }
+
+    if (resendFailed()) {
+        // Publishes that failed go before any new events
+        canSleep = false;
+        return;
+    }
+
+    if (inFlightCount >= inFlightLimit) {
+        // Wait for a publish to complete
+        canSleep = false;
+        return;
+    }
+
+    if (millis() - stateTime < durationMs || governor.available(millis()) == 0) {
+        return;
+    }
+    
+    curLane = selectLane();
+    if (!curLane) {
+        // No events, can sleep once the publishes in flight complete
+        curEvent = NULL;
+        canSleep = (inFlightCount == 0);
+        return;
+    }
+    Lane &lane = *curLane;
+
+    curBatchCount = 0;
+    uint32_t queuedAt = 0;
+    bool fromSpill = false;
+    WITH_LOCK(*this) {
+        uint8_t index = laneIndex(lane);
+        fromSpill = spill.size(index) > lane.spillSending;
+        if (fromSpill) {
+            curEvent = spill.read(index, lane.spillSending, queuedAt);
+            if (!curEvent && lane.spillSending == 0) {
+                _log.info("discarding event that could not be read from the spill storage");
+                spill.markSent(index, 1);
+                countDrop(PublishQueueDropReason::CORRUPTED);
+            }
+        }
+    }
+
+    curFileNum = fromSpill ? 0 : lane.fileQueue.getFileFromQueue(false);
+    if (fromSpill) {
+        // The FRAM ring is older than the files and the RAM queue. Its events are sent one per publish.
+        if (!curEvent) {
+            canSleep = false;
+            return;
+        }
+        lane.spillSending++;
+    }
+    else if (curFileNum) {
+        if (isFileInFlight(lane, curFileNum)) {
+            // Written one event per file; the next file can't be read until this one is removed
+            curFileNum = 0;
+            canSleep = false;
+            return;
+        }
+        lane.batchWaiting = false;
+        curFromSegment = false;
+        if (segmentSize) {
+            curEvent = readSegmentEvent(lane, curFileNum, curFromSegment, queuedAt);
+        }
+        else {
+            curEvent = readQueueFile(lane, curFileNum);
+        }
+        if (!curEvent && !curFromSegment) {
+            // Probably a corrupted file, discard
+            _log.info("discarding corrupted file %d", curFileNum);
+            removeQueueFile(lane, curFileNum, 1);
+            countDrop(PublishQueueDropReason::CORRUPTED);
+        }
+        if (!curEvent) {
+            // Try the next file, or another lane, on the next loop. The end of a segment with events
+            // in flight is removed after they complete.
+            curFileNum = 0;
+            canSleep = false;
+            return;
+        }
+        const char *batchName = getBatchName(curEvent->eventName);
+        if (batchName) {
+            curEvent = batchFromFile(lane, curEvent, batchName);
+        }
+    }
+    else {
+        WITH_LOCK(*this) {
+            PublishQueueEvent *first = lane.ramQueue.frontUnsent();
+            if (!first) {
+                // Every event in the RAM queue is already being sent
+                canSleep = false;
+                return;
+            }
+            queuedAt = lane.ramQueue.getQueuedAt(first);
+            const char *batchName = getBatchName(first->eventName);
+            if (batchName) {
+                if (!lane.batchWaiting) {
+                    lane.batchWaiting = true;
+                    lane.batchWindowStart = millis();
+                }
+                if (millis() - lane.batchWindowStart < batchWindowMs) {
+                    // Give more events a chance to join the batch
+                    canSleep = false;
+                    return;
+                }
+                lane.batchWaiting = false;
+                curEvent = batchFromRamQueue(lane, batchName);
+            }
+            else {
+                // Sent from the RAM queue buffer, where it stays until the publish completes
+                curEvent = first;
+                lane.ramQueue.setSending(lane.ramQueue.getSending() + 1);
+            }
+        }
+    }
+
+    if (curEvent) {
+        if (lane.credit > 0) {
+            lane.credit--;
+        }
+
+        InFlight &publish = inFlight[(inFlightHead + inFlightCount) % maxInFlight];
+        publish.lane = &lane;
+        publish.fileNum = curFileNum;
+        publish.fromSegment = curFileNum && curFromSegment;
+        publish.fromSpill = fromSpill;
+        publish.readOffset = lane.headSegment.readOffset;
+        publish.readCount = lane.headSegment.readCount;
+        publish.complete = false;
+        publish.success = false;
+        publish.failed = false;
+        publish.event = curEvent;
+        publish.ownsEvent = !lane.ramQueue.owns(curEvent);      // Otherwise it stays in the RAM queue until acknowledged
+        if (fromSpill) {
+            publish.eventCount = 1;
+        }
+        else if (curFileNum) {
+            publish.eventCount = curBatchCount ? curBatchCount : 1;
+        }
+        else {
+            // The RAM queue events sent before this one are in the other publishes in flight
+            size_t sendingBefore = 0;
+            for(size_t ii = 0; ii < inFlightCount; ii++) {
+                const InFlight &prev = inFlight[(inFlightHead + ii) % maxInFlight];
+                if (prev.lane == &lane && !prev.fileNum && !prev.fromSpill) {
+                    sendingBefore += prev.eventCount;
+                }
+            }
+            publish.eventCount = lane.ramQueue.getSending() - sendingBefore;
+        }
+        inFlightCount++;
+
+        publish.startMs = millis();
+        publish.latencyMs = 0;
+        publish.queuedAt = queuedAt;
+        stats.publishes++;
+        governor.take(publish.startMs);
+        canSleep = false;
+
+        // This message is monitored by the automated test tool. If you edit this, change that too.
+        _log.trace("publishing %s event=%s data=%s", (fromSpill ? "spill" : (curFileNum ? "file" : "ram")), curEvent->eventName, curEvent->eventData);
+
+        if (!BackgroundPublishRK::instance().publish(curEvent->eventName, curEvent->eventData, curEvent->flags, 
+            [this](bool succeeded, const char *eventName, const char *eventData, const void *context) {
+                publishCompleteCallback(succeeded, eventName, eventData, context);
+            }, &publish)) {
+            // Not started, handled the same as a failed publish
+            publish.complete = true;
+        }
+
+        // Kept with the publish, to be sent again if it fails
+        curEvent = NULL;
+        curFileNum = 0;
+    }
+    else {
+        // No events, can sleep once the publishes in flight complete
+        canSleep = (inFlightCount == 0);
+    }
+}
+
+
+PublishQueuePosix::PublishQueuePosix() {
+    Lane &critical = getLane(PublishQueuePriority::CRITICAL);
+    critical.ramQueueSize = 4;
+    critical.ramQueueBytes = 1024;
+    critical.fileQueueSize = 50;
+    critical.weight = 8;
+
+    Lane &telemetry = getLane(PublishQueuePriority::TELEMETRY);
+    telemetry.fileQueue.withDirPath("/usr/pubqueue");
+    telemetry.weight = 4;
+
+    Lane &diagnostics = getLane(PublishQueuePriority::DIAGNOSTICS);
+    diagnostics.ramQueueBytes = 1024;
+    diagnostics.fileQueueSize = 20;
+
+    // The RAM queue buffers are the only allocations for queued events. The index file lets setup() load
+    // the file queue without reading the directory, however long the backlog is.
+    for(size_t ii = 0; ii < NUM_LANES; ii++) {
+        lanes[ii].ramQueue.allocate(lanes[ii].ramQueueBytes);
+        lanes[ii].fileQueue.withIndexFile(".index");
+    }
+}
+
+PublishQueuePosix::~PublishQueuePosix() {
+
+}
+
+void PublishQueuePosix::systemEventHandler(system_event_t event, int param) {
+    if ((event == reset) || ((event == cloud_status) && (param == cloud_status_disconnecting))) {
+        _log.trace("reset or disconnect event, save files to queue");
+        PublishQueuePosix::instance().writeQueueToFiles();
+    }
+}
+
+
+
+PublishQueueRing::PublishQueueRing() {
+}
+
+PublishQueueRing::~PublishQueueRing() {
+    allocate(0);
+}
+
+void PublishQueueRing::allocate(size_t size) {
+    if (buf) {
+        delete[] buf;
+        buf = NULL;
+    }
+    capacity = 0;
+    if (size) {
+        buf = new uint8_t[size];
+        if (buf) {
+            capacity = size;
+        }
+    }
+    clear();
+}
+
+PublishQueueEvent *PublishQueueRing::push_back(const char *eventName, const char *eventData, PublishFlags flags, uint32_t key, uint32_t queuedAt) {
+    size_t len = recordSize(eventData);
+    if (key) {
+        // Leave room so the data can be replaced in place when it grows by a few characters
+        len = (len + KEYED_RECORD_ROUND - 1) & ~(KEYED_RECORD_ROUND - 1);
+    }
+    if (!buf || len >= RECORD_SUPERSEDED) {
+        return NULL;
+    }
+
+    size_t offset;
+    if (records == 0) {
+        if (len > capacity) {
+            return NULL;
+        }
+        offset = 0;
+    }
+    else if (tail > head) {
+        // Free space is at the end and before the head
+        if (tail + len <= capacity) {
+            offset = tail;
+        }
+        else if (len < head) {
+            // Start again at the beginning, marking the end of the used part if there's room
+            if (tail + RECORD_HEADER_SIZE <= capacity) {
+                memset(&buf[tail], 0, RECORD_HEADER_SIZE);
+            }
+            offset = 0;
+        }
+        else {
+            return NULL;
+        }
+    }
+    else {
+        // Free space is between the tail and the head. It's never completely filled so tail == head only when empty.
+        if (tail + len < head) {
+            offset = tail;
+        }
+        else {
+            return NULL;
+        }
+    }
 
-PublishQueuePosix::PublishQueuePosix() {
-    fileQueue.withDirPath("/usr/pubqueue");
+    uint16_t recLen = (uint16_t) len;
+    memcpy(&buf[offset], &recLen, sizeof(recLen));
+    memcpy(&buf[offset + sizeof(recLen)], &key, sizeof(key));
+    memcpy(&buf[offset + sizeof(recLen) + sizeof(key)], &queuedAt, sizeof(queuedAt));
+
+    PublishQueueEvent *event = eventAt(offset);
+    event->flags = flags;
+    strcpy(event->eventName, eventName);
+    strcpy(event->eventData, eventData);
+
+    tail = offset + len;
+    records++;
+    count++;
+    bytesUsed += len;
+    return event;
 }
 
-PublishQueuePosix::~PublishQueuePosix() {
+PublishQueueEvent *PublishQueueRing::front() const {
+    return count ? eventAt(head) : NULL;
+}
 
+PublishQueueEvent *PublishQueueRing::next(const PublishQueueEvent *event) const {
+    size_t offset = skipSuperseded(nextOffset(offsetOf(event)));
+    return (offset == tail) ? NULL : eventAt(offset);
 }
 
-void PublishQueuePosix::systemEventHandler(system_event_t event, int param) {
-    if ((event == reset) || ((event == cloud_status) && (param == cloud_status_disconnecting))) {
-        _log.trace("reset or disconnect event, save files to queue");
-        PublishQueuePosix::instance().writeQueueToFiles();
+void PublishQueueRing::pop_front() {
+    if (count) {
+        popRecord();
+    }
+}
+
+void PublishQueueRing::remove(PublishQueueEvent *event) {
+    size_t offset = offsetOf(event);
+    if (isSuperseded(offset)) {
+        return;
+    }
+    uint16_t recLen = readLen(offset) | RECORD_SUPERSEDED;
+    memcpy(&buf[offset], &recLen, sizeof(recLen));
+    count--;
+
+    if (offset == head) {
+        popRecord();
+    }
+}
+
+bool PublishQueueRing::replace(PublishQueueEvent *event, const char *eventData, PublishFlags flags) {
+    if (recordSize(eventData) > recordLen(offsetOf(event))) {
+        return false;
+    }
+    event->flags = flags;
+    strcpy(event->eventData, eventData);
+    return true;
+}
+
+void PublishQueueRing::clear() {
+    head = tail = 0;
+    records = 0;
+    count = 0;
+    bytesUsed = 0;
+    sending = 0;
+}
+
+uint32_t PublishQueueRing::getKey(const PublishQueueEvent *event) const {
+    uint32_t key;
+    memcpy(&key, &buf[offsetOf(event) + sizeof(uint16_t)], sizeof(key));
+    return key;
+}
+
+uint32_t PublishQueueRing::getQueuedAt(const PublishQueueEvent *event) const {
+    uint32_t queuedAt;
+    memcpy(&queuedAt, &buf[offsetOf(event) + sizeof(uint16_t) + sizeof(uint32_t)], sizeof(queuedAt));
+    return queuedAt;
+}
+
+bool PublishQueueRing::isSending(const PublishQueueEvent *event) const {
+    PublishQueueEvent *sent = front();
+    for(size_t ii = 0; sent && ii < sending; ii++) {
+        if (sent == event) {
+            return true;
+        }
+        sent = next(sent);
+    }
+    return false;
+}
+
+void PublishQueueRing::popSent() {
+    while(sending) {
+        pop_front();
+    }
+}
+
+PublishQueueEvent *PublishQueueRing::frontUnsent() const {
+    PublishQueueEvent *event = front();
+    for(size_t ii = 0; event && ii < sending; ii++) {
+        event = next(event);
+    }
+    return event;
+}
+
+size_t PublishQueueRing::removeUnsent(size_t removeCount) {
+    if (sending == 0) {
+        for(size_t ii = 0; ii < removeCount && count; ii++) {
+            pop_front();
+        }
+        return 0;
+    }
+
+    // Keep only the events being sent by moving the tail to the end of the last one
+    size_t lost = count - sending;
+    lost -= (removeCount < lost) ? removeCount : lost;
+
+    PublishQueueEvent *last = front();
+    for(size_t ii = 1; ii < sending; ii++) {
+        last = next(last);
+    }
+    tail = offsetOf(last) + recordLen(offsetOf(last));
+
+    records = 0;
+    bytesUsed = 0;
+    for(size_t offset = head; offset != tail; offset = nextOffset(offset)) {
+        records++;
+        bytesUsed += recordLen(offset);
+    }
+    count = sending;
+    return lost;
+}
+
+uint16_t PublishQueueRing::readLen(size_t offset) const {
+    uint16_t recLen;
+    memcpy(&recLen, &buf[offset], sizeof(recLen));
+    return recLen;
+}
+
+size_t PublishQueueRing::nextOffset(size_t offset) const {
+    offset += recordLen(offset);
+    return (offset == tail) ? tail : wrap(offset);
+}
+
+size_t PublishQueueRing::skipSuperseded(size_t offset) const {
+    while(offset != tail && isSuperseded(offset)) {
+        offset = nextOffset(offset);
+    }
+    return offset;
+}
+
+void PublishQueueRing::popRecord() {
+    // The head is never left at a superseded record, so those are removed too
+    do {
+        size_t len = recordLen(head);
+        if (!isSuperseded(head)) {
+            count--;
+            if (sending) {
+                sending--;
+            }
+        }
+        bytesUsed -= len;
+        records--;
+
+        if (records == 0) {
+            clear();
+            return;
+        }
+        head = wrap(head + len);
+    } while(isSuperseded(head));
+}
+
+
+PublishQueueKeyIndex::PublishQueueKeyIndex() {
+}
+
+PublishQueueKeyIndex::~PublishQueueKeyIndex() {
+    allocate(0);
+}
+
+void PublishQueueKeyIndex::allocate(size_t maxKeys) {
+    if (slots) {
+        delete[] slots;
+        slots = NULL;
+    }
+    this->maxKeys = 0;
+    mask = 0;
+    used = 0;
+
+    if (maxKeys) {
+        // At most half full so probe sequences stay short
+        size_t numSlots = 1;
+        while(numSlots < 2 * maxKeys) {
+            numSlots <<= 1;
+        }
+        slots = new Entry[numSlots];
+        if (slots) {
+            this->maxKeys = maxKeys;
+            mask = numSlots - 1;
+            clear();
+        }
+    }
+}
+
+PublishQueueKeyIndex::Entry *PublishQueueKeyIndex::find(uint32_t key) {
+    if (!slots) {
+        return NULL;
+    }
+    for(size_t ii = key & mask; slots[ii].key; ii = (ii + 1) & mask) {
+        if (slots[ii].key == key) {
+            return &slots[ii];
+        }
+    }
+    return NULL;
+}
+
+PublishQueueKeyIndex::Entry *PublishQueueKeyIndex::insert(uint32_t key) {
+    if (!slots) {
+        return NULL;
+    }
+    size_t ii;
+    for(ii = key & mask; slots[ii].key; ii = (ii + 1) & mask) {
+        if (slots[ii].key == key) {
+            return &slots[ii];
+        }
+    }
+    if (used >= maxKeys) {
+        return NULL;
+    }
+    memset(&slots[ii], 0, sizeof(Entry));
+    slots[ii].key = key;
+    used++;
+    return &slots[ii];
+}
+
+void PublishQueueKeyIndex::erase(Entry *entry) {
+    size_t hole = entry - slots;
+    slots[hole].key = 0;
+    used--;
+
+    // Move back the entries after it that would no longer be found past the empty slot
+    for(size_t ii = (hole + 1) & mask; slots[ii].key; ii = (ii + 1) & mask) {
+        size_t home = slots[ii].key & mask;
+        bool reachable = (hole <= ii) ? (hole < home && home <= ii) : (hole < home || home <= ii);
+        if (!reachable) {
+            slots[hole] = slots[ii];
+            slots[ii].key = 0;
+            hole = ii;
+        }
+    }
+}
+
+void PublishQueueKeyIndex::eraseIf(std::function<bool(const Entry &entry)> fn) {
+    for(size_t ii = 0; slots && ii <= mask; ii++) {
+        // An entry can move into this slot when one is erased, so check it again
+        while(slots[ii].key && fn(slots[ii])) {
+            erase(&slots[ii]);
+        }
+    }
+}
+
+void PublishQueueKeyIndex::clear() {
+    for(size_t ii = 0; slots && ii <= mask; ii++) {
+        slots[ii].key = 0;
+    }
+    used = 0;
+}
+
+
+PublishQueueGovernor::PublishQueueGovernor() {
+}
+
+PublishQueueGovernor::~PublishQueueGovernor() {
+}
+
+void PublishQueueGovernor::setRate(unsigned long intervalMs, size_t burst) {
+    this->intervalMs = (intervalMs > 0) ? intervalMs : 1;
+    this->burst = (burst > 0) ? burst : 1;
+    curIntervalMs = this->intervalMs;
+    levelMs = this->burst * curIntervalMs;
+}
+
+void PublishQueueGovernor::setBackoff(unsigned long firstMs, unsigned long maxMs) {
+    firstBackoffMs = firstMs;
+    maxBackoffMs = (maxMs > firstMs) ? maxMs : firstMs;
+}
+
+void PublishQueueGovernor::reset(unsigned long now) {
+    levelMs = burst * curIntervalMs;
+    lastUpdate = now;
+}
+
+bool PublishQueueGovernor::take(unsigned long now) {
+    refill(now);
+    if (levelMs < curIntervalMs) {
+        return false;
+    }
+    levelMs -= curIntervalMs;
+    return true;
+}
+
+size_t PublishQueueGovernor::available(unsigned long now) {
+    refill(now);
+    return levelMs / curIntervalMs;
+}
+
+void PublishQueueGovernor::succeeded(unsigned long latencyMs) {
+    failureCount = 0;
+
+    // Much slower than usual means the connection is getting worse, so don't speed up
+    bool slow = haveLatency && latencyMs > 2 * this->latencyMs;
+
+    if (haveLatency) {
+        // Smoothed the same way as the TCP round trip time, 1/8 of each new sample
+        this->latencyMs = (7 * this->latencyMs + latencyMs) / 8;
+    }
+    else {
+        this->latencyMs = latencyMs;
+        haveLatency = true;
+    }
+
+    if (slow) {
+        curIntervalMs += (intervalMs >= 4) ? intervalMs / 4 : 1;
+        if (curIntervalMs > intervalMs * MAX_INTERVAL_FACTOR) {
+            curIntervalMs = intervalMs * MAX_INTERVAL_FACTOR;
+        }
+    }
+    else {
+        // Halved back toward the configured rate, so one good publish undoes one slowdown
+        curIntervalMs = (curIntervalMs / 2 > intervalMs) ? curIntervalMs / 2 : intervalMs;
+    }
+}
+
+unsigned long PublishQueueGovernor::failed(unsigned long now, size_t failures) {
+    failureCount += (failures > 0) ? failures : 1;
+    levelMs = 0;
+    lastUpdate = now;
+
+    if (failureCount == 1) {
+        // A single failure between successes is usually a lost packet, not the cloud refusing
+        // publishes, so try again after one interval at the same rate
+        return curIntervalMs;
+    }
+
+    // Failures in a row, or several publishes failing together, mean the connection is down or the
+    // cloud is rate limiting, so slow down and back off
+    curIntervalMs *= 2;
+    if (curIntervalMs > intervalMs * MAX_INTERVAL_FACTOR) {
+        curIntervalMs = intervalMs * MAX_INTERVAL_FACTOR;
+    }
+
+    unsigned long backoffMs = firstBackoffMs;
+    for(size_t ii = 2; ii < failureCount && backoffMs < maxBackoffMs; ii++) {
+        backoffMs *= 2;
+    }
+    return (backoffMs < maxBackoffMs) ? backoffMs : maxBackoffMs;
+}
+
+void PublishQueueGovernor::refill(unsigned long now) {
+    unsigned long elapsed = now - lastUpdate;
+    unsigned long maxLevelMs = burst * curIntervalMs;
+    lastUpdate = now;
+
+    if (levelMs >= maxLevelMs || elapsed >= maxLevelMs - levelMs) {
+        levelMs = maxLevelMs;
+    }
+    else {
+        levelMs += elapsed;
+    }
+}
+
+
+PublishQueueSpill::PublishQueueSpill() {
+}
+
+PublishQueueSpill::~PublishQueueSpill() {
+}
+
+void PublishQueueSpill::withStorage(size_t size, ReadFn readFn, WriteFn writeFn) {
+    this->readFn = readFn;
+    this->writeFn = writeFn;
+
+    // Offsets in the header are 16 bits
+    capacity = (size > DATA_OFFSET + sizeof(Record)) ? size - DATA_OFFSET : 0;
+    if (capacity > 0xffff) {
+        capacity = 0xffff;
+    }
+    head = tail = 0;
+    records = 0;
+    bytesUsed = 0;
+    memset(laneCount, 0, sizeof(laneCount));
+}
+
+void PublishQueueSpill::load() {
+    if (!capacity) {
+        return;
+    }
+
+    // Use the valid copy of the header that was written last
+    Header hdr[2];
+    int valid = -1;
+    for(int ii = 0; ii < 2; ii++) {
+        if (readFn(ii * sizeof(Header), (uint8_t *)&hdr[ii], sizeof(Header)) &&
+            hdr[ii].magic == SPILL_MAGIC &&
+            hdr[ii].version == SPILL_VERSION &&
+            hdr[ii].headerSize == sizeof(Header) &&
+            hdr[ii].headOffset < capacity &&
+            hdr[ii].check == checksum(&hdr[ii], offsetof(Header, check))) {
+            if (valid < 0 || (int32_t)(hdr[ii].headSeq - hdr[valid].headSeq) > 0) {
+                valid = ii;
+            }
+        }
+    }
+
+    records = 0;
+    bytesUsed = 0;
+    memset(laneCount, 0, sizeof(laneCount));
+
+    if (valid < 0) {
+        _log.info("spill storage not valid, starting a new one");
+        head = tail = 0;
+        headSeq = tailSeq = 1;
+        headerCopy = 1;
+        writeHeader();
+        return;
+    }
+    headerCopy = valid;
+    head = tail = hdr[valid].headOffset;
+    headSeq = tailSeq = hdr[valid].headSeq;
+
+    // The records follow the head in sequence. The first one that is missing or torn is the tail.
+    size_t offset = head;
+    Record rec;
+    while(bytesUsed < capacity && locate(offset, tailSeq, rec, true)) {
+        if (records == 0) {
+            head = offset;
+        }
+        records++;
+        bytesUsed += rec.len;
+        if ((rec.nameLen & RECORD_SENT) == 0 && rec.lane < MAX_LANES) {
+            laneCount[rec.lane]++;
+        }
+        offset += rec.len;
+        tail = offset;
+        tailSeq++;
+    }
+
+    // A reset after marking events sent and before saving the head leaves them at the head
+    popSent();
+    _log.trace("spill has %u records, %u bytes", records, bytesUsed);
+}
+
+bool PublishQueueSpill::push_back(uint8_t lane, const char *eventName, const char *eventData, PublishFlags flags, uint32_t queuedAt) {
+    Record rec;
+    rec.flags = flags;
+    rec.nameLen = (uint8_t) strlen(eventName);
+    rec.lane = lane;
+    rec.reserved = 0;
+    rec.dataLen = (uint16_t) strlen(eventData);
+    rec.seq = tailSeq;
+    rec.queuedAt = queuedAt;
+    size_t len = sizeof(Record) + rec.nameLen + rec.dataLen;
+    rec.len = (uint16_t) len;
+
+    if (!capacity || lane >= MAX_LANES || len > capacity) {
+        return false;
+    }
+
+    // The same as PublishQueueRing, a record that does not fit at the end starts again at the beginning
+    size_t offset;
+    if (records == 0) {
+        offset = (tail + len <= capacity) ? tail : 0;
+    }
+    else if (tail > head) {
+        if (tail + len <= capacity) {
+            offset = tail;
+        }
+        else if (len < head) {
+            offset = 0;
+        }
+        else {
+            return false;
+        }
+    }
+    else {
+        if (tail + len < head) {
+            offset = tail;
+        }
+        else {
+            return false;
+        }
+    }
+
+    rec.check = checksum(eventData, rec.dataLen, checksum(eventName, rec.nameLen, checksum(&rec, offsetof(Record, check))));
+    if (!writeFn(DATA_OFFSET + offset, (const uint8_t *)&rec, sizeof(Record)) ||
+        !writeFn(DATA_OFFSET + offset + sizeof(Record), (const uint8_t *)eventName, rec.nameLen) ||
+        !writeFn(DATA_OFFSET + offset + sizeof(Record) + rec.nameLen, (const uint8_t *)eventData, rec.dataLen)) {
+        return false;
+    }
+
+    if (records == 0) {
+        head = offset;
+    }
+    tail = offset + len;
+    tailSeq++;
+    records++;
+    bytesUsed += len;
+    laneCount[lane]++;
+    return true;
+}
+
+PublishQueueEvent *PublishQueueSpill::read(uint8_t lane, size_t skip, uint32_t &queuedAt) {
+    size_t offset;
+    Record rec;
+    if (!find(lane, skip, offset, rec)) {
+        return NULL;
+    }
+
+    // eventData[1] in the structure leaves room for the null terminator
+    PublishQueueEvent *result = (PublishQueueEvent *)new char[sizeof(PublishQueueEvent) + rec.dataLen];
+    if (result) {
+        size_t nameLen = rec.nameLen & ~RECORD_SENT;
+        if (readFn(DATA_OFFSET + offset + sizeof(Record), (uint8_t *)result->eventName, nameLen) &&
+            readFn(DATA_OFFSET + offset + sizeof(Record) + nameLen, (uint8_t *)result->eventData, rec.dataLen)) {
+            result->flags = rec.flags;
+            result->eventName[nameLen] = 0;
+            result->eventData[rec.dataLen] = 0;
+            queuedAt = rec.queuedAt;
+        }
+        else {
+            PublishQueuePosix::freeEvent(result);
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+void PublishQueueSpill::markSent(uint8_t lane, size_t count) {
+    for(; count > 0; count--) {
+        size_t offset;
+        Record rec;
+        if (!find(lane, 0, offset, rec)) {
+            break;
+        }
+        // One byte, so it's never torn
+        rec.nameLen |= RECORD_SENT;
+        writeFn(DATA_OFFSET + offset + offsetof(Record, nameLen), &rec.nameLen, sizeof(rec.nameLen));
+        laneCount[lane]--;
+    }
+    popSent();
+}
+
+bool PublishQueueSpill::supersede(uint32_t seq, const char *eventName) {
+    size_t offset = head;
+    Record rec;
+    for(uint32_t cur = headSeq; cur != tailSeq; cur++) {
+        if (!locate(offset, cur, rec)) {
+            return false;
+        }
+        if (cur == seq) {
+            uint8_t name[particle::protocol::MAX_EVENT_NAME_LENGTH];
+            size_t nameLen = strlen(eventName);
+            if ((rec.nameLen & RECORD_SENT) != 0 || rec.lane >= MAX_LANES || rec.nameLen != nameLen || nameLen > sizeof(name) ||
+                !readFn(DATA_OFFSET + offset + sizeof(Record), name, nameLen) || memcmp(name, eventName, nameLen) != 0) {
+                return false;
+            }
+            rec.nameLen |= RECORD_SENT;
+            writeFn(DATA_OFFSET + offset + offsetof(Record, nameLen), &rec.nameLen, sizeof(rec.nameLen));
+            laneCount[rec.lane]--;
+            popSent();
+            return true;
+        }
+        offset += rec.len;
+    }
+    return false;
+}
+
+int PublishQueueSpill::unsentIndex(uint8_t lane, uint32_t seq) {
+    int result = 0;
+    size_t offset = head;
+    Record rec;
+    for(uint32_t cur = headSeq; cur != tailSeq; cur++) {
+        if (!locate(offset, cur, rec)) {
+            break;
+        }
+        if (rec.lane == lane && (rec.nameLen & RECORD_SENT) == 0) {
+            if (cur == seq) {
+                return result;
+            }
+            result++;
+        }
+        offset += rec.len;
+    }
+    return -1;
+}
+
+uint32_t PublishQueueSpill::frontQueuedAt(uint8_t lane) {
+    size_t offset;
+    Record rec;
+    return find(lane, 0, offset, rec) ? rec.queuedAt : 0;
+}
+
+void PublishQueueSpill::clear() {
+    if (!capacity) {
+        return;
+    }
+    // The sequence numbers keep going, so the old records are not found again
+    head = tail = 0;
+    headSeq = tailSeq;
+    records = 0;
+    bytesUsed = 0;
+    memset(laneCount, 0, sizeof(laneCount));
+    writeHeader();
+}
+
+bool PublishQueueSpill::readRecord(size_t offset, uint32_t seq, Record &rec, bool verify) {
+    if (offset + sizeof(Record) > capacity || !readFn(DATA_OFFSET + offset, (uint8_t *)&rec, sizeof(Record))) {
+        return false;
+    }
+    if (rec.seq != seq || rec.len != sizeof(Record) + (rec.nameLen & ~RECORD_SENT) + rec.dataLen || offset + rec.len > capacity) {
+        return false;
+    }
+    return !verify || rec.check == recordChecksum(offset, rec);
+}
+
+bool PublishQueueSpill::locate(size_t &offset, uint32_t seq, Record &rec, bool verify) {
+    if (readRecord(offset, seq, rec, verify)) {
+        return true;
+    }
+    if (offset != 0 && readRecord(0, seq, rec, verify)) {
+        offset = 0;
+        return true;
+    }
+    return false;
+}
+
+bool PublishQueueSpill::find(uint8_t lane, size_t skip, size_t &offset, Record &rec) {
+    if (lane >= MAX_LANES || skip >= laneCount[lane]) {
+        return false;
+    }
+
+    offset = head;
+    uint32_t seq = headSeq;
+    for(size_t ii = 0; ii < records; ii++, seq++) {
+        if (!locate(offset, seq, rec)) {
+            return false;
+        }
+        if (rec.lane == lane && (rec.nameLen & RECORD_SENT) == 0) {
+            if (skip == 0) {
+                return true;
+            }
+            skip--;
+        }
+        offset += rec.len;
+    }
+    return false;
+}
+
+void PublishQueueSpill::popSent() {
+    bool changed = false;
+
+    Record rec;
+    while(records > 0 && locate(head, headSeq, rec) && (rec.nameLen & RECORD_SENT) != 0) {
+        head += rec.len;
+        headSeq++;
+        records--;
+        bytesUsed -= rec.len;
+        changed = true;
+    }
+    if (records == 0) {
+        head = tail;
+        headSeq = tailSeq;
+    }
+    if (changed) {
+        writeHeader();
     }
 }
 
+void PublishQueueSpill::writeHeader() {
+    Header hdr;
+    hdr.magic = SPILL_MAGIC;
+    hdr.version = SPILL_VERSION;
+    hdr.headerSize = sizeof(Header);
+    hdr.headOffset = (uint16_t) head;
+    hdr.headSeq = headSeq;
+    hdr.check = checksum(&hdr, offsetof(Header, check));
+
+    headerCopy ^= 1;
+    writeFn(headerCopy * sizeof(Header), (const uint8_t *)&hdr, sizeof(Header));
+}
+
+uint32_t PublishQueueSpill::recordChecksum(size_t offset, const Record &rec) {
+    Record copy = rec;
+    copy.nameLen &= ~RECORD_SENT;
+    uint32_t hash = checksum(&copy, offsetof(Record, check));
+
+    // The name and data are read in small pieces to keep the stack small
+    uint8_t buf[32];
+    size_t len = copy.nameLen + copy.dataLen;
+    for(size_t ii = 0; ii < len; ii += sizeof(buf)) {
+        size_t count = (len - ii < sizeof(buf)) ? (len - ii) : sizeof(buf);
+        if (!readFn(DATA_OFFSET + offset + sizeof(Record) + ii, buf, count)) {
+            return ~rec.check;
+        }
+        hash = checksum(buf, count, hash);
+    }
+    return hash;
+}
+
+// [static]
+uint32_t PublishQueueSpill::checksum(const void *data, size_t len, uint32_t hash) {
+    // FNV-1a, the same as keyHash()
+    const uint8_t *bytes = (const uint8_t *)data;
+    for(size_t ii = 0; ii < len; ii++) {
+        hash = (hash ^ bytes[ii]) * 16777619;
+    }
+    return hash;
+}
@@ -7,7 +7,8 @@
 #include "Particle.h"
 #include "SequentialFileRK.h"
 
-#include <deque>
+#include <functional>
+#include <vector>
 
 /**
  * @brief Structure stored before the event data in files on the flash file system
@@ -26,7 +27,7 @@ struct PublishQueueFileHeader {
 /**
  * @brief Structure to hold an event in RAM or in files
  * 
- * In RAM, this structure is stored in the ramQueue. 
+ * In RAM, this structure is stored inline in the PublishQueueRing of a lane. 
  * 
  * On the flash file system, each file contains one event and consists of the
  * PublishQueueFileHeader above (8 bytes) plus this structure.
@@ -40,6 +41,726 @@ struct PublishQueueEvent {
     char eventData[1]; //!< Variable size event data
 };
 
+/**
+ * @brief Structure at the beginning of a segment file on the flash file system
+ * 
+ * When a segment size is set using withSegmentSize(), events are appended to segment
+ * files instead of one file per event. A segment is this header (16 bytes) followed by
+ * events, each a PublishQueueSegmentRecord followed by the event name and data.
+ * 
+ * Events are only ever appended. Writes to the flash file system are committed atomically
+ * when the file is closed, so a segment never ends with a partial event. The header is only
+ * rewritten to checkpoint the position of the first event that has not been acknowledged.
+ */
+struct PublishQueueSegmentHeader {
+    uint32_t magic;         //!< PublishQueuePosix::SEGMENT_MAGIC = 0x31b67664
+    uint8_t version;        //!< PublishQueuePosix::SEGMENT_VERSION = 3
+    uint8_t headerSize;     //!< sizeof(PublishQueueSegmentHeader) = 16
+    uint16_t sentCount;     //!< Number of events before sentOffset
+    uint32_t sentOffset;    //!< File offset of the first event that has not been acknowledged
+    uint32_t reserved;      //!< Reserved, set to 0
+};
+
+/**
+ * @brief Structure before each event in a segment file
+ * 
+ * It's followed by nameLen bytes of event name and dataLen bytes of event data. Neither
+ * is null terminated in the file.
+ * 
+ * When a newer event with the same key is published, the SEGMENT_RECORD_SUPERSEDED bit
+ * is set in nameLen, in place, and the event is skipped when reading.
+ */
+struct PublishQueueSegmentRecord {
+    PublishFlags flags;     //!< NO_ACK or WITH_ACK. Can use PRIVATE, but that's no longer needed.
+    uint8_t nameLen;        //!< Length of the event name in bytes, ORed with PublishQueuePosix::SEGMENT_RECORD_SUPERSEDED
+    uint16_t dataLen;       //!< Length of the event data in bytes
+    uint32_t key;           //!< Key set using publishKeyed(), 0 if none
+    uint32_t queuedAt;      //!< Time.now() when the event was published, 0 if the time was not valid
+};
+
+/**
+ * @brief Bounded queue of events stored inline in a single byte buffer
+ * 
+ * Each event is a 10 byte record header, the record length, key, and time it was queued,
+ * followed by a PublishQueueEvent sized to fit its data. Events are pushed at the tail and popped from
+ * the head in constant time. A record that does not fit at the end of the buffer starts
+ * again at the beginning, so the events are never moved and the buffer is the only allocation.
+ * 
+ * The events at the head can be marked as being sent. They stay in the buffer, and are
+ * published directly from it, until the publish completes.
+ * 
+ * An event can be replaced in place if the new data fits in its record. An event removed
+ * from the middle of the queue is marked as superseded, skipped, and its space is freed
+ * when it reaches the head.
+ */
+class PublishQueueRing {
+public:
+    /**
+     * @brief Constructor. Call allocate() before use.
+     */
+    PublishQueueRing();
+
+    /**
+     * @brief Destructor
+     */
+    virtual ~PublishQueueRing();
+
+    /**
+     * @brief This class is not copyable
+     */
+    PublishQueueRing(const PublishQueueRing&) = delete;
+
+    /**
+     * @brief This class is not copyable
+     */
+    PublishQueueRing& operator=(const PublishQueueRing&) = delete;
+
+    /**
+     * @brief Allocate the buffer, discarding any events in it
+     * 
+     * @param size Size of the buffer in bytes. 0 frees the buffer and every push fails.
+     */
+    void allocate(size_t size);
+
+    /**
+     * @brief Add an event at the tail
+     * 
+     * The name and data must already be validated for length. Returns the event in the
+     * buffer, or NULL if there is not enough room.
+     */
+    PublishQueueEvent *push_back(const char *eventName, const char *eventData, PublishFlags flags, uint32_t key = 0, uint32_t queuedAt = 0);
+
+    /**
+     * @brief Get the oldest event, or NULL if empty
+     */
+    PublishQueueEvent *front() const;
+
+    /**
+     * @brief Get the event after event, or NULL if it's the newest
+     */
+    PublishQueueEvent *next(const PublishQueueEvent *event) const;
+
+    /**
+     * @brief Remove the oldest event
+     */
+    void pop_front();
+
+    /**
+     * @brief Remove event, which must not be being sent, from anywhere in the queue
+     */
+    void remove(PublishQueueEvent *event);
+
+    /**
+     * @brief Replace the data of event, which must not be being sent, keeping its place in the queue
+     * 
+     * Returns false if eventData does not fit in the space of the event's record.
+     */
+    bool replace(PublishQueueEvent *event, const char *eventData, PublishFlags flags);
+
+    /**
+     * @brief Remove all events
+     */
+    void clear();
+
+    /**
+     * @brief Get the key event was pushed with
+     */
+    uint32_t getKey(const PublishQueueEvent *event) const;
+
+    /**
+     * @brief Get the queuedAt time event was pushed with
+     */
+    uint32_t getQueuedAt(const PublishQueueEvent *event) const;
+
+    /**
+     * @brief Mark the count oldest events as being sent, or 0 when the publish is done
+     */
+    void setSending(size_t count) { sending = count; };
+
+    /**
+     * @brief Get the number of events marked as being sent
+     */
+    size_t getSending() const { return sending; };
+
+    /**
+     * @brief Returns true if event is marked as being sent
+     */
+    bool isSending(const PublishQueueEvent *event) const;
+
+    /**
+     * @brief Remove the events marked as being sent, after they were published
+     */
+    void popSent();
+
+    /**
+     * @brief Get the oldest event that is not being sent, or NULL if there is none
+     */
+    PublishQueueEvent *frontUnsent() const;
+
+    /**
+     * @brief Remove the count oldest events that are not being sent, after they were written to files
+     * 
+     * While events are being sent the events after them can only be removed together, so
+     * any that were not written are lost. Returns the number of those.
+     */
+    size_t removeUnsent(size_t count);
+
+    /**
+     * @brief Returns true if event is stored in this buffer
+     */
+    bool owns(const PublishQueueEvent *event) const { return buf && (const uint8_t *)event >= buf && (const uint8_t *)event < &buf[capacity]; };
+
+    /**
+     * @brief Get the number of events, including the ones being sent
+     */
+    size_t size() const { return count; };
+
+    /**
+     * @brief Returns true if there are no events
+     */
+    bool empty() const { return count == 0; };
+
+    /**
+     * @brief Get the number of bytes used by events
+     * 
+     * Superseded events are included until their space is freed. Space at the end of the
+     * buffer skipped by a record that did not fit is not.
+     */
+    size_t getBytesUsed() const { return bytesUsed; };
+
+    /**
+     * @brief Get the size of the buffer in bytes
+     */
+    size_t getCapacity() const { return capacity; };
+
+    /**
+     * @brief Get the number of bytes an event with eventData uses in the buffer
+     */
+    static size_t recordSize(const char *eventData) { return RECORD_HEADER_SIZE + offsetof(PublishQueueEvent, eventData) + strlen(eventData) + 1; };
+
+protected:
+    /**
+     * @brief Get the record length at offset, 0 for the end of the used part of the buffer
+     */
+    size_t recordLen(size_t offset) const { return readLen(offset) & ~RECORD_SUPERSEDED; };
+
+    /**
+     * @brief Returns true if the record at offset has been removed using remove()
+     */
+    bool isSuperseded(size_t offset) const { return (readLen(offset) & RECORD_SUPERSEDED) != 0; };
+
+    /**
+     * @brief Get the record length field at offset, including the RECORD_SUPERSEDED bit
+     */
+    uint16_t readLen(size_t offset) const;
+
+    /**
+     * @brief Get the offset of the first record at or after offset, which is not the tail
+     */
+    size_t wrap(size_t offset) const { return (offset + RECORD_HEADER_SIZE > capacity || recordLen(offset) == 0) ? 0 : offset; };
+
+    /**
+     * @brief Get the offset of the record after the one at offset, or the tail
+     */
+    size_t nextOffset(size_t offset) const;
+
+    /**
+     * @brief Get the offset of the first record that is not superseded at or after offset, or the tail
+     */
+    size_t skipSuperseded(size_t offset) const;
+
+    /**
+     * @brief Remove the record at the head, and the superseded records after it
+     */
+    void popRecord();
+
+    /**
+     * @brief Get the event in the record at offset
+     */
+    PublishQueueEvent *eventAt(size_t offset) const { return (PublishQueueEvent *)&buf[offset + RECORD_HEADER_SIZE]; };
+
+    /**
+     * @brief Get the offset of the record holding event
+     */
+    size_t offsetOf(const PublishQueueEvent *event) const { return (const uint8_t *)event - buf - RECORD_HEADER_SIZE; };
+
+    static const size_t RECORD_HEADER_SIZE = 10; //!< uint16_t record length, uint32_t key, and uint32_t queuedAt
+    static const uint16_t RECORD_SUPERSEDED = 0x8000; //!< Set in the record length by remove()
+    static const size_t KEYED_RECORD_ROUND = 16; //!< Records pushed with a key are rounded up to this size
+
+    uint8_t *buf = NULL;    //!< The buffer
+    size_t capacity = 0;    //!< Size of buf in bytes
+    size_t head = 0;        //!< Offset of the oldest record, which is never superseded
+    size_t tail = 0;        //!< Offset after the newest record. It's only equal to head when empty.
+    size_t records = 0;     //!< Number of records, including superseded ones
+    size_t count = 0;       //!< Number of events
+    size_t bytesUsed = 0;   //!< Total length of the records
+    size_t sending = 0;     //!< Number of events at the head being sent
+};
+
+/**
+ * @brief Ring of events in byte addressable storage such as FRAM, which survives a reset
+ * 
+ * The storage is accessed through read and write functions, so it's not tied to a particular
+ * part. It starts with two copies of a header holding the position and sequence number of the 
+ * oldest record, written alternately so one is always valid. Each record has a sequence number
+ * and a checksum, so the records after the head are found again at startup and a record torn by
+ * a reset while it was written is ignored.
+ * 
+ * Events of all lanes share the ring. An event is marked as sent in place, by writing one byte,
+ * and its space is freed once it reaches the head.
+ */
+class PublishQueueSpill {
+public:
+    /**
+     * @brief Function that reads len bytes at offset in the storage into buf, returning true on success
+     */
+    typedef std::function<bool(size_t offset, uint8_t *buf, size_t len)> ReadFn;
+
+    /**
+     * @brief Function that writes len bytes from buf at offset in the storage, returning true on success
+     */
+    typedef std::function<bool(size_t offset, const uint8_t *buf, size_t len)> WriteFn;
+
+    /**
+     * @brief Constructor. Call withStorage() and load() before use.
+     */
+    PublishQueueSpill();
+
+    /**
+     * @brief Destructor
+     */
+    virtual ~PublishQueueSpill();
+
+    /**
+     * @brief This class is not copyable
+     */
+    PublishQueueSpill(const PublishQueueSpill&) = delete;
+
+    /**
+     * @brief This class is not copyable
+     */
+    PublishQueueSpill& operator=(const PublishQueueSpill&) = delete;
+
+    /**
+     * @brief Set the storage, size bytes starting at offset 0 of readFn and writeFn. 0 turns the ring off.
+     */
+    void withStorage(size_t size, ReadFn readFn, WriteFn writeFn);
+
+    /**
+     * @brief Returns true if storage has been set
+     */
+    bool isEnabled() const { return capacity > 0; };
+
+    /**
+     * @brief Find the events in the storage, or start an empty ring if it's not valid
+     */
+    void load();
+
+    /**
+     * @brief Add an event of lane at the tail
+     * 
+     * @return false if there is not enough room
+     */
+    bool push_back(uint8_t lane, const char *eventName, const char *eventData, PublishFlags flags, uint32_t queuedAt);
+
+    /**
+     * @brief Read the event of lane after the first skip events of lane that have not been sent
+     * 
+     * @param queuedAt Set to the time the event was published
+     * 
+     * Returns NULL if there is no such event. Free the result with PublishQueuePosix::freeEvent() when you are done using it.
+     */
+    PublishQueueEvent *read(uint8_t lane, size_t skip, uint32_t &queuedAt);
+
+    /**
+     * @brief Mark the first count events of lane that have not been sent as sent
+     */
+    void markSent(uint8_t lane, size_t count);
+
+    /**
+     * @brief Mark the event with sequence number seq as sent, because a newer one replaces it
+     * 
+     * @param eventName The name of the newer event; a different name is a key collision, and nothing is changed
+     * 
+     * @return false if it's not in the ring, already sent, or has another name
+     */
+    bool supersede(uint32_t seq, const char *eventName);
+
+    /**
+     * @brief Get the number of events of lane not sent before the event with sequence number seq, or -1 if it's not queued
+     */
+    int unsentIndex(uint8_t lane, uint32_t seq);
+
+    /**
+     * @brief Get the sequence number of the last event added by push_back()
+     */
+    uint32_t getLastSeq() const { return tailSeq - 1; };
+
+    /**
+     * @brief Get the time the oldest event of lane was published, 0 if none or not known
+     */
+    uint32_t frontQueuedAt(uint8_t lane);
+
+    /**
+     * @brief Remove all events
+     */
+    void clear();
+
+    /**
+     * @brief Get the number of events of lane that have not been sent
+     */
+    size_t size(uint8_t lane) const { return (lane < MAX_LANES) ? laneCount[lane] : 0; };
+
+    /**
+     * @brief Get the number of bytes used by records, including ones marked sent that are not at the head yet
+     */
+    size_t getBytesUsed() const { return bytesUsed; };
+
+    /**
+     * @brief Get the number of bytes records can use
+     */
+    size_t getCapacity() const { return capacity; };
+
+    static const size_t MAX_LANES = 4;          //!< Lanes that can share the ring
+    static const uint32_t SPILL_MAGIC = 0x31b67665; //!< Magic bytes in the header
+    static const uint8_t SPILL_VERSION = 1;     //!< Version of the header and records
+
+protected:
+    /**
+     * @brief One of the two copies of the header at the start of the storage
+     */
+    struct Header {
+        uint32_t magic;         //!< SPILL_MAGIC
+        uint8_t version;        //!< SPILL_VERSION
+        uint8_t headerSize;     //!< sizeof(Header) = 16
+        uint16_t headOffset;    //!< Offset of the oldest record, after the headers
+        uint32_t headSeq;       //!< Sequence number of the record at headOffset
+        uint32_t check;         //!< Checksum of the bytes above
+    };
+
+    /**
+     * @brief Structure before each event, followed by nameLen bytes of name and dataLen bytes of data
+     */
+    struct Record {
+        uint16_t len;           //!< Length of the record including this structure
+        PublishFlags flags;     //!< NO_ACK or WITH_ACK
+        uint8_t nameLen;        //!< Length of the event name, ORed with RECORD_SENT once published
+        uint8_t lane;           //!< Lane the event is in
+        uint8_t reserved;       //!< Reserved, set to 0
+        uint16_t dataLen;       //!< Length of the event data
+        uint32_t seq;           //!< Sequence number, one more than the record before it
+        uint32_t queuedAt;      //!< Time.now() when the event was published, 0 if not known
+        uint32_t check;         //!< Checksum of the bytes above without RECORD_SENT, and the name and data
+    };
+
+    /**
+     * @brief Read the record header at offset, returning true if it has sequence number seq
+     * 
+     * @param verify Also check the checksum, which reads the name and data
+     */
+    bool readRecord(size_t offset, uint32_t seq, Record &rec, bool verify = false);
+
+    /**
+     * @brief Read the record with sequence number seq, at offset or, if it did not fit at the end, at 0
+     * 
+     * offset is updated to where it was found. Returns false if it's at neither.
+     */
+    bool locate(size_t &offset, uint32_t seq, Record &rec, bool verify = false);
+
+    /**
+     * @brief Find the offset of the event of lane after skip unsent events of lane, returning false if there is none
+     */
+    bool find(uint8_t lane, size_t skip, size_t &offset, Record &rec);
+
+    /**
+     * @brief Free the records at the head that have been sent, and save the new head
+     */
+    void popSent();
+
+    /**
+     * @brief Write the header to the copy that was not written last
+     */
+    void writeHeader();
+
+    /**
+     * @brief Checksum of the record header without check, with RECORD_SENT cleared, then the name and data
+     */
+    uint32_t recordChecksum(size_t offset, const Record &rec);
+
+    /**
+     * @brief FNV-1a hash of len bytes, continuing from hash
+     */
+    static uint32_t checksum(const void *data, size_t len, uint32_t hash = 2166136261);
+
+    static const uint8_t RECORD_SENT = 0x80;    //!< Set in Record::nameLen when the event has been published
+    static const size_t DATA_OFFSET = 2 * sizeof(Header); //!< Offset of the records, after the two headers
+
+    ReadFn readFn = 0;      //!< Reads the storage
+    WriteFn writeFn = 0;    //!< Writes the storage
+    size_t capacity = 0;    //!< Bytes after the headers for records
+    size_t head = 0;        //!< Offset of the oldest record, relative to DATA_OFFSET
+    uint32_t headSeq = 0;   //!< Sequence number of the record at head
+    size_t tail = 0;        //!< Offset after the newest record. It's only equal to head when empty.
+    uint32_t tailSeq = 0;   //!< Sequence number of the next record
+    size_t records = 0;     //!< Number of records, including ones marked sent
+    size_t bytesUsed = 0;   //!< Total length of the records
+    int headerCopy = 0;     //!< Header copy written last, 0 or 1
+    size_t laneCount[MAX_LANES] = {}; //!< Records of each lane not marked sent
+};
+
+/**
+ * @brief Fixed size hash table of the queued events that have a key, to find them by key
+ * 
+ * It uses open addressing with linear probing, so after allocate() it never allocates.
+ */
+class PublishQueueKeyIndex {
+public:
+    /**
+     * @brief Where the newest unsent event with a key is queued
+     */
+    struct Entry {
+        uint32_t key;               //!< The key, 0 for an unused slot
+        uint32_t check;             //!< PublishQueuePosix::keyCheck() of the event, 0 if not known as the entry was made from a file
+        uint8_t lane;               //!< Index of the lane the event is in
+        int fileNum;                //!< File the event is in, 0 if it's in the RAM queue, -1 if in the FRAM ring
+        uint32_t offset;            //!< Offset of the event's record in segment fileNum
+        PublishQueueEvent *event;   //!< The event, when it's in the RAM queue
+    };
+
+    /**
+     * @brief Constructor. Call allocate() before use.
+     */
+    PublishQueueKeyIndex();
+
+    /**
+     * @brief Destructor
+     */
+    virtual ~PublishQueueKeyIndex();
+
+    /**
+     * @brief This class is not copyable
+     */
+    PublishQueueKeyIndex(const PublishQueueKeyIndex&) = delete;
+
+    /**
+     * @brief This class is not copyable
+     */
+    PublishQueueKeyIndex& operator=(const PublishQueueKeyIndex&) = delete;
+
+    /**
+     * @brief Allocate the table for maxKeys keys, discarding any entries. 0 frees it.
+     */
+    void allocate(size_t maxKeys);
+
+    /**
+     * @brief Find the entry for key, or NULL
+     */
+    Entry *find(uint32_t key);
+
+    /**
+     * @brief Find the entry for key, or add one. Returns NULL if there are already maxKeys entries.
+     */
+    Entry *insert(uint32_t key);
+
+    /**
+     * @brief Remove an entry returned by find() or insert()
+     */
+    void erase(Entry *entry);
+
+    /**
+     * @brief Remove the entries for which fn returns true
+     */
+    void eraseIf(std::function<bool(const Entry &entry)> fn);
+
+    /**
+     * @brief Remove all entries
+     */
+    void clear();
+
+    /**
+     * @brief Get the number of entries
+     */
+    size_t size() const { return used; };
+
+    /**
+     * @brief Get the maximum number of entries set using allocate()
+     */
+    size_t getMaxKeys() const { return maxKeys; };
+
+protected:
+    Entry *slots = NULL;    //!< The table
+    size_t mask = 0;        //!< Number of slots - 1, a power of 2 at least twice maxKeys
+    size_t maxKeys = 0;     //!< Maximum number of entries
+    size_t used = 0;        //!< Number of entries
+};
+
+/**
+ * @brief Token bucket that paces publishes, adapting to publish failures and latency
+ * 
+ * A token is added every interval, up to burst tokens, and each publish takes one. A single failure
+ * between successes is retried after one interval, at the same rate. From the second failure in a
+ * row, or when several publishes fail together, the interval doubles and the next publish waits for
+ * a backoff that doubles with each further failure. Each success halves the interval back toward
+ * the configured one, unless the publish took much longer than usual, which means the link is
+ * slowing down.
+ * 
+ * Times are millis() values. It doesn't lock; PublishQueuePosix only uses it from its loop.
+ */
+class PublishQueueGovernor {
+public:
+    /**
+     * @brief Constructor. The defaults are one publish per second, no burst, and backoff from 30 seconds to 5 minutes.
+     */
+    PublishQueueGovernor();
+
+    /**
+     * @brief Destructor
+     */
+    virtual ~PublishQueueGovernor();
+
+    /**
+     * @brief Set the rate to one publish every intervalMs, with up to burst publishes back to back
+     */
+    void setRate(unsigned long intervalMs, size_t burst);
+
+    /**
+     * @brief Set the wait after the second failure in a row, doubling for each one after it up to maxMs
+     */
+    void setBackoff(unsigned long firstMs, unsigned long maxMs);
+
+    /**
+     * @brief Start with a full bucket, after connecting
+     */
+    void reset(unsigned long now);
+
+    /**
+     * @brief Take a token if one is available
+     * 
+     * @return true if a publish can be started now
+     */
+    bool take(unsigned long now);
+
+    /**
+     * @brief Get the number of tokens available now
+     */
+    size_t available(unsigned long now);
+
+    /**
+     * @brief A publish succeeded after latencyMs
+     */
+    void succeeded(unsigned long latencyMs);
+
+    /**
+     * @brief Publishes failed. Empties the bucket, and slows down and backs off unless it was a single failure.
+     * 
+     * @param failures Number of publishes that failed together
+     * 
+     * @return how long to wait before publishing again
+     */
+    unsigned long failed(unsigned long now, size_t failures = 1);
+
+    /**
+     * @brief Get the interval between publishes now, which is longer than the configured one after failures
+     */
+    unsigned long getIntervalMs() const { return curIntervalMs; };
+
+    /**
+     * @brief Get the smoothed time from starting a publish to its completion
+     */
+    unsigned long getLatencyMs() const { return latencyMs; };
+
+    /**
+     * @brief Get the number of failures since the last success
+     */
+    size_t getFailureCount() const { return failureCount; };
+
+protected:
+    /**
+     * @brief Add the tokens for the time since the last update
+     */
+    void refill(unsigned long now);
+
+    unsigned long intervalMs = 1000;        //!< Configured time between publishes
+    size_t burst = 1;                       //!< Configured maximum number of tokens
+    unsigned long firstBackoffMs = 30000;   //!< Wait after the second failure in a row
+    unsigned long maxBackoffMs = 300000;    //!< Longest wait after a failure
+    unsigned long curIntervalMs = 1000;     //!< Time between publishes now, intervalMs up to MAX_INTERVAL_FACTOR times that
+    unsigned long levelMs = 1000;           //!< Tokens in the bucket, in units of 1 ms, so a token is curIntervalMs
+    unsigned long lastUpdate = 0;           //!< millis() value when levelMs was last updated
+    unsigned long latencyMs = 1000;         //!< Smoothed publish latency, a guess until the first publish completes
+    bool haveLatency = false;               //!< true once latencyMs is from a publish
+    size_t failureCount = 0;                //!< Failures since the last success
+
+    static const unsigned long MAX_INTERVAL_FACTOR = 8; //!< Slowest rate after failures, as a multiple of intervalMs
+};
+
+/**
+ * @brief Priority of an event, which selects the lane of the queue it waits in
+ * 
+ * Each lane has its own RAM and file queue, limits, and drop policy. Events in a
+ * lane are sent in order, but a higher priority lane is sent first.
+ */
+enum class PublishQueuePriority : uint8_t {
+    CRITICAL = 0,           //!< Alerts that must get out as soon as connected
+    TELEMETRY,              //!< Normal data (default)
+    DIAGNOSTICS             //!< Sent when nothing else is waiting
+};
+
+/**
+ * @brief Why events were discarded, the index into PublishQueueStats::drops
+ */
+enum class PublishQueueDropReason : uint8_t {
+    LANE_FULL = 0,          //!< Over the RAM and file queue size of the lane
+    TOO_LARGE,              //!< Event name or data too long to publish
+    WRITE_FAILED,           //!< Could not be written to the file system
+    CORRUPTED,              //!< File or segment could not be read back
+    REPLACED,               //!< Replaced by a newer event with the same key
+    CLEARED                 //!< Removed by clearQueues()
+};
+
+/**
+ * @brief Counters and histograms of the queue, see PublishQueuePosix::getStats()
+ * 
+ * The counters, histograms and maximums are since the last resetStats(). The depths and the
+ * age of the oldest event are the values now.
+ */
+struct PublishQueueStats {
+    static const size_t NUM_DROP_REASONS = 6;   //!< Number of PublishQueueDropReason values
+    static const size_t NUM_BUCKETS = 6;        //!< Number of buckets in each histogram
+
+    /**
+     * @brief Upper limits of the queueLatency buckets in seconds: 10 s, 1 minute, 10 minutes, 1 hour, 6 hours, and over
+     */
+    static const uint32_t queueLatencyLimits[NUM_BUCKETS - 1];
+
+    /**
+     * @brief Upper limits of the publishLatency buckets in milliseconds: 0.5, 1, 2, 5, 10 seconds, and over
+     */
+    static const uint32_t publishLatencyLimits[NUM_BUCKETS - 1];
+
+    uint32_t periodMs;                          //!< Time since resetStats(), to turn the counters into rates
+    uint32_t eventsQueued;                      //!< Events accepted by publish()
+    uint32_t bytesQueued;                       //!< Length of the names and data of those events
+    uint32_t eventsSent;                        //!< Events acknowledged by the cloud
+    uint32_t publishes;                         //!< Publishes started, a batch is one
+    uint32_t publishFailures;                   //!< Publishes that failed
+    uint32_t eventsResent;                      //!< Events sent again because their publish failed
+    uint32_t drops[NUM_DROP_REASONS];           //!< Events discarded, indexed by PublishQueueDropReason
+    uint32_t queueLatency[NUM_BUCKETS];         //!< Time from publish() to acknowledgement, per publish, by queueLatencyLimits
+    uint32_t publishLatency[NUM_BUCKETS];       //!< Time from starting the publish to acknowledgement, by publishLatencyLimits
+    uint32_t fileSystemMs;                      //!< Time spent reading and writing the queue files
+    uint16_t maxRamEvents;                      //!< Most events in the RAM queues of all lanes at once
+    uint16_t maxFileEvents;                     //!< Most events in the file queues of all lanes at once
+    uint32_t maxRamBytes;                       //!< Most bytes used in the RAM queue buffers at once
+
+    uint16_t ramEvents;                         //!< Events in the RAM queues now
+    uint16_t fileEvents;                        //!< Events in the file queues now
+    uint16_t spillEvents;                       //!< Events in the FRAM ring now, see withSpillStorage()
+    uint32_t ramBytes;                          //!< Bytes used in the RAM queue buffers now
+    uint32_t oldestAge;                         //!< Seconds since the oldest event was published, 0 if empty or not known
+};
+
 /**
  * @brief Class for asynchronous publishing of events
  * 
@@ -55,7 +776,40 @@ public:
     static PublishQueuePosix &instance();
 
     /**
-     * @brief Sets the RAM based queue size (default is 2)
+     * @brief Free an event returned by readQueueFile(), readSegmentEvent(), newBatchEvent() or PublishQueueSpill::read()
+     * 
+     * Events are allocated as a char array sized for their data, so they must be freed as one.
+     */
+    static void freeEvent(PublishQueueEvent *event) { delete[] (char *)event; };
+
+    /**
+     * @brief What to do when a lane is full
+     */
+    enum class DropPolicy {
+        DROP_OLDEST,        //!< Discard the oldest events in the file queue (default)
+        DROP_NEWEST         //!< Refuse new events; publish() returns false
+    };
+
+    /**
+     * @brief How to choose the lane to send from when more than one has events
+     */
+    enum class DrainPolicy {
+        STRICT,             //!< Always send from the highest priority lane with events (default)
+        WEIGHTED            //!< Send from each lane in proportion to its weight, highest priority first
+    };
+
+    /**
+     * @brief Number of lanes, one per PublishQueuePriority
+     */
+    static const size_t NUM_LANES = 3;
+
+    /**
+     * @brief The largest number of publishes that can be in flight at once, see withMaxInFlight()
+     */
+    static const size_t MAX_IN_FLIGHT = 8;
+
+    /**
+     * @brief Sets the RAM based queue size of the TELEMETRY lane (default is 2)
      * 
      * @param size The size to set (can be 0, default is 2)
      * 
@@ -67,16 +821,18 @@ public:
      * flash wear. Make sure you set the size larger than the maximum number
      * of events you plan to send out in bursts, as if you exceed the RAM
      * queue size, all outstanding events will be moved to files.
+     * 
+     * The events must also fit in the RAM queue buffer, see withLaneRamBytes().
      */
     PublishQueuePosix &withRamQueueSize(size_t size);
 
     /**
      * @brief Gets the size of the RAM queue
      */
-    size_t getRamQueueSize() const { return ramQueueSize; };
+    size_t getRamQueueSize() const { return getLane(PublishQueuePriority::TELEMETRY).ramQueueSize; };
 
     /**
-     * @brief Sets the file-based queue size (default is 100)
+     * @brief Sets the file-based queue size of the TELEMETRY lane (default is 100)
      * 
      * @param size The maximum number of files to store (one event per file)
      * 
@@ -87,7 +843,246 @@ public:
     /**
      * @brief Gets the file queue size
      */
-    size_t getFileQueueSize() const { return fileQueueSize; };
+    size_t getFileQueueSize() const { return getLane(PublishQueuePriority::TELEMETRY).fileQueueSize; };
+
+    /**
+     * @brief Sets the RAM and file queue sizes of the lane for priority
+     * 
+     * @param priority The lane to set
+     * 
+     * @param ramQueueSize The RAM queue size, see withRamQueueSize()
+     * 
+     * @param fileQueueSize The maximum number of events on the flash file system, see withFileQueueSize()
+     * 
+     * The defaults are 4 and 50 for CRITICAL, 2 and 100 for TELEMETRY, and 2 and 20 for DIAGNOSTICS.
+     */
+    PublishQueuePosix &withLaneLimits(PublishQueuePriority priority, size_t ramQueueSize, size_t fileQueueSize);
+
+    /**
+     * @brief Sets the size in bytes of the RAM queue buffer of the lane for priority
+     * 
+     * @param priority The lane to set
+     * 
+     * @param bytes The buffer size. Each event uses 73 bytes plus the length of its data,
+     * rounded up to 16 bytes for keyed events.
+     * 0 stores every event on the flash file system immediately.
+     * 
+     * Events are stored in the buffer without any other allocation. When an event does
+     * not fit, all outstanding events are moved to files, the same as when the RAM queue
+     * size is exceeded. The defaults are 1024 for CRITICAL, 2048 for TELEMETRY, and 1024
+     * for DIAGNOSTICS. The buffer is allocated again only when the lane's RAM queue is empty,
+     * so call this before setup().
+     */
+    PublishQueuePosix &withLaneRamBytes(PublishQueuePriority priority, size_t bytes);
+
+    /**
+     * @brief Gets the number of bytes used in the RAM queue buffer of the lane for priority
+     */
+    size_t getRamQueueBytesUsed(PublishQueuePriority priority = PublishQueuePriority::TELEMETRY);
+
+    /**
+     * @brief Gets the size of the RAM queue buffer of the lane for priority
+     */
+    size_t getRamQueueCapacity(PublishQueuePriority priority = PublishQueuePriority::TELEMETRY) const { return getLane(priority).ramQueue.getCapacity(); };
+
+    /**
+     * @brief Sets what happens when the lane for priority is full (default is DROP_OLDEST)
+     * 
+     * With DROP_NEWEST, a lane is full when it holds its RAM queue size plus its file queue
+     * size of events.
+     */
+    PublishQueuePosix &withLaneDropPolicy(PublishQueuePriority priority, DropPolicy dropPolicy);
+
+    /**
+     * @brief Sets the weight of the lane for priority, used with DrainPolicy::WEIGHTED
+     * 
+     * @param weight The number of events sent from this lane in each round, at least 1.
+     * The defaults are 8 for CRITICAL, 4 for TELEMETRY, and 1 for DIAGNOSTICS.
+     */
+    PublishQueuePosix &withLaneWeight(PublishQueuePriority priority, unsigned int weight);
+
+    /**
+     * @brief Sets how to choose the lane to send from (default is STRICT)
+     * 
+     * With STRICT a lower priority lane is only sent from when every higher priority lane is
+     * empty. WEIGHTED keeps a low priority lane from waiting forever behind a busy one.
+     */
+    PublishQueuePosix &withDrainPolicy(DrainPolicy policy) { drainPolicy = policy; return *this; };
+
+    /**
+     * @brief Gets the drain policy set using withDrainPolicy()
+     */
+    DrainPolicy getDrainPolicy() const { return drainPolicy; };
+
+    /**
+     * @brief Store events in segment files of the given size instead of one file per event (default is 0)
+     * 
+     * @param size The segment size in bytes, or 0 to store one event per file
+     * 
+     * With segments, events are appended to a segment file until it reaches size bytes,
+     * read back sequentially, and the whole segment is deleted once every event in it has
+     * been sent. This takes a fraction of the file system operations per event and keeps
+     * the queue directory small when offline for a long time. 4096 is a good value.
+     * 
+     * Files written one event per file are still read back with segments enabled, so you
+     * can turn segments on with events still in the queue. The file queue size limit still
+     * counts events, but when it's exceeded the whole oldest segment is discarded.
+     * 
+     * Events acknowledged after the last checkpoint are sent again after a reset. The
+     * checkpoint is written when the queue is written to files, which includes before a
+     * reset and when the cloud disconnects.
+     */
+    PublishQueuePosix &withSegmentSize(size_t size);
+
+    /**
+     * @brief Gets the segment size set using withSegmentSize(). 0 means one event per file.
+     */
+    size_t getSegmentSize() const { return segmentSize; };
+
+    /**
+     * @brief Send events named eventName in batches, combined into one publish named batchName
+     * 
+     * @param eventName The name of the event to batch
+     * 
+     * @param batchName The name of the combined event. If NULL or omitted, the eventName is used.
+     * Several event names can share one batchName to be sent together.
+     * 
+     * A batch is published with JSON array data. An event whose name is the batchName is added to
+     * the array as its data; other events in the group are added as {"name":"eventName","data":data}.
+     * Data that is not a JSON object or array is added as a JSON string. Events are added in
+     * the order they were queued until the next one is not in the group, has different publish
+     * flags, or would exceed the maximum event data size.
+     * 
+     * An event in a batch group is always sent as an array, even if it's the only one, so the
+     * webhook sees the same format every time. An event too large to fit in an array by itself is
+     * sent unchanged.
+     */
+    PublishQueuePosix &withBatchEvent(const char *eventName, const char *batchName = NULL);
+
+    /**
+     * @brief Gets the batch name for eventName, or NULL if eventName is not batched
+     */
+    const char *getBatchName(const char *eventName) const;
+
+    /**
+     * @brief How long to hold a batched event in the RAM queue so more can be added to the batch (default is 2000)
+     * 
+     * @param windowMs The time in milliseconds from when a batched event reaches the head of the
+     * RAM queue until it is sent. 0 sends whatever is queued right away.
+     * 
+     * Events sent from the file queue are not held as they are usually already old.
+     */
+    PublishQueuePosix &withBatchWindow(unsigned long windowMs) { batchWindowMs = windowMs; return *this; };
+
+    /**
+     * @brief Gets the batch window set using withBatchWindow()
+     */
+    unsigned long getBatchWindow() const { return batchWindowMs; };
+
+    /**
+     * @brief Sets how many publishes can be in flight at once (default is 1)
+     * 
+     * @param count The number of publishes, up to MAX_IN_FLIGHT, that can be started before the
+     * earlier ones are acknowledged by the cloud.
+     * 
+     * With 1, each publish waits for the round trip of the one before it. With more, a publish
+     * is started every second while earlier ones are in flight, so the queue drains at the
+     * publish rate limit instead of the round trip time. The publishes complete in order. If one
+     * fails, the queue waits for the rest to complete and then sends again from the failed one,
+     * so events are not reordered, but the ones after it that were already sent are sent again.
+     * After a failure one publish at a time is sent, and one more is allowed after each success.
+     * 
+     * Events in a file written one event per file are not sent until the one before is acknowledged.
+     * Each publish in flight uses about 700 bytes of RAM in BackgroundPublishRK. Call this before setup().
+     */
+    PublishQueuePosix &withMaxInFlight(size_t count);
+
+    /**
+     * @brief Gets the number of publishes that can be in flight at once
+     */
+    size_t getMaxInFlight() const { return maxInFlight; };
+
+    /**
+     * @brief Sets the rate publishes are started at (default is one every 1000 ms, no burst)
+     * 
+     * @param intervalMs Average time between publishes in milliseconds
+     * 
+     * @param burst Number of publishes that can be started back to back after the queue has
+     * been idle, for example 4 to send a small backlog at once when connecting.
+     * 
+     * Publishes are paced by a token bucket. A single failure is retried after one interval. After
+     * failures in a row the rate halves, down to one eighth, and each success doubles it again. A success that took over twice the usual time holds the
+     * rate down, as the connection is slowing down.
+     */
+    PublishQueuePosix &withPublishRate(unsigned long intervalMs, size_t burst = 1) { governor.setRate(intervalMs, burst); return *this; };
+
+    /**
+     * @brief Sets how long to wait after publishes fail in a row (default is 30 seconds, up to 5 minutes)
+     * 
+     * A single failure between successes is retried after one publish interval without backing off.
+     * 
+     * @param firstMs Wait after the second failure in a row in milliseconds
+     * 
+     * @param maxMs The wait doubles for each failure in a row, up to this
+     */
+    PublishQueuePosix &withFailureBackoff(unsigned long firstMs, unsigned long maxMs) { governor.setBackoff(firstMs, maxMs); return *this; };
+
+    /**
+     * @brief Gets the time between publishes now, which is longer than set with withPublishRate() after failures
+     */
+    unsigned long getPublishIntervalMs() const { return governor.getIntervalMs(); };
+
+    /**
+     * @brief Gets the smoothed time in milliseconds from starting a publish until it completes
+     */
+    unsigned long getPublishLatencyMs() const { return governor.getLatencyMs(); };
+
+    /**
+     * @brief Estimates how long it will take to send all of the queued events, in milliseconds
+     * 
+     * Use this to decide how long to stay connected. It's based on the publish rate now, the
+     * publish latency and the number of publishes in flight, plus any wait for a connection or
+     * after a failure. It assumes one event per publish, so it's high when events are batched.
+     * 
+     * @return 0 if the queue is empty
+     */
+    unsigned long getTimeToDrainMs();
+
+    /**
+     * @brief Keep events that don't fit in the RAM queue in a ring in FRAM, before using flash files
+     * 
+     * @param size Size of the FRAM region in bytes, which is at offset 0 of readFn and writeFn
+     * 
+     * @param readFn Reads from the region, for example a lambda calling MB85RC64::readData()
+     * 
+     * @param writeFn Writes to the region
+     * 
+     * Call this before setup(). Events in the ring survive a reset, as files do, but a short
+     * time offline doesn't write to the file system. Once the ring is full, events go to files,
+     * and they keep going to files until the file queue is empty.
+     */
+    PublishQueuePosix &withSpillStorage(size_t size, PublishQueueSpill::ReadFn readFn, PublishQueueSpill::WriteFn writeFn) { spill.withStorage(size, readFn, writeFn); return *this; };
+
+    /**
+     * @brief Returns the number of bytes used in the FRAM ring set with withSpillStorage()
+     */
+    size_t getSpillBytesUsed() const { return spill.getBytesUsed(); };
+
+    /**
+     * @brief Track up to maxKeys keys of events published with publishKeyed() (default is 0)
+     * 
+     * @param maxKeys The number of different keys that can be queued at once, across all lanes.
+     * Each uses about 48 bytes of RAM. 0 turns keys off and publishKeyed() is the same as publish().
+     * 
+     * Call this before setup(), which finds the keyed events in the file queue. When there are
+     * more keys than this, the extra events are queued but can't be replaced.
+     */
+    PublishQueuePosix &withKeyedEvents(size_t maxKeys);
+
+    /**
+     * @brief Gets the number of keys set using withKeyedEvents()
+     */
+    size_t getKeyedEvents() const { return keyIndex.getMaxKeys(); };
 
     /**
      * @brief Sets the directory to use as the queue directory. This is required!
@@ -101,16 +1096,19 @@ public:
      * The dirPath can end with a slash or not, but if you include it, it will be
      * removed.
      * 
+     * The TELEMETRY lane uses this directory. The CRITICAL and DIAGNOSTICS lanes use the 
+     * critical and diagnostics subdirectories of it.
+     * 
      * You must call this as you cannot use the root directory as a queue!
      */
-    PublishQueuePosix &withDirPath(const char *dirPath) { fileQueue.withDirPath(dirPath); return *this; };
+    PublishQueuePosix &withDirPath(const char *dirPath) { getLane(PublishQueuePriority::TELEMETRY).fileQueue.withDirPath(dirPath); return *this; };
 
     /**
      * @brief Gets the directory path set using withDirPath()
      * 
      * The returned path will not end with a slash.
      */
-    const char *getDirPath() const { return fileQueue.getDirPath(); };
+    const char *getDirPath() const { return getLane(PublishQueuePriority::TELEMETRY).fileQueue.getDirPath(); };
 
     /**
      * @brief You must call this from setup() to initialize this library
@@ -123,7 +1121,71 @@ public:
     void loop();
 
 	/**
-	 * @brief Overload for publishing an event
+	 * @brief Overload for publishing an event
+	 *
+	 * @param eventName The name of the event (63 character maximum).
+	 *
+	 * @param flags1 Normally PRIVATE. You can also use PUBLIC, but one or the other must be specified.
+	 *
+	 * @param flags2 (optional) You can use NO_ACK or WITH_ACK if desired.
+	 *
+	 * @return true if the event was queued or false if it was not.
+	 *
+	 * This function almost always returns true. If you queue more events than fit in the buffer the
+	 * oldest (sometimes second oldest) is discarded.
+	 */
+	inline bool publish(const char *eventName, PublishFlags flags1, PublishFlags flags2 = PublishFlags()) {
+		return publishCommon(eventName, "", 60, flags1, flags2);
+	}
+
+	/**
+	 * @brief Overload for publishing an event
+	 *
+	 * @param eventName The name of the event (63 character maximum).
+	 *
+	 * @param data The event data (255 bytes maximum, 622 bytes in system firmware 0.8.0-rc.4 and later).
+	 *
+	 * @param flags1 Normally PRIVATE. You can also use PUBLIC, but one or the other must be specified.
+	 *
+	 * @param flags2 (optional) You can use NO_ACK or WITH_ACK if desired.
+	 *
+	 * @return true if the event was queued or false if it was not.
+	 *
+	 * This function almost always returns true. If you queue more events than fit in the buffer the
+	 * oldest (sometimes second oldest) is discarded.
+	 */
+	inline bool publish(const char *eventName, const char *data, PublishFlags flags1, PublishFlags flags2 = PublishFlags()) {
+		return publishCommon(eventName, data, 60, flags1, flags2);
+	}
+
+	/**
+	 * @brief Overload for publishing an event
+	 *
+	 * @param eventName The name of the event (63 character maximum).
+	 *
+	 * @param data The event data (255 bytes maximum, 622 bytes in system firmware 0.8.0-rc.4 and later).
+	 *
+	 * @param ttl The time-to-live value. If not specified in one of the other overloads, the value 60 is
+	 * used. However, the ttl is ignored by the cloud, so it doesn't matter what you set it to. Essentially
+	 * all events are discarded immediately if not subscribed to so they essentially have a ttl of 0.
+	 *
+	 * @param flags1 Normally PRIVATE. You can also use PUBLIC, but one or the other must be specified.
+	 *
+	 * @param flags2 (optional) You can use NO_ACK or WITH_ACK if desired.
+	 *
+	 * @return true if the event was queued or false if it was not.
+	 *
+	 * This function almost always returns true. If you queue more events than fit in the buffer the
+	 * oldest (sometimes second oldest) is discarded.
+	 */
+	inline bool publish(const char *eventName, const char *data, int ttl, PublishFlags flags1, PublishFlags flags2 = PublishFlags()) {
+		return publishCommon(eventName, data, ttl, flags1, flags2);
+	}
+
+	/**
+	 * @brief Overload for publishing an event in the lane for priority
+	 *
+	 * @param priority The lane to queue the event in, for example PublishQueuePriority::CRITICAL.
 	 *
 	 * @param eventName The name of the event (63 character maximum).
 	 *
@@ -133,15 +1195,16 @@ public:
 	 *
 	 * @return true if the event was queued or false if it was not.
 	 *
-	 * This function almost always returns true. If you queue more events than fit in the buffer the
-	 * oldest (sometimes second oldest) is discarded.
+	 * The other overloads use PublishQueuePriority::TELEMETRY.
 	 */
-	inline bool publish(const char *eventName, PublishFlags flags1, PublishFlags flags2 = PublishFlags()) {
-		return publishCommon(eventName, "", 60, flags1, flags2);
+	inline bool publish(PublishQueuePriority priority, const char *eventName, PublishFlags flags1, PublishFlags flags2 = PublishFlags()) {
+		return publishCommon(eventName, "", 60, flags1, flags2, priority);
 	}
 
 	/**
-	 * @brief Overload for publishing an event
+	 * @brief Overload for publishing an event in the lane for priority
+	 *
+	 * @param priority The lane to queue the event in, for example PublishQueuePriority::CRITICAL.
 	 *
 	 * @param eventName The name of the event (63 character maximum).
 	 *
@@ -153,35 +1216,47 @@ public:
 	 *
 	 * @return true if the event was queued or false if it was not.
 	 *
-	 * This function almost always returns true. If you queue more events than fit in the buffer the
-	 * oldest (sometimes second oldest) is discarded.
+	 * The other overloads use PublishQueuePriority::TELEMETRY.
 	 */
-	inline bool publish(const char *eventName, const char *data, PublishFlags flags1, PublishFlags flags2 = PublishFlags()) {
-		return publishCommon(eventName, data, 60, flags1, flags2);
+	inline bool publish(PublishQueuePriority priority, const char *eventName, const char *data, PublishFlags flags1, PublishFlags flags2 = PublishFlags()) {
+		return publishCommon(eventName, data, 60, flags1, flags2, priority);
 	}
 
 	/**
-	 * @brief Overload for publishing an event
+	 * @brief Publish an event that replaces any unsent event queued with the same key
+	 *
+	 * @param key The coalescing key, for example a space number. Events only replace events with
+	 * the same eventName and priority, so the key does not need to include the name.
 	 *
 	 * @param eventName The name of the event (63 character maximum).
 	 *
 	 * @param data The event data (255 bytes maximum, 622 bytes in system firmware 0.8.0-rc.4 and later).
 	 *
-	 * @param ttl The time-to-live value. If not specified in one of the other overloads, the value 60 is
-	 * used. However, the ttl is ignored by the cloud, so it doesn't matter what you set it to. Essentially
-	 * all events are discarded immediately if not subscribed to so they essentially have a ttl of 0.
-	 *
 	 * @param flags1 Normally PRIVATE. You can also use PUBLIC, but one or the other must be specified.
 	 *
 	 * @param flags2 (optional) You can use NO_ACK or WITH_ACK if desired.
 	 *
 	 * @return true if the event was queued or false if it was not.
 	 *
-	 * This function almost always returns true. If you queue more events than fit in the buffer the
-	 * oldest (sometimes second oldest) is discarded.
+	 * Use this for events where only the latest value matters. In the RAM queue the older event's
+	 * data is replaced in place if it fits. Otherwise the older event is marked as superseded where
+	 * it is, in the RAM queue or in a segment file, and is not sent, and the new event is queued at
+	 * the end, as usual. An event that is already being sent is not replaced.
+	 *
+	 * Keys are only tracked when withKeyedEvents() is set, and events on the flash file system
+	 * are only replaced when withSegmentSize() is set. Otherwise this is the same as publish().
 	 */
-	inline bool publish(const char *eventName, const char *data, int ttl, PublishFlags flags1, PublishFlags flags2 = PublishFlags()) {
-		return publishCommon(eventName, data, ttl, flags1, flags2);
+	inline bool publishKeyed(const char *key, const char *eventName, const char *data, PublishFlags flags1, PublishFlags flags2 = PublishFlags()) {
+		return publishCommon(eventName, data, 60, flags1, flags2, PublishQueuePriority::TELEMETRY, key);
+	}
+
+	/**
+	 * @brief Publish an event in the lane for priority that replaces any unsent event queued with the same key
+	 *
+	 * See the overload without priority.
+	 */
+	inline bool publishKeyed(PublishQueuePriority priority, const char *key, const char *eventName, const char *data, PublishFlags flags1, PublishFlags flags2 = PublishFlags()) {
+		return publishCommon(eventName, data, 60, flags1, flags2, priority, key);
 	}
 
 	/**
@@ -199,12 +1274,16 @@ public:
 	 *
 	 * @param flags2 (optional) You can use NO_ACK or WITH_ACK if desired.
 	 *
+	 * @param priority (optional) The lane to queue the event in. Default is PublishQueuePriority::TELEMETRY.
+	 *
+	 * @param key (optional) Coalescing key, see publishKeyed(). Default is NULL, no key.
+	 *
 	 * @return true if the event was queued or false if it was not.
 	 *
 	 * This function almost always returns true. If you queue more events than fit in the buffer the
-	 * oldest (sometimes second oldest) is discarded.
+	 * oldest (sometimes second oldest) is discarded, unless the lane uses DropPolicy::DROP_NEWEST.
 	 */
-	virtual bool publishCommon(const char *eventName, const char *data, int ttl, PublishFlags flags1, PublishFlags flags2 = PublishFlags());
+	virtual bool publishCommon(const char *eventName, const char *data, int ttl, PublishFlags flags1, PublishFlags flags2 = PublishFlags(), PublishQueuePriority priority = PublishQueuePriority::TELEMETRY, const char *key = NULL);
 
     /**
      * @brief If there are events in the RAM queue, write them to files in the flash file system
@@ -244,6 +1323,14 @@ public:
      */
     bool getCanSleep() const { return canSleep; };
 
+    /**
+     * @brief How long loop() can go without being called, for an application that sleeps between calls
+     * 
+     * 0 while cloud connected or while publishes are in flight, as loop() moves those along. Otherwise it's
+     * the time until the next stats publish (withStatsPublish()), or 0xffffffff if nothing is timed.
+     */
+    unsigned long getMsUntilLoop() const;
+
     /**
      * @brief Gets the total number of events queued
      * 
@@ -256,7 +1343,49 @@ public:
     size_t getNumEvents();
 
     /**
-     * @brief Check the queue limit, discarding events as necessary
+     * @brief Gets the number of events queued in the lane for priority
+     */
+    size_t getNumEvents(PublishQueuePriority priority);
+
+    /**
+     * @brief Gets the queue counters and histograms, see PublishQueueStats
+     * 
+     * The age of the oldest event is found from the head of each lane, which reads the first
+     * record of a segment file. Events in files written one event per file don't have the time they
+     * were published, so they are not in the age or the queue latency.
+     */
+    void getStats(PublishQueueStats &stats);
+
+    /**
+     * @brief Starts new counters, histograms and maximums
+     */
+    void resetStats();
+
+    /**
+     * @brief Publish the stats every periodMs milliseconds as eventName in the DIAGNOSTICS lane (default is off)
+     * 
+     * @param eventName The name of the event, or NULL to turn it off
+     * 
+     * @param periodMs How often to publish. The stats are reset after each one, so it's also the period the counters cover.
+     * 
+     * The event data is compact JSON, for example:
+     * 
+     * {"t":3600,"q":42,"qb":5120,"s":40,"p":12,"f":1,"r":3,"d":[0,0,0,0,2,0],"ql":[30,10,0,0,0,0],"pl":[0,8,3,1,0,0],
+     * "fs":350,"mr":4,"mf":18,"mb":812,"r0":0,"f0":2,"b0":0,"age":95}
+     * 
+     * t is the period in seconds. q through fs are the counters, with d, ql and pl the drops and histograms in the order
+     * of PublishQueueStats. mr, mf and mb are the maximum RAM events, file events and RAM bytes, r0, f0 and b0 the values
+     * when published, and age the age of the oldest event in seconds.
+     */
+    PublishQueuePosix &withStatsPublish(const char *eventName, unsigned long periodMs);
+
+    /**
+     * @brief Publish the stats now, as the event set using withStatsPublish(), and reset them
+     */
+    void publishStats();
+
+    /**
+     * @brief Check the queue limits of every lane, discarding events as necessary
      * 
      * When the RAM queue exceeds the limit, all events are moved into files. 
      */
@@ -290,6 +1419,26 @@ public:
      */
     static const uint8_t FILE_VERSION = 1;
 
+    /**
+     * @brief Magic bytes stored at the beginning of segment files
+     */
+    static const uint32_t SEGMENT_MAGIC = 0x31b67664;
+
+    /**
+     * @brief Version of the segment file header
+     */
+    static const uint8_t SEGMENT_VERSION = 3;
+
+    /**
+     * @brief Set in PublishQueueSegmentRecord::nameLen when a newer event with the same key was published
+     */
+    static const uint8_t SEGMENT_RECORD_SUPERSEDED = 0x80;
+
+    /**
+     * @brief PublishQueueKeyIndex::Entry fileNum for an event in the FRAM ring, with its sequence number in offset
+     */
+    static const int SPILL_FILE_NUM = -1;
+
 protected:
     /**
      * @brief Constructor 
@@ -317,81 +1466,429 @@ protected:
      */
     PublishQueuePosix& operator=(const PublishQueuePosix&) = delete;
 
+    struct Lane;
+
     /**
-     * @brief Allocate a new event structure in RAM
+     * @brief Read an event from a sequentially numbered file 
+     * 
+     * @param lane The lane the file is in
      * 
-     * The PublishEventQueue structure contains a header and is variably sized for the eventData.
+     * @param fileNum The file number to read 
      * 
-     * May return NULL if eventName or eventData are invalid (too long) or out of memory.
+     * May return NULL if file does not exist, or out of memory.
      * 
-     * You must delete the result from this method when you are done using it. 
+     * Free the result with freeEvent() when you are done using it. 
      */
-    PublishQueueEvent *newRamEvent(const char *eventName, const char *eventData, PublishFlags flags);
+    PublishQueueEvent *readQueueFile(Lane &lane, int fileNum);
 
     /**
-     * @brief Read an event from a sequentially numbered file 
+     * @brief State of a segment file that is being appended to or read from
+     */
+    struct SegmentState {
+        int fileNum = 0;                    //!< File number of the segment, 0 if none
+        int fd = -1;                        //!< Open file descriptor when reading, -1 if not open
+        PublishQueueSegmentHeader hdr;      //!< Copy of the segment header
+        uint32_t endOffset = 0;             //!< Size of the segment file, for the tail segment
+        uint32_t lastOffset = 0;            //!< File offset of the last event appended, for the tail segment
+        uint32_t readOffset = 0;            //!< File offset of the next event to read
+        uint16_t readCount = 0;             //!< Number of events before readOffset
+        uint32_t filePos = 0;               //!< Current position of fd, to avoid seeking when reading sequentially
+        uint16_t checkpointCount = 0;       //!< sentCount last written to the file
+        bool exhausted = false;             //!< Read to the end with events still in flight; not read again until they complete or it's reopened
+    };
+
+    /**
+     * @brief One lane of the queue: a RAM queue, a file queue, and their limits
+     */
+    struct Lane {
+        SequentialFile fileQueue;                   //!< Queue of files on the flash file system
+        PublishQueueRing ramQueue;                  //!< Queue in RAM
+        size_t ramQueueSize = 2;                    //!< size of the queue in RAM
+        size_t ramQueueBytes = 2048;                //!< size of the ramQueue buffer in bytes
+        size_t fileQueueSize = 100;                 //!< maximum number of events on the flash file system
+        DropPolicy dropPolicy = DropPolicy::DROP_OLDEST; //!< what to do when the lane is full
+        unsigned int weight = 1;                    //!< events per round with DrainPolicy::WEIGHTED
+        unsigned int credit = 0;                    //!< events left in this round with DrainPolicy::WEIGHTED
+        size_t fileQueueEvents = 0;                 //!< number of unsent events in the file queue (files can hold more than one event)
+        SegmentState headSegment;                   //!< segment events are being read from
+        SegmentState tailSegment;                   //!< segment events are being appended to
+        unsigned long batchWindowStart = 0;         //!< millis() value when the batched event at the head of the RAM queue was first seen
+        bool batchWaiting = false;                  //!< true if holding the head of the RAM queue for batchWindowMs
+        size_t spillSending = 0;                    //!< number of events in the FRAM ring being sent
+    };
+
+    /**
+     * @brief Gets the lane for priority
+     */
+    Lane &getLane(PublishQueuePriority priority) { return lanes[(size_t)priority < NUM_LANES ? (size_t)priority : 1]; };
+
+    /**
+     * @brief Gets the lane for priority
+     */
+    const Lane &getLane(PublishQueuePriority priority) const { return lanes[(size_t)priority < NUM_LANES ? (size_t)priority : 1]; };
+
+    /**
+     * @brief Returns true if lane has events waiting to be sent
+     */
+    bool laneHasEvents(const Lane &lane) const { return !lane.ramQueue.empty() || lane.fileQueue.getQueueLen() > 0 || spill.size(laneIndex(lane)) > 0; };
+
+    /**
+     * @brief Returns the index of lane in lanes, which is also its lane number in the FRAM ring
+     */
+    uint8_t laneIndex(const Lane &lane) const { return (uint8_t)(&lane - lanes); };
+
+    /**
+     * @brief Returns the number of events in lane
+     */
+    size_t countLaneEvents(const Lane &lane) const;
+
+    /**
+     * @brief Chooses the lane to send the next event from using the drain policy, or NULL if there are no events
+     */
+    Lane *selectLane();
+
+    /**
+     * @brief If there are events in the RAM queue of lane, write them to files in the flash file system
      * 
-     * @param fileNum The file number to read 
+     * Events being sent stay in the RAM queue. If eventName is not NULL, that event is written
+     * after the RAM queue; it's used for an event that does not fit in the RAM queue.
+     */
+    void writeQueueToFiles(Lane &lane, const char *eventName = NULL, const char *eventData = NULL, PublishFlags flags = PublishFlags(), uint32_t key = 0);
+
+    /**
+     * @brief Write an event to a new file in the file queue of lane, one event per file
      * 
-     * May return NULL if file does not exist, or out of memory.
+     * @return false if the file could not be written, and nothing was added to the queue
+     */
+    bool writeEventToFile(Lane &lane, const char *eventName, const char *eventData, PublishFlags flags);
+
+    /**
+     * @brief Move the events in the RAM queue of lane to the FRAM ring, then eventName if not NULL
      * 
-     * You must delete the result from this method when you are done using it. 
+     * Returns true if they all fit. Otherwise the ones that did not fit are left in the RAM queue.
+     * eventName, eventData, flags, and key are the same as writeQueueToFiles().
      */
-    PublishQueueEvent *readQueueFile(int fileNum);
+    bool writeQueueToSpill(Lane &lane, const char *eventName, const char *eventData, PublishFlags flags, uint32_t key);
 
     /**
-     * @brief Callback for BackgroundPublishRK library
+     * @brief Check the queue limit of lane, discarding events as necessary
      */
-    void publishCompleteCallback(bool succeeded, const char *eventName, const char *eventData);
+    void checkQueueLimits(Lane &lane);
 
     /**
-     * @brief State handler for waiting to connect to the Particle cloud
+     * @brief Append the events in the RAM queue to the tail segment, starting new segments as needed
      * 
-     * Next state: stateWait
+     * eventName, eventData, flags, and key are the same as writeQueueToFiles().
      */
-    void stateConnectWait();
+    void writeQueueToSegments(Lane &lane, const char *eventName, const char *eventData, PublishFlags flags, uint32_t key);
 
     /**
-     * @brief State handler for waiting to publish
+     * @brief Append an event to the tail segment of lane
      * 
-     * stateTime and durationMs determine whether to stay in this state waiting, or whether
-     * to publish and go into statePublishWait.
+     * @param queuedAt The time the event was published, 0 if not known
      * 
-     * Next state: statePublishWait or stateConnectWait
+     * @param fd The tail segment file descriptor, or -1 if not open yet. Close it when done.
+     * 
+     * Returns false if a new segment could not be created.
      */
-    void stateWait();
+    bool writeEventToSegment(Lane &lane, const char *eventName, const char *eventData, PublishFlags flags, uint32_t key, uint32_t queuedAt, int &fd);
+
+    /**
+     * @brief Read the next event to send from segment fileNum
+     * 
+     * @param fileNum The file number at the head of the file queue
+     * 
+     * @param isSegment Set to false if fileNum holds one event per file, which is read using readQueueFile()
+     * 
+     * @param queuedAt Set to the time the event was published, or 0 if not known
+     * 
+     * Returns NULL if there is no event to send. A segment that has been completely sent, or is
+     * corrupted, is removed. Free the result with freeEvent() when you are done using it.
+     */
+    PublishQueueEvent *readSegmentEvent(Lane &lane, int fileNum, bool &isSegment, uint32_t &queuedAt);
+
+    /**
+     * @brief Read and validate the header of segment fileNum into seg, leaving the file open for reading
+     */
+    bool openSegment(Lane &lane, int fileNum, SegmentState &seg);
+
+    /**
+     * @brief Returns the number of events in file fileNum that have not been acknowledged
+     * 
+     * This is 1 for a file that holds one event. For a segment, the events after the checkpoint are counted,
+     * except superseded ones.
+     * 
+     * @param indexKeys Add the events with a key to the key index, used at startup
+     */
+    size_t countUnsentEvents(Lane &lane, int fileNum, bool indexKeys = false);
+
+    /**
+     * @brief Returns the time the first event not acknowledged in segment fileNum was published, 0 if not known
+     */
+    uint32_t segmentQueuedAt(Lane &lane, int fileNum);
+
+    /**
+     * @brief Close the head segment file descriptor if open
+     */
+    void closeSegment(SegmentState &seg);
+
+    /**
+     * @brief Write the header of the head segment so acknowledged events are not sent again after a reset
+     */
+    void checkpointSegment(Lane &lane);
+
+    /**
+     * @brief Remove segment or event file fileNum from the file queue, the file system and the event count
+     * 
+     * @param unsentEvents the number of unsent events in the file
+     */
+    void removeQueueFile(Lane &lane, int fileNum, size_t unsentEvents);
+
+    /**
+     * @brief Count the unsent events in the file queue, used at startup
+     */
+    void countFileQueueEvents(Lane &lane);
+
+    /**
+     * @brief Get the time to store with an event published now, 0 if the time is not valid
+     */
+    static uint32_t queuedAtNow() { return Time.isValid() ? (uint32_t)Time.now() : 0; };
+
+    /**
+     * @brief Get the key of an event published with key in the lane for priority, never 0
+     */
+    static uint32_t keyHash(PublishQueuePriority priority, const char *eventName, const char *key);
+
+    /**
+     * @brief Get a second hash of the same values as keyHash(), to tell apart keys whose keyHash() is the same
+     */
+    static uint32_t keyCheck(PublishQueuePriority priority, const char *eventName, const char *key);
+
+    /**
+     * @brief Returns true if entry is for an event published with eventName and keyCheck() check in lane
+     * 
+     * Only the index is used for events in files; supersedeSegmentEvent() and PublishQueueSpill::supersede()
+     * compare the event name before they change anything.
+     */
+    bool isSameKey(const PublishQueueKeyIndex::Entry &entry, Lane &lane, const char *eventName, uint32_t check);
+
+    /**
+     * @brief Find the index entry for key, or NULL if there is no unsent event with the key
+     * 
+     * Entries for events in files that have since been sent or discarded are removed here.
+     */
+    PublishQueueKeyIndex::Entry *findKey(uint32_t key);
+
+    /**
+     * @brief Returns true if the event for entry is still queued and not being sent
+     */
+    bool isKeyEntryValid(const PublishQueueKeyIndex::Entry &entry);
+
+    /**
+     * @brief Set the index entry for key to an event in the RAM queue (fileNum 0) or in segment fileNum
+     */
+    void indexKey(uint32_t key, Lane &lane, int fileNum, uint32_t offset, PublishQueueEvent *event);
+
+    /**
+     * @brief Remove the index entry for event in the RAM queue of lane, if there is one
+     */
+    void unindexRamEvent(Lane &lane, const PublishQueueEvent *event);
+
+    /**
+     * @brief Returns true if the index entry for the key of event in the RAM queue of lane is event
+     */
+    bool isRamEventIndexed(Lane &lane, const PublishQueueEvent *event);
+
+    /**
+     * @brief Mark the event at offset in segment fileNum as superseded, so it's not sent
+     * 
+     * @return false if the event is not there, has a name other than eventName, or could not be changed
+     */
+    bool supersedeSegmentEvent(Lane &lane, int fileNum, uint32_t offset, const char *eventName);
+
+    /**
+     * @brief Allocate an empty batch event with room for the maximum event data size
+     * 
+     * Free the result with freeEvent() when you are done using it.
+     */
+    PublishQueueEvent *newBatchEvent(const char *batchName, PublishFlags flags);
+
+    /**
+     * @brief Add event to the JSON array in batch, which is len bytes long so far
+     * 
+     * Returns false and leaves the batch unchanged if the event does not fit.
+     */
+    bool addToBatch(PublishQueueEvent *batch, size_t &len, const PublishQueueEvent *event) const;
+
+    /**
+     * @brief Format event as an element of the JSON array for batch, writing at most bufSize bytes
+     * 
+     * Returns the length of the element, which is larger than bufSize if it did not fit.
+     */
+    static size_t formatBatchElement(char *buf, size_t bufSize, const PublishQueueEvent *event, const char *batchName);
+
+    /**
+     * @brief Combine the first events in batch batchName not being sent from the RAM queue, returning the combined event
+     * 
+     * The events stay in the RAM queue, marked as being sent, until the publish completes.
+     */
+    PublishQueueEvent *batchFromRamQueue(Lane &lane, const char *batchName);
+
+    /**
+     * @brief Combine first, read from curFileNum, with the events after it in the head segment
+     * 
+     * first is deleted if it was added to the batch. A one event per file file is sent as a batch of one.
+     */
+    PublishQueueEvent *batchFromFile(Lane &lane, PublishQueueEvent *first, const char *batchName);
+
+    /**
+     * @brief A publish that has been started and not completed
+     */
+    struct InFlight {
+        Lane *lane = NULL;                  //!< Lane the events were taken from, NULL if the queue was cleared since
+        int fileNum = 0;                    //!< File the events were read from, 0 for the RAM queue
+        bool fromSegment = false;           //!< true if read from a segment
+        bool fromSpill = false;             //!< true if read from the FRAM ring
+        size_t eventCount = 0;              //!< Number of queued events in the publish, more than one for a batch
+        uint32_t readOffset = 0;            //!< Segment readOffset after the events, acknowledged when the publish succeeds
+        uint16_t readCount = 0;             //!< Segment readCount after the events
+        unsigned long startMs = 0;          //!< millis() value when the publish was started
+        uint32_t queuedAt = 0;              //!< Time the first event in the publish was queued, 0 if not known
+        volatile unsigned long latencyMs = 0; //!< Time from startMs until it completed, set by publishCompleteCallback()
+        volatile bool complete = false;     //!< Set by publishCompleteCallback() from the publish thread
+        volatile bool success = false;      //!< Set by publishCompleteCallback() if the publish succeeded
+        bool failed = false;                //!< Failed and waiting to be sent again
+        PublishQueueEvent *event = NULL;    //!< The event that was published, kept to send again if it fails
+        bool ownsEvent = false;             //!< true if event is freed with the publish, false if it's in the RAM queue
+    };
+
+    /**
+     * @brief Callback for BackgroundPublishRK library. context is the InFlight for the publish.
+     */
+    void publishCompleteCallback(bool succeeded, const char *eventName, const char *eventData, const void *context);
+
+    /**
+     * @brief Handle the completed publishes at the head of inFlight, in the order they were started
+     * 
+     * A publish that failed stays in inFlight with its event, and holds back the acknowledgement of
+     * the ones after it. Once none are left in flight, the wait after the failure starts.
+     */
+    void completeInFlight();
+
+    /**
+     * @brief Remove the events in publish from the queue after the publish succeeded
+     */
+    void finishPublish(const InFlight &publish);
+
+    /**
+     * @brief Publish the oldest failed publish again, once the wait after the failure is over
+     * 
+     * @return true if there is a failed publish, sent or still waiting. No new events are started until it's false.
+     */
+    bool resendFailed();
+
+    /**
+     * @brief Free the event kept with a publish once it's acknowledged or no longer needed
+     */
+    void releaseInFlight(InFlight &publish);
+
+    /**
+     * @brief Returns true if an event in fileNum, written one event per file, is in flight
+     */
+    bool isFileInFlight(const Lane &lane, int fileNum) const;
+
+    /**
+     * @brief Count count events discarded for reason in the stats
+     */
+    void countDrop(PublishQueueDropReason reason, size_t count = 1) { stats.drops[(size_t)reason] += count; };
+
+    /**
+     * @brief Update the maximum depths in the stats after an event was queued
+     */
+    void updateMaxDepths();
+
+    /**
+     * @brief Add value to the histogram with the given bucket limits
+     */
+    static void addToHistogram(uint32_t *buckets, const uint32_t *limits, uint32_t value);
+
+    /**
+     * @brief Adds the time until it goes out of scope to the file system time in the stats
+     * 
+     * It holds the queue mutex. When they're nested, only the outermost one counts.
+     */
+    class FileSystemTimer {
+    public:
+        FileSystemTimer(PublishQueuePosix &queue) : queue(queue) { queue.lock(); if (queue.fileSystemTimers++ == 0) start = micros(); };
+        ~FileSystemTimer() { if (--queue.fileSystemTimers == 0) queue.fileSystemUs += micros() - start; queue.unlock(); };
+    protected:
+        PublishQueuePosix &queue;       //!< The queue being timed
+        unsigned long start = 0;        //!< micros() value when the outermost timer started
+    };
 
     /**
-     * @brief State handler for waiting for publish to complete
+     * @brief State handler for waiting to connect to the Particle cloud
      * 
      * Next state: stateWait
      */
-    void statePublishWait();
+    void stateConnectWait();
+
+    /**
+     * @brief State handler for publishing
+     * 
+     * stateTime and durationMs set a wait after connecting or a failure. After that a publish is
+     * started whenever governor has a token, up to maxInFlight in flight.
+     * 
+     * Next state: stateConnectWait
+     */
+    void stateWait();
 
     /**
-     * @brief SequentialFileRK library object for maintaining the queue of files on the POSIX file system
+     * @brief Lanes of the queue, indexed by PublishQueuePriority
      */
-    SequentialFile fileQueue;
+    Lane lanes[NUM_LANES];
 
+    DrainPolicy drainPolicy = DrainPolicy::STRICT; //!< how to choose the lane to send from
+    Lane *curLane = NULL; //!< Lane curEvent was taken from
+    size_t segmentSize = 0; //!< size of segment files in bytes, 0 for one event per file
+    bool curFromSegment = false; //!< true if curEvent was read from a segment
 
-    size_t ramQueueSize = 2; //!< size of the queue in RAM
-    size_t fileQueueSize = 100; //!< size of the queue on the flash file system
+    /**
+     * @brief An event name that is sent in batches
+     */
+    struct BatchEvent {
+        String eventName; //!< Name of the event to batch
+        String batchName; //!< Name of the combined event
+    };
+    std::vector<BatchEvent> batchEvents; //!< Events sent in batches, set using withBatchEvent()
+    unsigned long batchWindowMs = 2000; //!< how long to hold a batched event in the RAM queue
+    PublishQueueKeyIndex keyIndex; //!< Queued events published with a key, set using withKeyedEvents()
+    PublishQueueSpill spill; //!< FRAM ring between the RAM queues and the files, set using withSpillStorage()
+    size_t curBatchCount = 0; //!< Number of events from the file queue in curEvent, when it's a batch
 
     os_mutex_recursive_t mutex; //!< mutex for protecting the queue
-    std::deque<PublishQueueEvent*> ramQueue; //!< Queue in RAM
 
-    PublishQueueEvent *curEvent = 0; //!< Current event being published
-    int curFileNum = 0; //!< Current file number being published (0 if from RAM queue)
+    PublishQueueEvent *curEvent = 0; //!< Event being started
+    int curFileNum = 0; //!< File number of the event being started (0 if from RAM queue)
     unsigned long stateTime = 0; //!< millis() value when entering the state, used for stateWait
     unsigned long durationMs = 0; //!< how long to wait before publishing in milliseconds, used in stateWait
-    bool publishComplete = false; //!< true if the publish has completed (successfully or not)
-    bool publishSuccess = false; //!< true if the publish succeeded
+    InFlight inFlight[MAX_IN_FLIGHT]; //!< Circular buffer of the publishes in flight, oldest at inFlightHead
+    size_t maxInFlight = 1; //!< Size of the circular buffer, set using withMaxInFlight()
+    size_t inFlightLimit = 1; //!< Publishes allowed in flight now: 1 after a failure, growing back to maxInFlight
+    size_t inFlightHead = 0; //!< Index in inFlight of the oldest publish in flight
+    size_t inFlightCount = 0; //!< Number of publishes in flight
+    size_t inFlightFailures = 0; //!< Publishes that failed while others are still in flight
     bool pausePublishing = false; //!< flag to pause publishing (used from automated test)
+    PublishQueueStats stats = {}; //!< counters and histograms since statsTime, see getStats()
+    unsigned long statsTime = 0; //!< millis() value when the stats were reset
+    uint64_t fileSystemUs = 0; //!< file system time since the stats were reset, in microseconds
+    size_t fileSystemTimers = 0; //!< number of nested FileSystemTimer
+    String statsEventName; //!< event to publish the stats as, set using withStatsPublish()
+    unsigned long statsPeriodMs = 0; //!< how often to publish the stats, 0 for never
     bool canSleep = false; //!< returns true if this is a good time to go to sleep
 
     unsigned long waitAfterConnect = 2000; //!< time to wait after Particle.connected() before publishing
-    unsigned long waitBetweenPublish = 1000; //!< how long to wait in milliseconds between publishes
-    unsigned long waitAfterFailure = 30000; //!< how long to wait after failing to publish before trying again
+    PublishQueueGovernor governor; //!< paces publishes and sets the wait after a failure
 
     std::function<void(PublishQueuePosix&)> stateHandler = 0; //!< state handler (stateConnectWait, stateWait, etc).
 
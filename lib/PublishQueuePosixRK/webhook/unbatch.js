@@ -0,0 +1,38 @@
+// Splits a batch published by PublishQueuePosixRK back into the original events.
+//
+// The webhook in batch-webhook.json posts {"device", "event", "published", "batch"}, where
+// batch is the JSON array from the event data. Call unbatch() with the parsed request body,
+// for example from a Ubidots UbiFunction or any Node.js handler, and process each event as
+// if it had been published by itself.
+//
+// Elements of the array are either:
+// - the data of an event named the same as the batch (the event field), or
+// - {"name": "eventName", "data": data} for other events in the same batch group
+//
+// Data that was not JSON is a string, so it's returned unchanged.
+
+function unbatch(body) {
+    const events = [];
+
+    let batch = body.batch;
+    if (typeof batch === 'string') {
+        batch = JSON.parse(batch);
+    }
+    if (!Array.isArray(batch)) {
+        // Not batched, a single event
+        return [{ name: body.event, data: batch, published: body.published }];
+    }
+
+    for (const element of batch) {
+        if (element && typeof element === 'object' && !Array.isArray(element) &&
+            Object.keys(element).length === 2 && 'name' in element && 'data' in element) {
+            events.push({ name: element.name, data: element.data, published: body.published });
+        }
+        else {
+            events.push({ name: body.event, data: element, published: body.published });
+        }
+    }
+    return events;
+}
+
+module.exports = { unbatch };
@@ -10,7 +10,10 @@
 
 // This is the maximum possible message size for radios supported by RadioHead.
 // Not all radios support this length, and many are much smaller
-#define RH_MAX_MESSAGE_LEN 255
+// Normally set in RadioHead.h to size the stack for our messages
+#ifndef RH_MAX_MESSAGE_LEN
+ #define RH_MAX_MESSAGE_LEN 255
+#endif
 
 /////////////////////////////////////////////////////////////////////
 /// \class RHDatagram RHDatagram.h <RHDatagram.h>
@@ -19,34 +19,67 @@ bool RHEncryptedDriver::recv(uint8_t* buf, uint8_t* len)
 {
     int h = 0; // Index of output _buffer
 
-    bool status = _driver.recv(_buffer, len);
-    if (status && buf && len)
+    if (!buf || !len)
+	return _driver.recv(NULL, NULL); // Nowhere to put it, just discard the message
+
+    // Decrypt straight out of the driver's receive buffer if it will lend it to us,
+    // otherwise copy the cipher text into _buffer first. Either way available() runs once per poll
+    uint8_t* cipherText;
+    uint8_t  cipherLen;
+    if (_driver.canLendBuffer())
+    {
+	if (!_driver.recvNoCopy(&cipherText, &cipherLen))
+	    return false;
+    }
+    else
+    {
+	cipherLen = _driver.maxMessageLength();
+	if (!_driver.recv(_buffer, &cipherLen))
+	    return false;
+	cipherText = _buffer;
+    }
+
+    int blockSize = _blockcipher.blockSize(); // Size of blocks used by encryption
+    int nbBlocks = cipherLen / blockSize;     // Number of blocks in that message
+#ifdef STRICT_CONTENT_LEN
+    int plainLen = nbBlocks * blockSize - 1;  // First byte of the first block is the length
+    // The first block is decrypted whole before its length byte is dropped, so a single
+    // block message needs one byte more than it returns
+    int spaceNeeded = (plainLen < blockSize) ? blockSize : plainLen;
+#else
+    int plainLen = nbBlocks * blockSize;
+    int spaceNeeded = plainLen;
+#endif
+    if (nbBlocks == 0 || nbBlocks * blockSize != cipherLen || spaceNeeded > *len)
     {
-	int blockSize = _blockcipher.blockSize(); // Size of blocks used by encryption
-	int nbBlocks = *len / blockSize; 	  // Number of blocks in that message
-	if (nbBlocks * blockSize == *len)
+	// Either we have a missmatch ... this is probably not symetrically encrypted
+	// or it will not fit in the callers buffer
+	_rxBad++;
+	return false;
+    }
+
+    *len = plainLen;
+    for (int k = 0; k < nbBlocks; k++)
+    {
+	// Decrypt each block
+	_blockcipher.decryptBlock(&buf[h], &cipherText[k*blockSize]); // Decrypt that block into buf
+	h += blockSize;
+#ifdef STRICT_CONTENT_LEN	
+	if (k == 0)
 	{
-	    // Or we have a missmatch ... this is probably not symetrically encrypted 
-	    for (int k = 0; k < nbBlocks; k++)
+	    if (buf[0] > plainLen)
 	    {
-		// Decrypt each block
-		_blockcipher.decryptBlock(&buf[h], &_buffer[k*blockSize]); // Decrypt that block into buf	
-		h += blockSize;
-#ifdef STRICT_CONTENT_LEN	
-		if (k == 0)
-		{
-//		    if (buf[0] > *len - 1)
-//			return false; // Bogus payload length
-		    *len = buf[0]; // First byte contains length
-		    h--;	   // First block is of length--
-		    memmove(buf, buf+1, blockSize - 1);
-		}
-#endif			
+		_rxBad++;
+		return false; // Bogus payload length
 	    }
+	    *len = buf[0]; // First byte contains length
+	    h--;	   // First block is of length--
+	    memmove(buf, buf+1, blockSize - 1);
 	}
+#endif			
     }
 
-    return status;
+    return true;
 }
 
 bool RHEncryptedDriver::send(const uint8_t* data, uint8_t len)
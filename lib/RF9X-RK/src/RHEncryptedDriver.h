@@ -161,6 +161,11 @@ public:
     /// \param[in] promiscuous true if you wish to receive messages with any TO address
     virtual void           setPromiscuous(bool promiscuous){ _driver.setPromiscuous(promiscuous);};
 
+    /// Sets a function to be called from the underlying driver's interrupt handler when a new message is received
+    /// \param[in] callback The function to call, or NULL to stop notifications
+    /// \param[in] context Passed to the callback
+    virtual void           setRxCallback(void (*callback)(void* context), void* context = NULL){ _driver.setRxCallback(callback, context);};
+
     /// Returns the TO header of the last received message
     /// \return The TO header
     virtual uint8_t        headerTo() { return _driver.headerTo();};
@@ -16,10 +16,20 @@ RHGenericDriver::RHGenericDriver()
     _rxBad(0),
     _rxGood(0),
     _txGood(0),
-    _cad_timeout(0)
+    _cad_timeout(0),
+    _rxCallback(NULL),
+    _rxCallbackContext(NULL)
 {
 }
 
+void RHGenericDriver::setRxCallback(void (*callback)(void* context), void* context)
+{
+    ATOMIC_BLOCK_START;
+    _rxCallback = callback;
+    _rxCallbackContext = context;
+    ATOMIC_BLOCK_END;
+}
+
 bool RHGenericDriver::init()
 {
     return true;
@@ -86,6 +86,29 @@ public:
     /// \return true if a valid message was copied to buf
     virtual bool recv(uint8_t* buf, uint8_t* len) = 0;
 
+    /// Like recv(), but instead of copying the message out, lends the caller a pointer to the
+    /// message in the Driver's own receive buffer. The pointer is only valid until the next call to
+    /// available(), recv() or recvNoCopy(), so the caller must consume (or copy) the message at once.
+    /// Only drivers whose canLendBuffer() returns true implement it; the others always return false,
+    /// so check canLendBuffer() to tell "no message" from "cannot lend" and fall back to recv().
+    /// \param[out] buf Set to point to the received message
+    /// \param[out] len Set to the length of the received message
+    /// \return true if a valid message was lent
+    virtual bool recvNoCopy(uint8_t** buf, uint8_t* len) { (void)buf; (void)len; return false; }
+
+    /// Tells whether this Driver implements recvNoCopy()
+    /// \return true if recvNoCopy() can lend the receive buffer
+    virtual bool canLendBuffer() { return false; }
+
+    /// Sets a function to be called from the interrupt handler each time a new, valid message has been
+    /// received and is waiting to be collected with recv(). This lets the application wait for a message
+    /// instead of polling for one. The receiver must still be started, eg with available().
+    /// The callback runs in interrupt context: keep it short (set a flag, give a semaphore) and 
+    /// dont call back into the driver from it.
+    /// \param[in] callback The function to call, or NULL to stop notifications
+    /// \param[in] context Passed to the callback
+    virtual void setRxCallback(void (*callback)(void* context), void* context = NULL);
+
     /// Waits until any previous transmit packet is finished being transmitted with waitPacketSent().
     /// Then optionally waits for Channel Activity Detection (CAD) 
     /// to show the channnel is clear (if the radio supports CAD) by calling waitCAD().
@@ -311,6 +334,12 @@ protected:
     /// Channel activity timeout in ms
     unsigned int        _cad_timeout;
 
+    /// Called by the interrupt handler when a valid message is received, if set
+    void                (*_rxCallback)(void* context);
+
+    /// Context for _rxCallback
+    void*               _rxCallbackContext;
+
 private:
 
 };
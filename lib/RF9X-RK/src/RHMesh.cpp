@@ -13,8 +13,6 @@
 
 #include <RHMesh.h>
 
-uint8_t RHMesh::_tmpMessage[RH_ROUTER_MAX_MESSAGE_LEN];
-
 ////////////////////////////////////////////////////////////////////
 // Constructors
 RHMesh::RHMesh(RHGenericDriver& driver, uint8_t thisAddress) 
@@ -54,12 +52,13 @@ uint8_t RHMesh::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address, uint8_t f
 		buf[len-1] = buf[len-1] + meshRouteDiscovertDelay;
 	}
 
-    // Now have a route. Contruct an application layer message and send it via that route
-    MeshApplicationMessage* a = (MeshApplicationMessage*)&_tmpMessage;
+    // Now have a route. Contruct an application layer message in the router's buffer and send it via that route
+    MeshApplicationMessage* a = (MeshApplicationMessage*)_tmpMessage.data;
     a->header.msgType = RH_MESH_MESSAGE_TYPE_APPLICATION;
-    memcpy(a->data, buf, len);
+    if (a->data != buf)
+	memcpy(a->data, buf, len);
 
-    return RHRouter::sendtoWait(_tmpMessage, sizeof(RHMesh::MeshMessageHeader) + len, address, flags);
+    return RHRouter::sendtoWait(_tmpMessage.data, sizeof(RHMesh::MeshMessageHeader) + len, address, flags);
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -67,7 +66,7 @@ bool RHMesh::doArp(uint8_t address)
 {
     // Need to discover a route
     // Broadcast a route discovery message with nothing in it
-    MeshRouteDiscoveryMessage* p = (MeshRouteDiscoveryMessage*)&_tmpMessage;
+    MeshRouteDiscoveryMessage* p = (MeshRouteDiscoveryMessage*)_tmpMessage.data;
     p->header.msgType = RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_REQUEST;
     p->destlen = 1; 
     p->dest = address; // Who we are looking for
@@ -77,7 +76,8 @@ bool RHMesh::doArp(uint8_t address)
     
     // Wait for a reply, which will be unicast back to us
     // It will contain the complete route to the destination
-    uint8_t messageLen = sizeof(_tmpMessage);
+    uint8_t* message;
+    uint8_t messageLen;
     // FIXME: timeout should be configurable
     unsigned long starttime = millis();
     int32_t timeLeft;
@@ -85,10 +85,10 @@ bool RHMesh::doArp(uint8_t address)
     {
 	if (waitAvailableTimeout(timeLeft))
 	{
-	    if (RHRouter::recvfromAck(_tmpMessage, &messageLen))
+	    if (RHRouter::recvfromAckNoCopy(&message, &messageLen))
 	    {
 		if (   messageLen > 1
-		       && p->header.msgType == RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE)
+		       && ((MeshMessageHeader*)message)->msgType == RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE)
 		{
 		    // Got a reply, now add the next hop to the dest to the routing table
 		    // The first hop taken is the first octet
@@ -147,7 +147,8 @@ uint8_t RHMesh::route(RoutedMessage* message, uint8_t messageLen)
 	if (message->header.source != _thisAddress)
 	{
 	    // This is being proxied, so tell the originator about it
-	    MeshRouteFailureMessage* p = (MeshRouteFailureMessage*)&_tmpMessage;
+	    // message is our own _tmpMessage when forwarding, but only its header is used from here on
+	    MeshRouteFailureMessage* p = (MeshRouteFailureMessage*)_tmpMessage.data;
 	    p->header.msgType = RH_MESH_MESSAGE_TYPE_ROUTE_FAILURE;
 	    p->dest = message->header.dest; // Who you were trying to deliver to
 	    // Make sure there is a route back towards whoever sent the original message
@@ -169,15 +170,17 @@ bool RHMesh::isPhysicalAddress(uint8_t* address, uint8_t addresslen)
 ////////////////////////////////////////////////////////////////////
 bool RHMesh::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* dest, uint8_t* id, uint8_t* flags, uint8_t* hops)
 {     
-    uint8_t tmpMessageLen = sizeof(_tmpMessage);
+    uint8_t* tmpMessage;
+    uint8_t tmpMessageLen;
     uint8_t _source;
     uint8_t _dest;
     uint8_t _id;
     uint8_t _flags;
     uint8_t _hops;
-    if (RHRouter::recvfromAck(_tmpMessage, &tmpMessageLen, &_source, &_dest, &_id, &_flags, &_hops))
+    // The message is left in the router's buffer and worked on in place
+    if (RHRouter::recvfromAckNoCopy(&tmpMessage, &tmpMessageLen, &_source, &_dest, &_id, &_flags, &_hops))
     {
-	MeshMessageHeader* p = (MeshMessageHeader*)&_tmpMessage;
+	MeshMessageHeader* p = (MeshMessageHeader*)tmpMessage;
 
 	if (   tmpMessageLen >= 1 
 	    && p->msgType == RH_MESH_MESSAGE_TYPE_APPLICATION)
@@ -233,14 +236,15 @@ bool RHMesh::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* d
 		d->header.msgType = RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE;
 		RHRouter::sendtoWait((uint8_t*)d, tmpMessageLen, _source);
 	    }
-	    else if ((i < _max_hops) && _isa_router)
+	    else if ((i < _max_hops) && _isa_router && tmpMessageLen < RH_ROUTER_MAX_MESSAGE_LEN)
 	    {
-		// Its for someone else, rebroadcast it, after adding ourselves to the list
+		// Its for someone else, rebroadcast it, after adding ourselves to the list.
+		// A full route list has no room for us, so that discovery goes no further
 		d->route[numRoutes] = _thisAddress;
 		tmpMessageLen++;
 		// Have to impersonate the source
 		// REVISIT: if this fails what can we do?
-		RHRouter::sendtoFromSourceWait(_tmpMessage, tmpMessageLen, RH_BROADCAST_ADDRESS, _source);
+		RHRouter::sendtoFromSourceWait(tmpMessage, tmpMessageLen, RH_BROADCAST_ADDRESS, _source);
 	    }
 	}
     }
@@ -175,7 +175,8 @@ uint8_t RHRouter::sendtoFromSourceWait(uint8_t* buf, uint8_t len, uint8_t dest,
     _tmpMessage.header.hops = 0;
     _tmpMessage.header.id = _lastE2ESequenceNumber++;
     _tmpMessage.header.flags = flags;
-    memcpy(_tmpMessage.data, buf, len);
+    if (buf != _tmpMessage.data)
+	memcpy(_tmpMessage.data, buf, len); // Else it was built in place
 
     return route(&_tmpMessage, sizeof(RoutedMessageHeader)+len);
 }
@@ -210,13 +211,27 @@ void RHRouter::peekAtMessage(RoutedMessage* message, uint8_t messageLen)
 
 ////////////////////////////////////////////////////////////////////
 bool RHRouter::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* dest, uint8_t* id, uint8_t* flags, uint8_t* hops)
+{  
+    uint8_t* msg;
+    uint8_t  msgLen;
+    if (!recvfromAckNoCopy(&msg, &msgLen, source, dest, id, flags, hops))
+	return false;
+    if (*len > msgLen)
+	*len = msgLen;
+    memcpy(buf, msg, *len);
+    return true; // Its for you!
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHRouter::recvfromAckNoCopy(uint8_t** buf, uint8_t* len, uint8_t* source, uint8_t* dest, uint8_t* id, uint8_t* flags, uint8_t* hops)
 {  
     uint8_t tmpMessageLen = sizeof(_tmpMessage);
     uint8_t _from;
     uint8_t _to;
     uint8_t _id;
     uint8_t _flags;
-    if (RHReliableDatagram::recvfromAck((uint8_t*)&_tmpMessage, &tmpMessageLen, &_from, &_to, &_id, &_flags))
+    if (   RHReliableDatagram::recvfromAck((uint8_t*)&_tmpMessage, &tmpMessageLen, &_from, &_to, &_id, &_flags)
+	&& tmpMessageLen >= sizeof(RoutedMessageHeader))
     {
 	// Here we simulate networks with limited visibility between nodes
 	// so we can test routing
@@ -281,10 +296,8 @@ bool RHRouter::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t*
 	    if (id)     *id      = _tmpMessage.header.id;
 	    if (flags)  *flags   = _tmpMessage.header.flags;
 	    if (hops)   *hops    = _tmpMessage.header.hops;
-	    uint8_t msgLen = tmpMessageLen - sizeof(RoutedMessageHeader);
-	    if (*len > msgLen)
-		*len = msgLen;
-	    memcpy(buf, _tmpMessage.data, *len);
+	    *buf = _tmpMessage.data;
+	    *len = tmpMessageLen - sizeof(RoutedMessageHeader);
 	    return true; // Its for you!
 	}
 	else if (   _tmpMessage.header.dest != RH_BROADCAST_ADDRESS
@@ -303,6 +303,19 @@ protected:
     /// \param [in] messageLen Length of message in octets
     virtual void peekAtMessage(RoutedMessage* message, uint8_t messageLen);
 
+    /// Does the work of recvfromAck(), but instead of copying the message out lends the caller a pointer
+    /// to the payload inside the shared _tmpMessage buffer. The payload is only valid until the next
+    /// send or receive through this router, so the caller must consume it (or copy it) at once.
+    /// \param[out] buf Set to point to the payload of the received message
+    /// \param[out] len Set to the length of the payload in octets
+    /// \param[in] source If present and not NULL, the referenced uint8_t will be set to the SOURCE address
+    /// \param[in] dest If present and not NULL, the referenced uint8_t will be set to the DEST address
+    /// \param[in] id If present and not NULL, the referenced uint8_t will be set to the ID
+    /// \param[in] flags If present and not NULL, the referenced uint8_t will be set to the FLAGS
+    /// \param[in] hops If present and not NULL, the referenced uint8_t will be set to the HOPS
+    /// \return true if a valid message was received for this node
+    bool recvfromAckNoCopy(uint8_t** buf, uint8_t* len, uint8_t* source = NULL, uint8_t* dest = NULL, uint8_t* id = NULL, uint8_t* flags = NULL, uint8_t* hops = NULL);
+
     /// Finds the next-hop route and sends the message via RHReliableDatagram::sendtoWait().
     /// This is virtual, which lets subclasses override or intercept the route() function.
     /// Called by sendtoWait after the message header has been filled in.
@@ -325,11 +338,12 @@ protected:
     /// Flag to set if packets are forwarded or not
     bool _isa_router;
 
-private:
-
-    /// Temporary mesage buffer
+    /// Temporary mesage buffer. This is the only message buffer in the router stack: messages are
+    /// received into it and subclasses build outgoing messages directly in _tmpMessage.data
     static RoutedMessage _tmpMessage;
 
+private:
+
     /// Local routing table
     RoutingTableEntry    _routes[RH_ROUTING_TABLE_SIZE];
 };
@@ -32,7 +32,10 @@ PROGMEM static const RH_RF95::ModemConfig MODEM_CONFIG_TABLE[] =
 RH_RF95::RH_RF95(uint8_t slaveSelectPin, uint8_t interruptPin, RHGenericSPI& spi)
     :
     RHSPIDriver(slaveSelectPin, spi),
-    _rxBufValid(0)
+    _rxBufValid(0),
+    _rxAfterReceive(false),
+    _servicingInterrupt(false),
+    _interruptDeferred(false)
 {
     _interruptPin = interruptPin;
     _myInterruptIndex = 0xff; // Not allocated yet
@@ -174,11 +177,17 @@ void RH_RF95::handleInterrupt()
     // spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // Clear all IRQ flags
     spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // Clear all IRQ flags
 
+    // Still in Rx with a message waiting to be collected (setRxAfterReceive): keep it, drop this one
+    if (_mode == RHModeRx && _rxBufValid
+	&& (irq_flags & (RH_RF95_RX_TIMEOUT | RH_RF95_PAYLOAD_CRC_ERROR | RH_RF95_RX_DONE)))
+    {
+	_rxBad++;
+    }
     // error if:
     // timeout
     // bad CRC
     // CRC is required but it is not present
-    if (_mode == RHModeRx
+    else if (_mode == RHModeRx
 	&& (   (irq_flags & (RH_RF95_RX_TIMEOUT | RH_RF95_PAYLOAD_CRC_ERROR))
 	    || (_enableCRC && !(hop_channel & RH_RF95_RX_PAYLOAD_CRC_IS_ON)) ))
 //    if (_mode == RHModeRx && irq_flags & (RH_RF95_RX_TIMEOUT | RH_RF95_PAYLOAD_CRC_ERROR))
@@ -195,6 +204,12 @@ void RH_RF95::handleInterrupt()
 //	Serial.println("R");
 	// Have received a packet
 	uint8_t len = spiRead(RH_RF95_REG_13_RX_NB_BYTES);
+	if (len > sizeof(_buf))
+	{
+	    // Too big for any message we handle (someone elses network?) - drop it rather than overrun _buf
+	    _rxBad++;
+	    len = 0;
+	}
 
 	// Reset the fifo read ptr to the beginning of the packet
 	spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, spiRead(RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR));
@@ -221,7 +236,7 @@ void RH_RF95::handleInterrupt()
 	    
 	// We have received a message.
 	validateRxBuf(); 
-	if (_rxBufValid)
+	if (_rxBufValid && !_rxAfterReceive)
 	    setModeIdle(); // Got one 
     }
     else if (_mode == RHModeTx && irq_flags & RH_RF95_TX_DONE)
@@ -248,23 +263,33 @@ void RH_RF95::handleInterrupt()
     RH_MUTEX_UNLOCK(lock); 
 }
 
+void RH_RF95::handleInterruptFromPin()
+{
+    if (_servicingInterrupt)
+    {
+	_interruptDeferred = true; // serviceInterrupt() checks the pin again when it is done
+	return;
+    }
+    handleInterrupt();
+}
+
 // These are low level functions that call the interrupt handler for the correct
 // instance of RH_RF95.
 // 3 interrupts allows us to have 3 different devices
 void RH_INTERRUPT_ATTR RH_RF95::isr0()
 {
     if (_deviceForInterrupt[0])
-	_deviceForInterrupt[0]->handleInterrupt();
+	_deviceForInterrupt[0]->handleInterruptFromPin();
 }
 void RH_INTERRUPT_ATTR RH_RF95::isr1()
 {
     if (_deviceForInterrupt[1])
-	_deviceForInterrupt[1]->handleInterrupt();
+	_deviceForInterrupt[1]->handleInterruptFromPin();
 }
 void RH_INTERRUPT_ATTR RH_RF95::isr2()
 {
     if (_deviceForInterrupt[2])
-	_deviceForInterrupt[2]->handleInterrupt();
+	_deviceForInterrupt[2]->handleInterruptFromPin();
 }
 
 // Check whether the latest received message is complete and uncorrupted
@@ -283,6 +308,8 @@ void RH_RF95::validateRxBuf()
     {
 	_rxGood++;
 	_rxBufValid = true;
+	if (_rxCallback)
+	    _rxCallback(_rxCallbackContext); // Let the application know there is something to collect
     }
 }
 
@@ -326,6 +353,44 @@ bool RH_RF95::recv(uint8_t* buf, uint8_t* len)
     return true;
 }
 
+void RH_RF95::serviceInterrupt()
+{
+    if (_interruptPin == RH_INVALID_PIN)
+	return;
+    // ATOMIC_BLOCK_START does nothing on nRF52 and the handler needs SPI, so rather than masking interrupts
+    // the ISR is held off with _servicingInterrupt. An interrupt it skipped is handled here before returning
+    do
+    {
+	_interruptDeferred = false;
+	_servicingInterrupt = true;
+	if (digitalRead(_interruptPin) == HIGH)
+	    handleInterrupt(); // Nothing pending if it is low (or the interrupt handler has already run)
+	_servicingInterrupt = false;
+    } while (_interruptDeferred);
+}
+
+void RH_RF95::setRxAfterReceive(bool rxAfterReceive)
+{
+    _rxAfterReceive = rxAfterReceive; // Set first: a message received after this goes by the new setting
+    if (!rxAfterReceive && _rxBufValid && _mode == RHModeRx)
+	setModeIdle(); // Back to normal - the held message must not be overwritten once it is collected
+}
+
+bool RH_RF95::recvNoCopy(uint8_t** buf, uint8_t* len)
+{
+    if (!available())
+	return false;
+    RH_MUTEX_LOCK(lock); // Multithread support
+    ATOMIC_BLOCK_START;
+    // Skip the 4 headers that are at the beginning of the rxBuf
+    *buf = _buf+RH_RF95_HEADER_LEN;
+    *len = _bufLen-RH_RF95_HEADER_LEN;
+    ATOMIC_BLOCK_END;
+    clearRxBuf(); // This message accepted and cleared - _buf is untouched until we go back to Rx
+    RH_MUTEX_UNLOCK(lock);
+    return true;
+}
+
 bool RH_RF95::send(const uint8_t* data, uint8_t len)
 {
     if (len > RH_RF95_MAX_MESSAGE_LEN)
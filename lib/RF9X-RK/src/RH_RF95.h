@@ -32,8 +32,13 @@
 // This is the maximum message length that can be supported by this driver. 
 // Can be pre-defined to a smaller size (to save SRAM) prior to including this header
 // Here we allow for 1 byte message length, 4 bytes headers, user data and 2 bytes of FCS
+// Limited to RH_MAX_MESSAGE_LEN as nothing above the driver can carry more
 #ifndef RH_RF95_MAX_MESSAGE_LEN
- #define RH_RF95_MAX_MESSAGE_LEN (RH_RF95_MAX_PAYLOAD_LEN - RH_RF95_HEADER_LEN)
+ #if RH_MAX_MESSAGE_LEN < (RH_RF95_MAX_PAYLOAD_LEN - RH_RF95_HEADER_LEN)
+  #define RH_RF95_MAX_MESSAGE_LEN RH_MAX_MESSAGE_LEN
+ #else
+  #define RH_RF95_MAX_MESSAGE_LEN (RH_RF95_MAX_PAYLOAD_LEN - RH_RF95_HEADER_LEN)
+ #endif
 #endif
 
 // The crystal oscillator frequency of the module
@@ -675,6 +680,35 @@ public:
     /// \return true if a valid message was copied to buf
     virtual bool    recv(uint8_t* buf, uint8_t* len);
 
+    /// Turns the receiver on if it not already on.
+    /// If there is a valid message available, sets *buf to point to it inside the driver's receive buffer
+    /// and returns true, else returns false. The message is marked as collected, but the radio stays idle
+    /// until the next call to available() so the contents will not change until then.
+    /// \param[out] buf Set to point to the received message (after the 4 headers)
+    /// \param[out] len Set to the length of the received message
+    /// \return true if a valid message was lent
+    virtual bool    recvNoCopy(uint8_t** buf, uint8_t* len);
+
+    /// This driver lends its receive buffer through recvNoCopy()
+    /// \return true
+    virtual bool    canLendBuffer() { return !_rxAfterReceive; }
+
+    /// Chooses what the radio does after it receives a valid message. Normally it goes idle, so the message cannot be
+    /// overwritten before it is collected and nothing more is heard until the next call to available() or recv().
+    /// With this set it stays in Rx instead: messages that arrive before the held one is collected are dropped and
+    /// counted in rxBad(), but each still raises the interrupt. Set it while the processor sleeps waiting for the
+    /// interrupt pin, so a message received just before the sleep does not leave the radio deaf for the whole sleep.
+    /// Clearing it puts the radio back in idle if a message is held. recvNoCopy() does not lend while it is set.
+    /// \param[in] rxAfterReceive true to stay in Rx after a valid message
+    void            setRxAfterReceive(bool rxAfterReceive);
+
+    /// Runs the interrupt handler from thread context if the radio's interrupt line is asserted.
+    /// Call this after waking the processor with the radio's interrupt pin: the interrupt is edge triggered
+    /// and the edge may be consumed by the wakeup, in which case the handler would never run and the
+    /// received message would never be collected. Does nothing if the radio has nothing pending.
+    /// The ISR does not run the handler while this does, so the two never touch the radio at once.
+    void            serviceInterrupt();
+
     /// Waits until any previous transmit packet is finished being transmitted with waitPacketSent().
     /// Then optionally waits for Channel Activity Detection (CAD) 
     /// to show the channnel is clear (if the radio supports CAD) by calling waitCAD().
@@ -855,6 +889,10 @@ protected:
     /// Should not need to be called by user code.
     void           handleInterrupt();
 
+    /// Called by isr*(). Runs handleInterrupt() unless serviceInterrupt() is running it from thread context,
+    /// in which case it leaves the interrupt to serviceInterrupt()
+    void           handleInterruptFromPin();
+
     /// Examine the revceive buffer to determine whether the message is for this node
     void validateRxBuf();
 
@@ -898,11 +936,20 @@ private:
     volatile uint8_t    _bufLen;
     
     /// The receiver/transmitter buffer
-    uint8_t             _buf[RH_RF95_MAX_PAYLOAD_LEN];
+    uint8_t             _buf[RH_RF95_MAX_MESSAGE_LEN + RH_RF95_HEADER_LEN];
 
     /// True when there is a valid message in the buffer
     volatile bool       _rxBufValid;
 
+    /// True to stay in Rx after a valid message, see setRxAfterReceive()
+    volatile bool       _rxAfterReceive;
+
+    /// True while serviceInterrupt() runs the interrupt handler from thread context
+    volatile bool       _servicingInterrupt;
+
+    /// Set by the ISR when the pin interrupted while _servicingInterrupt was set
+    volatile bool       _interruptDeferred;
+
     /// True if we are using the HF port (779.0 MHz and above)
     bool                _usingHFport;
 
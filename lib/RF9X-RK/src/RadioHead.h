@@ -1914,4 +1914,16 @@ these examples and explanations and extend them to suit your needs.
 // and if it goes to Serial, get a hang after a few minutes.
 //#define Serial SerialUSB
 
+// This is the maximum message length carried by the stack (RHDatagram and up). Upstream RadioHead uses 255,
+// the largest any radio supports, and RHRouter, RHMesh and RH_RF95 size their static buffers from it.
+// Our largest frame is a 28 octet data report - with the router and mesh headers and Speck padding that is
+// a 48 octet radio payload - so 64 leaves headroom and frees nearly 800 bytes of RAM across the stack.
+// This must be set here rather than in the application so the library and application agree on the sizes.
+#ifndef RH_MAX_MESSAGE_LEN
+ #define RH_MAX_MESSAGE_LEN 64
+#endif
+#if RH_MAX_MESSAGE_LEN > 255
+ #error "RadioHead.h: RH_MAX_MESSAGE_LEN must fit in the 8 bit message lengths"
+#endif
+
 #endif
@@ -1,5 +1,6 @@
 #include "SequentialFileRK.h"
 
+#include <algorithm>
 #include <dirent.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -36,6 +37,11 @@ bool SequentialFile::scanDir(void) {
         return false;
     }
 
+    if (indexName.length() && readIndex()) {
+        scanDirCompleted = true;
+        return true;
+    }
+
     _log.trace("scanning %s with pattern %s", dirPath.c_str(), pattern.c_str());
 
     DIR *dir = opendir(dirPath);
@@ -76,6 +82,13 @@ bool SequentialFile::scanDir(void) {
     closedir(dir);
     
     scanDirCompleted = true;
+
+    // The directory is not necessarily in filename order, and the queue must be oldest first
+    queueMutexLock();
+    std::sort(queue.begin(), queue.end());
+    writeIndex();
+    queueMutexUnlock();
+
     return true;
 }
 
@@ -97,6 +110,7 @@ void SequentialFile::addFileToQueue(int fileNum) {
 
     queueMutexLock();
     queue.push_back(fileNum); 
+    writeIndex();
     queueMutexUnlock();
 }
  
@@ -112,6 +126,7 @@ int SequentialFile::getFileFromQueue(bool remove) {
         fileNum = queue.front();
         if (remove) {
             queue.pop_front();
+            writeIndex();
         }
     }
     queueMutexUnlock();
@@ -200,6 +215,7 @@ void SequentialFile::removeAll(bool removeDir) {
 
     queue.clear();
 
+    // The index file was removed with the other files, and the next scanDir() writes it again
     if (removeDir) {
         rmdir(dirPath);
     }
@@ -217,6 +233,108 @@ int SequentialFile::getQueueLen() const {
     return size;
 }
 
+void SequentialFile::forEachFileInQueue(std::function<void(int fileNum)> fn) const {
+    queueMutexLock();
+    std::deque<int> copy = queue;
+    queueMutexUnlock();
+
+    for(int fileNum : copy) {
+        fn(fileNum);
+    }
+}
+
+
+bool SequentialFile::readIndex() {
+    IndexFile idx;
+
+    String path = dirPath + String("/") + indexName;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    int count = read(fd, &idx, sizeof(idx));
+    close(fd);
+
+    if (count != sizeof(idx) || idx.magic != INDEX_MAGIC || idx.version != INDEX_VERSION || 
+        idx.headerSize != sizeof(IndexFile) || idx.check != checksum(&idx, offsetof(IndexFile, check))) {
+        _log.info("index not valid, scanning");
+        return false;
+    }
+
+    // Only a consecutive range of file numbers is stored in the index
+    if (idx.count) {
+        if (idx.firstFileNum <= 0 || idx.lastFileNum < idx.firstFileNum || (uint32_t)(idx.lastFileNum - idx.firstFileNum + 1) != idx.count) {
+            _log.info("queue not in index, scanning");
+            return false;
+        }
+    }
+    else if (idx.firstFileNum != 0 || idx.lastFileNum < 0) {
+        return false;
+    }
+
+    // A reset after writing the index but before adding or removing a file leaves a file at either 
+    // end that the index doesn't know about
+    if ((idx.count && (!fileExists(idx.firstFileNum) || fileExists(idx.firstFileNum - 1))) || fileExists(idx.lastFileNum + 1)) {
+        _log.info("index does not match files, scanning");
+        return false;
+    }
+
+    queueMutexLock();
+    queue.clear();
+    for(uint32_t ii = 0; ii < idx.count; ii++) {
+        queue.push_back(idx.firstFileNum + (int)ii);
+    }
+    lastFileNum = idx.lastFileNum;
+    queueMutexUnlock();
+
+    _log.trace("loaded %lu files from index of %s", (unsigned long)idx.count, dirPath.c_str());
+    return true;
+}
+
+void SequentialFile::writeIndex() {
+    if (indexName.length() == 0 || !scanDirCompleted) {
+        return;
+    }
+
+    IndexFile idx;
+    idx.magic = INDEX_MAGIC;
+    idx.version = INDEX_VERSION;
+    idx.headerSize = sizeof(IndexFile);
+    idx.reserved = 0;
+    idx.firstFileNum = queue.empty() ? 0 : queue.front();
+    idx.lastFileNum = lastFileNum;
+    idx.count = queue.size();       // If the queue is not firstFileNum to lastFileNum, the next scanDir() reads the directory
+    idx.check = checksum(&idx, offsetof(IndexFile, check));
+
+    String path = dirPath + String("/") + indexName;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC);
+    if (fd >= 0) {
+        bool ok = write(fd, &idx, sizeof(idx)) == sizeof(idx);
+        close(fd);
+        if (!ok) {
+            // Without an index the next boot reads the directory
+            unlink(path);
+            _log.error("could not write index of %s", dirPath.c_str());
+        }
+    }
+}
+
+bool SequentialFile::fileExists(int fileNum) {
+    struct stat statbuf;
+
+    return fileNum > 0 && stat(getPathForFileNum(fileNum), &statbuf) == 0;
+}
+
+// [static]
+uint32_t SequentialFile::checksum(const void *data, size_t len) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint32_t hash = 2166136261;
+    for(size_t ii = 0; ii < len; ii++) {
+        hash = (hash ^ bytes[ii]) * 16777619;
+    }
+    return hash;
+}
+
 
 void SequentialFile::queueMutexLock() const {
     if (!queueMutex) {
@@ -102,8 +102,28 @@ public:
      */
     const char *getFilenameExtension() const { return filenameExtension; };
 
+    /**
+     * @brief Keep the first and last file numbers of the queue in an index file in the queue directory
+     * 
+     * @param name Filename of the index, for example ".index". It must not match the pattern. NULL or 
+     * an empty string (the default) to not use an index.
+     * 
+     * The index is written when a file is added to or removed from the queue. When it's valid, scanDir() 
+     * loads the queue from it without reading the directory, so the time it takes doesn't depend on the 
+     * number of files. It's only used when the queue is a consecutive range of file numbers, as it is 
+     * when files are added in order with reserveFile() and removed with getFileFromQueue().
+     */
+    SequentialFile &withIndexFile(const char *name) { this->indexName = name ? name : ""; return *this; };
+
+    /**
+     * @brief Gets the index filename set using withIndexFile(), an empty string if not used
+     */
+    const char *getIndexFile() const { return indexName; };
+
     /**
      * @brief Scans the queue directory for files. Typically called during setup().
+     * 
+     * If there is a valid index file (see withIndexFile()) the directory is not read.
      */
     bool scanDir(void);
 
@@ -198,6 +218,16 @@ public:
      */
     int getQueueLen() const;
 
+    /**
+     * @brief Calls fn for each file number in the queue, oldest first
+     * 
+     * @param fn Function to call. It's passed the fileNum.
+     * 
+     * The queue is copied before fn is called so fn can access the file system, and even modify
+     * the queue, without holding the queue mutex.
+     */
+    void forEachFileInQueue(std::function<void(int fileNum)> fn) const;
+
     /**
      * @brief This class is not copyable
      */
@@ -242,6 +272,43 @@ protected:
      */
     virtual bool preScanAddHook(const char *name) { return true; };
 
+    /**
+     * @brief Contents of the index file, see withIndexFile()
+     */
+    struct IndexFile {
+        uint32_t magic;         //!< INDEX_MAGIC
+        uint8_t version;        //!< INDEX_VERSION
+        uint8_t headerSize;     //!< sizeof(IndexFile) = 24
+        uint16_t reserved;      //!< Reserved, set to 0
+        int32_t firstFileNum;   //!< File number at the head of the queue, 0 if the queue is empty
+        int32_t lastFileNum;    //!< lastFileNum, the file number at the tail of the queue if not empty
+        uint32_t count;         //!< Number of files in the queue
+        uint32_t check;         //!< Checksum of the bytes above
+    };
+
+    /**
+     * @brief Load the queue from the index file, returning false if it's missing or does not match the files
+     */
+    bool readIndex();
+
+    /**
+     * @brief Write the index file for the queue now. Call with the queue mutex locked.
+     */
+    void writeIndex();
+
+    /**
+     * @brief Returns true if the file for fileNum exists
+     */
+    bool fileExists(int fileNum);
+
+    /**
+     * @brief Checksum of the index file (FNV-1a)
+     */
+    static uint32_t checksum(const void *data, size_t len);
+
+    static const uint32_t INDEX_MAGIC = 0x5146c3a9;     //!< Magic bytes in the index file
+    static const uint8_t INDEX_VERSION = 1;             //!< Version of the index file
+
     /**
      * @brief Lock the mutex used to protect the queue
      */
@@ -268,6 +335,11 @@ protected:
      */
     String filenameExtension = "";
 
+    /**
+     * @brief Filename of the index file in the queue directory. May be an empty string for no index.
+     */
+    String indexName = "";
+
     /**
      * @brief Set to true after scanDir() is called
      */
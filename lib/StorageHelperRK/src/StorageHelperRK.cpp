@@ -56,6 +56,28 @@ bool StorageHelperRK::PersistentDataBase::getValueString(size_t offset, size_t s
     return result;
 }
 
+size_t StorageHelperRK::PersistentDataBase::getValueString(size_t offset, size_t size, char *buf, size_t bufSize) const {
+    size_t len = 0;
+
+    if (bufSize == 0) {
+        return 0;
+    }
+
+    WITH_LOCK(*this) {
+        if (offset <= (savedDataSize - (size - 1))) {
+            const char *p = (const char *)savedDataHeader;
+            p += offset;
+            len = strnlen(p, size);
+            if (len >= bufSize) {
+                len = bufSize - 1;
+            }
+            memcpy(buf, p, len);
+        }
+    }
+    buf[len] = 0;
+    return len;
+}
+
 bool StorageHelperRK::PersistentDataBase::setValueString(size_t offset, size_t size, const char *value) {
     bool result = false;
 
@@ -64,10 +86,24 @@ bool StorageHelperRK::PersistentDataBase::setValueString(size_t offset, size_t s
             char *p = (char *)savedDataHeader;
             p += offset;
 
-            if (strcmp(value, p) != 0) {
-                memset(p, 0, size);
-                strcpy(p, value);
-                updateHash();
+            // Find the first byte that differs - only from there to the end of the longer string changes
+            size_t first = 0;
+            while(p[first] == value[first] && value[first] != 0) {
+                first++;
+            }
+            if (p[first] != value[first]) {
+                size_t oldLen = first + strnlen(&p[first], size - first);
+                size_t newLen = first + strlen(&value[first]);
+
+                strcpy(&p[first], &value[first]);
+                if (oldLen > newLen) {
+                    memset(&p[newLen], 0, oldLen - newLen);
+                }
+                size_t changedEnd = ((oldLen > newLen) ? oldLen : newLen) + 1;
+                if (changedEnd > size) {
+                    changedEnd = size;
+                }
+                updateHash(offset + first, changedEnd - first);
             }
             result = true;
         }
@@ -97,8 +133,114 @@ uint32_t StorageHelperRK::PersistentDataBase::getHash() const {
 }
 
 void StorageHelperRK::PersistentDataBase::updateHash() {
-    savedDataHeader->hash = getHash();
-    saveOrDefer();
+    updateHash(0, savedDataSize);
+}
+
+void StorageHelperRK::PersistentDataBase::updateHash(size_t offset, size_t size) {
+    bool deferred = false;
+
+    WITH_LOCK(*this) {
+        markDirty(offset, size);
+        if (updateDepth) {
+            // Inside beginUpdate()/commit() - the hash and save are done once by commit()
+            updateChanged = true;
+            deferred = true;
+        }
+        else {
+            savedDataHeader->hash = getHash();
+        }
+    }
+    if (!deferred) {
+        saveOrDefer();
+    }
+}
+
+void StorageHelperRK::PersistentDataBase::beginUpdate() {
+    lock();
+    updateDepth++;
+}
+
+void StorageHelperRK::PersistentDataBase::commit() {
+    bool changed = false;
+
+    if (updateDepth == 0) {
+        return;
+    }
+    if (--updateDepth == 0 && updateChanged) {
+        updateChanged = false;
+        savedDataHeader->hash = getHash();
+        changed = true;
+    }
+    unlock();
+
+    if (changed) {
+        saveOrDefer();
+    }
+}
+
+void StorageHelperRK::PersistentDataBase::markDirty(size_t offset, size_t size) {
+    if (dirtyAll || size == 0) {
+        return;
+    }
+    if (offset == 0 && size >= savedDataSize) {
+        markAllDirty();
+        return;
+    }
+
+    size_t start = offset;
+    size_t end = offset + size;
+
+    // Absorb any range that overlaps or is close to this one. The combined range can reach others, so start over.
+    for(size_t ii = 0; ii < dirtyRangeCount; ) {
+        const DirtyRange &range = dirtyRanges[ii];
+        if (start <= range.end + DIRTY_RANGE_MERGE_GAP && range.start <= end + DIRTY_RANGE_MERGE_GAP) {
+            if (range.start < start) {
+                start = range.start;
+            }
+            if (range.end > end) {
+                end = range.end;
+            }
+            dirtyRanges[ii] = dirtyRanges[--dirtyRangeCount];
+            ii = 0;
+        }
+        else {
+            ii++;
+        }
+    }
+
+    if (dirtyRangeCount == MAX_DIRTY_RANGES) {
+        // Out of slots - merge with the closest range
+        size_t closest = 0;
+        size_t closestGap = SIZE_MAX;
+        for(size_t ii = 0; ii < dirtyRangeCount; ii++) {
+            size_t gap = (dirtyRanges[ii].start > end) ? (dirtyRanges[ii].start - end) : (start - dirtyRanges[ii].end);
+            if (gap < closestGap) {
+                closestGap = gap;
+                closest = ii;
+            }
+        }
+        if (dirtyRanges[closest].start < start) {
+            start = dirtyRanges[closest].start;
+        }
+        if (dirtyRanges[closest].end > end) {
+            end = dirtyRanges[closest].end;
+        }
+        dirtyRanges[closest] = dirtyRanges[--dirtyRangeCount];
+    }
+
+    dirtyRanges[dirtyRangeCount].start = (uint16_t) start;
+    dirtyRanges[dirtyRangeCount].end = (uint16_t) end;
+    dirtyRangeCount++;
+}
+
+void StorageHelperRK::PersistentDataBase::markAllDirty() {
+    dirtyAll = true;
+    dirtyRangeCount = 0;
+}
+
+void StorageHelperRK::PersistentDataBase::clearDirty() {
+    dirtyAll = false;
+    dirtyRangeCount = 0;
 }
 
 
@@ -124,6 +266,7 @@ bool StorageHelperRK::PersistentDataBase::validate(size_t dataSize) {
             for(size_t ii = (size_t)dataSize; ii < savedDataSize; ii++) {
                 p[ii] = 0;
             }
+            markDirty(dataSize, savedDataSize - dataSize);
         }
         savedDataHeader->size = (uint16_t) savedDataSize;
         savedDataHeader->hash = getHash();
@@ -144,6 +287,7 @@ void StorageHelperRK::PersistentDataBase::initialize() {
     savedDataHeader->version = savedDataVersion;
     savedDataHeader->size = (uint16_t) savedDataSize;
     savedDataHeader->hash = getHash();
+    markAllDirty();
 }
 
 void StorageHelperRK::PersistentDataBase::save() {
@@ -152,6 +296,9 @@ void StorageHelperRK::PersistentDataBase::save() {
         Log.dump((const uint8_t *)savedDataHeader, savedDataHeader->size);
         Log.print("\n");
     }
+    WITH_LOCK(*this) {
+        clearDirty();
+    }
 }
 
 
@@ -192,8 +339,8 @@ void StorageHelperRK::PersistentDataEEPROM::save() {
         Log.dump(test, sizeof(test));
         Log.print("\n");
         */
+        PersistentDataBase::save();
     }
-    PersistentDataBase::save();
 }
 #endif // UNITTEST
 
@@ -238,8 +385,8 @@ void StorageHelperRK::PersistentDataFileSystem::save() {
 
             fs->close();
         }
+        PersistentDataBase::save();
     }
-    PersistentDataBase::save();
 }
 
 
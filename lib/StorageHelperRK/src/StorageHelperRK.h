@@ -639,7 +639,9 @@ public:
         /**
          * @brief Save the persistent data file. You normally do not need to call this; it will be saved automatically.
          * 
-         * Save does nothing in this base class, but for PersistentDataFile it saves to a file
+         * Save does nothing in this base class, but for PersistentDataFile it saves to a file.
+         * Subclasses call it at the end of their save() with the lock still held, so a setValue() from
+         * another thread cannot mark a range dirty between the write and clearing the dirty ranges.
          */
         virtual void save();
 
@@ -653,6 +655,20 @@ public:
          */
         virtual void flush(bool force);
 
+        /**
+         * @brief Milliseconds until flush(false) saves the changes, 0 if the next call does
+         * 
+         * Returns 0xffffffff if there is nothing to save. An application that sleeps between calls to flush()
+         * should not sleep longer than this, or the save waits until it wakes.
+         */
+        uint32_t getMsUntilSave() const {
+            if (!lastUpdate) {
+                return 0xffffffff;
+            }
+            uint32_t elapsed = millis() - lastUpdate;
+            return (elapsed >= saveDelayMs) ? 0 : (saveDelayMs - elapsed);
+        }
+
        /**
          * @brief Either saves data or immediately, or defers until later, based on saveDelayMs
          * 
@@ -661,6 +677,25 @@ public:
          */
         virtual void saveOrDefer();
 
+        /**
+         * @brief Start a group of changes that are applied as a single update
+         * 
+         * The lock is held until the matching commit() so other threads never see a half-updated structure.
+         * Set calls made in between only record what changed; the hash is calculated and the save scheduled
+         * once, by commit(). Calls can be nested, only the outermost commit() finishes the update.
+         * 
+         * Every beginUpdate() must be matched by a commit() from the same thread.
+         */
+        void beginUpdate();
+
+        /**
+         * @brief Finish a group of changes started with beginUpdate()
+         * 
+         * If anything changed, the hash is updated and a save is scheduled (or done immediately if the 
+         * save delay is 0).
+         */
+        void commit();
+
         /**
          * @brief Templated class for getting integral values (uint32_t, float, double, etc.)
          * 
@@ -699,7 +734,7 @@ public:
                     T oldValue = *(T *)p;
                     if (oldValue != value) {
                         *(T *)p = value;
-                        updateHash();
+                        updateHash(offset, sizeof(T));
                     }
                 }
             }
@@ -718,6 +753,19 @@ public:
          */
         bool getValueString(size_t offset, size_t size, String &value) const;
 
+        /**
+         * @brief Copy the value of a string into a caller supplied buffer
+         * 
+         * @param offset 
+         * @param size 
+         * @param buf Buffer to copy the string into. It is always null terminated if bufSize is not 0.
+         * @param bufSize Size of buf in bytes. If the string is longer it is truncated.
+         * @return size_t The number of characters copied, not including the null terminator
+         * 
+         * Unlike the String version, this does not allocate from the heap, which matters for large strings.
+         */
+        size_t getValueString(size_t offset, size_t size, char *buf, size_t bufSize) const;
+
         /**
          * @brief Set the value of a string
          * 
@@ -740,6 +788,8 @@ public:
         /**
          * @brief Update the hash
          * 
+         * The whole structure is marked as modified so the next save writes all of it. Use this after
+         * changing fields directly rather than through setValue() or setValueString().
          */
         void updateHash();
 
@@ -779,6 +829,41 @@ public:
          */
         virtual void initialize();
 
+        /**
+         * @brief Update the hash after changing size bytes at offset
+         * 
+         * Only that range is marked as modified, so save() can write just the bytes that changed.
+         */
+        void updateHash(size_t offset, size_t size);
+
+        /**
+         * @brief Record that size bytes at offset differ from the saved copy
+         * 
+         * Nearby ranges are merged. If there are more than MAX_DIRTY_RANGES, the new range is merged with
+         * the closest one, so tracking never needs more than a fixed amount of RAM.
+         */
+        void markDirty(size_t offset, size_t size);
+
+        /**
+         * @brief Record that the whole structure needs to be saved
+         */
+        void markAllDirty();
+
+        /**
+         * @brief Forget the modified ranges; called once the data has been saved
+         */
+        void clearDirty();
+
+        /**
+         * @brief A modified byte range within the saved data, offsets from the start of the header
+         */
+        struct DirtyRange {
+            uint16_t start;                 //!< Offset of the first modified byte
+            uint16_t end;                   //!< Offset one past the last modified byte
+        };
+
+        static const size_t MAX_DIRTY_RANGES = 4;       //!< Number of separate ranges tracked before merging
+        static const size_t DIRTY_RANGE_MERGE_GAP = 8;  //!< Ranges this close together are written as one
 
         SavedDataHeader *savedDataHeader = 0; //!< Pointer to the saved data header, which is followed by the data
         uint32_t savedDataSize = 0;     //!< Size of the saved data (header + actual data)
@@ -790,6 +875,13 @@ public:
         uint32_t saveDelayMs = 1000; //!< How long to wait to save before writing file to disk. Set to 0 to write immediately.
 
         bool logData = false; //!< Log data when read and saved
+
+        DirtyRange dirtyRanges[MAX_DIRTY_RANGES]; //!< Byte ranges modified since the last save
+        size_t dirtyRangeCount = 0; //!< Number of valid entries in dirtyRanges
+        bool dirtyAll = false; //!< The whole structure needs to be saved
+
+        uint16_t updateDepth = 0; //!< Nesting level of beginUpdate() calls, 0 = not in an update
+        bool updateChanged = false; //!< A value was changed during the current update
     };
 
     /**
@@ -887,6 +979,7 @@ public:
         virtual bool load() {
             WITH_LOCK(*this) {
                 fram.readData(framOffset, (uint8_t*)savedDataHeader, savedDataSize);
+                clearDirty();
                 if (!validate(savedDataHeader->size)) {
                     initialize();
                 }
@@ -897,12 +990,24 @@ public:
 
         /**
          * @brief Save the persistent data file. You normally do not need to call this; it will be saved automatically.
+         * 
+         * Only the ranges modified through setValue() and setValueString() are written, followed by the header.
+         * The header goes last because it holds the hash covering the new data.
          */
         virtual void save() {
             WITH_LOCK(*this) {
-                fram.writeData(framOffset, (const uint8_t*)savedDataHeader, savedDataSize);
+                if (dirtyAll || dirtyRangeCount == 0) {
+                    fram.writeData(framOffset, (const uint8_t*)savedDataHeader, savedDataSize);
+                }
+                else {
+                    for(size_t ii = 0; ii < dirtyRangeCount; ii++) {
+                        const DirtyRange &range = dirtyRanges[ii];
+                        fram.writeData(framOffset + range.start, (const uint8_t*)savedDataHeader + range.start, range.end - range.start);
+                    }
+                    fram.writeData(framOffset, (const uint8_t*)savedDataHeader, sizeof(SavedDataHeader));
+                }
+                PersistentDataBase::save();
             }
-            PersistentDataBase::save();
         } 
 
     protected:
@@ -2,6 +2,8 @@
 #include "Room_Occupancy.h"							// Aggregates node data to get net room occupancy for Occupancy Nodes
 #include "PublishQueuePosixRK.h"
 #include "LocalTimeRK.h"					        // https://rickkas7.github.io/LocalTimeRK/
+#include "config.h"											// NODE_DATABASE_COMMIT_DELAY_MS
+#include "NodeJournal.h"									// Append-only log of node changes since the last checkpoint
 
 // Singleton instantiation - from template
 JsonDataManager *JsonDataManager::_instance;
@@ -34,13 +36,26 @@ LocalTimeConvert conv2;						// For local time
 bool JsonDataManager::setup() {
 
 	// Here is where we load the JSON object from memory and parse
-	jp.addString(nodeDatabase.get_nodeIDJson());				// Read in the JSON string from memory
-	Log.info("The node string is %d bytes",nodeDatabase.get_nodeIDJson().length());
+	bool parsed = JsonDataManager::loadNodeDatabase();			// Read in the JSON string from memory
+	Log.info("The node string is %d bytes", jp.getOffset());
 	JsonDataManager::printNodeData(false);						// Print the node data to the log
 
-	if (jp.parse()) Log.info("Parsed Successfully");
+	NodeJournal::instance().setup();
+
+	if (parsed) {
+		Log.info("Parsed Successfully");
+		// The stored database is the last checkpoint - bring it up to date with the changes journaled since
+		size_t replayed = NodeJournal::instance().replay(nodeDatabase.get_journalEpoch(), [this](const NodeJournal::Record &record) {
+			JsonDataManager::applyJournalRecord(record);
+		});
+		if (replayed > 0) {
+			_nodeDatabaseDirty = true;												// Checkpoint is behind - compacted at the next quiet moment
+			Log.info("Replayed %u journaled node changes", replayed);
+		}
+	}
 	else {
 		nodeDatabase.resetNodeIDs();
+		NodeJournal::instance().clear();										// Journal belonged to the lost database
 		Log.info("Parsing error");
 	}
 	
@@ -48,7 +63,16 @@ bool JsonDataManager::setup() {
 }
 
 void JsonDataManager::loop() {
-												
+	// Write-behind - changes that could not be journaled are committed once the deadline passes
+	if (_nodeDatabaseUnjournaled && (millis() - _nodeDatabaseDirtySince >= NODE_DATABASE_COMMIT_DELAY_MS)) {
+		JsonDataManager::commitNodeDatabase();
+	}
+}
+
+system_tick_t JsonDataManager::getMsUntilCommit() const {
+	if (!_nodeDatabaseUnjournaled) return 0xffffffff;
+	system_tick_t elapsed = millis() - _nodeDatabaseDirtySince;
+	return (elapsed >= NODE_DATABASE_COMMIT_DELAY_MS) ? 0 : NODE_DATABASE_COMMIT_DELAY_MS - elapsed;
 }
 
 /************************************************************************
@@ -133,6 +157,12 @@ bool JsonDataManager::setType(int nodeNumber, int newType) {
 	mod.insertOrUpdateKeyValue(nodeObjectContainer, "jd1",(int)0);
 	mod.insertOrUpdateKeyValue(nodeObjectContainer, "jd2",(int)0);
 
+	// Committed right away like a new node - one checkpoint keeps the type and its reset values together, where a torn run of journal records could not
+	saveNodeDatabase(jp);													// Marks the change - a commit of a clean database does nothing
+	if (!JsonDataManager::instance().commitNodeDatabase()) {
+		Log.info("Node database commit failed - sensor type change saved at the next deadline");
+	}
+
 	return true;
 }
 
@@ -197,7 +227,7 @@ bool JsonDataManager::setJoinPayload(uint8_t nodeNumber) {
 	JsonModifier mod(jp);
 	mod.insertOrUpdateKeyValue(nodeObjectContainer, "p", (int)compressedJoinPayload);
 	
-	saveNodeDatabase(jp);						
+	journalNodeChange(nodeNumber, NodeJournal::FIELD_PAYLOAD, compressedJoinPayload);
 
 	return result;
 }
@@ -246,7 +276,7 @@ bool JsonDataManager::setAlertCode(int nodeNumber, int newAlert) {
 	JsonModifier mod(jp);
 	mod.insertOrUpdateKeyValue(nodeObjectContainer, "pend", (int)newAlert);
 	
-	saveNodeDatabase(jp);						
+	journalNodeChange(nodeNumber, NodeJournal::FIELD_PENDING_ALERT, newAlert);
 
 	return true;
 }
@@ -292,7 +322,7 @@ bool JsonDataManager::setAlertContext(int nodeNumber, int newAlertContext) {
 	JsonModifier mod(jp);
 	mod.insertOrUpdateKeyValue(nodeObjectContainer, "cont", (int)newAlertContext);
 	
-	saveNodeDatabase(jp);						// This updates the JSON object but doe not commit to to persistent storage
+	journalNodeChange(nodeNumber, NodeJournal::FIELD_ALERT_CONTEXT, newAlertContext);	// This updates the JSON object and journals the change - the checkpoint is written later
 
 	return true;
 }
@@ -326,7 +356,7 @@ bool JsonDataManager::setJsonData1(int nodeNumber, int sensorType, int newJsonDa
 	JsonModifier mod(jp);
 	mod.insertOrUpdateKeyValue(nodeObjectContainer, "jd1", (int)newJsonData1);
 	
-	saveNodeDatabase(jp);						// This updates the JSON object but doe not commit to to persistent storage
+	journalNodeChange(nodeNumber, NodeJournal::FIELD_JSON_DATA1, newJsonData1);	// This updates the JSON object and journals the change - the checkpoint is written later
 
 	return true;
 }
@@ -354,7 +384,7 @@ bool JsonDataManager::setJsonData2(int nodeNumber, int sensorType, int newJsonDa
 	JsonModifier mod(jp);
 	mod.insertOrUpdateKeyValue(nodeObjectContainer, "jd2", (int)newJsonData2);
 	
-	saveNodeDatabase(jp);						// This updates the JSON object but does not commit to to persistent storage
+	journalNodeChange(nodeNumber, NodeJournal::FIELD_JSON_DATA2, newJsonData2);	// This updates the JSON object and journals the change - the checkpoint is written later
 
 	return true;
 }
@@ -377,7 +407,7 @@ bool JsonDataManager::setLastReport(int nodeNumber, int newLastReport) {
 	JsonModifier mod(jp);
 	mod.insertOrUpdateKeyValue(nodeObjectContainer, "lrep", (int)newLastReport);
 	
-	saveNodeDatabase(jp);						// This updates the JSON object but does not commit to to persistent storage
+	journalNodeChange(nodeNumber, NodeJournal::FIELD_LAST_REPORT, newLastReport);	// This updates the JSON object and journals the change - the checkpoint is written later
 
 	return true;
 }
@@ -418,7 +448,7 @@ uint16_t JsonDataManager::getOccupancyNetBySpace(int space) {
 			if(sensorType < 10 || sensorType > 19){		// ignore nodes that are not occupancy sensors and throw an alert	
 				snprintf(message, sizeof(message), "Node in space %d has wrong sensorType = %d. uID: %lu", space + 1, sensorType, uniqueID);
 				Log.info(message);
-				if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", message, PRIVATE);
+				if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", message, PRIVATE);
 				continue;
 			}
 			jp.getValueByKey(nodeObjectContainer, "jd1", occupancyNet);	// Node is in the passed-in space!
@@ -429,14 +459,14 @@ uint16_t JsonDataManager::getOccupancyNetBySpace(int space) {
 			if(multiEntranceFlag && payload3 == 0){ // Throw an alert if one of the nodes in this space is not multiEntrance (they should all be) 
 				snprintf(message, sizeof(message), "Node in space %d is not set to multiEntrance. uID: %lu", space + 1, uniqueID);
 				Log.info(message);
-				if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", message, PRIVATE);
+				if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", message, PRIVATE);
 			}
 		}	
 	}
 	if(occupancyNetTotal < 0) {	// if the total net occupancy is less than 0, set all nodes in the space to 0
 		snprintf(message, sizeof(message), "Space %d has a negative value. Resetting all node counts to 0.", space + 1);
 		Log.info(message);
-		if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", message, PRIVATE);
+		if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", message, PRIVATE);
 		JsonDataManager::instance().resetSpace(space);
 		return 0; // and return 0 for this report.
 	}
@@ -525,6 +555,7 @@ bool JsonDataManager::setOccupancyNetForNode(int nodeNumber, int newOccupancyNet
 	int sensorType;
 	uint32_t uniqueID;
 	char message[256];
+	char key[24];															// Coalescing key for the occupancy webhook - node and space
 	bool result = 0;
 	uint8_t payload1;
 	uint8_t payload2;
@@ -558,12 +589,13 @@ bool JsonDataManager::setOccupancyNetForNode(int nodeNumber, int newOccupancyNet
 			// Update Ubidots preemptively with battery = -10. This is interpreted by UpdateGatewayNodesAndSpaces as "set the occupancyNet value only"
 			snprintf(message, sizeof(message), "{\"nodeUniqueID\":\"%lu\",\"battery\":%d,\"space\":%d,\"spaceNet\":%d,\"spaceGross\":%d}",\
 			uniqueID, -10, payload1 + 1, Room_Occupancy::instance().getRoomNet(payload1), Room_Occupancy::instance().getRoomGross(payload1));
-			PublishQueuePosix::instance().publish("Ubidots-LoRA-Occupancy-v2", message, PRIVATE | WITH_ACK);
+			snprintf(key, sizeof(key), "%lu-%d", uniqueID, payload1 + 1);
+			PublishQueuePosix::instance().publishKeyed(key, "Ubidots-LoRA-Occupancy-v2", message, PRIVATE | WITH_ACK);
 		}
 		else {	// if we failed to set the alert for this node, throw an Alert to particle
 			snprintf(message, sizeof(message), "Node not reset due to failure in setAlertCode or setAlertContext. uID: %lu", uniqueID);
 			Log.info(message);
-			if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", message, PRIVATE);
+			if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", message, PRIVATE);
 		}
 	}
 
@@ -628,13 +660,13 @@ void JsonDataManager::printNodeData(bool publish) {
 			} break;
 			default: {          		
 				Log.info("Unknown sensor type in printNodeData %d", sensorType);
-				if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", "Unknown sensor type in printNodeData", PRIVATE);
+				if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", "Unknown sensor type in printNodeData", PRIVATE);
 			} break;
     	}
 
 		Log.info(data);
 		if (Particle.connected() && publish) {
-			PublishQueuePosix::instance().publish("nodeData", data, PRIVATE);
+			PublishQueuePosix::instance().publish(PublishQueuePriority::DIAGNOSTICS, "nodeData", data, PRIVATE);
 			delay(1000);
 		}
 	}
@@ -685,13 +717,15 @@ uint8_t JsonDataManager::findNodeNumber(int nodeNumber, uint32_t uniqueID) {
 		mod.finishObjectOrArray();
 	mod.finish();
 
-	bool result = saveNodeDatabase(jp);									// This should backup the nodeID database - now updated to persistent storage
+	saveNodeDatabase(jp);
 
 	// Set the configuration settings from the join payload into the new database entry
 	JsonDataManager::instance().setJoinPayload(nodeNumber);
 
+	bool result = JsonDataManager::instance().commitNodeDatabase();		// A new node is committed right away - it will use this node number from now on
+
 	if (!result) {
-		if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", "set_nodeIDJson failed to add a node to the database!!", PRIVATE);
+		if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", "set_nodeIDJson failed to add a node to the database!!", PRIVATE);
 	}
 
 	return index;
@@ -845,6 +879,7 @@ bool JsonDataManager::resetInactiveSpaces(int secondsInactive){
 
 bool JsonDataManager::resetSpace(int space){
 	char message[256];
+	char key[24];															// Coalescing key for the occupancy webhook - node and space
 	byte updateNeeded = 0;
 	int sensorType;
 	int jsonData1;
@@ -889,7 +924,7 @@ bool JsonDataManager::resetSpace(int space){
 						if (!result) {
 							snprintf(message, sizeof(message), "Could not reset node %d - resetSpace", nodeNumber);
 							Log.info(message);
-							if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", message, PRIVATE);		
+							if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", message, PRIVATE);		
 							updateNeeded = 0;
 						}
 						updateNeeded = 1;
@@ -900,7 +935,7 @@ bool JsonDataManager::resetSpace(int space){
 				default: {          
 					snprintf(message, sizeof(message), "Unknown sensor type %d in resetSpace", sensorType);
 					Log.info(message);
-					if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", message, PRIVATE);	
+					if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", message, PRIVATE);	
 					return false;	
 				} break;
 			}
@@ -910,7 +945,8 @@ bool JsonDataManager::resetSpace(int space){
 		// Update Ubidots preemptively with battery = -10. This is interpreted by UpdateGatewayNodesAndSpaces as "set the occupancyNet value only"
 		snprintf(message, sizeof(message), "{\"nodeUniqueID\":\"%lu\",\"battery\":%d,\"space\":%d,\"spaceNet\":%d,\"spaceGross\":%d}",\
 		uniqueID, -10, payload1 + 1, Room_Occupancy::instance().getRoomNet(payload1), Room_Occupancy::instance().getRoomGross(payload1));
-		PublishQueuePosix::instance().publish("Ubidots-LoRA-Occupancy-v2", message, PRIVATE | WITH_ACK);
+		snprintf(key, sizeof(key), "%lu-%d", uniqueID, payload1 + 1);
+		PublishQueuePosix::instance().publishKeyed(key, "Ubidots-LoRA-Occupancy-v2", message, PRIVATE | WITH_ACK);
 	}
 	return true;
 }
@@ -921,6 +957,7 @@ bool JsonDataManager::resetCurrentDataForNode(int nodeNumber){
 	int sensorType;
 	uint32_t uniqueID;
 	char message[256];
+	char key[24];															// Coalescing key for the occupancy webhook - node and space
 	bool result = 0;
 	uint8_t payload1;
 	uint8_t payload2;
@@ -956,11 +993,12 @@ bool JsonDataManager::resetCurrentDataForNode(int nodeNumber){
 				// Send with battery = -10. This is interpreted by UpdateGatewayNodesAndSpaces as "set the occupancyNet value only", which we set to 0
 				snprintf(message, sizeof(message), "{\"nodeUniqueID\":\"%lu\",\"battery\":%d,\"space\":%d,\"spaceNet\":%d,\"spaceGross\":%d}",\
 				uniqueID, -10, payload1 + 1, Room_Occupancy::instance().getRoomNet(payload1), Room_Occupancy::instance().getRoomGross(payload1));
-				if (Particle.connected()) PublishQueuePosix::instance().publish("Ubidots-LoRA-Occupancy-v2", message, PRIVATE | WITH_ACK);
+				snprintf(key, sizeof(key), "%lu-%d", uniqueID, payload1 + 1);
+				if (Particle.connected()) PublishQueuePosix::instance().publishKeyed(key, "Ubidots-LoRA-Occupancy-v2", message, PRIVATE | WITH_ACK);
 			} else {	// if we failed to set the alert for this node, throw an Alert to particle
 				snprintf(message, sizeof(message), "Node not reset due to failure in setAlertCode. uID: %lu", uniqueID);
 				Log.info(message);
-				if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", message, PRIVATE);
+				if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", message, PRIVATE);
 				return false;
 			}					
 		} break;
@@ -970,7 +1008,7 @@ bool JsonDataManager::resetCurrentDataForNode(int nodeNumber){
 		default: {  
 			snprintf(message, sizeof(message), "Unknown sensor type in resetCurrentDataForNode %d", sensorType);
 			Log.info(message);
-			if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", message, PRIVATE);		        		
+			if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", message, PRIVATE);		        		
 			return false;
 		} break;
 	}
@@ -984,6 +1022,7 @@ bool JsonDataManager::resetAllDataForNode(int nodeNumber){
 	int sensorType;
 	uint32_t uniqueID;
 	char message[256];
+	char key[24];															// Coalescing key for the occupancy webhook - node and space
 	bool result = 0;
 	uint8_t payload1;
 	uint8_t payload2;
@@ -1020,11 +1059,12 @@ bool JsonDataManager::resetAllDataForNode(int nodeNumber){
 				// Send with battery = -10. This is interpreted by UpdateGatewayNodesAndSpaces as "set the occupancyNet value only", which we set to 0
 				snprintf(message, sizeof(message), "{\"nodeUniqueID\":\"%lu\",\"battery\":%d,\"space\":%d,\"spaceNet\":%d,\"spaceGross\":%d}",\
 				uniqueID, -10, payload1 + 1, Room_Occupancy::instance().getRoomNet(payload1), Room_Occupancy::instance().getRoomGross(payload1));
-				if (Particle.connected()) PublishQueuePosix::instance().publish("Ubidots-LoRA-Occupancy-v2", message, PRIVATE | WITH_ACK);
+				snprintf(key, sizeof(key), "%lu-%d", uniqueID, payload1 + 1);
+				if (Particle.connected()) PublishQueuePosix::instance().publishKeyed(key, "Ubidots-LoRA-Occupancy-v2", message, PRIVATE | WITH_ACK);
 			} else {	// if we failed to set the alert for this node, throw an Alert to particle
 				snprintf(message, sizeof(message), "Node not reset due to failure in setAlertCode. uID: %lu", uniqueID);
 				Log.info(message);
-				if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", message, PRIVATE);
+				if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", message, PRIVATE);
 				return false;
 			}					
 		} break;
@@ -1033,7 +1073,7 @@ bool JsonDataManager::resetAllDataForNode(int nodeNumber){
 		} break;
 		default: {          		
 			Log.info("Unknown sensor type in resetAllDataForNode %d", sensorType);
-			if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", "Unknown sensor type in resetAllDataForNode", PRIVATE);
+			if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", "Unknown sensor type in resetAllDataForNode", PRIVATE);
 			return false;
 		} break;
 	}
@@ -1042,6 +1082,45 @@ bool JsonDataManager::resetAllDataForNode(int nodeNumber){
 }
 
 bool JsonDataManager::saveNodeDatabase(JsonParser &jp) {
+	// The parser in RAM is the authoritative copy - just note that FRAM is behind and when that started
+	if (!_nodeDatabaseUnjournaled) {
+		_nodeDatabaseUnjournaled = true;
+		_nodeDatabaseDirtySince = millis();
+	}
+	_nodeDatabaseDirty = true;
+	return true;
+}
+
+void JsonDataManager::journalNodeChange(int nodeNumber, NodeJournal::Field field, int value) {
+	_nodeDatabaseDirty = true;
+	if (NodeJournal::instance().append(nodeNumber, field, value)) return;	// Durable now - a constant size append
+
+	// Journal is full - compact by writing a checkpoint, which already holds this change
+	Log.info("Node journal full - compacting");
+	if (!JsonDataManager::commitNodeDatabase()) saveNodeDatabase(jp);			// Could not checkpoint - fall back to the deadline commit
+}
+
+void JsonDataManager::applyJournalRecord(const NodeJournal::Record &record) {
+	const char *key = NodeJournal::fieldKey(record.field);
+	if (key == NULL || record.nodeNumber == 0 || record.nodeNumber == 255) return;
+
+	const JsonParserGeneratorRK::jsmntok_t *nodesArrayContainer;			// Token for the outer array
+	jp.getValueTokenByKey(jp.getOuterObject(), "nodes", nodesArrayContainer);
+	const JsonParserGeneratorRK::jsmntok_t *nodeObjectContainer;			// Token for the objects in the array
+
+	nodeObjectContainer = jp.getTokenByIndex(nodesArrayContainer, record.nodeNumber-1);
+	if(nodeObjectContainer == NULL) {
+		Log.info("Journal record for node %d not in the database - skipped", record.nodeNumber);
+		return;
+	}
+
+	JsonModifier mod(jp);
+	mod.insertOrUpdateKeyValue(nodeObjectContainer, key, (int)record.value);
+}
+
+bool JsonDataManager::commitNodeDatabase() {
+	if (!_nodeDatabaseDirty) return true;									// Nothing to do
+
     // The first token is the outer object - here we get the total size of the object
     JsonParserGeneratorRK::jsmntok_t *tok = jp.getTokens();
     
@@ -1049,23 +1128,47 @@ bool JsonDataManager::saveNodeDatabase(JsonParser &jp) {
     char *tempBuf = (char*)malloc(tok->end - tok->start + 1);
 
     // Check if memory allocation was successful
-    if (tempBuf != nullptr) {
-        // Copy the content to tempBuf
-        memcpy(tempBuf, jp.getBuffer() + tok->start, tok->end - tok->start);
-        
-        // Null-terminate the string
-        tempBuf[tok->end - tok->start] = '\0';
-
-        // Return the dynamically allocated string and save it
-		nodeDatabase.set_nodeIDJson(tempBuf);									// This should backup the nodeID database - now updated to persistent storage
-		nodeDatabase.flush(false);
-
-		free(tempBuf);															// Free the memory (good practice)
-        return true;
-    } else {
-        return "Memory allocation failure!!";
+    if (tempBuf == nullptr) {
+		Log.info("Memory allocation failure - node database commit deferred");
+		_nodeDatabaseDirtySince = millis();									// Still dirty - try again at the next deadline
 		return false;
-    }
+	}
+
+	// Copy the content to tempBuf and null-terminate the string
+	memcpy(tempBuf, jp.getBuffer() + tok->start, tok->end - tok->start);
+	tempBuf[tok->end - tok->start] = '\0';
+
+	// Ordering matters - the data goes to FRAM first and only then is the change marked as saved.  The checkpoint holds
+	// every record of this epoch, so it carries the epoch: if we lose power before clear(), they are not replayed over it
+	bool result = nodeDatabase.set_nodeIDJson(tempBuf);
+	nodeDatabase.set_journalEpoch(NodeJournal::instance().getEpoch());
+	nodeDatabase.flush(true);
+	free(tempBuf);
+	if (nodeDatabase.getLastSaveFailed()) result = false;					// Not in FRAM - the journal is all that has the changes
+
+	if (result) {
+		Log.info("Node database checkpoint written - compacted %u journal records", NodeJournal::instance().count());
+		NodeJournal::instance().clear();									// Only now that the checkpoint holds every journaled change
+		_nodeDatabaseDirty = false;
+		_nodeDatabaseUnjournaled = false;
+	}
+	else _nodeDatabaseDirtySince = millis();								// Did not fit or not written - still dirty, try again at the next deadline
+	return result;
+}
+
+void JsonDataManager::discardNodeDatabaseChanges() {
+	_nodeDatabaseDirty = false;
+	_nodeDatabaseUnjournaled = false;
+	NodeJournal::instance().clear();										// The journaled changes were for the old database
+	if (!JsonDataManager::loadNodeDatabase()) Log.info("Parsing error reloading node database");	// Back in step with what is stored
+}
+
+bool JsonDataManager::loadNodeDatabase() {
+	// Copy the stored JSON straight into the parser's static buffer - a String would put another 3K on the heap
+	jp.clear();
+	size_t len = nodeDatabase.get_nodeIDJson(jp.getBuffer(), jp.getBufferLen());
+	jp.setOffset(len);
+	return jp.parse();
 }
 
 
@@ -1093,7 +1196,7 @@ uint8_t JsonDataManager::getCompressedJoinPayload(uint8_t sensorType) {
         } break;
         default: {          		
             Log.info("Unknown sensor type in getCompressedJoinPayload %d", sensorType);
-            if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", "Unknown sensor type in getCompressedJoinPayload", PRIVATE);
+            if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", "Unknown sensor type in getCompressedJoinPayload", PRIVATE);
             return 0;
         } break;
     }
@@ -1125,7 +1228,7 @@ bool JsonDataManager::hydrateJoinPayload(uint8_t sensorType, uint8_t compressedJ
         } break;
         default: {
             Log.info("Unknown sensor type in hydrateJoinPayload %d", sensorType);
-            if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", "Unknown sensor type in hydrateJoinPayload", PRIVATE);
+            if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", "Unknown sensor type in hydrateJoinPayload", PRIVATE);
             return false;
         } break;
     }
@@ -1159,7 +1262,7 @@ bool JsonDataManager::parseJoinPayloadValues(uint8_t sensorType, uint8_t compres
         } break;
         default: {
             Log.info("Unknown sensor type in parseJoinPayloadValues %d", sensorType);
-            if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", "Unknown sensor type in parseJoinPayloadValues", PRIVATE);
+            if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", "Unknown sensor type in parseJoinPayloadValues", PRIVATE);
             return false;
         } break;
     }
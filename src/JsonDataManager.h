@@ -12,6 +12,7 @@
 #include "MyPersistentData.h"
 #include "JsonParserGeneratorRK.h"
 #include "LocalTimeRK.h"
+#include "NodeJournal.h"
 
 /**
  * This class is a singleton; you do not create one as a global, on the stack, or with new.
@@ -46,6 +47,14 @@ public:
      */
     void loop();
 
+    /**
+     * @brief Milliseconds until loop() commits the changes that could not be journaled - 0 if the next call does
+     * 
+     * @details Returns 0xffffffff if nothing is waiting.  The MCU should not sleep longer than this between calls
+     * to loop(), or the write-behind deadline slips by the length of the sleep.
+     */
+    system_tick_t getMsUntilCommit() const;
+
     /**
      * @brief Get Type is a function that returns the sensor Type for a given node number
      * 
@@ -277,10 +286,37 @@ public:
     bool resetAllDataForNode(int nodeNumber);
 
     /** 
-     * @brief Saves the node database as a string to memory.
+     * @brief Marks the node database as changed - the change is held in RAM and written to FRAM by commitNodeDatabase()
+     * 
+     * @details Write-behind for changes that are not journaled (new entries, sensor type changes) - these are
+     * coalesced into a single commit that happens in loop() once NODE_DATABASE_COMMIT_DELAY_MS has passed since the
+     * first unsaved change.
      */
     bool saveNodeDatabase(JsonParser &jp);
 
+    /**
+     * @brief Writes the node database checkpoint to FRAM now and compacts the journal
+     * 
+     * @details Call at quiet moments - leaving the LoRA window, sleeping or resetting.  The journal is only cleared
+     * once the checkpoint has been written so an interrupted commit is retried, never lost.
+     * 
+     * @return true if the database in FRAM is up to date
+     * @return false if the commit failed - changes are still pending
+     */
+    bool commitNodeDatabase();
+
+    /**
+     * @brief Drops any unsaved node database changes and reloads the database from FRAM
+     * 
+     * @details Use after the stored database is replaced (reset / initialize) so stale changes are not written over it
+     */
+    void discardNodeDatabaseChanges();
+
+    /**
+     * @brief Returns true if the node database has changes that have not been written to FRAM
+     */
+    bool nodeDatabaseDirty() const { return _nodeDatabaseDirty; }
+
 
     /**********************************************************************
      **                         Data Compression                         **
@@ -380,5 +416,26 @@ protected:
      */
     static JsonDataManager *_instance;
 
+    /**
+     * @brief Reloads the parser from the stored node database without a String copy and parses it
+     * 
+     * @return true if the stored database parsed
+     */
+    bool loadNodeDatabase();
+
+    /**
+     * @brief Appends a single field change to the node journal - compacts the journal if it is full
+     */
+    void journalNodeChange(int nodeNumber, NodeJournal::Field field, int value);
+
+    /**
+     * @brief Applies a journal record to the node database in RAM - used when replaying the journal at boot
+     */
+    void applyJournalRecord(const NodeJournal::Record &record);
+
+    bool _nodeDatabaseDirty = false;                // Checkpoint in FRAM is behind the node database in RAM
+    bool _nodeDatabaseUnjournaled = false;          // Some of those changes are not in the journal either
+    system_tick_t _nodeDatabaseDirtySince = 0;      // millis() of the first unjournaled change - sets the commit deadline
+
 };
 #endif  /* __LORA_FUNCTIONS_H */
@@ -1,7 +1,11 @@
 #include "LoRA_Functions.h"
+#include "LoRA_Messages.h"
+#include "LoRA_ReceiveFlag.h"
 #include "JsonDataManager.h"
 #include "PublishQueuePosixRK.h"
 
+using namespace LoRA_Messages;
+
 // Singleton instantiation - from template
 LoRA_Functions *LoRA_Functions::_instance;
 
@@ -40,19 +44,20 @@ RH_RF95 rf95(RFM95_CS, RFM95_INT);
 Speck myCipher;                             // Class instance for Speck block ciphering     
 RHEncryptedDriver driver(rf95, myCipher);   // Class instance for Encrypted RFM95 driver
 
+static LoRA_ReceiveFlag<RH_RF95> receiveFlag(rf95);	// Set from the radio interrupt handler when a message arrives
+
+static void loraReceiveCallback(void *context) {			// Runs in interrupt context - just raise the flag
+	receiveFlag.onReceive();
+}
+
 // Class to manage message delivery and receipt, using the driver declared above
 RHMesh manager(driver, GATEWAY_ADDRESS);
 
-// Mesh has much greater memory requirements, and you may need to limit the
-// max message length to prevent weird crashes
-#ifndef RH_MAX_MESSAGE_LEN
-#define RH_MAX_MESSAGE_LEN 255
-#endif
-
-// Mesh has much greater memory requirements, and you may need to limit the
-// max message length to prevent wierd crashes
-// #define RH_MESH_MAX_MESSAGE_LEN 50
+// Mesh has much greater memory requirements so the stack is sized for our messages with RH_MAX_MESSAGE_LEN in RadioHead.h
 uint8_t buf[RH_MESH_MAX_MESSAGE_LEN];               // Related to max message size - RadioHead example note: dont put this on the stack:
+static_assert(DataReport::length < RH_MESH_MAX_MESSAGE_LEN && JoinAck::length < RH_MESH_MAX_MESSAGE_LEN, "LoRA messages must fit in a mesh message");
+// Speck encrypts in 16 byte blocks (plus a length byte) and the decrypted blocks land in the router's message buffer
+static_assert(((sizeof(RHRouter::RoutedMessageHeader) + sizeof(RHMesh::MeshMessageHeader) + DataReport::length + 1 + 15) / 16) * 16 - 1 <= RH_MAX_MESSAGE_LEN, "RH_MAX_MESSAGE_LEN is too small for an encrypted data report");
 
 bool LoRA_Functions::setup(bool gatewayID) {
     // Set up the Radio Module
@@ -89,10 +94,7 @@ void LoRA_Functions::loop() {
 
 
 void LoRA_Functions::clearBuffer() {
-	uint8_t bufT[RH_RF95_MAX_MESSAGE_LEN];
-	uint8_t lenT;
-
-	while(driver.recv(bufT, &lenT)) {};
+	while(driver.recv(NULL, NULL)) {};				// Discard in the driver - no need to copy or decrypt what we are throwing away
 }
 
 void LoRA_Functions::sleepLoRaRadio() {
@@ -116,6 +118,7 @@ bool LoRA_Functions::initializeRadio() {  			// Set up the Radio Module
 	//driver.setModemConfig(RH_RF95::Bw125Cr48Sf4096);	// This optimized the radio for long range - https://www.airspayce.com/mikem/arduino/RadioHead/classRH__RF95.html
 	rf95.setLowDatarate();						// https://www.airspayce.com/mikem/arduino/RadioHead/classRH__RF95.html#a8e2df6a6d2cb192b13bd572a7005da67
 	manager.setTimeout(1000);						// 200mSec is the default - may need to extend once we play with other settings on the modem - https://www.airspayce.com/mikem/arduino/RadioHead/classRHReliableDatagram.html
+	driver.setRxCallback(loraReceiveCallback);		// Tell us when a message arrives so we don't have to poll for it
 return true;
 }
 
@@ -126,8 +129,23 @@ return true;
 
 // Common across message types - these messages are general for send and receive
 
+// Sends with RHMesh::sendtoWait() and then drops the receive flag raised by the acks it collected
+static uint8_t sendtoWaitGateway(uint8_t *message, uint8_t len, uint8_t address, uint8_t flags) {
+	uint8_t result = manager.sendtoWait(message, len, address, flags);
+	receiveFlag.sendDone();
+	return result;
+}
+
+bool LoRA_Functions::messagePending() {
+	return receiveFlag.messagePending();
+}
+
+bool LoRA_Functions::readyToSleep() {
+	return receiveFlag.readyToSleep(RFM95_INT);
+}
+
 bool LoRA_Functions::listenForLoRAMessageGateway() {
-	uint8_t len = sizeof(buf);
+	uint8_t len = sizeof(buf) - 1;													// Leave room for the terminator below
 	uint8_t from;  
 	uint8_t dest;
 	uint8_t id;
@@ -137,19 +155,21 @@ bool LoRA_Functions::listenForLoRAMessageGateway() {
 		buf[len] = 0;
 
 		current.set_nodeNumber(from);												// Captures the nodeNumber
-		uint16_t current_magicNumber = (buf[0] << 8 | buf[1]);								// Magic number
+		uint16_t current_magicNumber = NodeHeader::MagicNumber::get(buf);					// Magic number
 
 		// First we will validate that this node belongs in this network by checking the magic number
 		if (current_magicNumber != sysStatus.get_magicNumber()) {
 			Log.info("Node %d message magic number of %d did not match the Magic Number in memory %d - Ignoring", current.get_nodeNumber(), current_magicNumber, sysStatus.get_magicNumber());
 			return false;
 		}
+		current.beginUpdate();														// Header fields are applied as one update
 		current.set_alertCodeNode(0);												// Clear the alert code for the node - Alert codes are set in the response
 		current.set_tempNodeNumber(0);												// Clear for new response - this is used for join requests
 		current.set_hops(hops);														// How many hops to get here
-		current.set_token(buf[3] << 8 | buf[4]);									// The token sent by the note - need to check it is valid
-		current.set_sensorType(buf[5]);												// Sensor type reported by the node
-		current.set_uniqueID(buf[6] << 24 | buf[7] << 16 | buf[8] << 8 | buf[9]);	// Unique ID of the node - this is like the Particle deviceID
+		current.set_token(NodeHeader::Token::get(buf));								// The token sent by the note - need to check it is valid
+		current.set_sensorType(NodeHeader::SensorType::get(buf));					// Sensor type reported by the node
+		current.set_uniqueID(NodeHeader::UniqueID::get(buf));						// Unique ID of the node - this is like the Particle deviceID
+		current.commit();
 
 		lora_state = (LoRA_State)(0x0F & messageFlag);								// Strip out the overhead byte to get the message flag
 		Log.info("Node %d with uniqueID %lu a %s message with RSSI/SNR of %d / %d in %d hops", current.get_nodeNumber(), current.get_uniqueID(), loraStateNames[lora_state], rf95.lastRssi(), rf95.lastSNR(), current.get_hops());
@@ -189,30 +209,32 @@ bool LoRA_Functions::listenForLoRAMessageGateway() {
 
 }
 
+void LoRA_Functions::wakeFromListening() {
+	receiveFlag.wake();								// Will set the message pending flag if there is a message to collect
+}
+
 // These are the receive and respond messages for data reports
 bool LoRA_Functions::decipherDataReportGateway() {			// Receives the data report and loads results into current object for reporting
-	// buf[0] - buf[1] Magic number processed above
-	// buf[2] - nodeNumber processed above
-	// buf[3] - buf[4] is token - processed above
-	// buf[5] - Sensor type - processed above
-	// buf[6] - buf[9] is the unique ID of the node - processed above
-	current.set_payload1(buf[10]);
-	current.set_payload2(buf[11]);
-	current.set_payload3(buf[12]);
-	current.set_payload4(buf[13]);
-	current.set_payload5(buf[14]);
-	current.set_payload6(buf[15]);
-	current.set_payload7(buf[16]);
-	current.set_payload8(buf[17]);
+	// The NodeHeader fields (magic number, nodeNumber, token, sensor type and uniqueID) are processed above
+	current.beginUpdate();										// Apply the whole report as one update - one hash and one save
+	current.set_payload1(DataReport::Payload1::get(buf));
+	current.set_payload2(DataReport::Payload2::get(buf));
+	current.set_payload3(DataReport::Payload3::get(buf));
+	current.set_payload4(DataReport::Payload4::get(buf));
+	current.set_payload5(DataReport::Payload5::get(buf));
+	current.set_payload6(DataReport::Payload6::get(buf));
+	current.set_payload7(DataReport::Payload7::get(buf));
+	current.set_payload8(DataReport::Payload8::get(buf));
 	// Then, we will get the rest of the data from the payload
-	current.set_internalTempC(buf[18]);
-	current.set_stateOfCharge(buf[19]);
-	current.set_batteryState(buf[20]);
-	current.set_resetCount(buf[21]);
-	current.set_RSSI(buf[22] << 8 | buf[23]);		// These values are from the node based on the last successful data report
-	current.set_SNR(buf[24] << 8 | buf[25]);
-	current.set_retryCount(buf[26]);
-	current.set_retransmissionDelay(buf[27]);
+	current.set_internalTempC(DataReport::InternalTempC::get(buf));
+	current.set_stateOfCharge(DataReport::StateOfCharge::get(buf));
+	current.set_batteryState(DataReport::BatteryState::get(buf));
+	current.set_resetCount(DataReport::ResetCount::get(buf));
+	current.set_RSSI(DataReport::RSSI::get(buf));		// These values are from the node based on the last successful data report
+	current.set_SNR(DataReport::SNR::get(buf));
+	current.set_retryCount(DataReport::RetryCount::get(buf));
+	current.set_retransmissionDelay(DataReport::RetransmissionDelay::get(buf));
+	current.commit();
 
 	// Log.info("Data recieved from the report: sensorType %d, temp %d, battery %d, batteryState %d, resets %d, message count %d, RSSI %d, SNR %d", current.get_sensorType(), current.get_internalTempC(), current.get_stateOfCharge(), current.get_batteryState(), current.get_resetCount(), sysStatus.get_messageCount(), current.get_RSSI(), current.get_SNR());
 	
@@ -233,7 +255,7 @@ bool LoRA_Functions::decipherDataReportGateway() {			// Receives the data report
 		} break;
 		default: {          		
 			Log.info("Unknown sensor type in decipherDataReportGateway %d",current.get_sensorType());
-			if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", "Unknown sensor type in decipherDataReportGateway", PRIVATE);
+			if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", "Unknown sensor type in decipherDataReportGateway", PRIVATE);
 		} break;
 	}
 
@@ -262,24 +284,17 @@ bool LoRA_Functions::acknowledgeDataReportGateway() { 		// This is a response to
 			} break;
 			default: {          		
 				Log.info("Unknown sensor type in acknowledgeDataReportGateway %d", current.get_sensorType());
-				if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", "Unknown sensor type in acknowledgeDataReportGateway", PRIVATE);
+				if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", "Unknown sensor type in acknowledgeDataReportGateway", PRIVATE);
 			} break;
 		}
 	}
 
-	// buf[0] - buf[1] is magic number - processed above
-	// buf[2] is nodeNumber - processed above
-	buf[3] = highByte(current.get_token());			// Token - May have changed in the listening function above
-	buf[4] = lowByte(current.get_token());			// Token - so I can trust you
-	uint32_t currentTime = Time.now();
-	buf[5] = (uint8_t)(currentTime >> 24); 			// Fourth byte - current time
-	buf[6] = (uint8_t)(currentTime >> 16); 			// Third byte
-	buf[7] = (uint8_t)(currentTime >> 8);  			// Second byte
-	buf[8] = (uint8_t)(currentTime);  	
+	// Magic number and nodeNumber are parroted back from the data report
+	DataAck::Token::put(buf, current.get_token());			// Token - May have changed in the listening function above
+	DataAck::CurrentTime::put(buf, Time.now());				// Set the node's clock
 
 	// Here we calculate the seconds to the next report
-	buf[9] = highByte(sysStatus.get_frequencySeconds());	// Frequency of reports set by the gateway
-	buf[10] = lowByte(sysStatus.get_frequencySeconds());
+	DataAck::FrequencySeconds::put(buf, sysStatus.get_frequencySeconds());	// Frequency of reports set by the gateway
 	Log.info("Frequency of reports is %d seconds", sysStatus.get_frequencySeconds());	
 
 	// Next we have to determine if there is an alert code to send
@@ -293,27 +308,22 @@ bool LoRA_Functions::acknowledgeDataReportGateway() { 		// This is a response to
 	}
 
 	Log.info("In the data message ack composition, alert code for node %d is %d", current.get_nodeNumber(), current.get_alertCodeNode());
-	buf[11] = current.get_alertCodeNode();	    // Send alert code to the node
-
-	uint16_t alertContext = JsonDataManager::instance().getAlertContext(current.get_nodeNumber()); // Set the alert context if any
-	buf[12] = highByte(alertContext);
-	buf[13] = lowByte(alertContext);
-
-	buf[14] = current.get_sensorType();			// Set the sensor type - this is the sensor type reported by the node
-	buf[15] = 0;
-	buf[16] = 0;								// Will be over-written if needed
+	DataAck::AlertCode::put(buf, current.get_alertCodeNode());	    // Send alert code to the node
+	DataAck::AlertContext::put(buf, JsonDataManager::instance().getAlertContext(current.get_nodeNumber())); // Set the alert context if any
+	DataAck::SensorType::put(buf, current.get_sensorType());		// Set the sensor type - this is the sensor type reported by the node
+	DataAck::Reserved::put(buf, 0);									// Will be over-written if needed
 
 	current.flush(true);							// Save values reported by the nodes
 	digitalWrite(BLUE_LED,HIGH);			       	// Sending data
 
 	byte nodeAddress = (current.get_tempNodeNumber() == 0) ? current.get_nodeNumber() : current.get_tempNodeNumber();  // get the return address right
 
-	if (manager.sendtoWait(buf, 16, nodeAddress, DATA_ACK) == RH_ROUTER_ERROR_NONE) {
+	if (sendtoWaitGateway(buf, DataAck::length, nodeAddress, DATA_ACK) == RH_ROUTER_ERROR_NONE) {
 		digitalWrite(BLUE_LED,LOW);
 
 		snprintf(messageString,sizeof(messageString),"Node %d data report %d acknowledged with alert %d, and RSSI / SNR of %d / %d", current.get_nodeNumber(), sysStatus.get_messageCount(), current.get_alertCodeNode(), current.get_RSSI(), current.get_SNR());
 		Log.info(messageString);
-		if (Particle.connected()) PublishQueuePosix::instance().publish("status", messageString,PRIVATE);
+		if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::DIAGNOSTICS, "status", messageString, PRIVATE);
 		sysStatus.set_messageCount(sysStatus.get_messageCount() + 1); // Increment the message count
 		JsonDataManager::instance().setAlertCode(current.get_nodeNumber(), 0); // Clear pending alert, as you just sent it  
 		JsonDataManager::instance().setAlertContext(current.get_nodeNumber(), 0); // Clear pending alert context, as you just sent it  
@@ -329,24 +339,23 @@ bool LoRA_Functions::acknowledgeDataReportGateway() { 		// This is a response to
 
 // These are the receive and respond messages for join requests
 bool LoRA_Functions::decipherJoinRequestGateway() {			// Ths only question here is whether the node with the join request needs a new nodeNumber or is just looking for a clock set
-	// buf[0] - buf[1] Magic number processed above
-	// buf[2] - nodeNumber processed above
-	// buf[3] - buf[4] is token - processed above
+	// The NodeHeader fields (magic number, nodeNumber, token and uniqueID) are processed above
 
 	// This is a temporary fix
-	// buf[5] - Sensor type - processed above
+	// Sensor type - processed above
 	current.set_sensorType(10);		// This for a join request - set the sensor type to 10
 	// Remove this fix when we figure out how to get the sensor type from the node
 
-	// buf[6] - buf[9] is the unique ID of the node - processed above
-	current.set_payload1(buf[10]);					
-	current.set_payload2(buf[11]);
-	current.set_payload3(buf[12]);
-	current.set_payload4(buf[13]);
-	current.set_retryCount(buf[14]);
-	current.set_retransmissionDelay(buf[15]);
+	current.beginUpdate();
+	current.set_payload1(JoinRequest::Payload1::get(buf));
+	current.set_payload2(JoinRequest::Payload2::get(buf));
+	current.set_payload3(JoinRequest::Payload3::get(buf));
+	current.set_payload4(JoinRequest::Payload4::get(buf));
+	current.set_retryCount(JoinRequest::RetryCount::get(buf));
+	current.set_retransmissionDelay(JoinRequest::RetransmissionDelay::get(buf));
+	current.commit();
 
-	if (buf[6] == 255 && buf[7] == 255) {			// assign a uniqueID					// This is a virgin node - need to assign it a uniqueID
+	if ((JoinRequest::UniqueID::get(buf) >> 16) == 0xFFFF) {			// assign a uniqueID					// This is a virgin node - need to assign it a uniqueID
 		uint8_t random1 = random(0,254);													// Not to 255 so we can see if it is a virgin node
 		uint8_t random2 = random(0,254);
 		uint8_t time1 = ((uint8_t) ((Time.now()) >> 8));									// Second byte
@@ -374,46 +383,36 @@ bool LoRA_Functions::acknowledgeJoinRequestGateway() {
 	char messageString[128];
 	Log.info("Acknowledge Join Request");
 	// Gateway's response to a join request from a node
-	buf[0] = highByte(sysStatus.get_magicNumber());					// Magic number - so you can trust me
-	buf[1] = lowByte(sysStatus.get_magicNumber());					// Magic number - so you can trust me
-	buf[2] = current.get_nodeNumber();
-	buf[3] = highByte(current.get_token());							// Token - so I can trust you
-	buf[4] = lowByte(current.get_token());							// Token - so I can trust you
-	
-	uint32_t currentTime = Time.now();
-	buf[5] = (uint8_t)(currentTime >> 24); 							// Fourth byte - current time
-	buf[6] = (uint8_t)(currentTime >> 16); 							// Third byte
-	buf[7] = (uint8_t)(currentTime >> 8);  							// Second byte
-	buf[8] = (uint8_t)(currentTime);         						// First byte	
+	JoinAck::MagicNumber::put(buf, sysStatus.get_magicNumber());		// Magic number - so you can trust me
+	JoinAck::NodeNumber::put(buf, current.get_nodeNumber());
+	JoinAck::Token::put(buf, current.get_token());						// Token - so I can trust you
+	JoinAck::CurrentTime::put(buf, Time.now());							// Set the node's clock
 	// Need to calculate the seconds to the next report
-	buf[9] = highByte(sysStatus.get_frequencySeconds());			// Frequency of reports - for Gateways
-	buf[10] = lowByte(sysStatus.get_frequencySeconds());	
+	JoinAck::FrequencySeconds::put(buf, sysStatus.get_frequencySeconds());	// Frequency of reports - for Gateways
 	Log.info("Frequency of reports is %d seconds", sysStatus.get_frequencySeconds());	
-	buf[11] = (current.get_nodeNumber() != 255) ?  0 : 1;			// Clear the alert code for the node unless the nodeNumber process failed
-	buf[13] = current.get_sensorType();
-	buf[14] = current.get_uniqueID() >> 24;							// Unique ID of the node
-	buf[15] = current.get_uniqueID() >> 16;	
-	buf[16] = current.get_uniqueID() >> 8;
-	buf[17] = current.get_uniqueID();
-	buf[18] = current.get_nodeNumber();
+	JoinAck::AlertCode::put(buf, (current.get_nodeNumber() != 255) ?  0 : 1);	// Clear the alert code for the node unless the nodeNumber process failed
+	JoinAck::AlertContext::put(buf, 0);									// No alert context with a join
+	JoinAck::SensorType::put(buf, current.get_sensorType());
+	JoinAck::UniqueID::put(buf, current.get_uniqueID());				// Unique ID of the node
+	JoinAck::NewNodeNumber::put(buf, current.get_nodeNumber());
 
 	if (JsonDataManager::instance().uniqueIDExistsInDatabase(current.get_uniqueID())) {		// Check to make sure the node's uniqueID is in the database
 		uint8_t nodeNumber = JsonDataManager::instance().getNodeNumberForUniqueID(current.get_uniqueID());
-		buf[13] = JsonDataManager::instance().getType(nodeNumber);							// Make sure type is up to date
+		JoinAck::SensorType::put(buf, JsonDataManager::instance().getType(nodeNumber));		// Make sure type is up to date
 		JsonDataManager::instance().getJoinPayload(nodeNumber);								// Get the payload values from the nodeID database
-		buf[19] = current.get_payload1();					
-		buf[20] = current.get_payload2();
-		buf[21] = current.get_payload3();
-		buf[22] = current.get_payload4();
-		Log.info("Node %d join request will update sensorType to %d", current.get_tempNodeNumber(), (int)buf[13]);
+		JoinAck::Payload1::put(buf, current.get_payload1());
+		JoinAck::Payload2::put(buf, current.get_payload2());
+		JoinAck::Payload3::put(buf, current.get_payload3());
+		JoinAck::Payload4::put(buf, current.get_payload4());
+		Log.info("Node %d join request will update sensorType to %d", current.get_tempNodeNumber(), (int)JoinAck::SensorType::get(buf));
 		Log.info("Node %d join request will update with payload [%d, %d, %d, %d]", current.get_tempNodeNumber(), current.get_payload1(), current.get_payload2(), current.get_payload3(), current.get_payload4());
 	}
 	else {
-		if (Particle.connected()) PublishQueuePosix::instance().publish("Alert", "findNodeNumber failed to add the node to the database.", PRIVATE);
+		if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert", "findNodeNumber failed to add the node to the database.", PRIVATE);
 	}			// Else, we will send an alert because the uniqueID should have been set in decipherJoinPayload when findNodeNumber was called
 
-	buf[23] = 0;											// buf[23] and buf[24] are reserved for future use
-	buf[24] = 0;
+	JoinAck::RetryCount::put(buf, 0);						// Re-tries and re-transmission delay are filled in by RHReliableDatagram
+	JoinAck::RetransmissionDelay::put(buf, 0);
 
 	byte nodeAddress = (current.get_tempNodeNumber() == 0) ? current.get_nodeNumber() : current.get_tempNodeNumber();  // get the return address right
 
@@ -421,12 +420,12 @@ bool LoRA_Functions::acknowledgeJoinRequestGateway() {
 
 	Log.info("Sending response to %d with free memory = %li", nodeAddress, System.freeMemory());
 
-	if (manager.sendtoWait(buf, 25, nodeAddress, JOIN_ACK) == RH_ROUTER_ERROR_NONE) {
+	if (sendtoWaitGateway(buf, JoinAck::length, nodeAddress, JOIN_ACK) == RH_ROUTER_ERROR_NONE) {
 		current.set_tempNodeNumber(0);								// Temp no longer needed
 		digitalWrite(BLUE_LED,LOW);
-		snprintf(messageString,sizeof(messageString),"Node %d joined. New nodeNumber %d, sensorType %s, alert %d and RSSI / SNR of %d / %d", nodeAddress, current.get_nodeNumber(), (buf[10] ==0)? "car":"person",current.get_alertCodeNode(), current.get_RSSI(), current.get_SNR());
+		snprintf(messageString,sizeof(messageString),"Node %d joined. New nodeNumber %d, sensorType %d, alert %d and RSSI / SNR of %d / %d", nodeAddress, current.get_nodeNumber(), (int)JoinAck::SensorType::get(buf), current.get_alertCodeNode(), current.get_RSSI(), current.get_SNR());
 		Log.info(messageString);
-		if (Particle.connected()) PublishQueuePosix::instance().publish("status", messageString,PRIVATE);
+		if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::DIAGNOSTICS, "status", messageString, PRIVATE);
 		return true;
 	}
 	else {
@@ -7,7 +7,7 @@
  * 
  */
 
-// Data exchange formats
+// Data exchange formats - these are defined for the code in LoRA_Messages.h, keep the two in step
 // Format of a data report - From the Node to the Gateway so includes a token - most common message from node to gateway
 /*
 *** Header Section - Common to all Nodes
@@ -148,10 +148,21 @@ public:
 
 
     // Generic Gateway Functions
+    /**
+     * @brief Returns true (once) when the radio has received a message that is waiting to be processed
+     * 
+     * @details The radio interrupt handler sets a flag when a valid message arrives so we only go down the receive
+     * path when there is something to receive.  If nothing is pending this makes sure the receiver is listening.
+     * 
+     * @return true - call listenForLoRAMessageGateway() to process the message
+     * @return false - nothing to do
+     */
+    bool messagePending();
+
     /**
      * @brief This function is used to listen for all message types
      * 
-     * @details - Use polling with this function - executed in main LoRA_STATE every loop transit
+     * @details - Executed in main LoRA_STATE when messagePending() says a message has arrived
      * 
      * @param None
      * 
@@ -160,6 +171,24 @@ public:
      */
     bool listenForLoRAMessageGateway();     
 
+    /**
+     * @brief Puts the receiver back in Rx and returns true if the MCU can sleep until the radio's next interrupt
+     * 
+     * @details The radio is idle after it receives a message or sends an ack.  Call immediately before sleeping - 
+     * returns false if a message arrived since messagePending() so it is collected first.  If it returns true, call
+     * wakeFromListening() after the sleep.
+     */
+    bool readyToSleep();
+
+    /**
+     * @brief Call after a low power sleep that readyToSleep() allowed, whatever woke the MCU
+     * 
+     * @details The wakeup can consume the interrupt edge so the radio driver never hears about the message - this
+     * runs the driver's interrupt handler if the radio still has its interrupt asserted.  It also puts the radio
+     * back to idling after a receive, which readyToSleep() turned off for the sleep.
+     */
+    void wakeFromListening();
+
     // Specific Gateway Message Functions
     /**
      * @brief Function that unpacks a data report from a node
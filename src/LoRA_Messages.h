@@ -0,0 +1,170 @@
+/**
+ * @file LoRA_Messages.h
+ * @author Chip McClelland (chip@seeinisghts.com)
+ * @brief Compile-time wire schema for the LoRA messages exchanged between the nodes and the gateway
+ * @details Each message is described once as a set of Field<offset, type> aliases.  Encoding and decoding
+ * is generated from these at compile time (big-endian, no branches) and the layouts are checked with
+ * static_assert so a bad offset fails the build rather than corrupting a node's data.
+ * The byte-by-byte formats are documented in LoRA_Functions.h
+ * @version 0.1
+ * @date 2024-10-18
+ *
+ */
+
+#ifndef __LORA_MESSAGES_H
+#define __LORA_MESSAGES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+namespace LoRA_Messages {
+
+/**
+ * @brief A single field in a message - fixed offset, width taken from the type, big-endian on the wire
+ *
+ * @tparam Offset byte offset of the first (most significant) byte in the message
+ * @tparam T integral type of the field - uint8_t, int8_t, uint16_t, int16_t or uint32_t
+ */
+template <size_t Offset, typename T>
+struct Field {
+    static_assert(std::is_integral<T>::value, "Message fields must be integral");
+
+    typedef T type;
+    static constexpr size_t offset = Offset;
+    static constexpr size_t size = sizeof(T);
+    static constexpr size_t end = Offset + sizeof(T);
+
+    /**
+     * @brief Reads the field from a message buffer
+     */
+    static inline T get(const uint8_t *buf) {
+        typedef typename std::make_unsigned<T>::type U;
+        U value = 0;
+        for (size_t i = 0; i < size; i++) value = (U)((value << 8) | buf[Offset + i]);   // Unrolled by the compiler - size is a constant
+        return (T)value;
+    }
+
+    /**
+     * @brief Writes the field into a message buffer
+     */
+    static inline void put(uint8_t *buf, T value) {
+        typedef typename std::make_unsigned<T>::type U;
+        U v = (U)value;
+        for (size_t i = 0; i < size; i++) buf[Offset + i] = (uint8_t)(v >> (8 * (size - 1 - i)));
+    }
+};
+
+/**
+ * @brief Compile-time check that field B starts exactly where field A ends
+ */
+template <typename A, typename B>
+struct Follows {
+    static constexpr bool value = (A::end == B::offset);
+};
+
+// Header common to the messages sent from a node to the gateway (data report and join request)
+struct NodeHeader {
+    typedef Field<0, uint16_t>  MagicNumber;                // Magic number that identifies the Gateway's network
+    typedef Field<2, uint8_t>   NodeNumber;                 // nodeNumber - unique to each node on the gateway's network
+    typedef Field<3, uint16_t>  Token;                      // Token given to the node and good for 24 hours
+    typedef Field<5, uint8_t>   SensorType;                 // What sensor type is it
+    typedef Field<6, uint32_t>  UniqueID;                   // 4-byte identifier that is unique to each node
+    static constexpr size_t length = UniqueID::end;
+};
+
+// Data report - node to gateway
+struct DataReport : NodeHeader {
+    typedef Field<10, uint8_t>  Payload1;                   // Payload - 8 bytes sensor type determines interpretation
+    typedef Field<11, uint8_t>  Payload2;
+    typedef Field<12, uint8_t>  Payload3;
+    typedef Field<13, uint8_t>  Payload4;
+    typedef Field<14, uint8_t>  Payload5;
+    typedef Field<15, uint8_t>  Payload6;
+    typedef Field<16, uint8_t>  Payload7;
+    typedef Field<17, uint8_t>  Payload8;
+    typedef Field<18, int8_t>   InternalTempC;              // Enclosure temp
+    typedef Field<19, int8_t>   StateOfCharge;              // -1 to 100%
+    typedef Field<20, uint8_t>  BatteryState;               // 0 to 6
+    typedef Field<21, uint8_t>  ResetCount;
+    typedef Field<22, int16_t>  RSSI;                       // From the Node's perspective
+    typedef Field<24, int16_t>  SNR;                        // From the Node's perspective
+    typedef Field<26, uint8_t>  RetryCount;                 // Updated by RHReliableDatagram
+    typedef Field<27, uint8_t>  RetransmissionDelay;        // Updated by RHReliableDatagram
+    static constexpr size_t length = RetransmissionDelay::end;
+};
+
+// Join request - node to gateway
+struct JoinRequest : NodeHeader {
+    typedef Field<10, uint8_t>  Payload1;                   // Payload - 4 bytes sensor type determines interpretation
+    typedef Field<11, uint8_t>  Payload2;
+    typedef Field<12, uint8_t>  Payload3;
+    typedef Field<13, uint8_t>  Payload4;
+    typedef Field<14, uint8_t>  RetryCount;                 // Updated by RHReliableDatagram
+    typedef Field<15, uint8_t>  RetransmissionDelay;        // Updated by RHReliableDatagram
+    static constexpr size_t length = RetransmissionDelay::end;
+};
+
+// Header common to the messages sent from the gateway to a node (data ack and join ack)
+struct GatewayHeader {
+    typedef Field<0, uint16_t>  MagicNumber;                // Magic Number
+    typedef Field<2, uint8_t>   NodeNumber;                 // Node number (unique for the network)
+    typedef Field<3, uint16_t>  Token;                      // Token - so I can trust you
+    typedef Field<5, uint32_t>  CurrentTime;                // Time.now() - sets the node's clock
+    typedef Field<9, uint16_t>  FrequencySeconds;           // Seconds to next report
+    typedef Field<11, uint8_t>  AlertCode;                  // Lets the Gateway trigger an alert on the node
+    static constexpr size_t length = AlertCode::end;
+};
+
+// Data acknowledgement - gateway to node
+// The nodes expect a 16 byte frame so the last byte sent is reserved - RHReliableDatagram uses the final two bytes of the frame
+struct DataAck : GatewayHeader {
+    typedef Field<12, uint16_t> AlertContext;               // Context for the alert code if needed
+    typedef Field<14, uint8_t>  SensorType;                 // Lets the Gateway reset the sensor if needed
+    typedef Field<15, uint8_t>  Reserved;                   // Re-transmission delay on the wire
+    static constexpr size_t length = Reserved::end;
+};
+
+// Join acknowledgement - gateway to node
+struct JoinAck : GatewayHeader {
+    typedef Field<12, uint8_t>  AlertContext;               // Context for the alert code if needed
+    typedef Field<13, uint8_t>  SensorType;                 // Gateway confirms sensor type
+    typedef Field<14, uint32_t> UniqueID;                   // Set by the gateway on 1st joining
+    typedef Field<18, uint8_t>  NewNodeNumber;              // Gateway assigns a node number
+    typedef Field<19, uint8_t>  Payload1;                   // Payload - 4 bytes sensor type determines interpretation
+    typedef Field<20, uint8_t>  Payload2;
+    typedef Field<21, uint8_t>  Payload3;
+    typedef Field<22, uint8_t>  Payload4;
+    typedef Field<23, uint8_t>  RetryCount;                 // Updated by RHReliableDatagram
+    typedef Field<24, uint8_t>  RetransmissionDelay;        // Updated by RHReliableDatagram
+    static constexpr size_t length = RetransmissionDelay::end;
+};
+
+// Layout checks - the node firmware depends on these exact sizes and offsets
+static_assert(NodeHeader::length == 10, "Node header must be 10 bytes");
+static_assert(Follows<NodeHeader::MagicNumber, NodeHeader::NodeNumber>::value && Follows<NodeHeader::NodeNumber, NodeHeader::Token>::value
+           && Follows<NodeHeader::Token, NodeHeader::SensorType>::value && Follows<NodeHeader::SensorType, NodeHeader::UniqueID>::value, "Node header fields must be contiguous");
+
+static_assert(DataReport::Payload1::offset == NodeHeader::length, "Data report payload must follow the header");
+static_assert(Follows<DataReport::Payload8, DataReport::InternalTempC>::value && Follows<DataReport::ResetCount, DataReport::RSSI>::value
+           && Follows<DataReport::RSSI, DataReport::SNR>::value && Follows<DataReport::SNR, DataReport::RetryCount>::value, "Data report fields must be contiguous");
+static_assert(DataReport::length == 28, "Data report must be 28 bytes");
+
+static_assert(JoinRequest::Payload1::offset == NodeHeader::length, "Join request payload must follow the header");
+static_assert(Follows<JoinRequest::Payload4, JoinRequest::RetryCount>::value, "Join request fields must be contiguous");
+static_assert(JoinRequest::length == 16, "Join request must be 16 bytes");
+
+static_assert(Follows<GatewayHeader::Token, GatewayHeader::CurrentTime>::value && Follows<GatewayHeader::CurrentTime, GatewayHeader::FrequencySeconds>::value
+           && Follows<GatewayHeader::FrequencySeconds, GatewayHeader::AlertCode>::value, "Gateway header fields must be contiguous");
+static_assert(GatewayHeader::length == 12, "Gateway header must be 12 bytes");
+
+static_assert(DataAck::AlertContext::offset == GatewayHeader::length && Follows<DataAck::AlertContext, DataAck::SensorType>::value, "Data ack fields must be contiguous");
+static_assert(DataAck::length == 16, "Data ack must be 16 bytes");
+
+static_assert(JoinAck::AlertContext::offset == GatewayHeader::length && Follows<JoinAck::SensorType, JoinAck::UniqueID>::value
+           && Follows<JoinAck::UniqueID, JoinAck::NewNodeNumber>::value && Follows<JoinAck::Payload4, JoinAck::RetryCount>::value, "Join ack fields must be contiguous");
+static_assert(JoinAck::length == 25, "Join ack must be 25 bytes");
+
+}  // namespace LoRA_Messages
+
+#endif  /* __LORA_MESSAGES_H */
@@ -96,6 +96,7 @@
 #include "take_measurements.h"						// Manages interactions with the sensors (default is temp for charging)
 #include "MyPersistentData.h"						// Where my persistent storage files are kept
 #include "Room_Occupancy.h"							// Aggregates node data to get net room occupancy for Occupancy Nodes
+#include "TimeSeriesStore.h"						// Reports made while we can't connect - uploaded in batches when we do
 #include "config.h"									// Configuration file for the device
 
 // Support for Particle Products (changes coming in 4.x - https://docs.particle.io/cards/firmware/macros/product_id/)
@@ -107,6 +108,7 @@ void publishStateTransition(void);                  // Keeps track of state mach
 void userSwitchISR();                               // interrupt service routime for the user switch
 void publishWebhook(uint8_t nodeNumber);			// Publish data based on node number
 void softDelay(uint32_t t);                 		// Soft delay is safer than delay
+void listenWhileAsleep(system_tick_t windowLeftMs);	// Low power listening - the MCU sleeps while the radio listens
 
 // System Health Variables
 int outOfMemory = -1;                               // From reference code provided in AN0023 (see above)
@@ -125,6 +127,7 @@ void outOfMemoryHandler(system_event_t event, int param);
 
 // Program Variables
 volatile bool userSwitchDectected = false;	
+system_tick_t listenWindowLeftMs = 0;				// Set by LoRA_STATE when the MCU can sleep at the end of this pass
 
 void setup() 
 {
@@ -151,7 +154,16 @@ void setup()
 
 	System.on(out_of_memory, outOfMemoryHandler);   // Enabling an out of memory handler is a good safety tip. If we run out of memory a System.reset() is done.
 
+	PublishQueuePosix::instance().withSegmentSize(4096);	// Queue events offline in 4K segment files rather than a file per event
+	PublishQueuePosix::instance().withKeyedEvents(64);	// Offline, only the latest occupancy report for each node and space is kept
+	PublishQueuePosix::instance().withMaxInFlight(4);	// Start the next publish without waiting for the round trip of the last one
+	PublishQueuePosix::instance().withPublishRate(1000, 4);	// The cloud allows bursts of 4 as long as we average 1 per second
+	PublishQueuePosix::instance().withStatsPublish("Queue-Stats", 6 * 3600 * 1000UL);	// Queue depths, latencies and drops from the field for tuning the queue sizes and connected time
+	PublishQueuePosix::instance().withSpillStorage(PUBLISH_QUEUE_FRAM_SIZE,		// Short offline gaps are kept in FRAM and never touch the file system
+		[](size_t offset, uint8_t *buf, size_t len) { return fram.readData(PUBLISH_QUEUE_FRAM_OFFSET + offset, buf, len); },
+		[](size_t offset, const uint8_t *buf, size_t len) { return fram.writeData(PUBLISH_QUEUE_FRAM_OFFSET + offset, buf, len); });
 	PublishQueuePosix::instance().setup();          // Initialize PublishQueuePosixRK
+	TimeSeriesStore::instance().setup();			// Find the reports stored offline before the last reset
 
 	LoRA_Functions::instance().setup(true);			// Start the LoRA radio (true for Gateway and false for Node)
 
@@ -197,6 +209,7 @@ void loop() {
 			wakeInSeconds = constrain(wakeBoundary - Time.now() % wakeBoundary, 0UL, wakeBoundary);  // If Time is valid, we can compute time to the start of the next report window	
 			time = Time.now() + wakeInSeconds;
 			Log.info("Sleep for %lu seconds until next event at %s", wakeInSeconds, Time.format(time, "%T").c_str());
+			JsonDataManager::instance().commitNodeDatabase();					// Make sure the node database is in FRAM before we sleep
 			config.mode(SystemSleepMode::ULTRA_LOW_POWER)
 				.gpio(BUTTON_PIN,CHANGE)
 				.duration(wakeInSeconds * 1000L);
@@ -281,20 +294,32 @@ void loop() {
 				Log.info("Gateway is listening for %d minutes for LoRA messages (%d / %d / %d)", (sysStatus.get_connectivityMode() == 0) ? DEFAULT_LORA_WINDOW : 60, conv.getLocalTimeHMS().hour, sysStatus.get_openTime(), sysStatus.get_closeTime());
 			} 
 
-			if (LoRA_Functions::instance().listenForLoRAMessageGateway()) {
+			if (LoRA_Functions::instance().messagePending() && LoRA_Functions::instance().listenForLoRAMessageGateway()) {	// Only go down the receive path if the radio has a message for us
 				Log.info("Received LoRA message from node %d", current.get_nodeNumber());
 				if (current.get_alertCodeNode() != 1) state = REPORTING_STATE; 				    // Received and acknowledged data from a node - need to report the alert
 			}
 
+			#if LOW_POWER_LISTENING
+			// Nothing to do until the next message - sleep at the end of this pass, once the loop() calls below have run
+			if (state == LoRA_STATE && sysStatus.get_connectivityMode() == 0 && !Particle.connected()) {
+				system_tick_t windowMs = connectionWindow * 60000UL;
+				system_tick_t elapsedMs = millis() - startLoRAWindow;
+				if (elapsedMs < windowMs) listenWindowLeftMs = windowMs - elapsedMs;
+			}
+			#endif
+
 			if (sysStatus.get_connectivityMode() == 1)	{										// If we are in connected mode - we will stay in the LoRA state
-				if (Time.hour() != Time.hour(sysStatus.get_lastConnection())) state = CONNECTING_STATE;  	// Connect once an hour even if no messages are received	
+				if (Time.hour() != Time.hour(sysStatus.get_lastConnection())) {
+					JsonDataManager::instance().commitNodeDatabase();				// Leaving the LoRA state - save the node database
+					state = CONNECTING_STATE;  										// Connect once an hour even if no messages are received	
+				}
 				break;
 			}
 			else if ((millis() - startLoRAWindow) > (connectionWindow *60000UL)) { 				// Keeps us in listening mode for the specified windpw - then back to idle unless in test mode - keeps listening
 				Log.info("Listening window over");
 				LoRA_Functions::instance().sleepLoRaRadio();									// Done with the LoRA phase - put the radio to sleep
 				JsonDataManager::instance().printNodeData(false);
-				nodeDatabase.flush(true);
+				JsonDataManager::instance().commitNodeDatabase();								// One write for all the changes made in this window
 				if (Time.hour() != Time.hour(sysStatus.get_lastConnection())) state = CONNECTING_STATE;  	// Only Connect once an hour after the LoRA window is over and if the park is open			
 				else if (sysStatus.get_alertCodeGateway() != 0) state = ERROR_STATE;
 				else state = SLEEPING_STATE;
@@ -347,7 +372,7 @@ void loop() {
 					#endif
 				}
 				if (sysStatus.get_connectivityMode() == 1) state = LoRA_STATE;			// Go back to the LoRA State if we are in connected mode
-				else state = DISCONNECTING_STATE;	 									// Typically, we will disconnect and sleep to save power - publishes occur during the 90 seconds before disconnect
+				else state = DISCONNECTING_STATE;	 									// Typically, we will disconnect and sleep to save power - publishes occur before disconnect
 			}
 			else if (millis() - connectingTimeout > 600000L) {
 				Log.info("Failed to connect in 10 minutes - giving up");
@@ -357,15 +382,24 @@ void loop() {
 
 		} break;
 
-		case DISCONNECTING_STATE: {														// Waits 90 seconds then disconnects
+		case DISCONNECTING_STATE: {														// Waits until the queue is sent then disconnects
 			static system_tick_t stayConnectedWindow = 0;
+			static unsigned long stayConnectedMs = 0;
 
 			if (state != oldState) {
 				publishStateTransition(); 
 				stayConnectedWindow = millis(); 
+				stayConnectedMs = PublishQueuePosix::instance().getTimeToDrainMs() + TimeSeriesStore::instance().getTimeToUploadMs() + 10000UL;		// Size the connected time to the backlog with a little time for the cloud to reach us
+				if (stayConnectedMs < 30000UL) stayConnectedMs = 30000UL;
+				Log.info("Staying connected %lu seconds to send %u events and %u offline segments", stayConnectedMs / 1000, PublishQueuePosix::instance().getNumEvents(), TimeSeriesStore::instance().getNumSegments());
 			}
 
-			if ((millis() - stayConnectedWindow > 90000UL) && PublishQueuePosix::instance().getCanSleep()) {	// Stay on-line for 90 seconds and until we are done clearing the queue
+			if ((millis() - stayConnectedWindow > stayConnectedMs) && PublishQueuePosix::instance().getCanSleep() && TimeSeriesStore::instance().getNumSegments() == 0) {	// Stay on-line until we are done clearing the queue
+				if (sysStatus.get_connectivityMode() == 0) Particle_Functions::instance().disconnectFromParticle();
+				state = SLEEPING_STATE;
+			}
+			else if (millis() - stayConnectedWindow > stayConnectedMs + 300000UL) {	// Publishes are failing - leave the rest in the queue for the next connection
+				Log.info("Queue not sent in %lu seconds - disconnecting with %u events queued", (millis() - stayConnectedWindow) / 1000, PublishQueuePosix::instance().getNumEvents());
 				if (sysStatus.get_connectivityMode() == 0) Particle_Functions::instance().disconnectFromParticle();
 				state = SLEEPING_STATE;
 			}
@@ -376,12 +410,13 @@ void loop() {
 
 			if (state != oldState) {
 				publishStateTransition();
-				if (Particle.connected()) PublishQueuePosix::instance().publish("Alert","Deep power down in 30 seconds", PRIVATE);
+				if (Particle.connected()) PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert","Deep power down in 30 seconds", PRIVATE);
 				sysStatus.set_alertCodeGateway(0);			// Reset this
 			}
 
 			if (millis() - resetTimeout > 30000L) {
 				Log.info("Deep power down device");
+				JsonDataManager::instance().commitNodeDatabase();
 				softDelay(2000);
 				ab1805.deepPowerDown(); 
 			}
@@ -391,20 +426,66 @@ void loop() {
 	ab1805.loop();                                  // Keeps the RTC synchronized with the Boron's clock
 
 	PublishQueuePosix::instance().loop();           // Check to see if we need to tend to the message 
+	TimeSeriesStore::instance().loop();				// Uploads the reports stored offline once we are connected
 
 	sysStatus.loop();
 	current.loop();
+	JsonDataManager::instance().loop();				// Commits node database changes to FRAM when they are due
 	nodeDatabase.loop();
 
 	LoRA_Functions::instance().loop();				// Check to see if Node connections are healthy
 
 	if (outOfMemory >= 0) {                         // In this function we are going to reset the system if there is an out of memory error
 		Log.info("Resetting due to low memory");
+		JsonDataManager::instance().commitNodeDatabase();
 		softDelay(2000);
 		System.reset();
   	}
 
 	if (sysStatus.get_alertCodeGateway() > 0) state = ERROR_STATE;
+
+	#if LOW_POWER_LISTENING
+	if (listenWindowLeftMs) {
+		if (state == LoRA_STATE) listenWhileAsleep(listenWindowLeftMs);
+		listenWindowLeftMs = 0;
+	}
+	#endif
+}
+
+/**
+ * @brief Sleeps in STOP mode while the radio listens
+ *
+ * @details Wakes for a LoRA message, the button, the end of the window or whatever loop() has to do next - the
+ * write-behind saves of sysStatus, current and the node database, and the publish queue.  Call after those loop()
+ * calls have run in this pass, so nothing already due waits out the sleep.
+ *
+ * @param windowLeftMs time left in the LoRA window
+ */
+void listenWhileAsleep(system_tick_t windowLeftMs) {
+	system_tick_t sleepMs = windowLeftMs;
+	system_tick_t dueMs = sysStatus.getMsUntilSave();
+	if (dueMs < sleepMs) sleepMs = dueMs;
+	dueMs = current.getMsUntilSave();
+	if (dueMs < sleepMs) sleepMs = dueMs;
+	dueMs = nodeDatabase.getMsUntilSave();
+	if (dueMs < sleepMs) sleepMs = dueMs;
+	dueMs = JsonDataManager::instance().getMsUntilCommit();
+	if (dueMs < sleepMs) sleepMs = dueMs;
+	dueMs = PublishQueuePosix::instance().getMsUntilLoop();
+	if (dueMs < sleepMs) sleepMs = dueMs;
+	if (sleepMs < LOW_POWER_LISTEN_MIN_MS) return;							// Not worth it - stay awake until that is done
+
+	SystemSleepConfiguration listenConfig;
+	listenConfig.mode(SystemSleepMode::STOP)
+		.gpio(RFM95_INT, RISING)												// A LoRA message has arrived
+		.gpio(BUTTON_PIN, CHANGE)
+		.duration(sleepMs);														// Wake no later than the end of the window or the next save
+	ab1805.stopWDT();  												   			// No watchdogs interrupting our slumber
+	if (LoRA_Functions::instance().readyToSleep()) {							// Last thing before sleeping - radio back in Rx and nothing arrived since we looked
+		System.sleep(listenConfig);
+		LoRA_Functions::instance().wakeFromListening();						// In case the wake consumed the radio's interrupt
+	}
+	ab1805.resumeWDT();                                                			// Wakey Wakey - WDT can resume
 }
 
 /**
@@ -451,6 +532,9 @@ void userSwitchISR() {
 void publishWebhook(uint8_t nodeNumber) {							
 	char data[256];                             						// Store the date in this character array - not global
 	char webhook[256];													// Store Webhook name
+	char key[24] = "";													// Coalescing key - a newer report replaces a queued one with the same key
+	TimeSeriesStore::Sample sample;										// The same report in a few bytes - stored instead if we are offline
+	bool storeSample = true;
 
 	// Battery conect information - https://docs.particle.io/reference/device-os/firmware/boron/#batterystate-
 	const char* batteryContext[7] = {"Unknown","Not Charging","Charging","Charged","Discharging","Fault","Diconnected"};		// Fixed
@@ -460,6 +544,8 @@ void publishWebhook(uint8_t nodeNumber) {
 		Log.info("Time is not valid - not publishing webhook");
 	}
 	unsigned long endTimePeriod = Time.now() - (Time.second() + 1);		// Moves the timestamp within the reporting boundary - so 18:00:14 becomes 17:59:59 - helps in Ubidots reporting
+	sample.time = endTimePeriod;
+	sample.nodeNumber = nodeNumber;
 
 	if (nodeNumber == 0) {												// Webhook for the Gateway					
 		takeMeasurements();												// Loads the current values for the Gateway
@@ -467,15 +553,25 @@ void publishWebhook(uint8_t nodeNumber) {
 		snprintf(data, sizeof(data), "{\"deviceid\":\"%s\", \"battery\":%d,\"key1\":\"%s\",\"temp\":%d, \"resets\":%d, \"alerts\": %d, \"msg\":%d, \"timestamp\":%lu000}",\
 		Particle.deviceID().c_str(), current.get_stateOfCharge(), batteryContext[current.get_batteryState()],\
 		current.get_internalTempC(), sysStatus.get_resetCount(), sysStatus.get_alertCodeGateway(), sysStatus.get_messageCount(), endTimePeriod);
+		sample.battery = current.get_stateOfCharge();
+		sample.temp = current.get_internalTempC();
+		sample.value1 = sysStatus.get_resetCount();
+		sample.value2 = sysStatus.get_alertCodeGateway();
 	}
 	else {
 	Log.info("Publishing for nodeNumber is %i of sensorType of %s", nodeNumber, (nodeNumber == 0) ? "Gateway" : (current.get_sensorType() <= 9) ? "Visitation Counter" : (current.get_sensorType() <= 19) ? "Occupancy Counter" : (current.get_sensorType() <= 29) ? "Sensor" : "Unknown");
+		sample.sensorType = current.get_sensorType();
+		sample.uniqueID = current.get_uniqueID();
+		sample.battery = current.get_stateOfCharge();
+		sample.temp = current.get_internalTempC();
 		switch (current.get_sensorType()) {
 			case 1 ... 9: {													// Counter
 				snprintf(webhook, sizeof(webhook),"Ubidots-LoRA-Counter-v1");
 				snprintf(data, sizeof(data), "{\"uniqueid\":\"%lu\", \"hourly\":%u, \"daily\":%u, \"sensortype\":%d, \"battery\":%d,\"key1\":\"%s\",\"temp\":%d, \"resets\":%d,\"alerts\": %d, \"node\": %d, \"rssi\":%d,  \"snr\":%d, \"hops\":%d,\"timestamp\":%lu000}",\
 				current.get_uniqueID(), (current.get_payload1() << 8 | current.get_payload2()), (current.get_payload3() << 8 | current.get_payload4()), current.get_sensorType(), current.get_stateOfCharge(), batteryContext[current.get_batteryState()],\
 				current.get_internalTempC(), current.get_resetCount(), current.get_alertCodeNode(), current.get_nodeNumber(), current.get_RSSI(), current.get_SNR(), current.get_hops(), endTimePeriod);
+				sample.value1 = current.get_payload1() << 8 | current.get_payload2();
+				sample.value2 = current.get_payload3() << 8 | current.get_payload4();
 			} break;
 
 			case 10 ... 19: {												// Occupancy
@@ -494,6 +590,10 @@ void publishWebhook(uint8_t nodeNumber) {
 				snprintf(webhook, sizeof(webhook),"Ubidots-LoRA-Occupancy-v2");		
 				snprintf(data, sizeof(data), "{\"nodeUniqueID\":\"%lu\",\"battery\":%d,\"space\":%d,\"spaceNet\":%d,\"spaceGross\":%d}",\
 				current.get_uniqueID(), current.get_stateOfCharge(), current.get_payload5() + 1, Room_Occupancy::instance().getRoomNet(current.get_payload5()), Room_Occupancy::instance().getRoomGross(current.get_payload5()));
+				snprintf(key, sizeof(key), "%lu-%d", current.get_uniqueID(), current.get_payload5() + 1);
+				sample.space = current.get_payload5();
+				sample.value1 = Room_Occupancy::instance().getRoomNet(current.get_payload5());
+				sample.value2 = Room_Occupancy::instance().getRoomGross(current.get_payload5());
 			} break;
 
 			case 20 ... 29: {												// Sensor
@@ -501,15 +601,25 @@ void publishWebhook(uint8_t nodeNumber) {
 				snprintf(data, sizeof(data), "{\"uniqueid\":\"%lu\", \"soilvwc\":%u, \"soiltemp\":%u, \"space\":%d, \"placement\":%d, \"sensortype\":%d, \"battery\":%d,\"key1\":\"%s\",\"temp\":%d, \"resets\":%d,\"alerts\": %d, \"node\": %d, \"rssi\":%d,  \"snr\":%d, \"hops\":%d,\"timestamp\":%lu000}",\
 				current.get_uniqueID(), (current.get_payload1() << 8 | current.get_payload2()), (current.get_payload3() << 8 | current.get_payload4()), current.get_payload5() + 1, current.get_payload6(),current.get_sensorType(), current.get_stateOfCharge(), batteryContext[current.get_batteryState()],\
 				current.get_internalTempC(), current.get_resetCount(), current.get_alertCodeNode(), current.get_nodeNumber(), current.get_RSSI(), current.get_SNR(), current.get_hops(), endTimePeriod);
+				sample.space = current.get_payload5();
+				sample.value1 = current.get_payload1() << 8 | current.get_payload2();
+				sample.value2 = current.get_payload3() << 8 | current.get_payload4();
 			} break;
 
 			default: {														// Unknown
 				snprintf(webhook, sizeof(webhook),"Alert");	
 				snprintf(data, sizeof(data),"Unknown sensor type in gateway publish" );
+				storeSample = false;
 			} break;
 		}
 	}
-	if (Particle.connected()) PublishQueuePosix::instance().publish(webhook, data, PRIVATE | WITH_ACK);  // Only going to publish if connected
+	if (Particle.connected()) {														// Only going to publish if connected
+		if (key[0]) PublishQueuePosix::instance().publishKeyed(key, webhook, data, PRIVATE | WITH_ACK);
+		else PublishQueuePosix::instance().publish(webhook, data, PRIVATE | WITH_ACK);
+	}
+	else if (storeSample && TRANSPORT_MODE != 2) {									// Offline - keep the report as a sample to upload when we connect
+		if (!TimeSeriesStore::instance().append(sample)) Log.info("Could not store the report offline");
+	}
 	Log.info("%s : %s", webhook, data);
 
 	return;
@@ -0,0 +1,94 @@
+/**
+ * @file LoRA_ReceiveFlag.h
+ * @author Chip McClelland (chip@seeinisghts.com)
+ * @brief Message pending flag raised by the radio's receive interrupt, and the check made before the MCU sleeps while listening
+ * @details Templated on the radio driver (RH_RF95) so the host tests can run it against a fake radio.  RH_RF95 drops to idle
+ * after every frame it receives and after every transmission (including the acks RHReliableDatagram sends), so
+ * the receiver has to be put back in Rx before the MCU can sleep waiting for its interrupt.
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+
+#ifndef __LORA_RECEIVE_FLAG_H
+#define __LORA_RECEIVE_FLAG_H
+
+#include "Particle.h"
+
+template <class Driver>
+class LoRA_ReceiveFlag {
+public:
+    explicit LoRA_ReceiveFlag(Driver &driver) : driver(driver) {}
+
+    /**
+     * @brief Call from the driver's receive callback - runs in interrupt context
+     */
+    void onReceive() { pending = true; }
+
+    /**
+     * @brief Returns true (once) when a message has arrived.  If nothing is pending this makes sure the receiver is on.
+     */
+    bool messagePending() {
+        if (!pending) {
+            driver.available();                         // Only touches the radio if it has to change mode
+            return false;
+        }
+        pending = false;                                // Clear before we receive so a message arriving in the meantime is not missed
+        return true;
+    }
+
+    /**
+     * @brief Call after a send that waited for its ack - frames received during the wait were collected by the send
+     *
+     * @details The callback also fires for the ack and any other frame sendtoWait() consumes, so the flag is cleared
+     * and raised again only if the radio still holds a frame for recvfromAck().  Clearing first means a frame
+     * arriving during the check raises it again from the interrupt.
+     */
+    void sendDone() {
+        pending = false;
+        if (driver.available()) {
+            pending = true;
+        }
+    }
+
+    /**
+     * @brief Puts the receiver back in Rx and returns true if the MCU can sleep until the radio's next interrupt
+     *
+     * @param interruptPin the radio's DIO0 pin - the sleep wakes on its rising edge
+     *
+     * @details Call immediately before sleeping, and call wake() once the sleep is over.  The flag and the pin are
+     * read with interrupts masked so a frame that arrived since messagePending() keeps us awake.  A frame can still
+     * arrive after that check and before the sleep starts, and its edge is then missed - so the radio is told to
+     * stay in Rx after a receive until wake(), and the next frame wakes us.  That one is dropped (the node retries)
+     * but the radio is not left idle for the rest of the sleep.
+     */
+    bool readyToSleep(uint16_t interruptPin) {
+        bool ready = false;
+        driver.available();                             // Idle after a receive or an ack - listen again
+        driver.setRxAfterReceive(true);
+        ATOMIC_BLOCK() {
+            ready = !pending && digitalRead(interruptPin) == LOW;
+        }
+        if (!ready) {
+            driver.setRxAfterReceive(false);
+        }
+        return ready;
+    }
+
+    /**
+     * @brief Call after a sleep that readyToSleep() allowed, whatever woke the MCU
+     *
+     * @details Runs the interrupt handler if the wake consumed the radio's edge, then goes back to the radio
+     * idling after a receive so the held frame is not overwritten while it is collected.
+     */
+    void wake() {
+        driver.serviceInterrupt();
+        driver.setRxAfterReceive(false);
+    }
+
+private:
+    Driver &driver;
+    volatile bool pending = false;
+};
+
+#endif  /* __LORA_RECEIVE_FLAG_H */
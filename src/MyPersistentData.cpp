@@ -5,13 +5,31 @@
 #include "PublishQueuePosixRK.h"
 #include <stack>
 #include <cstring>
+#include <new>
 
 
 MB85RC64 fram(Wire, 0);
 // We use the 64kbit part so we have 8k bytes of storage
 // SysStatus Object - starts at 0
 // Current Object - starts at 100
-// Node Object - starts at 200
+// Node Object - slot A starts at 200, slot B at 3300
+// Publish queue spill - starts at 6400 (see PUBLISH_QUEUE_FRAM_OFFSET in MyPersistentData.h)
+// Node journal - starts at 7168 (last 1K - see NodeJournal.h)
+
+// Larger Wire buffers let the FRAM driver move the 3K node database in a few dozen I2C transactions instead of ~100
+#define WIRE_BUFFER_SIZE 128
+
+hal_i2c_config_t acquireWireBuffer() {
+    hal_i2c_config_t config = {
+        .size = sizeof(hal_i2c_config_t),
+        .version = HAL_I2C_CONFIG_VERSION_1,
+        .rx_buffer = new (std::nothrow) uint8_t[WIRE_BUFFER_SIZE],
+        .rx_buffer_size = WIRE_BUFFER_SIZE,
+        .tx_buffer = new (std::nothrow) uint8_t[WIRE_BUFFER_SIZE],
+        .tx_buffer_size = WIRE_BUFFER_SIZE
+    };
+    return config;
+}
 
 // *******************  SysStatus Storage Object **********************
 //
@@ -35,7 +53,7 @@ sysStatusData::~sysStatusData() {
 }
 
 void sysStatusData::setup() {
-    fram.begin();
+    fram.withWireBufferSize(WIRE_BUFFER_SIZE).begin();
     sysStatus
     //  .withLogData(true)
         .withSaveDelayMs(500)
@@ -283,7 +301,7 @@ currentStatusData::~currentStatusData() {
 }
 
 void currentStatusData::setup() {
-    fram.begin();
+    fram.withWireBufferSize(WIRE_BUFFER_SIZE).begin();
 
     current
     //    .withLogData(true)
@@ -414,12 +432,12 @@ void currentStatusData::set_payload8(uint8_t value) {
     setValue<uint8_t>(offsetof(CurrentData, payload8), value);
 }
 
-uint8_t currentStatusData::get_internalTempC() const {
-    return getValue<uint8_t>(offsetof(CurrentData, internalTempC));
+int8_t currentStatusData::get_internalTempC() const {
+    return getValue<int8_t>(offsetof(CurrentData, internalTempC));
 }
 
-void currentStatusData::set_internalTempC(uint8_t value) {
-    setValue<uint8_t>(offsetof(CurrentData, internalTempC), value);
+void currentStatusData::set_internalTempC(int8_t value) {
+    setValue<int8_t>(offsetof(CurrentData, internalTempC), value);
 }
 
 int8_t currentStatusData::get_stateOfCharge() const {
@@ -514,7 +532,7 @@ void currentStatusData::set_retransmissionDelay(uint8_t value) {
 
 // *******************  nodeID Storage Object **********************
 //
-// ******************** Offset of 200         **********************
+// ************** Offsets of 200 and 3300 (A/B slots) **************
 
 nodeIDData *nodeIDData::_instance;
 
@@ -526,7 +544,7 @@ nodeIDData &nodeIDData::instance() {
     return *_instance;
 }
 
-nodeIDData::nodeIDData() : StorageHelperRK::PersistentDataFRAM(::fram, 200, &nodeData.nodeHeader, sizeof(NodeData), NODEID_DATA_MAGIC, NODEID_DATA_VERSION) {
+nodeIDData::nodeIDData() : StorageHelperRK::PersistentDataFRAM(::fram, NODE_SLOT_A_OFFSET, &nodeData.nodeHeader, sizeof(NodeData), NODEID_DATA_MAGIC, NODEID_DATA_VERSION) {
 
 };
 
@@ -534,7 +552,7 @@ nodeIDData::~nodeIDData() {
 }
 
 void nodeIDData::setup() {
-    fram.begin();
+    fram.withWireBufferSize(WIRE_BUFFER_SIZE).begin();
 
     nodeDatabase
     //    .withLogData(true)
@@ -553,7 +571,7 @@ void nodeIDData::resetNodeIDs() {
     Log.info("Resetting NodeID config to: %s", blank.c_str());
     nodeDatabase.set_nodeIDJson(blank);
     nodeDatabase.flush(true);
-    Log.info("NodeID data is now %s", nodeDatabase.get_nodeIDJson().c_str());
+    Log.info("NodeID data is now %s", nodeData.nodeIDJson);
 }
 
 bool nodeIDData::validate(size_t dataSize) {
@@ -565,9 +583,9 @@ bool nodeIDData::validate(size_t dataSize) {
 void nodeIDData::initialize() {
 
     Log.info("Erasing FRAM region");
-    for (unsigned int i=0; i < sizeof(NodeData); i++) {
-        fram.writeData(i+200,(uint8_t *)0xFF,2);
-    }
+    fram.fillData(NODE_SLOT_A_OFFSET, 0xFF, sizeof(NodeData));
+    fram.fillData(NODE_SLOT_B_OFFSET, 0xFF, sizeof(NodeData));
+    activeSlot = 1;                                     // So the first snapshot lands in slot A
 
     Log.info("Initializing data");
     PersistentDataFRAM::initialize();
@@ -575,6 +593,64 @@ void nodeIDData::initialize() {
     updateHash();                                       // If you manually update fields here, be sure to update the hash
 }
 
+bool nodeIDData::load() {
+    WITH_LOCK(*this) {
+        bool validA = readSlot(0);
+        uint32_t generationA = nodeData.nodeHeader.reserved1;      // reserved1 holds the generation - covered by the hash
+        bool validB = readSlot(1);
+        uint32_t generationB = nodeData.nodeHeader.reserved1;
+
+        if (validB && (!validA || (int32_t)(generationB - generationA) > 0)) activeSlot = 1;  // Slot B is already in RAM
+        else if (validA) {
+            activeSlot = 0;
+            readSlot(0);
+        }
+        clearDirty();
+
+        if (!validA && !validB) initialize();
+        else {
+            framOffset = slotOffset(activeSlot);
+            Log.info("Node database from slot %c generation %lu (other slot %s)", (activeSlot == 0) ? 'A' : 'B', nodeData.nodeHeader.reserved1, (validA && validB) ? "valid" : "not valid");
+        }
+    }
+    return true;
+}
+
+void nodeIDData::save() {
+    WITH_LOCK(*this) {
+        int nextSlot = 1 - activeSlot;
+        nodeData.nodeHeader.reserved1++;                            // Next generation - the hash must cover it
+        nodeData.nodeHeader.hash = getHash();
+
+        // Data first, then the header that makes this slot the newest - a write cut short leaves the other slot in charge
+        bool written = fram.writeData(slotOffset(nextSlot) + sizeof(nodeData.nodeHeader), (const uint8_t *)&nodeData + sizeof(nodeData.nodeHeader), sizeof(NodeData) - sizeof(nodeData.nodeHeader));
+        if (written) written = fram.writeData(slotOffset(nextSlot), (const uint8_t *)&nodeData.nodeHeader, sizeof(nodeData.nodeHeader));
+
+        lastSaveFailed = !written;
+        if (!written) {
+            // The other slot is still the newest - keep it and try again later, see flush()
+            Log.error("Node database write to slot %c failed", (nextSlot == 0) ? 'A' : 'B');
+            nodeData.nodeHeader.reserved1--;
+            nodeData.nodeHeader.hash = getHash();
+            return;
+        }
+
+        activeSlot = nextSlot;
+        framOffset = slotOffset(activeSlot);
+        PersistentDataBase::save();
+    }
+}
+
+void nodeIDData::flush(bool force) {
+    PersistentDataFRAM::flush(force);
+    if (lastSaveFailed && !lastUpdate) lastUpdate = millis();      // Still unsaved - flush(false) tries again after the save delay
+}
+
+bool nodeIDData::readSlot(int slot) {
+    fram.readData(slotOffset(slot), (uint8_t *)&nodeData, sizeof(NodeData));
+    if (nodeData.nodeHeader.size > sizeof(NodeData)) return false;  // Erased or torn header - don't hash past the buffer
+    return validate(nodeData.nodeHeader.size);
+}
 
 String nodeIDData::get_nodeIDJson() const {
 	String result;
@@ -582,6 +658,18 @@ String nodeIDData::get_nodeIDJson() const {
 	return result;
 }
 
+size_t nodeIDData::get_nodeIDJson(char *buf, size_t bufSize) const {
+	return getValueString(offsetof(NodeData, nodeIDJson), sizeof(NodeData::nodeIDJson), buf, bufSize);
+}
+
+uint16_t nodeIDData::get_journalEpoch() const {
+    return getValue<uint16_t>(offsetof(NodeData, journalEpoch));
+}
+
+void nodeIDData::set_journalEpoch(uint16_t value) {
+    setValue<uint16_t>(offsetof(NodeData, journalEpoch), value);
+}
+
 bool nodeIDData::set_nodeIDJson(const char* str) {
 
     // Set the cleaned JSON value
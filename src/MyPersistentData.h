@@ -14,7 +14,14 @@
 // We use the 64kbit part so we have 8k bytes of storage
 // SysStatus Object - starts at 0
 // Current Object - starts at 100
-// Node Object - starts at 200
+// Node Object - slot A starts at 200, slot B at 3300
+// Publish queue spill - starts at 6400 (768 bytes - events queued offline, before they go to flash)
+// Node journal - starts at 7168 (last 1K - see NodeJournal.h)
+
+#define PUBLISH_QUEUE_FRAM_OFFSET 6400
+#define PUBLISH_QUEUE_FRAM_SIZE 768
+
+extern MB85RC64 fram;                                   // Defined in MyPersistentData.cpp - shared with the node journal
 
 /**
  * This class is a singleton; you do not create one as a global, on the stack, or with new.
@@ -304,7 +311,7 @@ public:
 		uint8_t payload6;							  	  // Payload Data Byte 6
 		uint8_t payload7;							  	  // Payload Data Byte 7
 		uint8_t payload8;							  	  // Payload Data Byte 8
-		uint8_t internalTempC;                            // Enclosure temperature in degrees C
+		int8_t internalTempC;                             // Enclosure temperature in degrees C
 		int8_t stateOfCharge;                             // Battery charge level
 		uint8_t batteryState;                             // Stores the current battery state (charging, discharging, etc)
 		uint8_t resetCount;								  // This is the number of resets for the node publishing data
@@ -384,8 +391,8 @@ public:
 	uint8_t get_payload8() const;
 	void set_payload8(uint8_t value);
 
-	uint8_t get_internalTempC() const ;
-	void set_internalTempC(uint8_t value);
+	int8_t get_internalTempC() const ;
+	void set_internalTempC(int8_t value);
 
 	int8_t get_stateOfCharge() const;
 	void set_stateOfCharge(int8_t value);
@@ -508,6 +515,32 @@ public:
 	 */
 	void initialize();
 
+	/**
+	 * @brief Loads the newest valid of the two node database slots
+	 * 
+	 * @details The node database is double buffered - each slot carries a generation counter in its header and the
+	 * header hash covers it, so a slot that was only partly written is never picked.
+	 */
+	bool load();
+
+	/**
+	 * @brief Writes the node database to the inactive slot, header last, then makes it the active slot
+	 * 
+	 * @details An interrupted write leaves the previous snapshot intact in the other slot.  If a write fails the
+	 * generation is not advanced, the other slot stays active and getLastSaveFailed() returns true.
+	 */
+	void save();
+
+	/**
+	 * @brief Saves if a save is due - and if the last one failed, schedules another attempt after the save delay
+	 */
+	void flush(bool force);
+
+	/**
+	 * @brief Returns true if the last save() could not write to FRAM, so the stored snapshot is older than nodeData
+	 */
+	bool getLastSaveFailed() const { return lastSaveFailed; }
+
 
 	class NodeData {
 	public:
@@ -517,6 +550,7 @@ public:
 		// (except at the end), insert fields, remove fields, change size of a field.
 		// Doing so will cause the data to be corrupted!
 		char nodeIDJson[3072];                             // JSON string that stores the nodeID data
+		uint16_t journalEpoch;                             // Node journal epoch this snapshot includes - 0 if not known (older snapshots)
 	};
 	NodeData nodeData;
 
@@ -547,6 +581,16 @@ public:
 	String get_nodeIDJson() const;
 	bool set_nodeIDJson(const char *str);
 
+	/**
+	 * @brief Copies the node database JSON into a caller supplied buffer - no String temporary on the heap
+	 * 
+	 * @returns The length of the JSON copied, not including the null terminator
+	 */
+	size_t get_nodeIDJson(char *buf, size_t bufSize) const;
+
+	uint16_t get_journalEpoch() const;
+	void set_journalEpoch(uint16_t value);
+
 	/**
 	 *  Removes any unformatted text from a JSON string
 	 * 
@@ -586,10 +630,31 @@ protected:
      */
     static nodeIDData *_instance;
 
+    /**
+     * @brief Reads a slot into nodeData and returns true if it holds a valid snapshot
+     */
+    bool readSlot(int slot);
+
+    /**
+     * @brief Returns the FRAM offset of a slot
+     */
+    static int slotOffset(int slot) { return (slot == 0) ? NODE_SLOT_A_OFFSET : NODE_SLOT_B_OFFSET; }
+
+    int activeSlot = 0;                                 // Slot holding the newest snapshot - the next save goes to the other one
+    bool lastSaveFailed = false;                        // The last save() could not write to FRAM
+
     //Since these variables are only used internally - They can be private. 
+	static const int NODE_SLOT_A_OFFSET = 200;
+	static const int NODE_SLOT_B_OFFSET = 3300;
 	static const uint32_t NODEID_DATA_MAGIC = 0x20a99e61;
 	static const uint16_t NODEID_DATA_VERSION = 3;
 
+	// The FRAM layout at the top of this file - each region must end before the next one starts
+	static_assert(sizeof(sysStatusData::SysData) <= 100, "sysStatus overlaps current");
+	static_assert(100 + sizeof(currentStatusData::CurrentData) <= NODE_SLOT_A_OFFSET, "current overlaps node database slot A");
+	static_assert(NODE_SLOT_A_OFFSET + sizeof(NodeData) <= NODE_SLOT_B_OFFSET, "Node database slot A overlaps slot B");
+	static_assert(NODE_SLOT_B_OFFSET + sizeof(NodeData) <= PUBLISH_QUEUE_FRAM_OFFSET, "Node database slot B overlaps the publish queue spill");
+
 };
 
 
@@ -0,0 +1,117 @@
+#include "NodeJournal.h"
+
+NodeJournal *NodeJournal::_instance;
+
+// [static]
+NodeJournal &NodeJournal::instance() {
+    if (!_instance) {
+        _instance = new NodeJournal();
+    }
+    return *_instance;
+}
+
+NodeJournal::NodeJournal() {
+}
+
+NodeJournal::~NodeJournal() {
+}
+
+void NodeJournal::setup() {
+    Header header;
+
+    fram.readData(NODE_JOURNAL_FRAM_OFFSET, (uint8_t *)&header, sizeof(header));
+    if (header.magic != JOURNAL_MAGIC || header.check != checksum(&header, offsetof(Header, check))) {
+        Log.info("Node journal not valid - starting a new one");
+        reset(1);
+        return;
+    }
+    epoch = header.epoch;
+
+    // The journal ends at the first record that is torn or left over from an earlier epoch
+    Record record;
+    for (recordCount = 0; recordCount < capacity(); recordCount++) {
+        if (!readRecord(recordCount, record)) break;
+    }
+    Log.info("Node journal epoch %u has %u records", epoch, recordCount);
+}
+
+size_t NodeJournal::replay(uint16_t checkpointEpoch, std::function<void(const Record &record)> apply) {
+    Record record;
+    size_t index;
+
+    // The epoch is never 0, so 0 means the checkpoint predates recording it.  Compared with wrap, as clear() counts up
+    if (checkpointEpoch != 0 && (int16_t)(epoch - checkpointEpoch) <= 0) {
+        Log.info("Node journal epoch %u is already in the checkpoint - %u records skipped", epoch, recordCount);
+        uint16_t newEpoch = checkpointEpoch + 1;                            // Finish the clear() the power loss cut off - past the
+        reset((newEpoch == 0) ? 1 : newEpoch);                              // checkpoint, as a reset journal can be behind it
+        return 0;
+    }
+
+    for (index = 0; index < recordCount; index++) {
+        if (!readRecord(index, record)) break;
+        apply(record);
+    }
+    return index;
+}
+
+bool NodeJournal::append(uint8_t nodeNumber, Field field, int32_t value) {
+    if (recordCount >= capacity()) return false;
+
+    Record record;
+    record.epoch = epoch;
+    record.nodeNumber = nodeNumber;
+    record.field = field;
+    record.value = value;
+    record.timestamp = (uint32_t)Time.now();
+    record.check = checksum(&record, offsetof(Record, check));
+
+    if (!fram.writeData(NODE_JOURNAL_FRAM_OFFSET + HEADER_SIZE + recordCount * sizeof(Record), (const uint8_t *)&record, sizeof(record))) return false;
+    recordCount++;
+    return true;
+}
+
+void NodeJournal::clear() {
+    uint16_t newEpoch = epoch + 1;
+    if (newEpoch == 0) reset(1);                                            // Wrapped - erase so no old record can match
+    else writeHeader(newEpoch);
+}
+
+const char *NodeJournal::fieldKey(uint8_t field) {
+    switch (field) {
+        case FIELD_TYPE: return "type";
+        case FIELD_PAYLOAD: return "p";
+        case FIELD_PENDING_ALERT: return "pend";
+        case FIELD_ALERT_CONTEXT: return "cont";
+        case FIELD_LAST_REPORT: return "lrep";
+        case FIELD_JSON_DATA1: return "jd1";
+        case FIELD_JSON_DATA2: return "jd2";
+        default: return NULL;
+    }
+}
+
+void NodeJournal::reset(uint16_t newEpoch) {
+    fram.fillData(NODE_JOURNAL_FRAM_OFFSET, 0xFF, NODE_JOURNAL_FRAM_SIZE);
+    writeHeader(newEpoch);
+}
+
+void NodeJournal::writeHeader(uint16_t newEpoch) {
+    Header header;
+    header.magic = JOURNAL_MAGIC;
+    header.epoch = newEpoch;
+    header.reserved = 0;
+    header.check = checksum(&header, offsetof(Header, check));
+
+    fram.writeData(NODE_JOURNAL_FRAM_OFFSET, (const uint8_t *)&header, sizeof(header));   // A single small write drops every record
+    epoch = newEpoch;
+    recordCount = 0;
+}
+
+bool NodeJournal::readRecord(size_t index, Record &record) const {
+    if (!fram.readData(NODE_JOURNAL_FRAM_OFFSET + HEADER_SIZE + index * sizeof(Record), (uint8_t *)&record, sizeof(record))) return false;
+    return record.epoch == epoch && record.check == checksum(&record, offsetof(Record, check));
+}
+
+// [static]
+uint32_t NodeJournal::checksum(const void *data, size_t len) {
+    return StorageHelperRK::murmur3_32((const uint8_t *)data, len, StorageHelperRK::PersistentDataBase::HASH_SEED);
+}
@@ -0,0 +1,185 @@
+/**
+ * @file NodeJournal.h
+ * @author Chip McClelland (chip@seeinisghts.com)
+ * @brief Append-only FRAM journal of node database changes
+ * @details Each change to a node's field is appended as a small checksummed record instead of rewriting the whole
+ * JSON database.  The database in FRAM is the checkpoint; on boot the journal is replayed on top of it.  Compaction
+ * writes a new checkpoint and starts a new epoch, which invalidates every record in one small header write.
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+
+#ifndef __NODE_JOURNAL_H
+#define __NODE_JOURNAL_H
+
+#include "Particle.h"
+#include "MyPersistentData.h"
+#include <functional>
+
+// FRAM region for the journal - the last 1K of the 8K part (see the layout in MyPersistentData.h)
+#define NODE_JOURNAL_FRAM_OFFSET 7168
+#define NODE_JOURNAL_FRAM_SIZE 1024
+static_assert(PUBLISH_QUEUE_FRAM_OFFSET + PUBLISH_QUEUE_FRAM_SIZE <= NODE_JOURNAL_FRAM_OFFSET, "The publish queue spill overlaps the node journal");
+static_assert(NODE_JOURNAL_FRAM_OFFSET + NODE_JOURNAL_FRAM_SIZE <= 8192, "The node journal does not fit in the 8K FRAM");
+
+/**
+ * This class is a singleton; you do not create one as a global, on the stack, or with new.
+ *
+ * From JsonDataManager setup you must call:
+ * NodeJournal::instance().setup();
+ */
+class NodeJournal {
+public:
+    /**
+     * @brief The node database fields that can be journaled
+     */
+    enum Field : uint8_t {
+        FIELD_TYPE = 1,                     // "type" - sensor type
+        FIELD_PAYLOAD,                      // "p" - compressed join payload
+        FIELD_PENDING_ALERT,                // "pend" - pending alert code
+        FIELD_ALERT_CONTEXT,                // "cont" - pending alert context
+        FIELD_LAST_REPORT,                  // "lrep" - time of the last report
+        FIELD_JSON_DATA1,                   // "jd1" - type specific
+        FIELD_JSON_DATA2                    // "jd2" - type specific
+    };
+
+    /**
+     * @brief One journal entry - 16 bytes in FRAM
+     */
+    struct Record {
+        uint16_t epoch;                     // Must match the journal header - older records are ignored
+        uint8_t nodeNumber;
+        uint8_t field;                      // A Field value
+        int32_t value;
+        uint32_t timestamp;                 // Time.now() when the change was made
+        uint32_t check;                     // Checksum of the bytes above - a torn write ends the journal
+    };
+
+    /**
+     * @brief Gets the singleton instance of this class, allocating it if necessary
+     *
+     * Use NodeJournal::instance() to instantiate the singleton.
+     */
+    static NodeJournal &instance();
+
+    /**
+     * @brief Reads the journal header and finds the end of the journal - call before replay()
+     *
+     * If the header is not valid the journal region is erased and a new journal started.
+     */
+    void setup();
+
+    /**
+     * @brief Calls apply for each valid record in the current epoch, oldest first
+     *
+     * @param checkpointEpoch the epoch the checkpoint was written in (0 if not known).  If the checkpoint is not older
+     * than the journal, it was written and the journal not yet cleared - its records are already in the checkpoint,
+     * so nothing is replayed and a new journal is started in the epoch after the checkpoint's - changes appended to
+     * the old one would be skipped too.
+     * @return the number of records replayed
+     */
+    size_t replay(uint16_t checkpointEpoch, std::function<void(const Record &record)> apply);
+
+    /**
+     * @brief Appends a change to the journal
+     *
+     * @return true if the record was written
+     * @return false if the journal is full - write a checkpoint and call clear()
+     */
+    bool append(uint8_t nodeNumber, Field field, int32_t value);
+
+    /**
+     * @brief Starts a new epoch - all existing records are dropped
+     *
+     * @details Call only after the checkpoint holding these changes has been written to FRAM
+     */
+    void clear();
+
+    /**
+     * @brief Returns the current epoch - store it with a checkpoint, see replay()
+     */
+    uint16_t getEpoch() const { return epoch; }
+
+    /**
+     * @brief Returns the number of records in the journal
+     */
+    size_t count() const { return recordCount; }
+
+    /**
+     * @brief Returns the maximum number of records the journal can hold
+     */
+    static constexpr size_t capacity() { return (NODE_JOURNAL_FRAM_SIZE - HEADER_SIZE) / sizeof(Record); }
+
+    /**
+     * @brief Maps a field to its key in the node database JSON
+     */
+    static const char *fieldKey(uint8_t field);
+
+protected:
+    /**
+     * @brief The constructor is protected because the class is a singleton
+     *
+     * Use NodeJournal::instance() to instantiate the singleton.
+     */
+    NodeJournal();
+
+    /**
+     * @brief The destructor is protected because the class is a singleton and cannot be deleted
+     */
+    virtual ~NodeJournal();
+
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    NodeJournal(const NodeJournal&) = delete;
+
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    NodeJournal& operator=(const NodeJournal&) = delete;
+
+    /**
+     * @brief Journal header at the start of the region
+     */
+    struct Header {
+        uint32_t magic;
+        uint16_t epoch;
+        uint16_t reserved;
+        uint32_t check;                     // Checksum of the bytes above
+    };
+
+    static const size_t HEADER_SIZE = 16;   // Header is padded so the records stay 16 byte aligned
+    static const uint32_t JOURNAL_MAGIC = 0x4e4a524e;
+
+    /**
+     * @brief Erases the region and writes a header for the given epoch
+     */
+    void reset(uint16_t newEpoch);
+
+    /**
+     * @brief Writes the header for the given epoch
+     */
+    void writeHeader(uint16_t newEpoch);
+
+    /**
+     * @brief Reads record index and returns true if it is valid for the current epoch
+     */
+    bool readRecord(size_t index, Record &record) const;
+
+    static uint32_t checksum(const void *data, size_t len);
+
+    uint16_t epoch = 0;                     // Current epoch from the header
+    size_t recordCount = 0;                 // Records in the current epoch - the next append goes here
+
+    /**
+     * @brief Singleton instance of this class
+     *
+     * The object pointer to this class is stored here. It's NULL at system boot.
+     */
+    static NodeJournal *_instance;
+};
+
+static_assert(sizeof(NodeJournal::Record) == 16, "Journal records must be 16 bytes");
+
+#endif  /* __NODE_JOURNAL_H */
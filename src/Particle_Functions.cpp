@@ -121,8 +121,9 @@ int Particle_Functions::jsonFunctionParser(String command) {
         if (variable == "nodeData") {
           snprintf(messaging,sizeof(messaging),"Resetting the gateway's node Data");
           nodeDatabase.resetNodeIDs();
+          JsonDataManager::instance().discardNodeDatabaseChanges();   // Don't let pending changes overwrite the new database
           Log.info("Resetting the Gateway node so new database is in effect");
-          PublishQueuePosix::instance().publish("Alert","Resetting Gateway",PRIVATE);
+          PublishQueuePosix::instance().publish(PublishQueuePriority::CRITICAL, "Alert","Resetting Gateway",PRIVATE);
           delay(2000);
           System.reset();
         }
@@ -130,6 +131,7 @@ int Particle_Functions::jsonFunctionParser(String command) {
             snprintf(messaging,sizeof(messaging),"Resetting the gateway's system and current data");
             sysStatus.initialize();                     // All will reset system values as well
             nodeDatabase.initialize();
+            JsonDataManager::instance().discardNodeDatabaseChanges();
         }
         else snprintf(messaging,sizeof(messaging),"Resetting the gateway's current data");
         sysStatus.set_messageCount(0);                  // Reset the message count
@@ -177,6 +179,7 @@ int Particle_Functions::jsonFunctionParser(String command) {
         snprintf(messaging,sizeof(messaging),"Going back to normal connectivity");
         sysStatus.set_connectivityMode(0);                            // Make sure we are set to not connect on resetart.
         sysStatus.flush(true);    
+        JsonDataManager::instance().commitNodeDatabase();
         Particle_Functions::disconnectFromParticle();                 // Can't reset if modem is powered up
         System.reset();                                               // Needed to disconnect from LoRA
       }
@@ -0,0 +1,343 @@
+#include "TimeSeriesStore.h"
+#include "PublishQueuePosixRK.h"
+#include "Base64RK.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+TimeSeriesStore *TimeSeriesStore::_instance;
+
+// Little endian and zigzag varint helpers - each returns the bytes used, or 0 if it doesn't fit
+static size_t putVarint(uint8_t *buf, size_t bufSize, int32_t value) {
+    uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    size_t len = 0;
+    do {
+        if (len >= bufSize) return 0;
+        buf[len++] = (zigzag & 0x7f) | ((zigzag > 0x7f) ? 0x80 : 0);
+        zigzag >>= 7;
+    } while (zigzag);
+    return len;
+}
+
+static size_t getVarint(const uint8_t *buf, size_t len, int32_t &value) {
+    uint32_t zigzag = 0;
+    for (size_t ii = 0; ii < len && ii < 5; ii++) {
+        zigzag |= (uint32_t)(buf[ii] & 0x7f) << (7 * ii);
+        if (!(buf[ii] & 0x80)) {
+            value = (int32_t)((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+            return ii + 1;
+        }
+    }
+    return 0;
+}
+
+static void putUint32(uint8_t *buf, uint32_t value) {
+    for (int ii = 0; ii < 4; ii++) buf[ii] = (uint8_t)(value >> (8 * ii));
+}
+
+static uint32_t getUint32(const uint8_t *buf) {
+    return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+// [static]
+TimeSeriesStore &TimeSeriesStore::instance() {
+    if (!_instance) {
+        _instance = new TimeSeriesStore();
+    }
+    return *_instance;
+}
+
+TimeSeriesStore::TimeSeriesStore() {
+    segments.withDirPath("/usr/series").withIndexFile(".index");
+}
+
+TimeSeriesStore::~TimeSeriesStore() {
+    delete[] segmentBuf;
+}
+
+void TimeSeriesStore::setup() {
+    segmentBuf = new uint8_t[TIME_SERIES_SEGMENT_SIZE];
+
+    segments.scanDir();                                                     // The segment being written at reset is queued with the others
+
+    bytesStored = 0;
+    segments.forEachFileInQueue([this](int fileNum) {
+        struct stat sb;
+        if (stat(segments.getPathForFileNum(fileNum), &sb) == 0) bytesStored += sb.st_size;
+    });
+
+    // Batches from the oldest segment that were queued before the reset are not sent again
+    uint8_t saved[8];
+    int fd = open(getUploadOffsetPath(), O_RDONLY);
+    if (fd != -1) {
+        bool valid = read(fd, saved, sizeof(saved)) == (int)sizeof(saved) && (int)getUint32(&saved[0]) == segments.getFileFromQueue(false);
+        close(fd);
+        if (valid) {
+            uploadOffset = getUint32(&saved[4]);
+            bytesStored -= std::min(bytesStored, uploadOffset);
+        }
+        else unlink(getUploadOffsetPath());                                 // For a segment that is gone - a new one could reuse its number
+    }
+    Log.info("Time series store has %d segments (%u bytes, %u already uploaded)", segments.getQueueLen(), (unsigned)bytesStored, (unsigned)uploadOffset);
+}
+
+void TimeSeriesStore::loop() {
+    if (!Particle.connected()) return;
+
+    if (headFileNum) closeSegment();                                        // Send what was stored offline, new samples go to a new segment
+    if (segments.getQueueLen() > 0 && PublishQueuePosix::instance().getNumEvents() < MAX_QUEUED_BATCHES) uploadBatch();
+}
+
+bool TimeSeriesStore::append(const Sample &sample) {
+    uint8_t record[32];
+    size_t len;
+
+    if (!headFileNum && !startSegment(sample.time)) return false;
+
+    len = encode(sample, headState, record, sizeof(record));
+    if (len == 0) return false;
+    if (headSize + len > TIME_SERIES_SEGMENT_SIZE) {
+        closeSegment();
+        if (!startSegment(sample.time)) return false;
+        len = encode(sample, headState, record, sizeof(record));            // The new segment describes the node again
+    }
+
+    int fd = open(segments.getPathForFileNum(headFileNum), O_WRONLY | O_APPEND);
+    if (fd == -1) {
+        Log.info("Time series segment %d open failed %d", headFileNum, errno);
+        headFileNum = 0;
+        return false;
+    }
+    bool result = write(fd, record, len) == (int)len;
+    close(fd);
+    if (result) {
+        headSize += len;
+        bytesStored += len;
+    }
+    return result;
+}
+
+size_t TimeSeriesStore::getNumSegments() const {
+    return segments.getQueueLen() + (headFileNum ? 1 : 0);
+}
+
+unsigned long TimeSeriesStore::getTimeToUploadMs() const {
+    // Records are re-encoded into batches at about the same size they're stored
+    size_t batches = (bytesStored + MAX_BATCH_BYTES - 1) / MAX_BATCH_BYTES + segments.getQueueLen();
+    return batches * PublishQueuePosix::instance().getPublishIntervalMs();
+}
+
+TimeSeriesStore::CodecState::Node *TimeSeriesStore::CodecState::find(uint8_t nodeNumber) {
+    for (size_t ii = 0; ii < numNodes; ii++) {
+        if (nodes[ii].nodeNumber == nodeNumber) return &nodes[ii];
+    }
+    return nullptr;
+}
+
+TimeSeriesStore::CodecState::Node *TimeSeriesStore::CodecState::add() {
+    if (numNodes < MAX_NODES) return &nodes[numNodes++];
+    return &nodes[MAX_NODES - 1];                                           // Full - the last entry is shared, so those nodes are described again
+}
+
+// [static]
+size_t TimeSeriesStore::encode(const Sample &sample, CodecState &state, uint8_t *buf, size_t bufSize) {
+    size_t len = 0, used;
+
+    CodecState::Node *node = state.find(sample.nodeNumber);
+    bool describe = !node || node->sensorType != sample.sensorType || node->uniqueID != sample.uniqueID;
+    if (describe) {
+        if (bufSize < 7) return 0;
+        buf[0] = RECORD_NODE;
+        buf[1] = sample.nodeNumber;
+        buf[2] = sample.sensorType;
+        putUint32(&buf[3], sample.uniqueID);
+        len = 7;
+    }
+
+    if (len + 2 > bufSize) return 0;
+    buf[len++] = RECORD_SAMPLE;
+    buf[len++] = sample.nodeNumber;
+    if (!(used = putVarint(&buf[len], bufSize - len, (int32_t)(sample.time - state.lastTime)))) return 0;
+    len += used;
+    if (len + 3 > bufSize) return 0;
+    buf[len++] = sample.space;
+    buf[len++] = (uint8_t)sample.battery;
+    buf[len++] = (uint8_t)sample.temp;
+    if (!(used = putVarint(&buf[len], bufSize - len, sample.value1))) return 0;
+    len += used;
+    if (!(used = putVarint(&buf[len], bufSize - len, sample.value2))) return 0;
+    len += used;
+
+    // It fits - only now update the state
+    if (describe) {
+        if (!node) node = state.add();
+        *node = { sample.nodeNumber, sample.sensorType, sample.uniqueID };
+    }
+    state.lastTime = sample.time;
+    return len;
+}
+
+// [static]
+size_t TimeSeriesStore::decode(const uint8_t *buf, size_t len, CodecState &state, Sample &sample, bool &isSample) {
+    size_t offset = 0, used;
+    int32_t value;
+
+    isSample = false;
+    if (len < 2) return 0;
+
+    if (buf[0] == RECORD_NODE) {
+        if (len < 7) return 0;
+        CodecState::Node *node = state.find(buf[1]);
+        if (!node) node = state.add();
+        *node = { buf[1], buf[2], getUint32(&buf[3]) };
+        return 7;
+    }
+    if (buf[0] != RECORD_SAMPLE) return 0;
+
+    sample.nodeNumber = buf[1];
+    CodecState::Node *node = state.find(sample.nodeNumber);
+    if (!node) return 0;                                                    // Every sample follows a description of its node
+    sample.sensorType = node->sensorType;
+    sample.uniqueID = node->uniqueID;
+    offset = 2;
+
+    if (!(used = getVarint(&buf[offset], len - offset, value))) return 0;
+    offset += used;
+    if (offset + 3 > len) return 0;
+    sample.space = buf[offset++];
+    sample.battery = (int8_t)buf[offset++];
+    sample.temp = (int8_t)buf[offset++];
+    if (!(used = getVarint(&buf[offset], len - offset, sample.value1))) return 0;
+    offset += used;
+    if (!(used = getVarint(&buf[offset], len - offset, sample.value2))) return 0;
+    offset += used;
+
+    sample.time = state.lastTime + value;
+    state.lastTime = sample.time;
+    isSample = true;
+    return offset;
+}
+
+bool TimeSeriesStore::startSegment(uint32_t baseTime) {
+    while (segments.getQueueLen() + 1 > TIME_SERIES_MAX_SEGMENTS) {
+        Log.info("Time series store full - dropping the oldest segment");
+        removeOldestSegment();
+    }
+
+    headFileNum = segments.reserveFile();
+    int fd = open(segments.getPathForFileNum(headFileNum), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1) {
+        Log.info("Time series segment %d create failed %d", headFileNum, errno);
+        headFileNum = 0;
+        return false;
+    }
+
+    uint8_t header[SEGMENT_HEADER_SIZE];
+    putUint32(&header[0], SEGMENT_MAGIC);
+    header[4] = FORMAT_VERSION;
+    putUint32(&header[5], baseTime);
+    bool result = write(fd, header, sizeof(header)) == (int)sizeof(header);
+    close(fd);
+    if (!result) {
+        segments.removeFileNum(headFileNum, false);
+        headFileNum = 0;
+        return false;
+    }
+
+    headSize = sizeof(header);
+    bytesStored += headSize;
+    headState.reset(baseTime);
+    return true;
+}
+
+void TimeSeriesStore::closeSegment() {
+    segments.addFileToQueue(headFileNum);
+    headFileNum = 0;
+}
+
+bool TimeSeriesStore::uploadBatch() {
+    int fileNum = segments.getFileFromQueue(false);
+    if (fileNum == 0) return false;
+
+    int fd = open(segments.getPathForFileNum(fileNum), O_RDONLY);
+    int segmentLen = (fd == -1) ? -1 : read(fd, segmentBuf, TIME_SERIES_SEGMENT_SIZE);
+    if (fd != -1) close(fd);
+    if (segmentLen < (int)SEGMENT_HEADER_SIZE || getUint32(&segmentBuf[0]) != SEGMENT_MAGIC || segmentBuf[4] != FORMAT_VERSION) {
+        Log.info("Time series segment %d is not valid - discarding", fileNum);
+        removeOldestSegment();
+        return false;
+    }
+
+    // Decode the segment from the start so the node table and time are right, re-encoding into the batch from uploadOffset
+    uint8_t batch[MAX_BATCH_BYTES];
+    size_t batchLen = 0, offset = SEGMENT_HEADER_SIZE, used;
+    CodecState segmentState, batchState;
+    Sample sample;
+    bool isSample;
+
+    segmentState.reset(getUint32(&segmentBuf[5]));
+    while (offset < (size_t)segmentLen) {
+        if (!(used = decode(&segmentBuf[offset], segmentLen - offset, segmentState, sample, isSample))) {
+            Log.info("Time series segment %d ends at a bad record at %u", fileNum, (unsigned)offset);
+            offset = segmentLen;                                            // A torn write at reset - the rest is lost
+            break;
+        }
+        if (isSample && offset >= uploadOffset) {
+            if (batchLen == 0) {
+                batch[0] = FORMAT_VERSION;
+                putUint32(&batch[1], sample.time);
+                batchState.reset(sample.time);
+                batchLen = BATCH_HEADER_SIZE;
+            }
+            size_t len = encode(sample, batchState, &batch[batchLen], sizeof(batch) - batchLen);
+            if (len == 0) break;                                            // Batch full - the next one starts with this record
+            batchLen += len;
+        }
+        offset += used;
+    }
+
+    if (batchLen > 0) {
+        String data = Base64::encodeToString(batch, batchLen);
+        if (!PublishQueuePosix::instance().publish(TIME_SERIES_EVENT, data.c_str(), PRIVATE | WITH_ACK)) return false;
+        Log.info("Queued a time series batch of %u bytes from segment %d", (unsigned)batchLen, fileNum);
+    }
+
+    // Once the batch is in the publish queue it's that queue's job to get it to the cloud
+    if (offset >= (size_t)segmentLen) {
+        removeOldestSegment();
+    }
+    else {
+        bytesStored -= std::min(bytesStored, offset - uploadOffset);
+        uploadOffset = offset;
+        saveUploadOffset(fileNum);
+    }
+    return batchLen > 0;
+}
+
+void TimeSeriesStore::removeOldestSegment() {
+    int fileNum = segments.getFileFromQueue(true);
+    if (fileNum == 0) return;
+
+    struct stat sb;
+    if (stat(segments.getPathForFileNum(fileNum), &sb) == 0 && (size_t)sb.st_size > uploadOffset) {
+        bytesStored -= std::min(bytesStored, (size_t)sb.st_size - uploadOffset);       // What the batches already sent didn't account for
+    }
+    segments.removeFileNum(fileNum, false);
+    if (uploadOffset) unlink(getUploadOffsetPath());
+    uploadOffset = 0;
+}
+
+void TimeSeriesStore::saveUploadOffset(int fileNum) {
+    uint8_t saved[8];
+    putUint32(&saved[0], (uint32_t)fileNum);
+    putUint32(&saved[4], (uint32_t)uploadOffset);
+
+    int fd = open(getUploadOffsetPath(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    bool result = fd != -1 && write(fd, saved, sizeof(saved)) == (int)sizeof(saved);
+    if (fd != -1) close(fd);
+    if (!result) Log.info("Time series upload offset not saved %d - segment %d is sent from the start after a reset", errno, fileNum);
+}
+
+String TimeSeriesStore::getUploadOffsetPath() const {
+    return String(segments.getDirPath()) + "/.upload";
+}
@@ -0,0 +1,238 @@
+/**
+ * @file TimeSeriesStore.h
+ * @author Chip McClelland (chip@seeinisghts.com)
+ * @brief Compact binary store of node reports made while the gateway is offline, uploaded in batches on reconnect
+ * @details When the gateway can't reach Particle, each webhook is stored as a sample of a few bytes (a time delta, the
+ * counts, battery and temperature) in segment files on the flash file system instead of being lost.  When the gateway
+ * connects the oldest segments are sent as Base64 batch events of up to ~70 samples each.
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ */
+
+/*
+Segment file and batch event format (all values little endian)
+
+Segment file                                    Batch event (the data is Base64 of this)
+  [0-3]  magic 0x31535354 ("TSS1")                [0]    version (1)
+  [4]    version (1)                              [1-4]  baseTime
+  [5-8]  baseTime - Time.now() when created       [5-]   records
+  [9-]   records
+
+Upload offset file (.upload in the segment directory) - while the oldest segment is part way uploaded
+  [0-3]  file number of the segment
+  [4-7]  offset of the first record not yet in a batch
+
+Node record - the first time a node appears in a segment or batch, and when its uniqueID or sensorType changes
+  [0]    1
+  [1]    nodeNumber (0 is the gateway)
+  [2]    sensorType
+  [3-6]  uniqueID
+
+Sample record - typically 10 bytes
+  [0]    2
+  [1]    nodeNumber
+  [2-]   time - seconds since the previous sample (or baseTime), zigzag varint
+  [+0]   space (payload5, 0-63)
+  [+1]   battery - state of charge, signed
+  [+2]   temp - internal temperature C, signed
+  [+3-]  value1, zigzag varint
+  [ -]   value2, zigzag varint
+
+value1 / value2 by sensor type: gateway - resets / alerts, counter - hourly / daily, occupancy - spaceNet / spaceGross,
+sensor - soilvwc / soiltemp
+*/
+
+#ifndef __TIME_SERIES_STORE_H
+#define __TIME_SERIES_STORE_H
+
+#include "Particle.h"
+#include "SequentialFileRK.h"
+#include "config.h"
+
+/**
+ * This class is a singleton; you do not create one as a global, on the stack, or with new.
+ *
+ * From global application setup you must call:
+ * TimeSeriesStore::instance().setup();
+ *
+ * From global application loop you must call:
+ * TimeSeriesStore::instance().loop();
+ */
+class TimeSeriesStore {
+public:
+    /**
+     * @brief One report from a node or the gateway
+     */
+    struct Sample {
+        uint32_t time = 0;                  // Time.now() of the report
+        uint8_t nodeNumber = 0;             // 0 is the gateway
+        uint8_t sensorType = 0;
+        uint32_t uniqueID = 0;
+        uint8_t space = 0;                  // payload5 - 0-63
+        int8_t battery = 0;                 // State of charge
+        int8_t temp = 0;                    // Internal temperature C
+        int32_t value1 = 0;                 // See the format description above
+        int32_t value2 = 0;
+    };
+
+    /**
+     * @brief Gets the singleton instance of this class, allocating it if necessary
+     *
+     * Use TimeSeriesStore::instance() to instantiate the singleton.
+     */
+    static TimeSeriesStore &instance();
+
+    /**
+     * @brief Sets the directory the segments are stored in - call before setup(). The default is /usr/series.
+     */
+    TimeSeriesStore &withDirPath(const char *dirPath) { segments.withDirPath(dirPath); return *this; }
+
+    /**
+     * @brief Finds the segments stored before the last reset - call from setup() after the file system is available
+     *
+     * Uploading continues after the last batch that was queued from the oldest segment, so a reset does not send
+     * its batches again.
+     */
+    void setup();
+
+    /**
+     * @brief Uploads a batch when connected and the publish queue has room - call from loop()
+     */
+    void loop();
+
+    /**
+     * @brief Adds a sample to the newest segment, starting a new segment when it's full
+     *
+     * @return false if the sample could not be written to the file system
+     *
+     * When there are more than TIME_SERIES_MAX_SEGMENTS segments the oldest one is discarded.
+     */
+    bool append(const Sample &sample);
+
+    /**
+     * @brief Returns the number of segments waiting to be uploaded, including the one being written
+     */
+    size_t getNumSegments() const;
+
+    /**
+     * @brief Returns the time to upload what is stored at the publish queue's current publish rate
+     */
+    unsigned long getTimeToUploadMs() const;
+
+protected:
+    /**
+     * @brief The constructor is protected because the class is a singleton
+     *
+     * Use TimeSeriesStore::instance() to instantiate the singleton.
+     */
+    TimeSeriesStore();
+
+    /**
+     * @brief The destructor is protected because the class is a singleton and cannot be deleted
+     */
+    virtual ~TimeSeriesStore();
+
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    TimeSeriesStore(const TimeSeriesStore&) = delete;
+
+    /**
+     * This class is a singleton and cannot be copied
+     */
+    TimeSeriesStore& operator=(const TimeSeriesStore&) = delete;
+
+    static const size_t MAX_NODES = 32;     // Nodes remembered per segment or batch - more than this just repeat their node record
+
+    /**
+     * @brief The nodes already described in a segment or batch, and the time of the last sample
+     */
+    struct CodecState {
+        struct Node {
+            uint8_t nodeNumber;
+            uint8_t sensorType;
+            uint32_t uniqueID;
+        };
+        uint32_t lastTime = 0;
+        size_t numNodes = 0;
+        Node nodes[MAX_NODES];
+
+        void reset(uint32_t baseTime) { lastTime = baseTime; numNodes = 0; }
+        Node *find(uint8_t nodeNumber);
+        Node *add();
+    };
+
+    /**
+     * @brief Encodes sample into buf, with a node record first if needed
+     *
+     * @return the number of bytes used, or 0 if it doesn't fit in bufSize (state is not changed)
+     */
+    static size_t encode(const Sample &sample, CodecState &state, uint8_t *buf, size_t bufSize);
+
+    /**
+     * @brief Decodes one record from buf
+     *
+     * @return the number of bytes used, or 0 if the record is truncated or not valid. isSample is true if
+     * the record was a sample record, which is returned in sample.
+     */
+    static size_t decode(const uint8_t *buf, size_t len, CodecState &state, Sample &sample, bool &isSample);
+
+    /**
+     * @brief Creates the file for a new head segment
+     */
+    bool startSegment(uint32_t baseTime);
+
+    /**
+     * @brief Adds the head segment to the upload queue so the next sample starts a new one
+     */
+    void closeSegment();
+
+    /**
+     * @brief Builds a batch from the oldest segment and adds it to the publish queue
+     *
+     * @return true if a batch was queued
+     */
+    bool uploadBatch();
+
+    /**
+     * @brief Removes the oldest segment from the queue and the file system
+     */
+    void removeOldestSegment();
+
+    /**
+     * @brief Writes uploadOffset for segment fileNum to the upload offset file, read back by setup()
+     */
+    void saveUploadOffset(int fileNum);
+
+    /**
+     * @brief Returns the path of the upload offset file
+     */
+    String getUploadOffsetPath() const;
+
+    static const uint32_t SEGMENT_MAGIC = 0x31535354;
+    static const uint8_t FORMAT_VERSION = 1;
+    static const size_t SEGMENT_HEADER_SIZE = 9;
+    static const size_t BATCH_HEADER_SIZE = 5;
+    static const size_t MAX_BATCH_BYTES = (particle::protocol::MAX_EVENT_DATA_LENGTH / 4) * 3;     // Fits in one event once Base64 encoded
+    static const size_t MAX_QUEUED_BATCHES = 2;     // Batches in the publish queue at once - the rest stay here until there is room
+    static const uint8_t RECORD_NODE = 1;
+    static const uint8_t RECORD_SAMPLE = 2;
+
+    SequentialFile segments;                // Full segments, oldest first
+    int headFileNum = 0;                    // Segment being written - 0 if none
+    size_t headSize = 0;                    // Bytes in the head segment
+    CodecState headState;                   // Nodes described in the head segment
+    size_t uploadOffset = 0;                // Offset of the next record to upload in the oldest segment - saved in .upload
+    size_t bytesStored = 0;                 // Approximate bytes in all segments, for the upload time estimate
+    uint8_t *segmentBuf = nullptr;          // TIME_SERIES_SEGMENT_SIZE bytes for reading a segment to upload
+
+    /**
+     * @brief Singleton instance of this class
+     *
+     * The object pointer to this class is stored here. It's NULL at system boot.
+     */
+    static TimeSeriesStore *_instance;
+};
+
+#endif  /* __TIME_SERIES_STORE_H */
@@ -32,6 +32,24 @@
 // How many minutes will the Gateway stay connected
 #define STAY_CONNECTED 60
 
+// Low power listening - when disconnected, the gateway puts the MCU into STOP mode during the LoRA window and leaves the
+// radio listening.  It wakes on a LoRA message, the user button, the end of the window or the next write-behind save.
+// 0 = busy-loop for the whole window
+#define LOW_POWER_LISTENING 1
+// Not worth going to sleep for less than this many milliseconds - the end of the window or a save is that close
+#define LOW_POWER_LISTEN_MIN_MS 1000
+
+// Node database write-behind - changes to the node database are held in RAM and written to FRAM as a single commit
+// no later than this many milliseconds after the first unsaved change (also at the end of the LoRA window and before sleep / reset)
+#define NODE_DATABASE_COMMIT_DELAY_MS 60000
+
+// Offline time series - reports made while the gateway can't connect are stored in compact binary segment files
+// and uploaded in Base64 batch events when it does.  See TimeSeriesStore.h for the format
+#define TIME_SERIES_SEGMENT_SIZE 4096
+// Oldest segments are dropped beyond this many - 64 x 4K holds about 25,000 reports
+#define TIME_SERIES_MAX_SEGMENTS 64
+#define TIME_SERIES_EVENT "LoRA-Series-v1"
+
 // Next, the timezone setting for the gateway is set here to support developmnet in different locations.
 // This will be used to set the time on the gateway device but - remember - nodes do not care about local time
 // This is the timezone string from: https://github.com/rickkas7/LocalTimeRK/
@@ -0,0 +1,107 @@
+// Gateway LoRA wire schema (src/LoRA_Messages.h) against the hand-written byte code it replaced: decoding a data
+// report and encoding a data ack, in nanoseconds per message
+#include "harness.h"
+#include "LoRA_Messages.h"
+
+using namespace LoRA_Messages;
+
+static const int MESSAGES = 1024;                   // Different messages so the compiler can't hoist the work
+static const int ROUNDS = 2000;
+
+static uint8_t reports[MESSAGES][DataReport::length];
+static uint8_t acks[MESSAGES][DataAck::length];
+static volatile uint32_t sink;
+
+struct Report {
+    uint16_t token; uint8_t sensorType; uint32_t uniqueID; uint8_t payload[8];
+    int8_t internalTempC; int8_t stateOfCharge; uint8_t batteryState; uint8_t resetCount; int16_t rssi; int16_t snr;
+};
+
+static inline uint32_t sum(const Report &r) {
+    return r.token + r.sensorType + r.uniqueID + r.payload[0] + r.payload[7] + r.internalTempC + r.stateOfCharge +
+        r.batteryState + r.resetCount + r.rssi + r.snr;
+}
+
+static void decodeByHand(const uint8_t *buf, Report &r) {
+    r.token = buf[3] << 8 | buf[4];
+    r.sensorType = buf[5];
+    r.uniqueID = (uint32_t)buf[6] << 24 | buf[7] << 16 | buf[8] << 8 | buf[9];
+    for (int ii = 0; ii < 8; ii++) r.payload[ii] = buf[10 + ii];
+    r.internalTempC = buf[18];
+    r.stateOfCharge = buf[19];
+    r.batteryState = buf[20];
+    r.resetCount = buf[21];
+    r.rssi = buf[22] << 8 | buf[23];
+    r.snr = buf[24] << 8 | buf[25];
+}
+
+static void decodeBySchema(const uint8_t *buf, Report &r) {
+    r.token = DataReport::Token::get(buf);
+    r.sensorType = DataReport::SensorType::get(buf);
+    r.uniqueID = DataReport::UniqueID::get(buf);
+    r.payload[0] = DataReport::Payload1::get(buf);
+    r.payload[1] = DataReport::Payload2::get(buf);
+    r.payload[2] = DataReport::Payload3::get(buf);
+    r.payload[3] = DataReport::Payload4::get(buf);
+    r.payload[4] = DataReport::Payload5::get(buf);
+    r.payload[5] = DataReport::Payload6::get(buf);
+    r.payload[6] = DataReport::Payload7::get(buf);
+    r.payload[7] = DataReport::Payload8::get(buf);
+    r.internalTempC = DataReport::InternalTempC::get(buf);
+    r.stateOfCharge = DataReport::StateOfCharge::get(buf);
+    r.batteryState = DataReport::BatteryState::get(buf);
+    r.resetCount = DataReport::ResetCount::get(buf);
+    r.rssi = DataReport::RSSI::get(buf);
+    r.snr = DataReport::SNR::get(buf);
+}
+
+static void encodeByHand(uint8_t *buf, uint16_t token, uint32_t currentTime, uint16_t frequencySeconds, uint16_t alertContext) {
+    buf[3] = (uint8_t)(token >> 8);
+    buf[4] = (uint8_t)token;
+    buf[5] = (uint8_t)(currentTime >> 24);
+    buf[6] = (uint8_t)(currentTime >> 16);
+    buf[7] = (uint8_t)(currentTime >> 8);
+    buf[8] = (uint8_t)(currentTime);
+    buf[9] = (uint8_t)(frequencySeconds >> 8);
+    buf[10] = (uint8_t)frequencySeconds;
+    buf[11] = 0;
+    buf[12] = (uint8_t)(alertContext >> 8);
+    buf[13] = (uint8_t)alertContext;
+    buf[14] = 10;
+    buf[15] = 0;
+}
+
+static void encodeBySchema(uint8_t *buf, uint16_t token, uint32_t currentTime, uint16_t frequencySeconds, uint16_t alertContext) {
+    DataAck::Token::put(buf, token);
+    DataAck::CurrentTime::put(buf, currentTime);
+    DataAck::FrequencySeconds::put(buf, frequencySeconds);
+    DataAck::AlertCode::put(buf, 0);
+    DataAck::AlertContext::put(buf, alertContext);
+    DataAck::SensorType::put(buf, 10);
+    DataAck::Reserved::put(buf, 0);
+}
+
+template <class F>
+static double nsPerMessage(F fn) {
+    unsigned long long start = hostMicros();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int ii = 0; ii < MESSAGES; ii++) fn(ii, round);
+    }
+    return (hostMicros() - start) * 1000.0 / ((double)ROUNDS * MESSAGES);
+}
+
+int main(int argc, char **argv) {
+    for (int ii = 0; ii < MESSAGES; ii++) {
+        for (size_t jj = 0; jj < DataReport::length; jj++) reports[ii][jj] = (uint8_t)(ii * 31 + jj * 7);
+    }
+
+    double decodeHand = nsPerMessage([](int ii, int) { Report r; decodeByHand(reports[ii], r); sink = sink + sum(r); });
+    double decodeSchema = nsPerMessage([](int ii, int) { Report r; decodeBySchema(reports[ii], r); sink = sink + sum(r); });
+    double encodeHand = nsPerMessage([](int ii, int round) { encodeByHand(acks[ii], ii, 1760745600 + round, 3600, ii); sink = sink + acks[ii][ii & 15]; });
+    double encodeSchema = nsPerMessage([](int ii, int round) { encodeBySchema(acks[ii], ii, 1760745600 + round, 3600, ii); sink = sink + acks[ii][ii & 15]; });
+
+    printf("%-22s %10s %10s\n", "ns/message", "by hand", "schema");
+    printf("%-22s %10.2f %10.2f\n", "decode data report", decodeHand, decodeSchema);
+    printf("%-22s %10.2f %10.2f\n", "encode data ack", encodeHand, encodeSchema);
+    return 0;
+}
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Runs each gateway host test and reports the number that failed
+BUILD=${1:-build}
+
+pass=0
+fail=0
+run() {
+    if "$BUILD/$@"; then
+        pass=$((pass + 1))
+    else
+        echo "FAILED: $*"
+        fail=$((fail + 1))
+    fi
+}
+
+run lora_messages_test
+run listen_test
+run node_database_test
+run time_series_test "$BUILD/series-batches.json"
+
+# The webhook decoder against the batches time_series_test uploaded, where Node.js is installed
+if command -v node >/dev/null; then
+    if node tests/series_test.js "$BUILD/series-batches.json"; then
+        pass=$((pass + 1))
+    else
+        echo "FAILED: series_test.js"
+        fail=$((fail + 1))
+    fi
+fi
+
+echo "$pass passed, $fail failed"
+[ "$fail" -eq 0 ]
@@ -0,0 +1,12 @@
+// Host stand-in for the LocalTimeRK conversion the node database log lines use
+#pragma once
+#include "Particle.h"
+
+class LocalTimeConvert {
+public:
+    LocalTimeConvert &withTime(time_t time) { this->time = time; return *this; }
+    void convert() {}
+    String timeStr() { return String(std::to_string((long long)time)); }
+
+    time_t time = 0;
+};
@@ -0,0 +1,192 @@
+// Host stand-in for the parts of Device OS used by the gateway code under test in src/.
+// Only what that code uses is here; pin levels and interrupts are scripted from the tests with host.h.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+typedef uint8_t byte;
+typedef uint16_t pin_t;
+typedef uint32_t system_tick_t;
+
+// GPIO and interrupt masking - pin levels and interrupts are scripted with hostSetPin() and hostInterrupt()
+#define LOW 0
+#define HIGH 1
+int digitalRead(uint16_t pin);
+struct HostAtomicSection {
+    HostAtomicSection();
+    ~HostAtomicSection();
+};
+#define ATOMIC_BLOCK() for (bool __todo = true; __todo; ) for (HostAtomicSection __atomic; __todo; __todo = false)
+
+#define WITH_LOCK(lockable) for (bool __todo = true; __todo; ) for (std::lock_guard<typename std::remove_reference<decltype(lockable)>::type> __lock((lockable)); __todo; __todo = false)
+
+// Wiring random(min, max) - from the C library generator, so srand() makes it repeatable
+inline long random(long min, long max) { return (max > min) ? min + rand() % (max - min) : min; }
+
+// Time - a simulated clock that only moves with delay() or hostAdvanceMillis()
+system_tick_t millis();
+void delay(unsigned long ms);
+
+class TimeClass {
+public:
+    time_t now();
+};
+extern TimeClass Time;
+
+// Cloud - disconnected unless a test sets Particle.online
+enum PublishFlag { PUBLIC = 0, PRIVATE = 1, NO_ACK = 2, WITH_ACK = 8 };
+
+namespace particle { namespace protocol {
+const size_t MAX_EVENT_DATA_LENGTH = 1024;
+} }
+
+class CloudClass {
+public:
+    bool connected() { return online; }
+    bool online = false;
+};
+extern CloudClass Particle;
+
+// Logging - printed only when HOST_LOG is set in the environment
+class Logger {
+public:
+    Logger(const char *name = "app") {}
+    void info(const char *fmt, ...) const;
+    void warn(const char *fmt, ...) const;
+    void error(const char *fmt, ...) const;
+    void trace(const char *fmt, ...) const;
+    void dump(const void *data, size_t len) const;
+    void print(const char *str) const;
+};
+extern Logger Log;
+
+class String : public std::string {
+public:
+    String() {}
+    String(const char *s) : std::string(s ? s : "") {}
+    String(const std::string &s) : std::string(s) {}
+    const char *c_str() const { return std::string::c_str(); }
+    operator const char *() const { return c_str(); }
+    unsigned length() const { return (unsigned)size(); }
+    void reserve(size_t n) { std::string::reserve(n); }
+    bool concat(char c) { push_back(c); return true; }
+    String substring(size_t from, size_t to) const { return String(substr(from, to - from)); }
+    bool endsWith(const char *s) const { size_t n = strlen(s); return size() >= n && compare(size() - n, n, s) == 0; }
+    static String format(const char *fmt, ...) { char buf[512]; va_list ap; va_start(ap, fmt); vsnprintf(buf, sizeof(buf), fmt, ap); va_end(ap); return String(buf); }
+};
+inline String operator+(const String &a, const String &b) { return String(static_cast<const std::string &>(a) + static_cast<const std::string &>(b)); }
+inline String operator+(const String &a, const char *b) { return String(static_cast<const std::string &>(a) + b); }
+
+// Threads - the tests are single threaded, but the libraries lock
+typedef std::mutex *os_mutex_t;
+inline int os_mutex_create(os_mutex_t *m) {
+    static std::deque<std::mutex> mutexes;                  // Never destroyed - the libraries don't, as on a device
+    mutexes.emplace_back();
+    *m = &mutexes.back();
+    return 0;
+}
+inline int os_mutex_lock(os_mutex_t m) { m->lock(); return 0; }
+inline int os_mutex_unlock(os_mutex_t m) { m->unlock(); return 0; }
+
+// Wire buffer configuration the application can hand to Device OS - the emulated bus ignores it
+#define HAL_I2C_CONFIG_VERSION_1 1
+typedef struct {
+    uint16_t size;
+    uint16_t version;
+    uint8_t *rx_buffer;
+    uint32_t rx_buffer_size;
+    uint8_t *tx_buffer;
+    uint32_t tx_buffer_size;
+} hal_i2c_config_t;
+
+/**
+ * @brief I2C bus with FRAM chips on it. Each 7-bit address is 64K of memory with a two byte address pointer, as the
+ * MB85RC parts are. Transfers larger than the Wire buffer are cut short, as they are on a device.
+ */
+class TwoWire {
+public:
+    void begin() {}
+    void lock() { mutex.lock(); }
+    void unlock() { mutex.unlock(); }
+
+    void beginTransmission(uint8_t address) {
+        txAddress = address;
+        txBuf.clear();
+    }
+    size_t write(uint8_t value) {
+        if (txBuf.size() >= bufferSize) {
+            return 0;
+        }
+        txBuf.push_back(value);
+        return 1;
+    }
+    size_t write(const uint8_t *data, size_t len) {
+        size_t count = 0;
+        while(count < len && write(data[count])) {
+            count++;
+        }
+        return count;
+    }
+    uint8_t endTransmission(bool stop = true) {
+        if (txBuf.size() < 2) {
+            return 2;           // NACK - the driver always sends the memory address
+        }
+        std::vector<uint8_t> &mem = chip(txAddress);
+        pointer[txAddress] = (txBuf[0] << 8 | txBuf[1]);
+        for(size_t ii = 2; ii < txBuf.size(); ii++) {
+            mem[pointer[txAddress]++ & 0xffff] = txBuf[ii];
+        }
+        return 0;
+    }
+    size_t requestFrom(uint8_t address, size_t len, uint8_t stop) {
+        if (len > bufferSize) {
+            len = bufferSize;
+        }
+        std::vector<uint8_t> &mem = chip(address);
+        rxBuf.clear();
+        rxPos = 0;
+        for(size_t ii = 0; ii < len; ii++) {
+            rxBuf.push_back(mem[pointer[address]++ & 0xffff]);
+        }
+        return len;
+    }
+    int available() { return (int)(rxBuf.size() - rxPos); }
+    int read() { return (rxPos < rxBuf.size()) ? rxBuf[rxPos++] : -1; }
+
+    /**
+     * @brief The memory of the FRAM chip at an I2C address, for tests to look at or change behind the driver's back
+     */
+    std::vector<uint8_t> &chip(uint8_t address) {
+        std::vector<uint8_t> &mem = chips[address];
+        if (mem.empty()) {
+            mem.resize(65536, 0);
+        }
+        return mem;
+    }
+
+    size_t bufferSize = 32;         //!< Wire rx and tx buffer size
+
+private:
+    std::recursive_mutex mutex;
+    std::map<uint8_t, std::vector<uint8_t>> chips;
+    std::map<uint8_t, uint16_t> pointer;
+    uint8_t txAddress = 0;
+    std::vector<uint8_t> txBuf;
+    std::vector<uint8_t> rxBuf;
+    size_t rxPos = 0;
+};
+extern TwoWire Wire;
@@ -0,0 +1,38 @@
+// Host stand-in for the publish queue - events are kept in order for the test to check, and a test takes them out
+// to publish them
+#pragma once
+#include "Particle.h"
+#include <deque>
+
+enum class PublishQueuePriority : uint8_t {
+    CRITICAL = 0,
+    TELEMETRY,
+    DIAGNOSTICS
+};
+
+class PublishQueuePosix {
+public:
+    struct Event {
+        String eventName;
+        String data;
+    };
+
+    static PublishQueuePosix &instance() {
+        static PublishQueuePosix queue;
+        return queue;
+    }
+    bool publish(const char *eventName, const char *data, int flags) {
+        events.push_back({ eventName, data });
+        return true;
+    }
+    bool publish(PublishQueuePriority priority, const char *eventName, const char *data, int flags) {
+        return publish(eventName, data, flags);
+    }
+    bool publishKeyed(const char *key, const char *eventName, const char *data, int flags) {
+        return publish(eventName, data, flags);
+    }
+    size_t getNumEvents() const { return events.size(); }
+    unsigned long getPublishIntervalMs() const { return 1000; }
+
+    std::deque<Event> events;               // Queued events, oldest first
+};
@@ -0,0 +1,2 @@
+// Host stand-in - the gateway code under test only needs the radio headers to be there, not what is in them
+#pragma once
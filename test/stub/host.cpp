@@ -0,0 +1,110 @@
+// Host runtime for the gateway tests
+#include "Particle.h"
+#include "host.h"
+#include <chrono>
+#include <map>
+#include <vector>
+
+unsigned long long hostMicros() {
+    return (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ---------------------------------------------------------------- GPIO and interrupts
+static std::map<uint16_t, int> pinLevels;
+static std::map<uint16_t, std::function<void()>> pinHooks;
+static int atomicDepth = 0;
+static std::vector<std::function<void()>> deferredIsrs;
+
+void hostSetPin(uint16_t pin, int level, std::function<void()> onRead) {
+    pinLevels[pin] = level;
+    pinHooks[pin] = onRead;
+}
+
+int digitalRead(uint16_t pin) {
+    auto hook = pinHooks.find(pin);
+    if (hook != pinHooks.end() && hook->second) {
+        hook->second();
+    }
+    return pinLevels[pin];
+}
+
+void hostInterrupt(std::function<void()> isr) {
+    if (atomicDepth > 0) {
+        deferredIsrs.push_back(isr);
+        return;
+    }
+    isr();
+}
+
+HostAtomicSection::HostAtomicSection() {
+    atomicDepth++;
+}
+
+HostAtomicSection::~HostAtomicSection() {
+    if (--atomicDepth > 0) {
+        return;
+    }
+    std::vector<std::function<void()>> isrs;
+    isrs.swap(deferredIsrs);
+    for (auto &isr : isrs) {
+        isr();
+    }
+}
+
+// ---------------------------------------------------------------- Time
+static system_tick_t hostMillisNow = 1000;                     // Device OS has been up a while before setup() - never 0
+static const time_t HOST_EPOCH = 1760000000;                   // Time.now() at millis() 0 - a time the clock is valid
+
+system_tick_t millis() {
+    return hostMillisNow;
+}
+
+void delay(unsigned long ms) {
+    hostAdvanceMillis(ms);
+}
+
+void hostAdvanceMillis(unsigned long ms) {
+    hostMillisNow += ms;
+}
+
+time_t TimeClass::now() {
+    return HOST_EPOCH + hostMillisNow / 1000;
+}
+
+TimeClass Time;
+CloudClass Particle;
+TwoWire Wire;
+
+// ---------------------------------------------------------------- Logging
+Logger Log;
+
+static void hostLog(const char *level, const char *fmt, va_list args) {
+    if (!getenv("HOST_LOG")) {
+        return;
+    }
+    printf("%s: ", level);
+    vprintf(fmt, args);
+    printf("\n");
+}
+
+#define HOST_LOG_LEVEL(name, level) \
+    void Logger::name(const char *fmt, ...) const { va_list args; va_start(args, fmt); hostLog(level, fmt, args); va_end(args); }
+HOST_LOG_LEVEL(info, "INFO")
+HOST_LOG_LEVEL(warn, "WARN")
+HOST_LOG_LEVEL(error, "ERROR")
+HOST_LOG_LEVEL(trace, "TRACE")
+
+void Logger::dump(const void *data, size_t len) const {
+    if (!getenv("HOST_LOG")) {
+        return;
+    }
+    for(size_t ii = 0; ii < len; ii++) {
+        printf("%02x", ((const uint8_t *)data)[ii]);
+    }
+}
+
+void Logger::print(const char *str) const {
+    if (getenv("HOST_LOG")) {
+        printf("%s", str);
+    }
+}
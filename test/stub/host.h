@@ -0,0 +1,24 @@
+// Host runtime for the gateway tests: real time for benchmarks, a simulated clock, scripted pins and interrupts
+#pragma once
+#include <functional>
+#include <stdint.h>
+
+/**
+ * @brief Real time in microseconds, for measuring CPU time of the code under test
+ */
+unsigned long long hostMicros();
+
+/**
+ * @brief Set the level digitalRead() returns for a pin, and optionally a hook that runs on each read of it
+ */
+void hostSetPin(uint16_t pin, int level, std::function<void()> onRead = nullptr);
+
+/**
+ * @brief Raise an interrupt: isr runs now, or when the ATOMIC_BLOCK() in progress ends
+ */
+void hostInterrupt(std::function<void()> isr);
+
+/**
+ * @brief Move the simulated clock behind millis() and Time.now() forward
+ */
+void hostAdvanceMillis(unsigned long ms);
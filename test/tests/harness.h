@@ -0,0 +1,11 @@
+// Helpers shared by the gateway host tests and benchmarks
+#pragma once
+#include "Particle.h"
+#include "host.h"
+
+static bool harnessFailed = false;
+
+/**
+ * @brief Check a condition, printing what failed and continuing
+ */
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); harnessFailed = true; } } while (0)
@@ -0,0 +1,189 @@
+// Gateway low power listening (src/LoRA_ReceiveFlag.h): after a frame and its acks the radio is back in Rx before
+// the MCU sleeps, acks collected by a send do not read as a message, and a frame whose interrupt lands between the
+// check and the sleep keeps the MCU awake - or, once past the check, does not leave the radio deaf while it sleeps
+#include "harness.h"
+#include "LoRA_ReceiveFlag.h"
+
+static const uint16_t RFM95_INT = 9;
+
+// Enough of RH_RF95 to follow its mode: idle after a frame is received (unless setRxAfterReceive()) and after a
+// transmission, and available() puts it back in Rx unless it is transmitting
+struct FakeRadio {
+    enum Mode { Idle, Rx, Tx };
+    Mode mode = Idle;
+    bool rxBufValid = false;
+    bool rxAfterReceive = false;
+    int dropped = 0;                                // Frames heard while one was held
+    LoRA_ReceiveFlag<FakeRadio> *flag = nullptr;
+    std::function<void()> onAvailable;              // Runs inside available(), to raise an interrupt at that moment
+
+    bool available() {
+        if (onAvailable) onAvailable();
+        if (mode == Tx) return false;
+        mode = Rx;
+        return rxBufValid;
+    }
+
+    void handleInterrupt() {                        // RH_RF95::handleInterrupt() for RX_DONE and TX_DONE
+        hostSetPin(RFM95_INT, LOW);
+        if (mode == Rx && rxBufValid) {
+            dropped++;
+        }
+        else if (mode == Rx) {
+            rxBufValid = true;
+            if (!rxAfterReceive) mode = Idle;
+            flag->onReceive();
+        }
+        else if (mode == Tx) {
+            mode = Idle;
+        }
+    }
+
+    void setRxAfterReceive(bool value) {
+        rxAfterReceive = value;
+        if (!value && rxBufValid && mode == Rx) mode = Idle;
+    }
+
+    void serviceInterrupt() {
+        if (digitalRead(RFM95_INT) == HIGH) handleInterrupt();
+    }
+
+    bool frame() {                                  // A node transmits - only heard in Rx
+        if (mode != Rx) return false;
+        hostSetPin(RFM95_INT, HIGH);
+        hostInterrupt([this]() { handleInterrupt(); });
+        return true;
+    }
+
+    bool recv() {
+        if (!available()) return false;
+        rxBufValid = false;
+        return true;
+    }
+
+    void send() {                                   // An ack, waiting for TX_DONE as sendtoWait() does
+        mode = Tx;
+        handleInterrupt();
+    }
+
+    void sendtoWait() {                             // A data or join ack: sent, then its hop ack received and consumed
+        send();
+        available();
+        frame();
+        recv();
+        flag->sendDone();
+    }
+};
+
+static FakeRadio radio;
+static LoRA_ReceiveFlag<FakeRadio> flag(radio);
+
+struct Pass {
+    bool received = false;                          // messagePending() and recv() got a frame
+    bool slept = false;                             // readyToSleep() let the MCU sleep
+    FakeRadio::Mode sleepMode = FakeRadio::Idle;    // Radio mode while the MCU slept
+};
+
+static bool lateFrame = false;                      // A frame arrives between readyToSleep() and the sleep
+
+// One pass of the gateway's LoRA_STATE: receive and ack, then the low power listening sleep
+static Pass loopPass(bool appAck) {
+    Pass pass;
+    if (flag.messagePending() && radio.recv()) {
+        pass.received = true;
+        radio.send();                               // RHMesh acks the hop
+        if (appAck) radio.sendtoWait();             // Data or join ack from the gateway
+    }
+    if (flag.readyToSleep(RFM95_INT)) {
+        pass.slept = true;
+        pass.sleepMode = radio.mode;
+        if (lateFrame) {
+            lateFrame = false;
+            radio.frame();                          // After the check, before the sleep starts: its edge is missed
+            pass.sleepMode = radio.mode;
+            radio.frame();                          // The next frame's edge wakes us
+        }
+        flag.wake();
+    }
+    return pass;
+}
+
+static void startCase() {
+    radio = FakeRadio();
+    radio.flag = &flag;
+    flag.messagePending();                          // Clear anything left from the last case
+    hostSetPin(RFM95_INT, LOW);
+}
+
+int main(int argc, char **argv) {
+    // Nothing has arrived: the first pass turns the receiver on and sleeps listening
+    startCase();
+    Pass pass = loopPass(true);
+    CHECK(!pass.received && pass.slept && pass.sleepMode == FakeRadio::Rx);
+
+    // A frame that listenForLoRAMessageGateway() rejects only gets the mesh ack, which leaves the radio idle
+    CHECK(radio.frame());
+    pass = loopPass(false);
+    CHECK(pass.received && pass.slept && pass.sleepMode == FakeRadio::Rx);
+    CHECK(radio.frame());                           // The next frame wakes us
+    pass = loopPass(false);
+    CHECK(pass.received);
+
+    // A good frame with alertCodeNode 1 stays in LoRA_STATE after its data ack
+    startCase();
+    loopPass(true);
+    CHECK(radio.frame());
+    pass = loopPass(true);
+    CHECK(pass.received && pass.slept && pass.sleepMode == FakeRadio::Rx);
+    CHECK(radio.frame());
+
+    // The ack collected by sendtoWait() raised the flag too - it must not read as a message for us
+    startCase();
+    loopPass(true);
+    CHECK(radio.frame());
+    loopPass(true);
+    CHECK(!flag.messagePending());
+
+    // A frame arrives after messagePending() looked, as readyToSleep() turns the receiver back on
+    startCase();
+    loopPass(true);
+    radio.onAvailable = []() {
+        if (radio.mode == FakeRadio::Rx) {
+            radio.onAvailable = nullptr;
+            radio.frame();
+        }
+    };
+    pass = loopPass(true);
+    CHECK(!pass.received && !pass.slept);
+    pass = loopPass(true);                          // Received on the next pass, then sleeps
+    CHECK(pass.received && pass.slept && pass.sleepMode == FakeRadio::Rx);
+
+    // A frame raises DIO0 inside the masked section: its interrupt is held off, the pin keeps us awake
+    startCase();
+    loopPass(true);
+    bool raised = false;
+    hostSetPin(RFM95_INT, LOW, [&raised]() {
+        if (!raised) {
+            raised = true;
+            radio.frame();                          // Deferred until the ATOMIC_BLOCK() ends
+        }
+    });
+    pass = loopPass(true);
+    CHECK(raised && !pass.slept);
+    hostSetPin(RFM95_INT, LOW);
+    pass = loopPass(true);                          // The deferred interrupt raised the flag
+    CHECK(pass.received && pass.slept && pass.sleepMode == FakeRadio::Rx);
+
+    // A frame arrives after readyToSleep() and before the sleep: the radio stays in Rx, so the next frame wakes us
+    startCase();
+    loopPass(true);
+    lateFrame = true;
+    pass = loopPass(true);
+    CHECK(pass.slept && pass.sleepMode == FakeRadio::Rx && radio.dropped == 1);
+    CHECK(radio.mode == FakeRadio::Idle);           // Idle once awake, so the held frame is not overwritten
+    pass = loopPass(true);
+    CHECK(pass.received && pass.slept && pass.sleepMode == FakeRadio::Rx);
+
+    printf("listen: %s\n", harnessFailed ? "FAIL" : "PASS");
+    return harnessFailed ? 1 : 0;
+}
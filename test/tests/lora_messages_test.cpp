@@ -0,0 +1,218 @@
+// Gateway LoRA wire schema (src/LoRA_Messages.h): random messages decoded and encoded by the schema and by the
+// hand-written byte code it replaced must agree byte for byte, and no field may touch bytes outside its own
+#include "harness.h"
+#include "LoRA_Messages.h"
+#include <random>
+
+using namespace LoRA_Messages;
+
+static std::mt19937 rng(20241018);
+
+static uint8_t highByte(uint16_t v) { return (uint8_t)(v >> 8); }
+static uint8_t lowByte(uint16_t v) { return (uint8_t)v; }
+
+static void randomFill(uint8_t *buf, size_t len) {
+    for (size_t ii = 0; ii < len; ii++) buf[ii] = (uint8_t)rng();
+}
+
+// What decipherDataReportGateway() and listenForLoRAMessageGateway() stored, as the original byte code decoded it
+struct Report {
+    uint16_t magicNumber; uint8_t nodeNumber; uint16_t token; uint8_t sensorType; uint32_t uniqueID;
+    uint8_t payload[8]; int8_t internalTempC; int8_t stateOfCharge; uint8_t batteryState; uint8_t resetCount;
+    int16_t rssi; int16_t snr; uint8_t retryCount; uint8_t retransmissionDelay;
+    bool operator==(const Report &o) const { return memcmp(this, &o, sizeof(*this)) == 0; }
+};
+
+static Report decodeByHand(const uint8_t *buf) {
+    Report r;
+    memset(&r, 0, sizeof(r));
+    r.magicNumber = (buf[0] << 8 | buf[1]);
+    r.nodeNumber = buf[2];
+    r.token = buf[3] << 8 | buf[4];
+    r.sensorType = buf[5];
+    r.uniqueID = (uint32_t)buf[6] << 24 | buf[7] << 16 | buf[8] << 8 | buf[9];
+    for (int ii = 0; ii < 8; ii++) r.payload[ii] = buf[10 + ii];
+    r.internalTempC = buf[18];
+    r.stateOfCharge = buf[19];
+    r.batteryState = buf[20];
+    r.resetCount = buf[21];
+    r.rssi = buf[22] << 8 | buf[23];
+    r.snr = buf[24] << 8 | buf[25];
+    r.retryCount = buf[26];
+    r.retransmissionDelay = buf[27];
+    return r;
+}
+
+static Report decodeBySchema(const uint8_t *buf) {
+    Report r;
+    memset(&r, 0, sizeof(r));
+    r.magicNumber = DataReport::MagicNumber::get(buf);
+    r.nodeNumber = DataReport::NodeNumber::get(buf);
+    r.token = DataReport::Token::get(buf);
+    r.sensorType = DataReport::SensorType::get(buf);
+    r.uniqueID = DataReport::UniqueID::get(buf);
+    r.payload[0] = DataReport::Payload1::get(buf);
+    r.payload[1] = DataReport::Payload2::get(buf);
+    r.payload[2] = DataReport::Payload3::get(buf);
+    r.payload[3] = DataReport::Payload4::get(buf);
+    r.payload[4] = DataReport::Payload5::get(buf);
+    r.payload[5] = DataReport::Payload6::get(buf);
+    r.payload[6] = DataReport::Payload7::get(buf);
+    r.payload[7] = DataReport::Payload8::get(buf);
+    r.internalTempC = DataReport::InternalTempC::get(buf);
+    r.stateOfCharge = DataReport::StateOfCharge::get(buf);
+    r.batteryState = DataReport::BatteryState::get(buf);
+    r.resetCount = DataReport::ResetCount::get(buf);
+    r.rssi = DataReport::RSSI::get(buf);
+    r.snr = DataReport::SNR::get(buf);
+    r.retryCount = DataReport::RetryCount::get(buf);
+    r.retransmissionDelay = DataReport::RetransmissionDelay::get(buf);
+    return r;
+}
+
+// The values the gateway puts in its acks
+struct Ack {
+    uint16_t magicNumber; uint8_t nodeNumber; uint16_t token; uint32_t currentTime; uint16_t frequencySeconds;
+    uint8_t alertCode; uint16_t alertContext; uint8_t sensorType; uint32_t uniqueID; uint8_t payload[4];
+};
+
+static Ack randomAck() {
+    Ack a;
+    a.magicNumber = rng(); a.nodeNumber = rng(); a.token = rng(); a.currentTime = rng(); a.frequencySeconds = rng();
+    a.alertCode = rng(); a.alertContext = rng(); a.sensorType = rng(); a.uniqueID = rng();
+    for (int ii = 0; ii < 4; ii++) a.payload[ii] = rng();
+    return a;
+}
+
+static void dataAckByHand(uint8_t *buf, const Ack &a) {
+    buf[0] = highByte(a.magicNumber);
+    buf[1] = lowByte(a.magicNumber);
+    buf[2] = a.nodeNumber;
+    buf[3] = highByte(a.token);
+    buf[4] = lowByte(a.token);
+    buf[5] = (uint8_t)(a.currentTime >> 24);
+    buf[6] = (uint8_t)(a.currentTime >> 16);
+    buf[7] = (uint8_t)(a.currentTime >> 8);
+    buf[8] = (uint8_t)(a.currentTime);
+    buf[9] = highByte(a.frequencySeconds);
+    buf[10] = lowByte(a.frequencySeconds);
+    buf[11] = a.alertCode;
+    buf[12] = highByte(a.alertContext);
+    buf[13] = lowByte(a.alertContext);
+    buf[14] = a.sensorType;
+    buf[15] = 0;
+}
+
+static void dataAckBySchema(uint8_t *buf, const Ack &a) {
+    DataAck::MagicNumber::put(buf, a.magicNumber);
+    DataAck::NodeNumber::put(buf, a.nodeNumber);
+    DataAck::Token::put(buf, a.token);
+    DataAck::CurrentTime::put(buf, a.currentTime);
+    DataAck::FrequencySeconds::put(buf, a.frequencySeconds);
+    DataAck::AlertCode::put(buf, a.alertCode);
+    DataAck::AlertContext::put(buf, a.alertContext);
+    DataAck::SensorType::put(buf, a.sensorType);
+    DataAck::Reserved::put(buf, 0);
+}
+
+static void joinAckByHand(uint8_t *buf, const Ack &a) {
+    buf[0] = highByte(a.magicNumber);
+    buf[1] = lowByte(a.magicNumber);
+    buf[2] = a.nodeNumber;
+    buf[3] = highByte(a.token);
+    buf[4] = lowByte(a.token);
+    buf[5] = (uint8_t)(a.currentTime >> 24);
+    buf[6] = (uint8_t)(a.currentTime >> 16);
+    buf[7] = (uint8_t)(a.currentTime >> 8);
+    buf[8] = (uint8_t)(a.currentTime);
+    buf[9] = highByte(a.frequencySeconds);
+    buf[10] = lowByte(a.frequencySeconds);
+    buf[11] = a.alertCode;
+    buf[12] = 0;                                                // The byte code left this stale - the schema sends no context with a join
+    buf[13] = a.sensorType;
+    buf[14] = a.uniqueID >> 24;
+    buf[15] = a.uniqueID >> 16;
+    buf[16] = a.uniqueID >> 8;
+    buf[17] = a.uniqueID;
+    buf[18] = a.nodeNumber;
+    for (int ii = 0; ii < 4; ii++) buf[19 + ii] = a.payload[ii];
+    buf[23] = 0;
+    buf[24] = 0;
+}
+
+static void joinAckBySchema(uint8_t *buf, const Ack &a) {
+    JoinAck::MagicNumber::put(buf, a.magicNumber);
+    JoinAck::NodeNumber::put(buf, a.nodeNumber);
+    JoinAck::Token::put(buf, a.token);
+    JoinAck::CurrentTime::put(buf, a.currentTime);
+    JoinAck::FrequencySeconds::put(buf, a.frequencySeconds);
+    JoinAck::AlertCode::put(buf, a.alertCode);
+    JoinAck::AlertContext::put(buf, 0);
+    JoinAck::SensorType::put(buf, a.sensorType);
+    JoinAck::UniqueID::put(buf, a.uniqueID);
+    JoinAck::NewNodeNumber::put(buf, a.nodeNumber);
+    JoinAck::Payload1::put(buf, a.payload[0]);
+    JoinAck::Payload2::put(buf, a.payload[1]);
+    JoinAck::Payload3::put(buf, a.payload[2]);
+    JoinAck::Payload4::put(buf, a.payload[3]);
+    JoinAck::RetryCount::put(buf, 0);
+    JoinAck::RetransmissionDelay::put(buf, 0);
+}
+
+// put() writes only its own bytes and get() reads back the value, for random values of the field's type
+template <typename F>
+static void checkField() {
+    for (int ii = 0; ii < 1000; ii++) {
+        uint8_t before[64], after[64];
+        randomFill(before, sizeof(before));
+        memcpy(after, before, sizeof(after));
+        typename F::type value = (typename F::type)rng();
+        F::put(after, value);
+        CHECK(F::get(after) == value);
+        for (size_t jj = 0; jj < sizeof(before); jj++) {
+            if (jj < F::offset || jj >= F::end) CHECK(before[jj] == after[jj]);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int iterations = (argc > 1) ? atoi(argv[1]) : 100000;
+
+    for (int ii = 0; ii < iterations; ii++) {
+        uint8_t buf[64];
+        randomFill(buf, sizeof(buf));
+        CHECK(decodeByHand(buf) == decodeBySchema(buf));
+
+        Ack ack = randomAck();
+        uint8_t byHand[64], bySchema[64];
+        randomFill(byHand, sizeof(byHand));
+        memcpy(bySchema, byHand, sizeof(bySchema));
+        dataAckByHand(byHand, ack);
+        dataAckBySchema(bySchema, ack);
+        CHECK(memcmp(byHand, bySchema, sizeof(byHand)) == 0);
+
+        joinAckByHand(byHand, ack);
+        joinAckBySchema(bySchema, ack);
+        CHECK(memcmp(byHand, bySchema, sizeof(byHand)) == 0);
+        if (harnessFailed) break;
+    }
+
+    // Edges of the signed fields
+    uint8_t buf[DataReport::length] = {};
+    DataReport::RSSI::put(buf, -32768);
+    CHECK(buf[22] == 0x80 && buf[23] == 0x00 && DataReport::RSSI::get(buf) == -32768);
+    DataReport::SNR::put(buf, -1);
+    CHECK(buf[24] == 0xff && buf[25] == 0xff && DataReport::SNR::get(buf) == -1);
+    DataReport::InternalTempC::put(buf, -40);
+    CHECK(DataReport::InternalTempC::get(buf) == -40);
+
+    checkField<DataReport::UniqueID>();
+    checkField<DataReport::RSSI>();
+    checkField<DataReport::InternalTempC>();
+    checkField<DataAck::AlertContext>();
+    checkField<JoinAck::UniqueID>();
+    checkField<JoinAck::RetransmissionDelay>();
+
+    printf("lora_messages_test %d messages %s\n", iterations, harnessFailed ? "FAILED" : "passed");
+    return harnessFailed ? 1 : 0;
+}
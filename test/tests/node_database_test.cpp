@@ -0,0 +1,75 @@
+// Node database checkpoint and journal (src/JsonDataManager.cpp, src/NodeJournal.cpp) against emulated FRAM: a
+// sensor type change on a clean database is in FRAM after a restart, and journal records already in the checkpoint
+// are not replayed over it when power is lost before the journal is cleared
+#include "harness.h"
+#include "JsonDataManager.h"
+#include "Room_Occupancy.h"
+
+static const uint8_t FRAM_I2C_ADDR = 0x50;                  // MB85RC64 with its address pins low
+
+// Room_Occupancy stand-in - JsonDataManager only asks it for the room counts it publishes
+Room_Occupancy *Room_Occupancy::_instance;
+Room_Occupancy &Room_Occupancy::instance() {
+    if (!_instance) {
+        _instance = new Room_Occupancy();
+    }
+    return *_instance;
+}
+Room_Occupancy::Room_Occupancy() {}
+Room_Occupancy::~Room_Occupancy() {}
+int Room_Occupancy::getRoomNet(int space) { return 0; }
+int Room_Occupancy::getRoomGross(int space) { return 0; }
+
+hal_i2c_config_t acquireWireBuffer();                      // Defined in MyPersistentData.cpp - Device OS calls it at boot
+
+// A restart: RAM is rebuilt from what is in FRAM, as setup() does on the device
+static void restart() {
+    nodeDatabase.load();
+    JsonDataManager::instance().setup();
+}
+
+int main() {
+    hal_i2c_config_t config = acquireWireBuffer();              // The Wire buffers the FRAM driver is set up for
+    Wire.bufferSize = config.rx_buffer_size;
+    delete[] config.rx_buffer;
+    delete[] config.tx_buffer;
+
+    sysStatus.setup();                                          // Blank FRAM - an empty database
+    current.setup();
+    nodeDatabase.setup();
+    JsonDataManager::instance().setup();
+
+    current.set_sensorType(10);                                 // An occupancy counter - its jd1 is the net count of space 0
+    uint8_t nodeNumber = JsonDataManager::instance().findNodeNumber(0, 0x12345678);
+    CHECK(nodeNumber == 1);
+    CHECK(!JsonDataManager::instance().nodeDatabaseDirty());   // A new node is committed right away
+
+    // Type change on a clean database
+    CHECK(JsonDataManager::instance().setType(nodeNumber, 12));
+    CHECK(!JsonDataManager::instance().nodeDatabaseDirty());
+    restart();
+    CHECK(JsonDataManager::instance().getType(nodeNumber) == 12);
+
+    // A journaled change, then a checkpoint that supersedes it - power is lost before the journal is cleared
+    CHECK(JsonDataManager::instance().setJsonData1(nodeNumber, 12, 5));
+    CHECK(NodeJournal::instance().count() == 1);
+    std::vector<uint8_t> &mem = Wire.chip(FRAM_I2C_ADDR);
+    std::vector<uint8_t> journal(mem.begin() + NODE_JOURNAL_FRAM_OFFSET, mem.begin() + NODE_JOURNAL_FRAM_OFFSET + NODE_JOURNAL_FRAM_SIZE);
+    CHECK(JsonDataManager::instance().setType(nodeNumber, 11));    // Zeroes jd1 in the checkpoint
+    std::copy(journal.begin(), journal.end(), mem.begin() + NODE_JOURNAL_FRAM_OFFSET);
+
+    restart();
+    CHECK(JsonDataManager::instance().getType(nodeNumber) == 11);
+    CHECK(JsonDataManager::instance().getOccupancyNetBySpace(0) == 0);  // Not replayed over the newer checkpoint
+    CHECK(!JsonDataManager::instance().nodeDatabaseDirty());
+    CHECK(NodeJournal::instance().count() == 0);                // Dropped, and a new epoch started past the checkpoint's
+    CHECK(NodeJournal::instance().getEpoch() != nodeDatabase.get_journalEpoch());
+
+    // Records of a newer epoch than the checkpoint are still replayed
+    CHECK(JsonDataManager::instance().setJsonData1(nodeNumber, 11, 7));
+    restart();
+    CHECK(JsonDataManager::instance().getOccupancyNetBySpace(0) == 7);
+    CHECK(JsonDataManager::instance().nodeDatabaseDirty());
+
+    return harnessFailed ? 1 : 0;
+}
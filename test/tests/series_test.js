@@ -0,0 +1,29 @@
+// Webhook decoder (webhook/series.js) against the batches time_series_test uploaded: each batch decodes to the samples
+// the gateway stored, and every sample becomes the webhook for its sensor type. Usage: node series_test.js batches.json
+const assert = require('assert');
+const fs = require('fs');
+const path = require('path');
+const { decodeSeries, decodeSamples } = require(path.join(__dirname, '..', '..', 'webhook', 'series.js'));
+
+const batches = JSON.parse(fs.readFileSync(process.argv[2], 'utf8'));
+let count = 0;
+
+assert(batches.length > 0);
+for (const batch of batches) {
+    assert.deepStrictEqual(decodeSamples(batch.data), batch.samples);
+
+    const events = decodeSeries({ device: 'e00fce68', event: 'LoRA-Series-v1', published: '2026-01-01T00:00:00Z', data: batch.data });
+    assert.strictEqual(events.length, batch.samples.filter((s) => s.nodeNumber === 0 || (s.sensorType >= 1 && s.sensorType <= 29)).length);
+    for (const event of events) {
+        assert(event.name.startsWith('Ubidots-LoRA-'));
+        assert(Number.isInteger(event.data.timestamp));
+    }
+    count += batch.samples.length;
+}
+
+// A batch cut short is an error, not a silently shorter list
+const data = Buffer.from(batches[0].data, 'base64');
+assert.throws(() => decodeSamples(data.subarray(0, data.length - 1).toString('base64')));
+assert.throws(() => decodeSamples(Buffer.from([2, 0, 0, 0, 0]).toString('base64')));
+
+console.log('series webhook ' + count + ' samples in ' + batches.length + ' batches passed');
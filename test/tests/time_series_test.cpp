@@ -0,0 +1,215 @@
+// Offline time series (src/TimeSeriesStore.cpp): samples come back from the codec exactly, and what is stored offline
+// is uploaded in batches that decode to the same samples, each once - also across a reset part way through a segment.
+// With a path argument, the batches and their samples are written there as JSON for the webhook decoder test.
+#include "harness.h"
+#include "TimeSeriesStore.h"
+#include "PublishQueuePosixRK.h"
+#include "Base64RK.h"
+#include <random>
+#include <vector>
+
+typedef TimeSeriesStore::Sample Sample;
+
+// A store for each boot, with the codec opened up for the test
+class TestStore : public TimeSeriesStore {
+public:
+    using TimeSeriesStore::CodecState;
+    using TimeSeriesStore::encode;
+    using TimeSeriesStore::decode;
+    using TimeSeriesStore::MAX_NODES;
+};
+
+static bool sameSample(const Sample &a, const Sample &b) {
+    return a.time == b.time && a.nodeNumber == b.nodeNumber && a.sensorType == b.sensorType && a.uniqueID == b.uniqueID &&
+        a.space == b.space && a.battery == b.battery && a.temp == b.temp && a.value1 == b.value1 && a.value2 == b.value2;
+}
+
+// Reports from more nodes than a segment remembers, now and then with a new sensor type, the clock stepping back,
+// and values at the ends of the varint range
+static std::vector<Sample> makeSamples(size_t count, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<Sample> samples;
+    uint32_t time = 1760000000;
+    uint8_t sensorTypes[TestStore::MAX_NODES + 8];
+
+    for (size_t ii = 0; ii < sizeof(sensorTypes); ii++) {
+        sensorTypes[ii] = (ii == 0) ? 0 : 1 + rng() % 29;
+    }
+    for (size_t ii = 0; ii < count; ii++) {
+        Sample sample;
+        time += (rng() % 20 == 0) ? -(int32_t)(rng() % 3600) : rng() % 3600;
+        sample.time = time;
+        sample.nodeNumber = rng() % sizeof(sensorTypes);
+        if (sample.nodeNumber != 0 && rng() % 50 == 0) sensorTypes[sample.nodeNumber] = 1 + rng() % 29;
+        sample.sensorType = sensorTypes[sample.nodeNumber];
+        sample.uniqueID = (sample.nodeNumber == 0) ? 0 : 0x10000000u * (sample.nodeNumber % 16) + sample.nodeNumber;
+        sample.space = rng() % 64;
+        sample.battery = (int8_t)(rng() % 102) - 1;
+        sample.temp = (int8_t)(rng() % 120) - 40;
+        switch (rng() % 8) {
+            case 0: sample.value1 = INT32_MIN; sample.value2 = INT32_MAX; break;
+            case 1: sample.value1 = -(int32_t)(rng() % 100000); sample.value2 = rng(); break;
+            default: sample.value1 = rng() % 500; sample.value2 = rng() % 5000; break;
+        }
+        samples.push_back(sample);
+    }
+    return samples;
+}
+
+static void codecRoundTrip() {
+    std::vector<Sample> samples = makeSamples(5000, 1);
+    std::vector<uint8_t> buf(samples.size() * 32);
+    TestStore::CodecState encodeState, decodeState;
+    size_t len = 0;
+
+    encodeState.reset(samples[0].time);
+    for (const Sample &sample : samples) {
+        // Too small a buffer uses nothing and leaves the state alone, so the record can go in the next batch
+        TestStore::CodecState trial = encodeState;
+        size_t full = TestStore::encode(sample, trial, &buf[len], buf.size() - len);
+        CHECK(full > 0);
+        uint8_t scratch[32];
+        for (size_t size = 0; size < full; size++) {
+            CHECK(TestStore::encode(sample, encodeState, scratch, size) == 0);
+        }
+        CHECK(TestStore::encode(sample, encodeState, &buf[len], buf.size() - len) == full);     // Same as from the state before
+        len += full;
+    }
+
+    decodeState.reset(samples[0].time);
+    size_t offset = 0, index = 0, used;
+    Sample sample;
+    bool isSample;
+    while (offset < len && (used = TestStore::decode(&buf[offset], len - offset, decodeState, sample, isSample))) {
+        if (isSample) {
+            CHECK(index < samples.size() && sameSample(sample, samples[index]));
+            index++;
+        }
+        offset += used;
+    }
+    CHECK(offset == len);
+    CHECK(index == samples.size());
+    printf("codec: %u samples in %u bytes\n", (unsigned)samples.size(), (unsigned)len);
+}
+
+// Takes the batches out of the publish queue, as the cloud would, adding their samples to received
+static void publishBatches(std::vector<Sample> &received, FILE *fixture) {
+    auto &events = PublishQueuePosix::instance().events;
+    while (!events.empty()) {
+        PublishQueuePosix::Event event = events.front();
+        events.pop_front();
+        CHECK(event.eventName == TIME_SERIES_EVENT);
+        CHECK(event.data.length() <= particle::protocol::MAX_EVENT_DATA_LENGTH);
+
+        uint8_t batch[particle::protocol::MAX_EVENT_DATA_LENGTH];
+        size_t batchLen = sizeof(batch);
+        CHECK(Base64::decode(event.data.c_str(), batch, batchLen));
+        CHECK(batchLen >= 5 && batch[0] == 1);
+
+        TestStore::CodecState state;
+        state.reset((uint32_t)batch[1] | (uint32_t)batch[2] << 8 | (uint32_t)batch[3] << 16 | (uint32_t)batch[4] << 24);
+        size_t offset = 5, used, first = received.size();
+        Sample sample;
+        bool isSample;
+        while (offset < batchLen && (used = TestStore::decode(&batch[offset], batchLen - offset, state, sample, isSample))) {
+            if (isSample) received.push_back(sample);
+            offset += used;
+        }
+        CHECK(offset == batchLen);
+
+        if (fixture) {
+            fprintf(fixture, "%s{\"data\":\"%s\",\"samples\":[", ftell(fixture) > 1 ? ",\n" : "", event.data.c_str());
+            for (size_t ii = first; ii < received.size(); ii++) {
+                const Sample &s = received[ii];
+                fprintf(fixture, "%s{\"time\":%u,\"nodeNumber\":%u,\"sensorType\":%u,\"uniqueID\":%u,\"space\":%u,\"battery\":%d,\"temp\":%d,\"value1\":%d,\"value2\":%d}",
+                    (ii > first) ? "," : "", s.time, s.nodeNumber, s.sensorType, s.uniqueID, s.space, s.battery, s.temp, s.value1, s.value2);
+            }
+            fprintf(fixture, "]}");
+        }
+    }
+}
+
+static bool sameSamples(const std::vector<Sample> &a, const std::vector<Sample> &b) {
+    if (a.size() != b.size()) return false;
+    for (size_t ii = 0; ii < a.size(); ii++) {
+        if (!sameSample(a[ii], b[ii])) return false;
+    }
+    return true;
+}
+
+// Offline for a while, then connected until everything is uploaded
+static void storeRoundTrip(const char *dirPath, FILE *fixture) {
+    std::vector<Sample> samples = makeSamples(1200, 2), received;
+    TestStore store;
+    store.withDirPath(dirPath).setup();
+
+    Particle.online = false;
+    for (const Sample &sample : samples) {
+        CHECK(store.append(sample));
+    }
+    CHECK(store.getNumSegments() >= 3);
+
+    Particle.online = true;
+    for (int ii = 0; ii < 1000 && store.getNumSegments() > 0; ii++) {
+        store.loop();
+        publishBatches(received, fixture);
+    }
+    CHECK(store.getNumSegments() == 0);
+    CHECK(sameSamples(received, samples));
+    printf("store: %u samples uploaded\n", (unsigned)received.size());
+}
+
+// A reset after the first batch from a segment is queued - the next boot carries on after it
+static void uploadAcrossReset(const char *dirPath) {
+    std::vector<Sample> samples = makeSamples(250, 3), received;
+    String uploadPath = String(dirPath) + "/.upload";
+
+    TestStore *store = new TestStore();
+    store->withDirPath(dirPath).setup();
+    Particle.online = false;
+    for (const Sample &sample : samples) {
+        CHECK(store->append(sample));
+    }
+    CHECK(store->getNumSegments() == 1);
+
+    Particle.online = true;
+    store->loop();
+    publishBatches(received, nullptr);
+    CHECK(received.size() > 0 && received.size() < samples.size());
+    CHECK(access(uploadPath, F_OK) == 0);
+    delete store;                                               // Power lost - nothing is saved on the way down
+
+    store = new TestStore();
+    store->withDirPath(dirPath).setup();
+    for (int ii = 0; ii < 100 && store->getNumSegments() > 0; ii++) {
+        store->loop();
+        publishBatches(received, nullptr);
+    }
+    CHECK(store->getNumSegments() == 0);
+    CHECK(sameSamples(received, samples));                      // None sent twice
+    CHECK(access(uploadPath, F_OK) != 0);                       // Removed with the segment
+    delete store;
+}
+
+int main(int argc, char *argv[]) {
+    char dir[] = "/tmp/time_series_testXXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("could not make a directory for the segments\n");
+        return 1;
+    }
+    FILE *fixture = (argc > 1) ? fopen(argv[1], "w") : nullptr;
+    if (fixture) fprintf(fixture, "[");
+
+    codecRoundTrip();
+    storeRoundTrip((String(dir) + "/store").c_str(), fixture);
+    uploadAcrossReset((String(dir) + "/reset").c_str());
+
+    if (fixture) {
+        fprintf(fixture, "]\n");
+        fclose(fixture);
+    }
+    std::string cleanup = std::string("rm -rf ") + dir;
+    if (system(cleanup.c_str()) != 0) printf("could not remove %s\n", dir);
+
+    return harnessFailed ? 1 : 0;
+}
@@ -0,0 +1,117 @@
+// Decodes the offline time series batches the gateway publishes as LoRA-Series-v1 back into the webhooks it
+// would have published when it was connected. The format is described in src/TimeSeriesStore.h.
+//
+// The webhook in series-webhook.json posts {"device", "event", "published", "data"}, where data is the Base64
+// batch. Call decodeSeries() with the parsed request body, for example from a Ubidots UbiFunction or any Node.js
+// handler, and process each event as if it had been published by itself.
+//
+// A sample only keeps what the back end charts, so these events have fewer fields than the live ones: the battery
+// state text, the node's resets and alerts and the radio statistics are not there. Every event has "timestamp"
+// (milliseconds) set to the time of the report - Ubidots-LoRA-Occupancy-v2 does not have one when published live,
+// as it arrives right away.
+
+const FORMAT_VERSION = 1;
+const RECORD_NODE = 1;
+const RECORD_SAMPLE = 2;
+
+// Returns the samples in a batch, oldest first: {time, nodeNumber, sensorType, uniqueID, space, battery, temp,
+// value1, value2}. time is in seconds.
+function decodeSamples(base64) {
+    const buf = Buffer.from(base64, 'base64');
+    if (buf.length < 5 || buf[0] !== FORMAT_VERSION) {
+        throw new Error('not a version ' + FORMAT_VERSION + ' time series batch');
+    }
+
+    const nodes = new Map();                // nodeNumber -> {sensorType, uniqueID} from the node records
+    const samples = [];
+    let lastTime = buf.readUInt32LE(1);
+    let offset = 5;
+
+    // Zigzag varint - in floating point, as the zigzag value can be past 2^31
+    function getVarint() {
+        let zigzag = 0;
+        for (let ii = 0; ii < 5 && offset < buf.length; ii++) {
+            const byte = buf[offset++];
+            zigzag += (byte & 0x7f) * 2 ** (7 * ii);
+            if (!(byte & 0x80)) {
+                return (zigzag % 2) ? -(zigzag + 1) / 2 : zigzag / 2;
+            }
+        }
+        throw new Error('truncated record at ' + offset);
+    }
+
+    while (offset < buf.length) {
+        const type = buf[offset];
+        if (type === RECORD_NODE) {
+            if (offset + 7 > buf.length) {
+                throw new Error('truncated record at ' + offset);
+            }
+            nodes.set(buf[offset + 1], { sensorType: buf[offset + 2], uniqueID: buf.readUInt32LE(offset + 3) });
+            offset += 7;
+        }
+        else if (type === RECORD_SAMPLE) {
+            const nodeNumber = buf[offset + 1];
+            const node = nodes.get(nodeNumber);
+            if (!node) {
+                throw new Error('sample for node ' + nodeNumber + ' before its node record at ' + offset);
+            }
+            offset += 2;
+            lastTime = (lastTime + getVarint()) >>> 0;
+            if (offset + 3 > buf.length) {
+                throw new Error('truncated record at ' + offset);
+            }
+            const space = buf[offset];
+            const battery = buf.readInt8(offset + 1);
+            const temp = buf.readInt8(offset + 2);
+            offset += 3;
+            const value1 = getVarint();
+            const value2 = getVarint();
+            samples.push({ time: lastTime, nodeNumber, sensorType: node.sensorType, uniqueID: node.uniqueID, space,
+                battery, temp, value1, value2 });
+        }
+        else {
+            throw new Error('unknown record type ' + type + ' at ' + offset);
+        }
+    }
+    return samples;
+}
+
+// Returns the webhook a sample stands in for as {name, data}, or null for a sensor type the gateway doesn't publish
+function sampleToEvent(sample, device) {
+    const timestamp = sample.time * 1000;
+    const uniqueid = String(sample.uniqueID);
+
+    if (sample.nodeNumber === 0) {
+        return { name: 'Ubidots-LoRA-Gateway-v1', data: { deviceid: device, battery: sample.battery, temp: sample.temp,
+            resets: sample.value1, alerts: sample.value2, timestamp } };
+    }
+    if (sample.sensorType >= 1 && sample.sensorType <= 9) {
+        return { name: 'Ubidots-LoRA-Counter-v1', data: { uniqueid, hourly: sample.value1, daily: sample.value2,
+            sensortype: sample.sensorType, battery: sample.battery, temp: sample.temp, node: sample.nodeNumber, timestamp } };
+    }
+    if (sample.sensorType >= 10 && sample.sensorType <= 19) {
+        return { name: 'Ubidots-LoRA-Occupancy-v2', data: { nodeUniqueID: uniqueid, battery: sample.battery,
+            space: sample.space + 1, spaceNet: sample.value1, spaceGross: sample.value2, timestamp } };
+    }
+    if (sample.sensorType >= 20 && sample.sensorType <= 29) {
+        return { name: 'Ubidots-LoRA-Sensor-v1', data: { uniqueid, soilvwc: sample.value1, soiltemp: sample.value2,
+            space: sample.space + 1, sensortype: sample.sensorType, battery: sample.battery, temp: sample.temp,
+            node: sample.nodeNumber, timestamp } };
+    }
+    return null;
+}
+
+// Returns the events in the batch posted by series-webhook.json, oldest first: {name, data, published}
+function decodeSeries(body) {
+    const events = [];
+
+    for (const sample of decodeSamples(body.data)) {
+        const event = sampleToEvent(sample, body.device);
+        if (event) {
+            events.push({ name: event.name, data: event.data, published: body.published });
+        }
+    }
+    return events;
+}
+
+module.exports = { decodeSeries, decodeSamples, sampleToEvent };